@@ -0,0 +1,2831 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "frontend.h"
+
+typedef struct {
+  char* buffer;
+  int length;
+  int capacity;
+} SourceWriter;
+
+static void write_source(SourceWriter* w, char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+
+  int written = vsnprintf(w->buffer + w->length, w->capacity - w->length, fmt, ap);
+  assert(written >= 0 && w->length + written < w->capacity);
+  w->length += written;
+
+  va_end(ap);
+}
+
+#define GENERATED_FN_BYTES 512
+
+// Deterministic, so every run generates the same source
+static uint32_t bench_random(uint32_t* state) {
+  *state = *state * 1664525u + 1013904223u;
+  return *state >> 8;
+}
+
+static char* ascii_names[] = { "a", "b", "c" };
+static char* unicode_names[] = { "\xCE\xB1", "\xCE\xB2", "\xE5\x80\xBC" }; // alpha, beta, and a CJK ideograph
+
+// Generates a file of num_funcs functions that make it through the whole
+// frontend, with a mix of locals, arithmetic, loops and branches
+static SourceContents generate_source(Arena* arena, int num_funcs, char** names) {
+  char* a = names[0];
+  char* b = names[1];
+  char* c = names[2];
+
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n", i);
+    write_source(&w, "  %s: int = %d;\n", a, i);
+    write_source(&w, "  %s: int = %s * 2 + 7;\n", b, a);
+    write_source(&w, "  %s: int;\n", c);
+    write_source(&w, "  %s = 0;\n\n", c);
+    write_source(&w, "  // Accumulate\n");
+    write_source(&w, "  while %s - %d {\n", a, i + 100);
+    write_source(&w, "    if %s / 3 {\n", b);
+    write_source(&w, "      %s = %s + %s * 4;\n", c, c, a);
+    write_source(&w, "    }\n");
+    write_source(&w, "    else {\n");
+    write_source(&w, "      %s = %s - 1;\n", b, b);
+    write_source(&w, "    }\n\n");
+    write_source(&w, "    %s = %s + 1;\n", a, a);
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  return %s + %s;\n", c, b);
+    write_source(&w, "}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+static bool tokens_ident(TokenizedBuffer* a, TokenizedBuffer* b) {
+  if (a->length != b->length || a->num_literals != b->num_literals) {
+    return false;
+  }
+
+  for_range(int, i, a->length) {
+    Token x = a->tokens[i];
+    Token y = b->tokens[i];
+
+    if (x.kind != y.kind || x.length != y.length || x.line != y.line || x.start != y.start) {
+      return false;
+    }
+
+    if (x.kind == TOKEN_INTEGER_LITERAL && a->literals[x.literal] != b->literals[y.literal]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+#define BENCH_REPEATS 5
+
+static bool bench_tokenize(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* serial = tokenize_parallel(arena, source, 1);
+
+  double mb = (double)source.length / (1024.0 * 1024.0);
+  printf("tokenize: %.1f MB, %d tokens\n", mb, serial->length);
+
+  double serial_time = 0.0;
+  int max_threads = hardware_thread_count();
+
+  for (int num_threads = 1; num_threads <= max_threads; ++num_threads) {
+    Scratch scratch = global_scratch(1, &arena);
+    double best = 1e30;
+
+    for_range(int, r, BENCH_REPEATS) {
+      double start = timer_seconds();
+      TokenizedBuffer* tokens = tokenize_parallel(scratch.arena, source, num_threads);
+      double time = timer_seconds() - start;
+
+      if (!tokens_ident(tokens, serial)) {
+        printf("  %d threads: output differs from the serial tokenizer\n", num_threads);
+        scratch_release(&scratch);
+        return false;
+      }
+
+      best = time < best ? time : best;
+    }
+
+    if (num_threads == 1) {
+      serial_time = best;
+    }
+
+    printf("  %2d threads: %8.2f ms  %8.1f MB/s  %.2fx\n", num_threads, best * 1000.0, mb / best, serial_time / best);
+
+    scratch_release(&scratch);
+  }
+
+  return true;
+}
+
+static double time_tokenize(Arena* arena, SourceContents source) {
+  double best = 1e30;
+
+  for_range(int, r, BENCH_REPEATS) {
+    Scratch scratch = global_scratch(1, &arena);
+
+    double start = timer_seconds();
+    tokenize_parallel(scratch.arena, source, 1);
+    double time = timer_seconds() - start;
+
+    best = time < best ? time : best;
+    scratch_release(&scratch);
+  }
+
+  return best;
+}
+
+static struct {
+  char* name;
+  int features;
+} utf8_validators[] = {
+  { "scalar", 0 },
+  { "sse4.1", CPU_FEATURE_SSE41 },
+  { "avx2", CPU_FEATURE_AVX2 },
+};
+
+static bool bench_utf8_source(Arena* arena, char* name, SourceContents source) {
+  double mb = (double)source.length / (1024.0 * 1024.0);
+  double tokenize_time = time_tokenize(arena, source);
+
+  printf("utf8 (%s): %.1f MB, tokenize (validation included) %.2f ms\n", name, mb, tokenize_time * 1000.0);
+
+  for_range(int, i, (int)LENGTH(utf8_validators)) {
+    int features = utf8_validators[i].features;
+
+    if ((cpu_features() & features) != features) {
+      printf("  %-8s unsupported on this CPU\n", utf8_validators[i].name);
+      continue;
+    }
+
+    double best = 1e30;
+
+    for_range(int, r, BENCH_REPEATS) {
+      double start = timer_seconds();
+      int invalid = utf8_validate_with(source.contents, source.length, features);
+      double time = timer_seconds() - start;
+
+      if (invalid != -1) {
+        printf("  %s: rejected valid input at byte %d\n", utf8_validators[i].name, invalid);
+        return false;
+      }
+
+      best = time < best ? time : best;
+    }
+
+    printf("  %-8s %8.3f ms  %8.1f MB/s  %5.1f%% of tokenize\n", utf8_validators[i].name, best * 1000.0, mb / best, 100.0 * best / tokenize_time);
+  }
+
+  return true;
+}
+
+// Bytes at the edges of what each lead byte allows after it
+static uint8_t utf8_edge_bytes[] = { 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC1, 0xC2, 0xDF, 0xE0, 0xED, 0xEF, 0xF0, 0xF4, 0xF5, 0xFF };
+
+// Overlongs, surrogates, values past U+10FFFF and sequences cut short
+static char* utf8_bad_sequences[] = {
+  "\xC0\xAF", "\xE0\x80\xAF", "\xF0\x80\x80\xAF",
+  "\xED\xA0\x80", "\xED\xBF\xBF",
+  "\xF4\x90\x80\x80", "\xF5\x80\x80\x80",
+  "\xE2\x82", "\xF0\x9F\x98"
+};
+
+// Pieces of valid text with a few bytes changed, so the vector validators'
+// error paths run: the zero-padded tail, the scalar rescan for the offset, and
+// bad sequences that straddle a block. Each must give what the scalar one does.
+static bool check_utf8_errors(Arena* arena, SourceContents source) {
+  int max_length = 200;
+  int num_cases = 100000;
+  int num_invalid = 0;
+
+  uint8_t* buffer = arena_push(arena, max_length);
+  uint32_t seed = 28;
+
+  for_range(int, c, num_cases) {
+    int length = 1 + bench_random(&seed) % max_length;
+    int from = bench_random(&seed) % (source.length - length);
+
+    memcpy(buffer, source.contents + from, length);
+
+    int num_mutations = 1 + bench_random(&seed) % 3;
+
+    for_range(int, m, num_mutations) {
+      int at = bench_random(&seed) % length;
+
+      switch (bench_random(&seed) % 3) {
+        case 0:
+          buffer[at] = utf8_edge_bytes[bench_random(&seed) % LENGTH(utf8_edge_bytes)];
+          break;
+
+        // Past the end it is cut short
+        case 1: {
+          char* sequence = utf8_bad_sequences[bench_random(&seed) % LENGTH(utf8_bad_sequences)];
+          int n = (int)strlen(sequence);
+          memcpy(buffer + at, sequence, n < length - at ? n : length - at);
+        } break;
+
+        case 2:
+          buffer[at] = (uint8_t)bench_random(&seed);
+          break;
+      }
+    }
+
+    int expected = utf8_validate_with((char*)buffer, length, 0);
+    num_invalid += expected != -1;
+
+    for (int i = 1; i < (int)LENGTH(utf8_validators); ++i) {
+      int features = utf8_validators[i].features;
+
+      if ((cpu_features() & features) != features) {
+        continue;
+      }
+
+      int invalid = utf8_validate_with((char*)buffer, length, features);
+
+      if (invalid != expected) {
+        printf("  %s: found byte %d invalid where scalar found %d, in case %d\n", utf8_validators[i].name, invalid, expected, c);
+        return false;
+      }
+    }
+  }
+
+  printf("utf8 errors: %d mutated inputs, %d invalid, same offsets from every validator\n", num_cases, num_invalid);
+  return true;
+}
+
+static bool bench_utf8(Arena* arena) {
+  SourceContents unicode = generate_source(arena, 50000, unicode_names);
+
+  bool result = true;
+  result &= bench_utf8_source(arena, "ascii", generate_source(arena, 50000, ascii_names));
+  result &= bench_utf8_source(arena, "unicode identifiers", unicode);
+  result &= check_utf8_errors(arena, unicode);
+  return result;
+}
+
+static bool same_sem_func(SemFunc* a, SemFunc* b) {
+  if (!strings_ident(a->name, b->name) || a->first_token != b->first_token || dynamic_array_length(a->blocks) != dynamic_array_length(b->blocks)) {
+    return false;
+  }
+
+  for_range(int, i, dynamic_array_length(a->blocks)) {
+    SemBlock* x = &a->blocks[i];
+    SemBlock* y = &b->blocks[i];
+
+    if (x->num_insts != y->num_insts || x->num_succs != y->num_succs || x->num_preds != y->num_preds) {
+      return false;
+    }
+
+    if (memcmp(x->succs, y->succs, x->num_succs * sizeof(uint32_t)) != 0 || memcmp(x->preds, y->preds, x->num_preds * sizeof(uint32_t)) != 0) {
+      return false;
+    }
+
+    for_range(int, j, (int)x->num_insts) {
+      uint32_t u = x->insts[j];
+      uint32_t v = y->insts[j];
+      SemInst* p = sem_inst(a, u);
+      SemInst* q = sem_inst(b, v);
+
+      if (u != v || p->op != q->op || p->num_ins != q->num_ins || a->tokens[u] != b->tokens[v]) {
+        return false;
+      }
+
+      for_range(int, k, p->num_ins) {
+        if (sem_operand(a, u, k) != sem_operand(b, v, k)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// What the parallel check is measured against, and what the other checks are
+static SemFile* check_serial(SemContext* context, SourceContents source, AST* ast) {
+  return check_ast_parallel(context, source, ast, 1);
+}
+
+static double time_check(SourceContents source, AST* ast, SemFile*(*check)(SemContext*, SourceContents, AST*)) {
+  double best = 1e30;
+
+  for_range(int, r, BENCH_REPEATS) {
+    Arena* sem_arena = new_arena();
+    SemContext* sem = sem_init(sem_arena);
+
+    double start = timer_seconds();
+    SemFile* file = check(sem, source, ast);
+    double time = timer_seconds() - start;
+
+    free_arena(sem_arena);
+
+    if (!file) {
+      return -1.0;
+    }
+
+    best = time < best ? time : best;
+  }
+
+  return best;
+}
+
+static bool bench_ast(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+
+  double parse_start = timer_seconds();
+  AST* ast = parse(arena, source, tokens, 0);
+  double parse_time = timer_seconds() - parse_start;
+
+  if (!ast) {
+    return false;
+  }
+
+  size_t flat_bytes = ast->num_nodes * sizeof(ASTNode) + ast->num_children * sizeof(uint32_t);
+
+  // The pointer based layout this replaced: a node holding a whole Token and a
+  // pointer to a separately allocated array of child pointers
+  size_t pointer_node_size = sizeof(int) + sizeof(Token) + sizeof(int) + sizeof(void*);
+  size_t pointer_bytes = ast->num_nodes * pointer_node_size + ast->num_children * sizeof(void*);
+
+  printf("ast: %d nodes, parse %.2f ms\n", ast->num_nodes, parse_time * 1000.0);
+  printf("  flat     %6.2f bytes/node  %8.2f MB\n", (double)flat_bytes / ast->num_nodes, (double)flat_bytes / (1024.0 * 1024.0));
+  printf("  pointers %6.2f bytes/node  %8.2f MB\n", (double)pointer_bytes / ast->num_nodes, (double)pointer_bytes / (1024.0 * 1024.0));
+
+  double best = time_check(source, ast, check_serial);
+
+  if (best < 0.0) {
+    return false;
+  }
+
+  printf("  check    %8.2f ms  %8.1f ns/node\n", best * 1000.0, best * 1e9 / ast->num_nodes);
+
+  return true;
+}
+
+// The stack walk over the tree against the single pass over the postorder
+// stream, which must lower to exactly the same functions
+static bool bench_postorder(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = parse(arena, source, tokens, PARSE_POSTORDER);
+
+  if (!ast) {
+    return false;
+  }
+
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+
+  SemFile* tree = check_ast(sem, source, ast);
+  SemFile* linear = check_postorder(sem, source, ast);
+
+  bool same = tree && linear && tree->num_funcs == linear->num_funcs;
+  for (int i = 0; same && i < tree->num_funcs; ++i) {
+    same = same_sem_func(&tree->funcs[i], &linear->funcs[i]);
+  }
+
+  free_arena(sem_arena);
+
+  if (!same) {
+    printf("postorder: output differs from check_ast\n");
+    return false;
+  }
+
+  double tree_time = time_check(source, ast, check_serial);
+  double linear_time = time_check(source, ast, check_postorder);
+
+  if (tree_time < 0.0 || linear_time < 0.0) {
+    return false;
+  }
+
+  printf("postorder: %d nodes, %d stream items\n", ast->num_nodes, ast->num_postorder);
+  printf("  tree walk %8.2f ms  %8.1f ns/node\n", tree_time * 1000.0, tree_time * 1e9 / ast->num_nodes);
+  printf("  linear    %8.2f ms  %8.1f ns/node  %.2fx\n", linear_time * 1000.0, linear_time * 1e9 / ast->num_nodes, tree_time / linear_time);
+
+  return true;
+}
+
+static bool asts_ident(AST* a, AST* b) {
+  return a->root == b->root
+    && a->num_nodes == b->num_nodes
+    && a->num_children == b->num_children
+    && a->num_postorder == b->num_postorder
+    && memcmp(a->nodes, b->nodes, a->num_nodes * sizeof(ASTNode)) == 0
+    && memcmp(a->children, b->children, a->num_children * sizeof(uint32_t)) == 0
+    && memcmp(a->postorder, b->postorder, a->num_postorder * sizeof(PostorderItem)) == 0;
+}
+
+static bool bench_parse(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* serial = parse_parallel(arena, source, tokens, PARSE_POSTORDER, 1);
+
+  printf("parse: %d functions, %d tokens, %d nodes\n", 50000, tokens->length, serial->num_nodes);
+
+  double serial_time = 0.0;
+  int max_threads = hardware_thread_count();
+
+  for (int num_threads = 1; num_threads <= max_threads; ++num_threads) {
+    Scratch scratch = global_scratch(1, &arena);
+    double best = 1e30;
+
+    for_range(int, r, BENCH_REPEATS) {
+      double start = timer_seconds();
+      AST* ast = parse_parallel(scratch.arena, source, tokens, PARSE_POSTORDER, num_threads);
+      double time = timer_seconds() - start;
+
+      if (!ast || !asts_ident(ast, serial)) {
+        printf("  %d threads: output differs from the serial parser\n", num_threads);
+        scratch_release(&scratch);
+        return false;
+      }
+
+      best = time < best ? time : best;
+    }
+
+    if (num_threads == 1) {
+      serial_time = best;
+    }
+
+    printf("  %2d threads: %8.2f ms  %8.1f ns/node  %.2fx\n", num_threads, best * 1000.0, best * 1e9 / serial->num_nodes, serial_time / best);
+
+    scratch_release(&scratch);
+  }
+
+  return true;
+}
+
+// Functions with unreachable code, and optionally a few that fail to check,
+// spread out so they land in different batches
+static SourceContents generate_error_source(Arena* arena, int num_funcs, bool check_errors) {
+  SourceWriter w = {
+    .capacity = num_funcs * 64 + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n  a: int = %d;\n", i, i);
+
+    if (check_errors && i % 997 == 500) {
+      write_source(&w, "  return b%d;\n", i);
+    }
+    else if (i % 389 == 200) {
+      write_source(&w, "  return a;\n  a = 1;\n");
+    }
+    else {
+      write_source(&w, "  return a;\n");
+    }
+
+    write_source(&w, "}\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+// Checks, then analyzes if that passed, collecting whatever errors come out
+static bool check_and_analyze(SemContext* sem, SourceContents source, AST* ast, int num_threads, DynamicArray(char)* errors) {
+  DynamicArray(char)* outer = capture_errors(errors);
+
+  SemFile* file = check_ast_parallel(sem, source, ast, num_threads);
+  bool success = file && sem_analyze_parallel(sem, source, file, num_threads);
+
+  capture_errors(outer);
+  return success;
+}
+
+static bool same_errors(SourceContents source, int num_threads) {
+  Scratch scratch = global_scratch(0, NULL);
+
+  TokenizedBuffer* tokens = tokenize(scratch.arena, source);
+  AST* ast = parse(scratch.arena, source, tokens, 0);
+
+  DynamicArray(char) serial = new_dynamic_array(scratch.allocator);
+  DynamicArray(char) parallel = new_dynamic_array(scratch.allocator);
+
+  SemContext* sem = sem_init(scratch.arena);
+
+  bool serial_success = check_and_analyze(sem, source, ast, 1, &serial);
+  bool parallel_success = check_and_analyze(sem, source, ast, num_threads, &parallel);
+
+  bool same = !serial_success && !parallel_success
+    && dynamic_array_length(serial) == dynamic_array_length(parallel)
+    && memcmp(serial, parallel, dynamic_array_length(serial)) == 0;
+
+  scratch_release(&scratch);
+  return same;
+}
+
+// Checking and analysis across threads must give the same functions and the
+// same errors, in the same order, as doing them on one
+static bool bench_check(Arena* arena) {
+  int num_funcs = 50000;
+  SourceContents source = generate_source(arena, num_funcs, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = parse(arena, source, tokens, 0);
+
+  Arena* serial_arena = new_arena();
+  SemContext* serial_sem = sem_init(serial_arena);
+  SemFile* serial = check_serial(serial_sem, source, ast);
+
+  if (!serial || !sem_analyze_parallel(serial_sem, source, serial, 1)) {
+    free_arena(serial_arena);
+    return false;
+  }
+
+  printf("check: %d functions, %d nodes\n", num_funcs, ast->num_nodes);
+
+  int max_threads = hardware_thread_count();
+
+  // Run with a few threads even on a machine without them, as the order
+  // errors come out in depends on how the functions are split up
+  SourceContents check_errors = generate_error_source(arena, 4000, true);
+  SourceContents analyze_errors = generate_error_source(arena, 4000, false);
+  bool ok = true;
+
+  for (int num_threads = 2; ok && (num_threads <= max_threads || num_threads <= 4); ++num_threads) {
+    ok = same_errors(check_errors, num_threads) && same_errors(analyze_errors, num_threads);
+  }
+
+  if (!ok) {
+    printf("  errors differ from the serial check\n");
+    free_arena(serial_arena);
+    return false;
+  }
+
+  double serial_time = 0.0;
+
+  for (int num_threads = 1; ok && num_threads <= max_threads; ++num_threads) {
+    double best = 1e30;
+
+    for_range(int, r, BENCH_REPEATS) {
+      Arena* sem_arena = new_arena();
+      SemContext* sem = sem_init(sem_arena);
+
+      double start = timer_seconds();
+      SemFile* file = check_ast_parallel(sem, source, ast, num_threads);
+      bool analyzed = file && sem_analyze_parallel(sem, source, file, num_threads);
+      double time = timer_seconds() - start;
+
+      ok = analyzed && file->num_funcs == serial->num_funcs;
+
+      for (int i = 0; ok && i < file->num_funcs; ++i) {
+        ok = same_sem_func(&file->funcs[i], &serial->funcs[i]);
+      }
+
+      free_arena(sem_arena);
+
+      if (!ok) {
+        printf("  %d threads: output differs from the serial check\n", num_threads);
+        break;
+      }
+
+      best = time < best ? time : best;
+    }
+
+    if (num_threads == 1) {
+      serial_time = best;
+    }
+
+    if (ok) {
+      printf("  %2d threads: %8.2f ms  %8.1f ns/node  %.2fx\n", num_threads, best * 1000.0, best * 1e9 / ast->num_nodes, serial_time / best);
+    }
+  }
+
+  free_arena(serial_arena);
+  return ok;
+}
+
+static double time_pipeline(SourceContents source) {
+  double best = 1e30;
+
+  for_range(int, r, BENCH_REPEATS) {
+    Arena* arena = new_arena();
+
+    double start = timer_seconds();
+
+    TokenizedBuffer* tokens = tokenize(arena, source);
+    AST* ast = parse(arena, source, tokens, 0);
+    SemContext* sem = sem_init(arena);
+    SemFile* file = check_ast(sem, source, ast);
+    sem_analyze(sem, source, file);
+
+    double time = timer_seconds() - start;
+
+    free_arena(arena);
+    best = time < best ? time : best;
+  }
+
+  return best;
+}
+
+// One-line edits to a function in the middle of a ~100k line file
+static bool bench_incremental(Arena* arena) {
+  int num_funcs = 6000;
+  SourceContents source = generate_source(arena, num_funcs, ascii_names);
+
+  int num_lines = 1;
+  for_range(int, i, source.length) {
+    num_lines += source.contents[i] == '\n';
+  }
+
+  double full_time = time_pipeline(source);
+
+  Session* session = session_open(source);
+
+  if (!session_file(session)) {
+    return false;
+  }
+
+  // The literal in 'a: int = 3000;' of f3000, edited back and forth
+  char needle[64];
+  snprintf(needle, sizeof(needle), "fn f%d {\n  a: int = ", num_funcs / 2);
+
+  int num_edits = 100;
+  double best = 1e30;
+  double total = 0.0;
+
+  for_range(int, i, num_edits) {
+    SourceContents cur = session_source(session);
+    char* literal = strstr(cur.contents, needle) + strlen(needle);
+    int length = (int)(strchr(literal, ';') - literal);
+
+    char text[32];
+    int text_length = snprintf(text, sizeof(text), "%d", i * 37);
+
+    double start = timer_seconds();
+    bool ok = session_edit(session, (int)(literal - cur.contents), (int)(literal - cur.contents) + length, text, text_length);
+    double time = timer_seconds() - start;
+
+    if (!ok) {
+      session_close(session);
+      return false;
+    }
+
+    best = time < best ? time : best;
+    total += time;
+  }
+
+  // The session must agree with starting from scratch on the final text
+  SourceContents final = session_source(session);
+  Arena* fresh_arena = new_arena();
+  SemContext* sem = sem_init(fresh_arena);
+  SemFile* fresh = check_ast(sem, final, parse(fresh_arena, final, tokenize(fresh_arena, final), 0));
+  SemFile* incremental = session_file(session);
+
+  bool same = fresh->num_funcs == incremental->num_funcs;
+  for (int i = 0; same && i < fresh->num_funcs; ++i) {
+    same = same_sem_func(&fresh->funcs[i], &incremental->funcs[i]);
+  }
+
+  free_arena(fresh_arena);
+  session_close(session);
+
+  if (!same) {
+    printf("incremental: output differs from a full build\n");
+    return false;
+  }
+
+  printf("incremental: %d lines, %d functions\n", num_lines, num_funcs);
+  printf("  full pipeline %8.2f ms\n", full_time * 1000.0);
+  printf("  edit          %8.2f ms best  %8.2f ms average  %.1fx\n", best * 1000.0, total * 1000.0 / num_edits, full_time / best);
+
+  return true;
+}
+
+typedef enum {
+  PIPELINE_TREE,
+  PIPELINE_POSTORDER,
+  PIPELINE_DIRECT,
+} Pipeline;
+
+static SemFile* run_pipeline(Arena* arena, SourceContents source, Pipeline pipeline) {
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  SemContext* sem = sem_init(arena);
+  SemFile* file = NULL;
+
+  switch (pipeline) {
+    case PIPELINE_TREE:
+      file = check_ast(sem, source, parse(arena, source, tokens, 0));
+      break;
+    case PIPELINE_POSTORDER:
+      file = check_postorder(sem, source, parse(arena, source, tokens, PARSE_POSTORDER));
+      break;
+    case PIPELINE_DIRECT:
+      file = parse_and_check(sem, source, tokens);
+      break;
+  }
+
+  if (file && !sem_analyze(sem, source, file)) {
+    file = NULL;
+  }
+
+  return file;
+}
+
+// End to end, source text to analyzed SemFile
+static bool bench_direct(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+
+  int num_lines = 1;
+  for_range(int, i, source.length) {
+    num_lines += source.contents[i] == '\n';
+  }
+
+  static struct {
+    char* name;
+    Pipeline pipeline;
+  } pipelines[] = {
+    { "ast + check", PIPELINE_TREE },
+    { "postorder", PIPELINE_POSTORDER },
+    { "direct", PIPELINE_DIRECT },
+  };
+
+  printf("direct: %d lines\n", num_lines);
+
+  Arena* reference_arena = new_arena();
+  SemFile* reference = run_pipeline(reference_arena, source, PIPELINE_TREE);
+
+  double tree_time = 0.0;
+
+  for_range(int, p, (int)LENGTH(pipelines)) {
+    double best = 1e30;
+
+    for_range(int, r, BENCH_REPEATS) {
+      Arena* run_arena = new_arena();
+
+      double start = timer_seconds();
+      SemFile* file = run_pipeline(run_arena, source, pipelines[p].pipeline);
+      double time = timer_seconds() - start;
+
+      bool same = file && file->num_funcs == reference->num_funcs;
+      for (int i = 0; same && i < file->num_funcs; ++i) {
+        same = same_sem_func(&file->funcs[i], &reference->funcs[i]);
+      }
+
+      free_arena(run_arena);
+
+      if (!same) {
+        printf("  %s: output differs from check_ast\n", pipelines[p].name);
+        free_arena(reference_arena);
+        return false;
+      }
+
+      best = time < best ? time : best;
+    }
+
+    if (p == 0) {
+      tree_time = best;
+    }
+
+    printf("  %-12s %8.2f ms  %10.0f lines/s  %.2fx\n", pipelines[p].name, best * 1000.0, num_lines / best, tree_time / best);
+  }
+
+  free_arena(reference_arena);
+  return true;
+}
+
+// Size of the lowered functions, and how long analysis takes to walk them
+static bool bench_ir(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = parse(arena, source, tokens, 0);
+
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = check_ast(sem, source, ast);
+
+  if (!file) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  size_t num_insts = 0;
+  size_t num_blocks = 0;
+  size_t num_edges = 0;
+  size_t dense_bytes = 0;
+
+  for_range(int, i, file->num_funcs) {
+    SemFunc* func = &file->funcs[i];
+
+    num_insts += dynamic_array_length(func->insts) - 1;
+    num_blocks += dynamic_array_length(func->blocks);
+
+    dense_bytes += dynamic_array_length(func->insts) * (sizeof(SemInst) + 3 * sizeof(uint32_t));
+    dense_bytes += dynamic_array_length(func->uses) * sizeof(SemUse);
+    dense_bytes += dynamic_array_length(func->constants) * sizeof(uint64_t);
+    dense_bytes += dynamic_array_length(func->blocks) * sizeof(SemBlock);
+
+    for_range(int, b, dynamic_array_length(func->blocks)) {
+      dense_bytes += (func->blocks[b].num_insts + func->blocks[b].num_preds) * sizeof(uint32_t);
+      num_edges += func->blocks[b].num_succs;
+    }
+  }
+
+  // The pointer based layout this replaced: a linked instruction holding a
+  // whole Token, four operand pointers and a pointer to its constant or
+  // separately allocated branch targets, and blocks holding list ends
+  size_t pointer_inst_size = 4 * sizeof(int) + sizeof(Token) + 4 * sizeof(void*) + 3 * sizeof(void*);
+  size_t pointer_bytes = num_insts * pointer_inst_size + num_edges * sizeof(int) + num_blocks * 2 * sizeof(void*);
+
+  double best = 1e30;
+
+  for_range(int, r, BENCH_REPEATS) {
+    double start = timer_seconds();
+    bool ok = sem_analyze(sem, source, file);
+    double time = timer_seconds() - start;
+
+    if (!ok) {
+      free_arena(sem_arena);
+      return false;
+    }
+
+    best = time < best ? time : best;
+  }
+
+  printf("ir: %zu instructions, %zu blocks\n", num_insts, num_blocks);
+  printf("  dense    %6.2f bytes/inst  %8.2f MB\n", (double)dense_bytes / num_insts, (double)dense_bytes / (1024.0 * 1024.0));
+  printf("  pointers %6.2f bytes/inst  %8.2f MB\n", (double)pointer_bytes / num_insts, (double)pointer_bytes / (1024.0 * 1024.0));
+  printf("  analyze  %8.2f ms  %8.1f ns/inst\n", best * 1000.0, best * 1e9 / num_insts);
+
+  for_range(int, i, file->num_funcs) {
+    sem_invalidate_cfg(&file->funcs[i]);
+  }
+
+  double rpo_start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    sem_rpo(sem, &file->funcs[i]);
+  }
+
+  double rpo_time = timer_seconds() - rpo_start;
+
+  printf("  rpo      %8.2f ms  %8.1f ns/block\n", rpo_time * 1000.0, rpo_time * 1e9 / num_blocks);
+
+  // Every operand must show up in exactly one use list
+  size_t num_operands = 0;
+  size_t num_listed = 0;
+
+  double walk_start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    SemFunc* func = &file->funcs[i];
+
+    for (uint32_t inst = 1; inst < (uint32_t)dynamic_array_length(func->insts); ++inst) {
+      for (uint32_t use = func->first_use[inst]; use; use = sem_next_use(func, inst, use)) {
+        num_listed++;
+      }
+    }
+  }
+
+  double walk_time = timer_seconds() - walk_start;
+
+  for_range(int, i, file->num_funcs) {
+    SemFunc* func = &file->funcs[i];
+
+    for (uint32_t inst = 1; inst < (uint32_t)dynamic_array_length(func->insts); ++inst) {
+      for_range(int, j, func->insts[inst].num_ins) {
+        num_operands += sem_operand(func, inst, j) != 0;
+      }
+    }
+  }
+
+  // Folds every function's constants into its first, the way hash-consing them would
+  size_t num_replaced = 0;
+  size_t num_const_uses = 0;
+  bool folded = true;
+
+  double replace_start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    SemFunc* func = &file->funcs[i];
+    uint32_t first = 0;
+
+    for (uint32_t inst = 1; inst < (uint32_t)dynamic_array_length(func->insts); ++inst) {
+      if (func->insts[inst].op != SEM_OP_INT_CONST) {
+        continue;
+      }
+
+      if (first) {
+        sem_replace_all_uses_with(func, inst, first);
+        num_replaced++;
+      }
+      else {
+        first = inst;
+      }
+    }
+  }
+
+  double replace_time = timer_seconds() - replace_start;
+
+  for_range(int, i, file->num_funcs) {
+    SemFunc* func = &file->funcs[i];
+
+    for (uint32_t inst = 1; inst < (uint32_t)dynamic_array_length(func->insts); ++inst) {
+      for_range(int, j, func->insts[inst].num_ins) {
+        uint32_t value = sem_operand(func, inst, j);
+        folded &= func->insts[value].op != SEM_OP_INT_CONST || func->replaced_by[value] == 0;
+      }
+
+      if (func->insts[inst].op == SEM_OP_INT_CONST) {
+        for (uint32_t use = func->first_use[inst]; use; use = sem_next_use(func, inst, use)) {
+          num_const_uses++;
+        }
+      }
+    }
+  }
+
+  free_arena(sem_arena);
+
+  if (num_listed != num_operands || !folded) {
+    printf("  use lists do not match the operands\n");
+    return false;
+  }
+
+  printf("  uses     %8.2f ms  %8.1f ns/use  %zu uses\n", walk_time * 1000.0, walk_time * 1e9 / num_listed, num_listed);
+  printf("  replace  %8.2f ms  %8.1f ns/replace  %zu constants into %zu uses\n", replace_time * 1000.0, replace_time * 1e9 / num_replaced, num_replaced, num_const_uses);
+
+  return true;
+}
+
+// One function of about num_blocks blocks, in nested loops and branches
+static SourceContents generate_cfg_source(Arena* arena, int num_blocks) {
+  SourceWriter w = {
+    .capacity = num_blocks * 64 + 256
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  enum { OPEN_WHILE, OPEN_IF, OPEN_ELSE };
+  int open[16];
+  int depth = 0;
+
+  int blocks = 1;
+  uint32_t seed = 1;
+
+  write_source(&w, "fn f {\n  x: int = 1;\n");
+
+  while (blocks < num_blocks || depth) {
+    uint32_t r = bench_random(&seed) % 8;
+
+    if (blocks < num_blocks && depth < (int)LENGTH(open) && r < 3) {
+      if (r == 0) {
+        write_source(&w, "while x - %d {\n", blocks);
+        open[depth++] = OPEN_WHILE;
+        blocks += 3;
+      }
+      else {
+        write_source(&w, "if x / %d {\n", blocks);
+        open[depth++] = OPEN_IF;
+        blocks += 2;
+      }
+    }
+    else if (depth && (r >= 6 || blocks >= num_blocks)) {
+      if (open[--depth] == OPEN_IF && bench_random(&seed) % 2) {
+        write_source(&w, "}\nelse {\n");
+        open[depth++] = OPEN_ELSE;
+        blocks++;
+      }
+      else {
+        write_source(&w, "}\n");
+      }
+    }
+    else {
+      write_source(&w, "x = x + %d;\n", r);
+    }
+  }
+
+  write_source(&w, "  return x;\n}\n");
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "generated"
+  };
+}
+
+// Checks a against a search that is not allowed through it, and its frontier
+// against the definition
+static bool check_dominance(SemContext* sem, SemFunc* func, uint32_t a) {
+  Scratch scratch = global_scratch(1, &sem->arena);
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  uint64_t* reached = arena_array(scratch.arena, uint64_t, bitset_num_u64(num_blocks));
+  DynamicArray(uint32_t) stack = new_dynamic_array(scratch.allocator);
+
+  if (a != 0) {
+    bitset_set(reached, 0);
+    dynamic_array_put(stack, 0);
+  }
+
+  while (dynamic_array_length(stack)) {
+    SemBlock* b = &func->blocks[dynamic_array_pop(stack)];
+
+    for_range(uint32_t, i, b->num_succs) {
+      uint32_t succ = b->succs[i];
+
+      if (succ != a && !bitset_query(reached, succ)) {
+        bitset_set(reached, succ);
+        dynamic_array_put(stack, succ);
+      }
+    }
+  }
+
+  SemDominators* dom = func->dom;
+  bool ok = true;
+
+  for_range(int, b, num_blocks) {
+    if (func->rpo_index[b] == SEM_UNREACHABLE) {
+      continue;
+    }
+
+    ok &= sem_dominates(func, a, b) == !bitset_query(reached, b);
+
+    bool in_frontier = false;
+
+    for_range(uint32_t, i, func->blocks[b].num_preds) {
+      uint32_t pred = func->blocks[b].preds[i];
+      in_frontier |= func->rpo_index[pred] != SEM_UNREACHABLE && sem_dominates(func, a, pred);
+    }
+
+    in_frontier &= a == (uint32_t)b || !sem_dominates(func, a, b);
+
+    bool listed = false;
+
+    for (uint32_t i = dom->first_frontier[a]; i < dom->first_frontier[a+1]; ++i) {
+      listed |= dom->frontiers[i] == (uint32_t)b;
+    }
+
+    ok &= listed == in_frontier;
+  }
+
+  scratch_release(&scratch);
+  return ok;
+}
+
+static bool bench_dominators(Arena* arena) {
+  (void)arena;
+
+  int sizes[] = { 10000, 100000, 1000000 };
+
+  printf("dominators:\n");
+
+  for_range(int, s, (int)LENGTH(sizes)) {
+    Arena* run_arena = new_arena();
+
+    SourceContents source = generate_cfg_source(run_arena, sizes[s]);
+    TokenizedBuffer* tokens = tokenize(run_arena, source);
+    AST* ast = tokens ? parse(run_arena, source, tokens, 0) : NULL;
+    SemContext* sem = sem_init(run_arena);
+    SemFile* file = ast ? check_ast(sem, source, ast) : NULL;
+
+    if (!file) {
+      free_arena(run_arena);
+      return false;
+    }
+
+    SemFunc* func = &file->funcs[0];
+    int num_blocks = dynamic_array_length(func->blocks);
+
+    double best_dom = 1e30;
+    double best_frontiers = 1e30;
+
+    for_range(int, r, BENCH_REPEATS) {
+      sem_invalidate_cfg(func);
+      sem_rpo(sem, func);
+
+      double start = timer_seconds();
+      sem_dominators(sem, func);
+      double mid = timer_seconds();
+      sem_dominance_frontiers(sem, func);
+      double end = timer_seconds();
+
+      best_dom = mid - start < best_dom ? mid - start : best_dom;
+      best_frontiers = end - mid < best_frontiers ? end - mid : best_frontiers;
+    }
+
+    bool ok = true;
+
+    if (s == 0) {
+      uint32_t seed = 7;
+
+      for_range(int, i, 20) {
+        ok &= check_dominance(sem, func, func->rpo[bench_random(&seed) % func->num_rpo]);
+      }
+    }
+
+    size_t num_frontiers = func->dom->first_frontier[num_blocks];
+
+    free_arena(run_arena);
+
+    if (!ok) {
+      printf("  %d blocks: dominance disagrees with a brute force search\n", num_blocks);
+      return false;
+    }
+
+    printf("  %8d blocks  idom %8.2f ms  %6.1f ns/block  frontiers %8.2f ms  %6.1f ns/block  %zu entries\n",
+      num_blocks, best_dom * 1000.0, best_dom * 1e9 / num_blocks, best_frontiers * 1000.0, best_frontiers * 1e9 / num_blocks, num_frontiers);
+  }
+
+  return true;
+}
+
+// Runs a function on the IR as it stands, so passes can be checked against
+// what the code did before them. False if it runs too long or divides by 0.
+typedef struct {
+  int64_t steps; // Instructions run, phis aside
+  int64_t branches;
+  int64_t gotos;
+} RunCounts;
+
+static bool interpret_counting(SemFunc* func, uint64_t* result, RunCounts* counts) {
+  Scratch scratch = global_scratch(0, NULL);
+
+  int num_insts = dynamic_array_length(func->insts);
+
+  // Out of SSA, values are kept in their register instead
+  uint32_t* slot = func->regs;
+
+  if (!slot) {
+    slot = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+
+    for_range(int, i, num_insts) {
+      slot[i] = i;
+    }
+  }
+
+  // Locals live in the value slot of their LOCAL
+  uint64_t* values = arena_array(scratch.arena, uint64_t, num_insts);
+  uint64_t* memory = arena_array(scratch.arena, uint64_t, num_insts);
+  uint64_t* incoming = arena_push(scratch.arena, num_insts * sizeof(uint64_t));
+
+  uint32_t block = 0;
+  int pred = -1;
+  int steps = 0;
+  int branches = 0;
+  int gotos = 0;
+  bool ok = false;
+
+  *result = 0;
+
+  while (steps < 10000000) {
+    SemBlock* b = &func->blocks[block];
+    uint32_t next = SEM_UNREACHABLE;
+    int next_succ = 0;
+    bool returned = false;
+    uint32_t i = 0;
+
+    // Phis read their operands as the edge is taken, all at once
+    uint32_t num_phis = 0;
+    while (num_phis < b->num_insts && func->insts[b->insts[num_phis]].op == SEM_OP_PHI) {
+      uint32_t phi = b->insts[num_phis++];
+      incoming[phi] = pred >= 0 ? values[slot[sem_operand(func, phi, pred)]] : 0;
+    }
+
+    for (; i < num_phis; ++i) {
+      values[slot[b->insts[i]]] = incoming[b->insts[i]];
+    }
+
+    for (; i < b->num_insts && next == SEM_UNREACHABLE && !returned; ++i, ++steps) {
+      uint32_t id = b->insts[i];
+      SemInst* inst = sem_inst(func, id);
+
+      uint64_t x = inst->num_ins > 0 ? values[slot[sem_operand(func, id, 0)]] : 0;
+      uint64_t y = inst->num_ins > 1 ? values[slot[sem_operand(func, id, 1)]] : 0;
+      uint64_t* out = sem_op_has_value[inst->op] ? &values[slot[id]] : NULL;
+
+      switch (inst->op) {
+        default:
+          assert(false);
+          break;
+
+        case SEM_OP_INT_CONST:
+          *out = func->constants[inst->data];
+          break;
+
+        case SEM_OP_ADD:
+          *out = x + y;
+          break;
+        case SEM_OP_SUB:
+          *out = x - y;
+          break;
+        case SEM_OP_MUL:
+          *out = x * y;
+          break;
+
+        case SEM_OP_DIV:
+          if (y == 0 || ((int64_t)x == INT64_MIN && (int64_t)y == -1)) {
+            goto end;
+          }
+          *out = (uint64_t)((int64_t)x / (int64_t)y);
+          break;
+
+        case SEM_OP_COPY:
+          *out = x;
+          break;
+
+        case SEM_OP_UNDEF:
+        case SEM_OP_LOCAL:
+          *out = 0;
+          break;
+
+        case SEM_OP_LOAD:
+          *out = memory[sem_operand(func, id, 0)];
+          break;
+        case SEM_OP_STORE:
+          memory[sem_operand(func, id, 0)] = y;
+          break;
+
+        case SEM_OP_GOTO:
+          next = b->succs[0];
+          gotos++;
+          break;
+
+        case SEM_OP_BRANCH:
+          next_succ = x ? 0 : 1;
+          next = b->succs[next_succ];
+          branches++;
+          break;
+
+        case SEM_OP_RETURN:
+          *result = x;
+          returned = true;
+          break;
+      }
+    }
+
+    if (returned || next == SEM_UNREACHABLE) {
+      ok = true;
+      break;
+    }
+
+    pred = sem_pred_index(func, block, next_succ);
+    block = next;
+  }
+
+  end:
+  if (counts) {
+    counts->steps = steps;
+    counts->branches = branches;
+    counts->gotos = gotos;
+  }
+
+  scratch_release(&scratch);
+  return ok;
+}
+
+static bool interpret(SemFunc* func, uint64_t* result) {
+  return interpret_counting(func, result, NULL);
+}
+
+// Only every few functions are run to check a pass, as they loop a hundred
+// times each
+#define SAMPLE_STRIDE 97
+
+static int num_samples(SemFile* file) {
+  return (file->num_funcs + SAMPLE_STRIDE - 1) / SAMPLE_STRIDE;
+}
+
+static bool run_sample(SemFile* file, int i, uint64_t* result, RunCounts* total) {
+  RunCounts counts;
+
+  if (!interpret_counting(&file->funcs[i * SAMPLE_STRIDE], result, total ? &counts : NULL)) {
+    return false;
+  }
+
+  if (total) {
+    total->steps += counts.steps;
+    total->branches += counts.branches;
+    total->gotos += counts.gotos;
+  }
+
+  return true;
+}
+
+// What each sampled function returns, before a pass. Counts, if given, are
+// added to.
+static bool sample_results(SemFile* file, uint64_t* results, RunCounts* total) {
+  for_range(int, i, num_samples(file)) {
+    if (!run_sample(file, i, &results[i], total)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Whether each sampled function still returns what it did
+static bool same_results(SemFile* file, uint64_t* expected, RunCounts* total) {
+  bool ok = true;
+
+  for_range(int, i, num_samples(file)) {
+    uint64_t result;
+    ok &= run_sample(file, i, &result, total) && result == expected[i];
+  }
+
+  return ok;
+}
+
+typedef struct {
+  size_t locals;
+  size_t loads;
+  size_t stores;
+  size_t phis;
+} MemoryOps;
+
+static MemoryOps count_memory_ops(SemFile* file) {
+  MemoryOps ops = {0};
+
+  for_range(int, f, file->num_funcs) {
+    SemFunc* func = &file->funcs[f];
+
+    for_range(int, b, dynamic_array_length(func->blocks)) {
+      SemBlock* block = &func->blocks[b];
+
+      for_range(uint32_t, i, block->num_insts) {
+        switch (func->insts[block->insts[i]].op) {
+          case SEM_OP_LOCAL: ops.locals++; break;
+          case SEM_OP_LOAD: ops.loads++; break;
+          case SEM_OP_STORE: ops.stores++; break;
+          case SEM_OP_PHI: ops.phis++; break;
+        }
+      }
+    }
+  }
+
+  return ops;
+}
+
+static bool bench_ssa(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = parse(arena, source, tokens, 0);
+
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = check_ast(sem, source, ast);
+
+  if (!file || !sem_analyze(sem, source, file)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  int num_sampled = num_samples(file);
+  uint64_t* expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+
+  if (!sample_results(file, expected, NULL)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  MemoryOps before = count_memory_ops(file);
+
+  size_t num_promoted = 0;
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    num_promoted += sem_promote_locals(sem, &file->funcs[i]);
+  }
+
+  double time = timer_seconds() - start;
+
+  MemoryOps after = count_memory_ops(file);
+
+  bool ok = true;
+
+  ok &= same_results(file, expected, NULL);
+
+  free_arena(sem_arena);
+
+  printf("ssa:\n");
+  printf("  %zu locals promoted in %.2f ms (%.1f ns/local)\n", num_promoted, time * 1000.0, time * 1e9 / num_promoted);
+  printf("  locals %zu -> %zu  loads %zu -> %zu  stores %zu -> %zu  phis %zu -> %zu\n",
+    before.locals, after.locals, before.loads, after.loads, before.stores, after.stores, before.phis, after.phis);
+  printf("  %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  return ok;
+}
+
+// Loops that swap and rotate locals, and keep a local's value from the last
+// iteration, which are what naive phi copies get wrong
+static SourceContents generate_copy_source(Arena* arena, int num_funcs) {
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn s%d {\n", i);
+    write_source(&w, "  a: int = %d;\n  b: int = 7;\n  c: int = 3;\n", i);
+    write_source(&w, "  n: int = 0;\n  last: int = 0;\n\n");
+    write_source(&w, "  while n - %d {\n", i % 7 + 3);
+    write_source(&w, "    t: int = a;\n");
+
+    if (i % 2) {
+      write_source(&w, "    a = b;\n    b = t;\n");
+    }
+    else {
+      write_source(&w, "    a = b;\n    b = c;\n    c = t;\n");
+    }
+
+    write_source(&w, "    last = n;\n    n = n + 1;\n  }\n\n");
+    write_source(&w, "  return a * 100 + b * 10 + c + last * 1000;\n}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+static size_t count_block_insts(SemFile* file) {
+  size_t count = 0;
+
+  for_range(int, i, file->num_funcs) {
+    SemFunc* func = &file->funcs[i];
+
+    for_range(int, b, dynamic_array_length(func->blocks)) {
+      count += func->blocks[b].num_insts;
+    }
+  }
+
+  return count;
+}
+
+static SemFile* checked_file(SemContext* sem, Arena* arena, SourceContents source) {
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = tokens ? parse(arena, source, tokens, 0) : NULL;
+  SemFile* file = ast ? check_ast(sem, source, ast) : NULL;
+
+  if (!file || !sem_analyze(sem, source, file)) {
+    return NULL;
+  }
+
+  return file;
+}
+
+static SemFile* promoted_file(SemContext* sem, Arena* arena, SourceContents source) {
+  SemFile* file = checked_file(sem, arena, source);
+
+  if (!file) {
+    return NULL;
+  }
+
+  for_range(int, i, file->num_funcs) {
+    sem_promote_locals(sem, &file->funcs[i]);
+  }
+
+  return file;
+}
+
+typedef void(*GrowingPass)(SemContext* sem, SemFunc* func, DynamicArray(char)* note);
+
+// One function of growing size, where anything worse than linear shows. Each
+// size gets a row, ending in what the pass notes about its run.
+static bool bench_growing(GrowingPass pass) {
+  int sizes[] = { 10000, 100000, 1000000 };
+
+  for_range(int, s, (int)LENGTH(sizes)) {
+    Arena* run_arena = new_arena();
+    SemContext* run_sem = sem_init(run_arena);
+    SemFile* big = promoted_file(run_sem, run_arena, generate_cfg_source(run_arena, sizes[s]));
+
+    if (!big) {
+      free_arena(run_arena);
+      return false;
+    }
+
+    SemFunc* func = &big->funcs[0];
+    int num_blocks = dynamic_array_length(func->blocks);
+    size_t num_insts = count_block_insts(big);
+
+    DynamicArray(char) note = new_dynamic_array(new_allocator(run_arena));
+
+    double start = timer_seconds();
+    pass(run_sem, func, &note);
+    double time = timer_seconds() - start;
+
+    dynamic_array_put(note, '\0');
+
+    printf("  %8d blocks  %9zu insts  %8.2f ms  %6.1f ns/inst  %s\n",
+      num_blocks, num_insts, time * 1000.0, time * 1e9 / num_insts, note);
+
+    free_arena(run_arena);
+  }
+
+  return true;
+}
+
+static bool bench_out_of_ssa_source(Arena* arena, char* name, SourceContents source) {
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = parse(arena, source, tokens, 0);
+
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = check_ast(sem, source, ast);
+
+  if (!file || !sem_analyze(sem, source, file)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  for_range(int, i, file->num_funcs) {
+    sem_promote_locals(sem, &file->funcs[i]);
+  }
+
+  int num_sampled = num_samples(file);
+  uint64_t* expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+
+  if (!sample_results(file, expected, NULL)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  SemCopyCounts total = {0};
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    SemCopyCounts counts = sem_leave_ssa(sem, &file->funcs[i]);
+
+    total.naive += counts.naive;
+    total.coalesced += counts.coalesced;
+    total.cycle_temps += counts.cycle_temps;
+    total.remaining += counts.remaining;
+  }
+
+  double time = timer_seconds() - start;
+
+  bool ok = true;
+
+  ok &= same_results(file, expected, NULL);
+
+  int num_funcs = file->num_funcs;
+  free_arena(sem_arena);
+
+  printf("  %s: %d functions in %.2f ms (%.1f us/function)\n", name, num_funcs, time * 1000.0, time * 1e6 / num_funcs);
+  printf("    %d naive copies, %d coalesced, %d to break cycles, %d remaining\n", total.naive, total.coalesced, total.cycle_temps, total.remaining);
+  printf("    %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  return ok;
+}
+
+static void grow_out_of_ssa(SemContext* sem, SemFunc* func, DynamicArray(char)* note) {
+  SemCopyCounts counts = sem_leave_ssa(sem, func);
+  write_text(note, "%d copies remaining", counts.remaining);
+}
+
+static bool bench_out_of_ssa(Arena* arena) {
+  printf("out of ssa:\n");
+
+  bool ok = bench_out_of_ssa_source(arena, "loops", generate_source(arena, 50000, ascii_names));
+  ok &= bench_out_of_ssa_source(arena, "swaps", generate_copy_source(arena, 50000));
+
+  ok &= bench_growing(grow_out_of_ssa);
+
+  return ok;
+}
+
+// What a pass does most, visiting every operand of the code in block order
+static double time_operand_walk(SemFile* file, uint64_t* checksum) {
+  double best = 1e30;
+
+  for_range(int, r, BENCH_REPEATS) {
+    double start = timer_seconds();
+    uint64_t sum = 0;
+
+    for_range(int, f, file->num_funcs) {
+      SemFunc* func = &file->funcs[f];
+
+      for_range(int, b, dynamic_array_length(func->blocks)) {
+        SemBlock* block = &func->blocks[b];
+
+        for_range(uint32_t, i, block->num_insts) {
+          SemInst* inst = sem_inst(func, block->insts[i]);
+
+          for_range(int, j, inst->num_ins) {
+            sum += func->insts[sem_operand(func, block->insts[i], j)].op;
+          }
+        }
+      }
+    }
+
+    double time = timer_seconds() - start;
+    best = time < best ? time : best;
+    *checksum = sum;
+  }
+
+  return best;
+}
+
+static bool bench_compact(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = parse(arena, source, tokens, 0);
+
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = check_ast(sem, source, ast);
+
+  if (!file || !sem_analyze(sem, source, file)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  for_range(int, i, file->num_funcs) {
+    sem_promote_locals(sem, &file->funcs[i]);
+  }
+
+  int num_sampled = num_samples(file);
+  uint64_t* expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+
+  if (!sample_results(file, expected, NULL)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  size_t insts_before = 0;
+  size_t uses_before = 0;
+
+  for_range(int, i, file->num_funcs) {
+    insts_before += dynamic_array_length(file->funcs[i].insts);
+    uses_before += dynamic_array_length(file->funcs[i].uses);
+  }
+
+  uint64_t sum_before, sum_after;
+  double walk_before = time_operand_walk(file, &sum_before);
+
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    sem_compact(sem, &file->funcs[i]);
+  }
+
+  double time = timer_seconds() - start;
+  double walk_after = time_operand_walk(file, &sum_after);
+
+  size_t insts_after = 0;
+  size_t uses_after = 0;
+
+  for_range(int, i, file->num_funcs) {
+    insts_after += dynamic_array_length(file->funcs[i].insts);
+    uses_after += dynamic_array_length(file->funcs[i].uses);
+  }
+
+  bool ok = sum_before == sum_after;
+
+  ok &= same_results(file, expected, NULL);
+
+  int num_funcs = file->num_funcs;
+  free_arena(sem_arena);
+
+  printf("compact:\n");
+  printf("  %d functions after promotion in %.2f ms (%.1f us/function)\n", num_funcs, time * 1000.0, time * 1e6 / num_funcs);
+  printf("  instruction IDs %zu -> %zu  operand slots %zu -> %zu\n", insts_before, insts_after, uses_before, uses_after);
+  printf("  operand walk %.2f ms -> %.2f ms\n", walk_before * 1000.0, walk_after * 1000.0);
+  printf("  %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  return ok;
+}
+
+// Dumps functions in SSA form and reads them back, which must give the same
+// text and functions that return the same values
+static bool bench_read(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = parse(arena, source, tokens, 0);
+
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = check_ast(sem, source, ast);
+
+  if (!file || !sem_analyze(sem, source, file)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  for_range(int, i, file->num_funcs) {
+    sem_promote_locals(sem, &file->funcs[i]);
+  }
+
+  double write_time = 1e30;
+  DynamicArray(char) text = NULL;
+
+  for_range(int, r, BENCH_REPEATS) {
+    Scratch scratch = global_scratch(2, (Arena*[]) { arena, sem_arena });
+
+    double start = timer_seconds();
+    DynamicArray(char) written = sem_write(scratch.arena, file);
+    double time = timer_seconds() - start;
+
+    write_time = time < write_time ? time : write_time;
+
+    if (r == BENCH_REPEATS-1) {
+      text = arena_push(arena, dynamic_array_length(written) + 1);
+      memcpy(text, written, dynamic_array_length(written));
+      text[dynamic_array_length(written)] = '\0';
+    }
+
+    scratch_release(&scratch);
+  }
+
+  int length = (int)strlen(text);
+
+  SourceContents ir = {
+    .contents = text,
+    .length = length,
+    .path = "<dumped>"
+  };
+
+  double read_time = 1e30;
+  bool ok = true;
+
+  for_range(int, r, BENCH_REPEATS) {
+    Arena* read_arena = new_arena();
+    SemContext* read_sem = sem_init(read_arena);
+
+    double start = timer_seconds();
+    SemFile* read = sem_read(read_sem, ir);
+    double time = timer_seconds() - start;
+
+    read_time = time < read_time ? time : read_time;
+
+    if (!read || read->num_funcs != file->num_funcs) {
+      free_arena(read_arena);
+      ok = false;
+      break;
+    }
+
+    if (r == 0) {
+      DynamicArray(char) again = sem_write(read_arena, read);
+      ok &= dynamic_array_length(again) == length && memcmp(again, text, length) == 0;
+
+      for (int i = 0; ok && i < file->num_funcs; i += 97) {
+        uint64_t expected, result;
+        ok &= interpret(&file->funcs[i], &expected) && interpret(&read->funcs[i], &result) && result == expected;
+      }
+    }
+
+    free_arena(read_arena);
+  }
+
+  int num_funcs = file->num_funcs;
+  free_arena(sem_arena);
+
+  double mb = length / (1024.0 * 1024.0);
+
+  printf("read: %d functions in SSA form, %.2f MB of text\n", num_funcs, mb);
+  printf("  write %8.2f ms  %8.1f MB/s\n", write_time * 1000.0, mb / write_time);
+  printf("  read  %8.2f ms  %8.1f MB/s\n", read_time * 1000.0, mb / read_time);
+  printf("  %s\n", ok ? "read back to the same text and results" : "DID NOT READ BACK THE SAME");
+
+  return ok;
+}
+
+// What time_operand_walk sums, read straight out of a mapped file
+static double time_binary_walk(SemBinary* binary, uint64_t* checksum) {
+  double start = timer_seconds();
+  uint64_t sum = 0;
+
+  for_range(uint32_t, f, binary->header->num_funcs) {
+    SemBinaryFunc* func = &binary->funcs[f];
+    SemInst* insts = sem_binary_at(binary, func->insts);
+    SemUse* uses = sem_binary_at(binary, func->uses);
+    SemBinaryBlock* blocks = sem_binary_at(binary, func->blocks);
+    uint32_t* block_insts = sem_binary_at(binary, func->block_insts);
+
+    for_range(uint32_t, b, func->num_blocks) {
+      for_range(uint32_t, i, blocks[b].num_insts) {
+        SemInst* inst = &insts[block_insts[blocks[b].first_inst + i]];
+
+        for_range(int, j, inst->num_ins) {
+          sum += insts[uses[inst->ins + j].value].op;
+        }
+      }
+    }
+  }
+
+  *checksum = sum;
+  return timer_seconds() - start;
+}
+
+// Copies of a small file with a few bytes changed past the header. Each one
+// is either rejected or good enough to optimize without crashing
+static bool mutate_binary(Arena* arena, SemFile* file, int* rejected, int* accepted) {
+  SemFile small = *file;
+  small.num_funcs = file->num_funcs < 8 ? file->num_funcs : 8;
+
+  char* path = "bench_mutated.sem";
+
+  if (!sem_binary_write(&small, path)) {
+    return false;
+  }
+
+  SemBinary* original = sem_binary_load(arena, path);
+
+  if (!original) {
+    remove(path);
+    return false;
+  }
+
+  uint64_t size = original->size;
+  uint8_t* bytes = arena_push(arena, size);
+  uint8_t* mutated = arena_push(arena, size);
+
+  memcpy(bytes, original->data, size);
+  sem_binary_close(original);
+
+  uint32_t seed = 43;
+  bool ok = true;
+
+  for (int i = 0; ok && i < 1000; ++i) {
+    memcpy(mutated, bytes, size);
+
+    for_range(uint32_t, j, 1 + bench_random(&seed) % 3) {
+      uint64_t at = sizeof(SemBinaryHeader) + bench_random(&seed) % (size - sizeof(SemBinaryHeader));
+      uint32_t r = bench_random(&seed);
+
+      mutated[at] = r % 2 ? mutated[at] ^ (1 << (r / 2 % 8)) : (uint8_t)(r / 2 % 8);
+    }
+
+    FILE* out = fopen(path, "wb");
+    ok &= out && fwrite(mutated, 1, size, out) == size;
+
+    if (out) {
+      fclose(out);
+    }
+
+    SemBinary* binary = ok ? sem_binary_load(arena, path) : NULL;
+    ok &= binary != NULL;
+
+    if (!binary) {
+      continue;
+    }
+
+    binary->quiet = true;
+
+    if (sem_binary_validate(binary)) {
+      Arena* loaded_arena = new_arena();
+      SemContext* loaded_sem = sem_init(loaded_arena);
+
+      sem_optimize(loaded_sem, sem_binary_file(loaded_sem, binary));
+
+      free_arena(loaded_arena);
+      (*accepted)++;
+    }
+    else {
+      (*rejected)++;
+    }
+
+    sem_binary_close(binary);
+  }
+
+  remove(path);
+  return ok;
+}
+
+// Writes functions in SSA form to a binary file, then maps it and reads it in
+// place, against parsing the same functions from text
+static bool bench_binary(Arena* arena) {
+  SourceContents source = generate_source(arena, 50000, ascii_names);
+  TokenizedBuffer* tokens = tokenize(arena, source);
+  AST* ast = parse(arena, source, tokens, 0);
+
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = check_ast(sem, source, ast);
+
+  if (!file || !sem_analyze(sem, source, file)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  for_range(int, i, file->num_funcs) {
+    sem_promote_locals(sem, &file->funcs[i]);
+  }
+
+  char* path = "bench_binary.sem";
+
+  double start = timer_seconds();
+  bool ok = sem_binary_write(file, path);
+  double write_time = timer_seconds() - start;
+
+  if (!ok) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  start = timer_seconds();
+  SemBinary* binary = sem_binary_load(arena, path);
+  double load_time = timer_seconds() - start;
+
+  if (!binary) {
+    free_arena(sem_arena);
+    remove(path);
+    return false;
+  }
+
+  // The first walk takes the page faults, which is what loading really costs
+  uint64_t binary_sum, expected_sum;
+  double cold_walk_time = time_binary_walk(binary, &binary_sum);
+  double walk_time = time_binary_walk(binary, &binary_sum);
+  double func_walk_time = time_operand_walk(file, &expected_sum);
+
+  start = timer_seconds();
+  ok &= sem_binary_validate(binary);
+  double validate_time = timer_seconds() - start;
+
+  Arena* loaded_arena = new_arena();
+  SemContext* loaded_sem = sem_init(loaded_arena);
+
+  start = timer_seconds();
+  SemFile* loaded = sem_binary_file(loaded_sem, binary);
+  double copy_time = timer_seconds() - start;
+
+  ok &= binary_sum == expected_sum && loaded->num_funcs == file->num_funcs;
+
+  for (int i = 0; ok && i < file->num_funcs; ++i) {
+    ok &= same_sem_func(&file->funcs[i], &loaded->funcs[i]);
+  }
+
+  for (int i = 0; ok && i < file->num_funcs; i += 97) {
+    uint64_t expected, result;
+    ok &= interpret(&file->funcs[i], &expected) && interpret(&loaded->funcs[i], &result) && result == expected;
+  }
+
+  double mb = binary->size / (1024.0 * 1024.0);
+
+  sem_binary_close(binary);
+  remove(path);
+  free_arena(loaded_arena);
+
+  // The same functions as text, for what parsing them costs
+  DynamicArray(char) text = sem_write(arena, file);
+  dynamic_array_put(text, '\0');
+
+  SourceContents ir = {
+    .contents = text,
+    .length = dynamic_array_length(text) - 1,
+    .path = "<dumped>"
+  };
+
+  Arena* read_arena = new_arena();
+
+  start = timer_seconds();
+  ok &= sem_read(sem_init(read_arena), ir) != NULL;
+  double read_time = timer_seconds() - start;
+
+  free_arena(read_arena);
+
+  int rejected = 0, accepted = 0;
+  ok &= mutate_binary(arena, file, &rejected, &accepted);
+
+  int num_funcs = file->num_funcs;
+  free_arena(sem_arena);
+
+  printf("binary: %d functions in SSA form, %.2f MB\n", num_funcs, mb);
+  printf("  write             %8.2f ms\n", write_time * 1000.0);
+  printf("  load              %8.3f ms\n", load_time * 1000.0);
+  printf("  first walk        %8.2f ms  (page faults)\n", cold_walk_time * 1000.0);
+  printf("  walk in place     %8.2f ms  (%8.2f ms on SemFuncs)\n", walk_time * 1000.0, func_walk_time * 1000.0);
+  printf("  validate          %8.2f ms\n", validate_time * 1000.0);
+  printf("  copy to SemFuncs  %8.2f ms\n", copy_time * 1000.0);
+  printf("  read as text      %8.2f ms\n", read_time * 1000.0);
+  printf("  mutated copies    %d rejected, %d optimized\n", rejected, accepted);
+  printf("  %s\n", ok ? "same functions and results" : "DID NOT LOAD THE SAME");
+
+  return ok;
+}
+
+// Arithmetic on constants and branches on constants, around a loop that is not
+static SourceContents generate_constant_source(Arena* arena, int num_funcs) {
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n", i);
+    write_source(&w, "  a: int = %d;\n", i);
+    write_source(&w, "  b: int = a * 3 + 4;\n");
+    write_source(&w, "  c: int = 0;\n\n");
+    write_source(&w, "  if b - %d {\n", i * 3 + 4);
+    write_source(&w, "    c = a / 0;\n");
+    write_source(&w, "  }\n");
+    write_source(&w, "  else {\n");
+    write_source(&w, "    c = b / 2 - a;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  if 2 {\n");
+    write_source(&w, "    c = c * 0 + c + 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  d: int = 0;\n\n");
+    write_source(&w, "  while d - 10 {\n");
+    write_source(&w, "    d = d + 1;\n");
+    write_source(&w, "    c = c + b;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  return c + d;\n");
+    write_source(&w, "}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+static void grow_sccp(SemContext* sem, SemFunc* func, DynamicArray(char)* note) {
+  SemFoldCounts counts = sem_propagate_constants(sem, func);
+  write_text(note, "%d folded, %d branches", counts.folded, counts.branches);
+}
+
+static bool bench_sccp(Arena* arena) {
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = promoted_file(sem, sem_arena, generate_constant_source(arena, 50000));
+
+  if (!file) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  int num_sampled = num_samples(file);
+  uint64_t* expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+
+  if (!sample_results(file, expected, NULL)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  size_t before = count_block_insts(file);
+  SemFoldCounts total = {0};
+
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    SemFoldCounts counts = sem_propagate_constants(sem, &file->funcs[i]);
+    total.folded += counts.folded;
+    total.branches += counts.branches;
+    total.unreachable += counts.unreachable;
+  }
+
+  double time = timer_seconds() - start;
+
+  bool ok = true;
+
+  ok &= same_results(file, expected, NULL);
+
+  int num_funcs = file->num_funcs;
+  free_arena(sem_arena);
+
+  printf("sccp:\n");
+  printf("  %d functions, %zu instructions in %.2f ms (%.1f ns/inst)\n", num_funcs, before, time * 1000.0, time * 1e9 / before);
+  printf("  %d folded, %d branches made gotos, %d unreachable instructions removed\n", total.folded, total.branches, total.unreachable);
+  printf("  %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  ok &= bench_growing(grow_sccp);
+
+  return ok;
+}
+
+// Redundant sums in dominating blocks, some with their operands swapped, and
+// some in sibling branches that must stay
+static SourceContents generate_redundant_source(Arena* arena, int num_funcs) {
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n", i);
+    write_source(&w, "  a: int = %d;\n", i);
+    write_source(&w, "  b: int = a * 7;\n");
+    write_source(&w, "  c: int = 0;\n\n");
+    write_source(&w, "  while c - 5 {\n");
+    write_source(&w, "    x: int = a + b;\n");
+    write_source(&w, "    y: int = b + a;\n\n");
+    write_source(&w, "    if x - y {\n");
+    write_source(&w, "      s: int = a + b;\n");
+    write_source(&w, "      c = c + s * 2;\n");
+    write_source(&w, "    }\n");
+    write_source(&w, "    else {\n");
+    write_source(&w, "      t: int = b + a;\n");
+    write_source(&w, "      c = c + 1 + t * 2 - x * 2;\n");
+    write_source(&w, "    }\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  e: int = a + b;\n");
+    write_source(&w, "  return c + a * 7 + e;\n");
+    write_source(&w, "}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+static void grow_gvn(SemContext* sem, SemFunc* func, DynamicArray(char)* note) {
+  write_text(note, "%d replaced", sem_number_values(sem, func));
+}
+
+static bool bench_gvn(Arena* arena) {
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = promoted_file(sem, sem_arena, generate_redundant_source(arena, 50000));
+
+  if (!file) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  int num_sampled = num_samples(file);
+  uint64_t* expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+
+  if (!sample_results(file, expected, NULL)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  size_t before = count_block_insts(file);
+  int num_replaced = 0;
+
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    num_replaced += sem_number_values(sem, &file->funcs[i]);
+  }
+
+  double time = timer_seconds() - start;
+
+  bool ok = true;
+
+  ok &= same_results(file, expected, NULL);
+
+  int num_funcs = file->num_funcs;
+  free_arena(sem_arena);
+
+  printf("gvn:\n");
+  printf("  %d functions, %zu instructions in %.2f ms (%.1f ns/inst)\n", num_funcs, before, time * 1000.0, time * 1e9 / before);
+  printf("  %d redundant values replaced\n", num_replaced);
+  printf("  %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  ok &= bench_growing(grow_gvn);
+
+  return ok;
+}
+
+// Unused expressions, stores nothing reads, and the empty blocks returns leave
+static SourceContents generate_dead_source(Arena* arena, int num_funcs) {
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n", i);
+    write_source(&w, "  a: int = %d;\n", i);
+    write_source(&w, "  b: int = a * 3;\n");
+    write_source(&w, "  b = a + 1;\n");
+    write_source(&w, "  a * 2;\n");
+    write_source(&w, "  c: int = 0;\n");
+    write_source(&w, "  n: int = 0;\n\n");
+    write_source(&w, "  while n - 4 {\n");
+    write_source(&w, "    c = c + b;\n");
+    write_source(&w, "    c * c - n;\n");
+    write_source(&w, "    t: int = c - n;\n");
+    write_source(&w, "    n = n + 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  if c - 8 {\n");
+    write_source(&w, "    return c;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  return 0;\n");
+    write_source(&w, "}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+// Promoting, leaving SSA and compacting, which all cost more with dead code
+static double time_downstream(SemContext* sem, SemFile* file) {
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    sem_promote_locals(sem, &file->funcs[i]);
+    sem_leave_ssa(sem, &file->funcs[i]);
+    sem_compact(sem, &file->funcs[i]);
+  }
+
+  return timer_seconds() - start;
+}
+
+static bool bench_dce(Arena* arena) {
+  SourceContents source = generate_dead_source(arena, 50000);
+
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = checked_file(sem, arena, source);
+
+  if (!file) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  int num_sampled = num_samples(file);
+  uint64_t* expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+
+  if (!sample_results(file, expected, NULL)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  size_t before = count_block_insts(file);
+  SemDeadCounts total = {0};
+
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    SemDeadCounts counts = sem_eliminate_dead_code(sem, &file->funcs[i]);
+    total.blocks += counts.blocks;
+    total.insts += counts.insts;
+    total.stores += counts.stores;
+  }
+
+  double time = timer_seconds() - start;
+  size_t after = count_block_insts(file);
+
+  double with_dce = time_downstream(sem, file);
+
+  bool ok = true;
+
+  ok &= same_results(file, expected, NULL);
+
+  int num_funcs = file->num_funcs;
+  free_arena(sem_arena);
+
+  // The same functions again, kept as they are
+  sem_arena = new_arena();
+  sem = sem_init(sem_arena);
+  file = checked_file(sem, arena, source);
+
+  if (!file) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  double without_dce = time_downstream(sem, file);
+  free_arena(sem_arena);
+
+  printf("dce:\n");
+  printf("  %d functions, %zu instructions in %.2f ms (%.1f ns/inst)\n", num_funcs, before, time * 1000.0, time * 1e9 / before);
+  printf("  %d unreachable blocks, %d unused instructions, %d dead stores removed, %zu instructions left\n", total.blocks, total.insts, total.stores, after);
+  printf("  promote, leave ssa and compact: %.2f ms as checked, %.2f ms after dce (%.2f ms with it)\n", without_dce * 1000.0, with_dce * 1000.0, (with_dce + time) * 1000.0);
+  printf("  %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  return ok;
+}
+
+// Flags set in one if and tested by the next, and gotos from every if and loop
+static SourceContents generate_flag_source(Arena* arena, int num_funcs) {
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n", i);
+    write_source(&w, "  x: int = %d;\n", i);
+    write_source(&w, "  r: int = 0;\n");
+    write_source(&w, "  n: int = 0;\n\n");
+    write_source(&w, "  while n - 4 {\n");
+    write_source(&w, "    big: int = 0;\n");
+    write_source(&w, "    if x - n * 7 {\n");
+    write_source(&w, "      big = 1;\n");
+    write_source(&w, "    }\n\n");
+    write_source(&w, "    if big {\n");
+    write_source(&w, "      r = r + x;\n");
+    write_source(&w, "    }\n");
+    write_source(&w, "    else {\n");
+    write_source(&w, "      r = r - n;\n");
+    write_source(&w, "    }\n\n");
+    write_source(&w, "    n = n + 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  odd: int = 0;\n");
+    write_source(&w, "  if x / 2 * 2 - x {\n");
+    write_source(&w, "    odd = 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  if odd {\n");
+    write_source(&w, "    r = r * 3;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  return r;\n");
+    write_source(&w, "}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+static void count_blocks(SemFile* file, size_t* num_blocks, size_t* num_branches) {
+  *num_blocks = 0;
+  *num_branches = 0;
+
+  for_range(int, i, file->num_funcs) {
+    SemFunc* func = &file->funcs[i];
+    *num_blocks += dynamic_array_length(func->blocks);
+
+    for_range(int, b, dynamic_array_length(func->blocks)) {
+      SemBlock* block = &func->blocks[b];
+      *num_branches += block->num_insts && func->insts[block->insts[block->num_insts-1]].op == SEM_OP_BRANCH;
+    }
+  }
+}
+
+static void grow_simplify(SemContext* sem, SemFunc* func, DynamicArray(char)* note) {
+  SemCfgCounts counts = sem_simplify_cfg(sem, func);
+  write_text(note, "%d blocks left, %d forwarded, %d merged", dynamic_array_length(func->blocks), counts.forwarded, counts.merged);
+}
+
+static bool bench_simplify(Arena* arena) {
+  Arena* sem_arena = new_arena();
+  SemContext* sem = sem_init(sem_arena);
+  SemFile* file = promoted_file(sem, sem_arena, generate_flag_source(arena, 50000));
+
+  if (!file) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  for_range(int, i, file->num_funcs) {
+    sem_eliminate_dead_code(sem, &file->funcs[i]);
+  }
+
+  int num_sampled = num_samples(file);
+  uint64_t* expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+
+  if (!sample_results(file, expected, NULL)) {
+    free_arena(sem_arena);
+    return false;
+  }
+
+  size_t blocks_before, branches_before;
+  count_blocks(file, &blocks_before, &branches_before);
+
+  SemCfgCounts total = {0};
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    SemCfgCounts counts = sem_simplify_cfg(sem, &file->funcs[i]);
+    total.forwarded += counts.forwarded;
+    total.merged += counts.merged;
+    total.threaded += counts.threaded;
+  }
+
+  double time = timer_seconds() - start;
+
+  size_t blocks_after, branches_after;
+  count_blocks(file, &blocks_after, &branches_after);
+
+  bool ok = true;
+
+  ok &= same_results(file, expected, NULL);
+
+  int num_funcs = file->num_funcs;
+  free_arena(sem_arena);
+
+  printf("simplify:\n");
+  printf("  %d functions in %.2f ms (%.2f us/function)\n", num_funcs, time * 1000.0, time * 1e6 / num_funcs);
+  printf("  %d edges forwarded, %d blocks merged, %d edges threaded\n", total.forwarded, total.merged, total.threaded);
+  printf("  blocks %zu -> %zu, branches %zu -> %zu\n", blocks_before, blocks_after, branches_before, branches_after);
+  printf("  %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  ok &= bench_growing(grow_simplify);
+
+  return ok;
+}
+
+// Nested counting loops whose bodies recompute what the loops around them
+// already know, next to a division that has to stay put
+static SourceContents generate_kernel_source(Arena* arena, int num_funcs) {
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n", i);
+    write_source(&w, "  a: int = %d;\n", i);
+    write_source(&w, "  b: int = a * 3 + 1;\n");
+    write_source(&w, "  s: int = 0;\n");
+    write_source(&w, "  i: int = 0;\n\n");
+    write_source(&w, "  while i - 8 {\n");
+    write_source(&w, "    j: int = 0;\n\n");
+    write_source(&w, "    while j - 8 {\n");
+    write_source(&w, "      s = s + a * b + i * b - j / 2 + a / b;\n");
+    write_source(&w, "      j = j + 1;\n");
+    write_source(&w, "    }\n\n");
+    write_source(&w, "    i = i + 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  return s;\n");
+    write_source(&w, "}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+static bool bench_licm_file(Arena* arena, char* name, SemContext* sem, SemFile* file) {
+  int num_sampled = num_samples(file);
+  uint64_t* expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+
+  RunCounts before = {0};
+  double run_start = timer_seconds();
+
+  if (!sample_results(file, expected, &before)) {
+    return false;
+  }
+
+  double run_before = timer_seconds() - run_start;
+
+  int num_hoisted = 0;
+  double start = timer_seconds();
+
+  for_range(int, i, file->num_funcs) {
+    num_hoisted += sem_hoist_invariants(sem, &file->funcs[i]);
+  }
+
+  double time = timer_seconds() - start;
+
+  RunCounts after = {0};
+  run_start = timer_seconds();
+
+  bool ok = same_results(file, expected, &after);
+  double run_after = timer_seconds() - run_start;
+
+  printf("  %s: %d functions in %.2f ms (%.2f us/function), %d instructions hoisted\n",
+    name, file->num_funcs, time * 1000.0, time * 1e6 / file->num_funcs, num_hoisted);
+  printf("    sampled runs %lld -> %lld instructions, %.2f -> %.2f ms\n",
+    (long long)before.steps, (long long)after.steps, run_before * 1000.0, run_after * 1000.0);
+  printf("    %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  return ok;
+}
+
+static void grow_licm(SemContext* sem, SemFunc* func, DynamicArray(char)* note) {
+  write_text(note, "%d hoisted", sem_hoist_invariants(sem, func));
+}
+
+static bool bench_licm(Arena* arena) {
+  printf("licm:\n");
+
+  SourceContents source = generate_kernel_source(arena, 50000);
+  bool ok = true;
+
+  // Before promotion the loads of locals the loops never store to move too
+  for_range(int, promote, 2) {
+    Arena* sem_arena = new_arena();
+    SemContext* sem = sem_init(sem_arena);
+    SemFile* file = promote ? promoted_file(sem, sem_arena, source) : checked_file(sem, sem_arena, source);
+
+    ok &= file && bench_licm_file(arena, promote ? "promoted" : "loads", sem, file);
+    free_arena(sem_arena);
+  }
+
+  ok &= bench_growing(grow_licm);
+
+  return ok;
+}
+
+#define COUNT_ITERATIONS (64 + 8 + 8 * 8)
+
+// A counting loop and a nest of two, going round COUNT_ITERATIONS times in all
+static SourceContents generate_count_source(Arena* arena, int num_funcs) {
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n", i);
+    write_source(&w, "  x: int = %d;\n", i);
+    write_source(&w, "  s: int = 0;\n");
+    write_source(&w, "  i: int = 0;\n\n");
+    write_source(&w, "  while i - 64 {\n");
+    write_source(&w, "    s = s + x * i;\n");
+    write_source(&w, "    i = i + 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  j: int = 0;\n\n");
+    write_source(&w, "  while j - 8 {\n");
+    write_source(&w, "    k: int = 0;\n\n");
+    write_source(&w, "    while k - 8 {\n");
+    write_source(&w, "      s = s + j * k;\n");
+    write_source(&w, "      k = k + 1;\n");
+    write_source(&w, "    }\n\n");
+    write_source(&w, "    j = j + 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  return s;\n");
+    write_source(&w, "}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+static void grow_rotate(SemContext* sem, SemFunc* func, DynamicArray(char)* note) {
+  write_text(note, "%d rotated", sem_rotate_loops(sem, func));
+}
+
+static bool bench_rotate(Arena* arena) {
+  SourceContents source = generate_count_source(arena, 50000);
+
+  int num_sampled = 0;
+  uint64_t* expected = NULL;
+
+  int num_funcs = 0;
+  int num_rotated = 0;
+  double time = 0.0;
+
+  RunCounts counts[2] = {0};
+  bool ok = true;
+
+  // The same functions left as they are and rotated, then both folded and
+  // simplified, which takes the guards of loops that always run at least once
+  for_range(int, rotated, 2) {
+    Arena* sem_arena = new_arena();
+    SemContext* sem = sem_init(sem_arena);
+    SemFile* file = promoted_file(sem, sem_arena, source);
+
+    if (!file) {
+      free_arena(sem_arena);
+      return false;
+    }
+
+    if (rotated) {
+      double start = timer_seconds();
+
+      for_range(int, i, file->num_funcs) {
+        num_rotated += sem_rotate_loops(sem, &file->funcs[i]);
+      }
+
+      time = timer_seconds() - start;
+    }
+    else {
+      num_funcs = file->num_funcs;
+      num_sampled = num_samples(file);
+      expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+    }
+
+    for_range(int, i, file->num_funcs) {
+      sem_propagate_constants(sem, &file->funcs[i]);
+      sem_simplify_cfg(sem, &file->funcs[i]);
+    }
+
+    if (rotated) {
+      ok &= same_results(file, expected, &counts[rotated]);
+    }
+    else {
+      ok &= sample_results(file, expected, &counts[rotated]);
+    }
+
+    free_arena(sem_arena);
+  }
+
+  double iterations = (double)num_sampled * COUNT_ITERATIONS;
+
+  printf("rotate:\n");
+  printf("  %d functions in %.2f ms (%.2f us/function), %d loops rotated\n", num_funcs, time * 1000.0, time * 1e6 / num_funcs, num_rotated);
+  printf("  per iteration %.2f branches and %.2f gotos -> %.2f branches and %.2f gotos\n",
+    counts[0].branches / iterations, counts[0].gotos / iterations, counts[1].branches / iterations, counts[1].gotos / iterations);
+  printf("  %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  ok &= bench_growing(grow_rotate);
+
+  return ok;
+}
+
+#define UNROLL_ITERATIONS (6 + 100)
+
+// A short counting loop and a long one counting down, both multiplying their
+// counter by something the loop doesn't change
+static SourceContents generate_unroll_source(Arena* arena, int num_funcs) {
+  SourceWriter w = {
+    .capacity = num_funcs * GENERATED_FN_BYTES + 1
+  };
+
+  w.buffer = arena_push(arena, w.capacity);
+
+  for_range(int, i, num_funcs) {
+    write_source(&w, "fn f%d {\n", i);
+    write_source(&w, "  x: int = %d;\n", i);
+    write_source(&w, "  s: int = 0;\n");
+    write_source(&w, "  i: int = 0;\n\n");
+    write_source(&w, "  while i - 6 {\n");
+    write_source(&w, "    s = s + x * i;\n");
+    write_source(&w, "    i = i + 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  j: int = 100;\n\n");
+    write_source(&w, "  while j {\n");
+    write_source(&w, "    s = s + j * x - 3;\n");
+    write_source(&w, "    j = j - 1;\n");
+    write_source(&w, "  }\n\n");
+    write_source(&w, "  return s + i + j;\n");
+    write_source(&w, "}\n\n");
+  }
+
+  return (SourceContents) {
+    .contents = w.buffer,
+    .length = w.length,
+    .path = "<generated>"
+  };
+}
+
+static bool bench_unroll(Arena* arena) {
+  SourceContents source = generate_unroll_source(arena, 50000);
+
+  int num_sampled = 0;
+  uint64_t* expected = NULL;
+
+  int num_funcs = 0;
+  SemInductionCounts inductions = {0};
+  SemUnrollCounts unrolled = {0};
+  double time = 0.0;
+
+  RunCounts counts[2] = {0};
+  bool ok = true;
+
+  // Both go through everything else sem_optimize does, and the unrolled ones
+  // are cleaned up after
+  for_range(int, unroll, 2) {
+    Arena* sem_arena = new_arena();
+    SemContext* sem = sem_init(sem_arena);
+    SemFile* file = promoted_file(sem, sem_arena, source);
+
+    if (!file) {
+      free_arena(sem_arena);
+      return false;
+    }
+
+    for_range(int, i, file->num_funcs) {
+      SemFunc* func = &file->funcs[i];
+
+      sem_rotate_loops(sem, func);
+      sem_propagate_constants(sem, func);
+      sem_hoist_invariants(sem, func);
+      sem_number_values(sem, func);
+      sem_eliminate_dead_code(sem, func);
+      sem_simplify_cfg(sem, func);
+      sem_eliminate_dead_code(sem, func);
+    }
+
+    if (unroll) {
+      double start = timer_seconds();
+
+      for_range(int, i, file->num_funcs) {
+        SemInductionCounts k = sem_simplify_inductions(sem, &file->funcs[i]);
+        SemUnrollCounts u = sem_unroll_loops(sem, &file->funcs[i]);
+
+        inductions.basic += k.basic;
+        inductions.derived += k.derived;
+        inductions.reduced += k.reduced;
+        inductions.exit_values += k.exit_values;
+
+        unrolled.full += u.full;
+        unrolled.partial += u.partial;
+        unrolled.copies += u.copies;
+      }
+
+      time = timer_seconds() - start;
+
+      for_range(int, i, file->num_funcs) {
+        SemFunc* func = &file->funcs[i];
+
+        sem_propagate_constants(sem, func);
+        sem_number_values(sem, func);
+        sem_eliminate_dead_code(sem, func);
+        sem_simplify_cfg(sem, func);
+        sem_eliminate_dead_code(sem, func);
+      }
+    }
+    else {
+      num_funcs = file->num_funcs;
+      num_sampled = num_samples(file);
+      expected = arena_push(arena, num_sampled * sizeof(uint64_t));
+    }
+
+    if (unroll) {
+      ok &= same_results(file, expected, &counts[unroll]);
+    }
+    else {
+      ok &= sample_results(file, expected, &counts[unroll]);
+    }
+
+    free_arena(sem_arena);
+  }
+
+  double iterations = (double)num_sampled * UNROLL_ITERATIONS;
+
+  printf("unroll:\n");
+  printf("  %d functions in %.2f ms (%.2f us/function)\n", num_funcs, time * 1000.0, time * 1e6 / num_funcs);
+  printf("  %d induction variables, %d derived, %d strength reduced, %d exit values\n",
+    inductions.basic, inductions.derived, inductions.reduced, inductions.exit_values);
+  printf("  %d loops unrolled fully and %d partly, %d copies of bodies\n", unrolled.full, unrolled.partial, unrolled.copies);
+  printf("  per iteration %.2f steps and %.2f branches -> %.2f steps and %.2f branches\n",
+    counts[0].steps / iterations, counts[0].branches / iterations, counts[1].steps / iterations, counts[1].branches / iterations);
+  printf("  %d sampled functions %s\n", num_sampled, ok ? "return the same values" : "RETURN DIFFERENT VALUES");
+
+  return ok;
+}
+
+typedef struct {
+  char* name;
+  bool(*proc)(Arena* arena);
+} Benchmark;
+
+static Benchmark benchmarks[] = {
+  { "tokenize", bench_tokenize },
+  { "utf8", bench_utf8 },
+  { "ast", bench_ast },
+  { "postorder", bench_postorder },
+  { "parse", bench_parse },
+  { "check", bench_check },
+  { "incremental", bench_incremental },
+  { "direct", bench_direct },
+  { "ir", bench_ir },
+  { "dominators", bench_dominators },
+  { "ssa", bench_ssa },
+  { "outssa", bench_out_of_ssa },
+  { "compact", bench_compact },
+  { "read", bench_read },
+  { "binary", bench_binary },
+  { "sccp", bench_sccp },
+  { "gvn", bench_gvn },
+  { "dce", bench_dce },
+  { "simplify", bench_simplify },
+  { "licm", bench_licm },
+  { "rotate", bench_rotate },
+  { "unroll", bench_unroll },
+};
+
+int run_benchmarks(char* name) {
+  Arena* arena = new_arena();
+  bool success = true;
+  bool found = false;
+
+  for_range(int, i, (int)LENGTH(benchmarks)) {
+    if (name && strcmp(name, benchmarks[i].name) != 0) {
+      continue;
+    }
+
+    found = true;
+    success &= benchmarks[i].proc(arena);
+    printf("\n");
+  }
+
+  if (!found) {
+    fprintf(stderr, "Unknown benchmark '%s'\n", name);
+    success = false;
+  }
+
+  free_arena(arena);
+  return success ? 0 : 1;
+}
@@ -27,24 +27,57 @@ static void find_line(char* source, int line, char** out_start, int* out_length)
   *out_length = length;
 }
 
+// Set on a thread whose errors should wait to be printed in order with others
+static THREAD_LOCAL DynamicArray(char)* capture;
+
+DynamicArray(char)* capture_errors(DynamicArray(char)* buffer) {
+  DynamicArray(char)* outer = capture;
+  capture = buffer;
+  return outer;
+}
+
+static int emit_v(char* fmt, va_list ap) {
+  if (!capture) {
+    return vfprintf(stderr, fmt, ap);
+  }
+
+  int start = dynamic_array_length(*capture);
+  write_text_v(capture, fmt, ap);
+
+  return dynamic_array_length(*capture) - start;
+}
+
+static int emit(char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int length = emit_v(fmt, ap);
+  va_end(ap);
+
+  return length;
+}
+
+void print_captured_errors(DynamicArray(char) errors) {
+  emit("%.*s", dynamic_array_length(errors), errors);
+}
+
 void error_at_token(SourceContents source, Token token, char* fmt, ...) {
   char* line_start;
   int line_length;
   find_line(source.contents, token.line, &line_start, &line_length);
 
-  int offset = fprintf(stderr, "%s(%d): error: ", source.path, token.line);
-  fprintf(stderr, "%.*s\n", line_length, line_start);
+  int offset = emit("%s(%d): error: ", source.path, token.line);
+  emit("%.*s\n", line_length, line_start);
 
   offset += (int)(token.start - line_start);
 
-  fprintf(stderr, "%*s^ ", offset, "");
+  emit("%*s^ ", offset, "");
 
   va_list ap;
   va_start(ap, fmt);
 
-  vfprintf(stderr, fmt, ap);
+  emit_v(fmt, ap);
 
   va_end(ap);
 
-  fprintf(stderr, "\n");
-}
\ No newline at end of file
+  emit("\n");
+}
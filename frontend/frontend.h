@@ -5,6 +5,7 @@
 
 typedef struct {
   char* contents;
+  int length;
   char* path;
 } SourceContents;
 
@@ -27,12 +28,16 @@ typedef struct {
   int kind;
   int length;
   int line;
+  int literal; // Index into TokenizedBuffer::literals for integer literals
   char* start;
 } Token;
 
 typedef struct {
   int length;
   Token* tokens;
+
+  int num_literals;
+  uint64_t* literals; // Decoded values of integer literals
 } TokenizedBuffer;
 
 #define X(name, ...) AST_##name,
@@ -50,16 +55,68 @@ static char* ast_kind_string[] = {
 };
 #undef X
 
-typedef struct AST AST;
-
-struct AST {
+// Nodes live in one array and refer to each other by index. A node's children
+// are a contiguous range of AST::children. Nodes are stored in the order the
+// parser completes them, so every child comes before its parent.
+typedef struct {
   ASTKind kind;
-  Token token;
+  uint32_t token; // Index into TokenizedBuffer::tokens
+  uint32_t first_child; // Index into AST::children
+  uint32_t num_children;
+} ASTNode;
+
+typedef enum {
+  POSTORDER_NODE, // A node, after all of its children
+
+  // Markers for where the checker needs to act before a node is complete
+  POSTORDER_FN_BEGIN, // Before a function's body
+  POSTORDER_BLOCK_BEGIN, // After a block's '{'
+  POSTORDER_WHILE_BEGIN, // Before a while predicate
+  POSTORDER_WHILE_BODY, // Between a while predicate and its body
+  POSTORDER_IF_THEN, // Between an if predicate and its body
+  POSTORDER_IF_ELSE, // Between an if body and its else
+} PostorderKind;
+
+typedef struct {
+  PostorderKind kind;
+  uint32_t index; // Node index for POSTORDER_NODE, token index for markers
+} PostorderItem;
+
+typedef struct {
+  TokenizedBuffer* tokens;
+
+  int num_nodes;
+  ASTNode* nodes;
 
   int num_children;
-  AST** children;
+  uint32_t* children; // Node indices
+
+  uint32_t root;
+
+  // With PARSE_POSTORDER, the order the checker visits nodes in. Leaves that
+  // only name something (a local's name and type, a function's name) are left
+  // out since their parent reads them.
+  int num_postorder;
+  PostorderItem* postorder;
+} AST;
+
+enum {
+  PARSE_POSTORDER = BIT(0),
 };
 
+inline ASTNode* ast_node(AST* ast, uint32_t node) {
+  return &ast->nodes[node];
+}
+
+inline uint32_t ast_child(AST* ast, uint32_t node, uint32_t i) {
+  assert(i < ast->nodes[node].num_children);
+  return ast->children[ast->nodes[node].first_child + i];
+}
+
+inline Token ast_token(AST* ast, uint32_t node) {
+  return ast->tokens->tokens[ast->nodes[node].token];
+}
+
 #define X(name, ...) SEM_OP_##name,
 typedef enum {
   SEM_OP_INVALID,
@@ -74,40 +131,144 @@ static char* sem_op_str[] = {
 };
 #undef X
 
-typedef struct SemInst SemInst;
+#define X(name, str, has_value, ...) has_value,
+static bool sem_op_has_value[] = {
+  false,
+  #include "sem/op.def"
+};
+#undef X
 
-#define SEM_MAX_INS 4
+#define X(name, str, has_value, num_ins) num_ins,
+static int sem_op_num_ins[] = {
+  0,
+  #include "sem/op.def"
+};
+#undef X
 
-struct SemInst {
-  int block;
-  SemInst* prev;
-  SemInst* next;
+// Instructions live in per-function arrays and refer to each other by ID, the
+// index into SemFunc::insts. ID 0 is never used, so it can stand for no value.
+// Everything a pass reads on every instruction is packed in here, the rest is
+// in arrays parallel to SemFunc::insts.
+typedef struct {
+  uint8_t op; // SemOp
+  uint8_t pad;
+  uint16_t num_ins;
+  uint32_t block;
+  uint32_t ins; // Index of the first operand in SemFunc::uses
+  uint32_t data; // Index into SemFunc::constants for INT_CONST
+} SemInst;
 
-  SemOp op;
-  int def;
-  Token token;
+#define SEM_MAX_INS UINT16_MAX
 
-  int num_ins;
-  SemInst* ins[SEM_MAX_INS];
+// An operand. The uses of a value form a circular list, so users can be found
+// without a scan and all of them can be moved to another value at once.
+typedef struct {
+  uint32_t value; // Possibly replaced since, read it through sem_operand
+  uint32_t user;
+  uint32_t prev;
+  uint32_t next;
+} SemUse;
 
-  void* data;
-};
+#define SEM_MAX_SUCCS 2
 
+// Functions have many small blocks, so their instruction and predecessor
+// lists grow in the arena rather than each being a separate allocation
 typedef struct {
-  SemInst* start;
-  SemInst* end;
+  uint32_t* insts; // In order
+  uint32_t num_insts;
+  uint32_t capacity;
+
+  // A terminator's targets, in its order, so a BRANCH goes to succs[0] if true
+  uint32_t num_succs;
+  uint32_t succs[SEM_MAX_SUCCS];
+
+  uint32_t* preds; // One per edge, in the order they were added
+  uint32_t num_preds;
+  uint32_t preds_capacity;
 } SemBlock;
 
+#define SEM_UNREACHABLE UINT32_MAX
+
+// All per block. Children and frontiers are ranges of one array each, so the
+// children of b are children[first_child[b]] up to children[first_child[b+1]].
+typedef struct {
+  uint32_t* idom; // The entry's is itself, unreachable blocks' SEM_UNREACHABLE
+  uint32_t* first_child;
+  uint32_t* children;
+
+  // Where a block is entered and left in a walk of the tree, so a block
+  // dominates another when its interval contains the other's
+  uint32_t* pre;
+  uint32_t* post;
+
+  uint32_t* first_frontier; // NULL until sem_dominance_frontiers
+  uint32_t* frontiers;
+} SemDominators;
+
 typedef struct {
   String name;
+  uint32_t first_token; // Its 'fn', instruction tokens are relative to it
+
+  DynamicArray(SemInst) insts;
+  DynamicArray(uint32_t) tokens; // Parallel to insts
+  DynamicArray(uint32_t) first_use; // Parallel to insts, 0 if a value is unused
+  DynamicArray(uint32_t) replaced_by; // Parallel to insts, see sem_replace_all_uses_with
+
+  DynamicArray(SemUse) uses; // Index 0 is never used
+  DynamicArray(uint64_t) constants;
+
   DynamicArray(SemBlock) blocks;
+
+  // Computed by sem_rpo, and dropped whenever a block or an edge changes
+  uint32_t num_rpo;
+  uint32_t* rpo; // Blocks reachable from the entry, in reverse postorder
+  uint32_t* rpo_index; // Per block, its position in rpo or SEM_UNREACHABLE
+  SemDominators* dom; // Computed by sem_dominators, dropped along with rpo
+
+  // Set by sem_leave_ssa. Per instruction, the register its value lives in,
+  // as values then share registers and are assigned by copies.
+  uint32_t num_regs;
+  uint32_t* regs;
 } SemFunc;
 
 typedef struct {
+  TokenizedBuffer* tokens; // What instruction tokens index into
+
   int num_funcs;
   SemFunc* funcs;
 } SemFile;
 
+inline bool sem_is_terminator(SemOp op) {
+  return op == SEM_OP_GOTO || op == SEM_OP_BRANCH || op == SEM_OP_RETURN;
+}
+
+inline SemInst* sem_inst(SemFunc* func, uint32_t inst) {
+  return &func->insts[inst];
+}
+
+uint32_t sem_resolve(SemFunc* func, uint32_t value);
+
+inline uint32_t sem_operand(SemFunc* func, uint32_t inst, int i) {
+  assert(i < func->insts[inst].num_ins);
+  SemUse* use = &func->uses[func->insts[inst].ins + i];
+
+  if (func->replaced_by[use->value]) {
+    use->value = sem_resolve(func, use->value);
+  }
+
+  return use->value;
+}
+
+// Walks the uses of a value that has not been replaced, 0 after the last
+inline uint32_t sem_next_use(SemFunc* func, uint32_t value, uint32_t use) {
+  uint32_t next = func->uses[use].next;
+  return next == func->first_use[value] ? 0 : next;
+}
+
+inline Token sem_token(SemFunc* func, TokenizedBuffer* tokens, uint32_t inst) {
+  return tokens->tokens[func->first_token + func->tokens[inst]];
+}
+
 typedef struct {
   Arena* arena;
   Allocator* allocator;
@@ -115,15 +276,331 @@ typedef struct {
 
 SourceContents load_source(Arena* arena, char* path);
 
-TokenizedBuffer tokenize(Arena* arena, SourceContents source);
+int utf8_validate(char* data, int length); // Offset of the first invalid byte, or -1
+int utf8_validate_with(char* data, int length, int cpu_features);
+int utf8_decode(char* data, uint32_t* codepoint); // Data must be valid, returns the sequence length
+bool is_xid_start(uint32_t codepoint);
+bool is_xid_continue(uint32_t codepoint);
+
+TokenizedBuffer* tokenize(Arena* arena, SourceContents source);
+TokenizedBuffer* tokenize_parallel(Arena* arena, SourceContents source, int num_threads);
+TokenizedBuffer* tokenize_region(Arena* arena, SourceContents source, int start, int end, int first_line);
 
 void error_at_token(SourceContents source, Token token, char* fmt, ...);
 
-AST* parse(Arena* arena, SourceContents source, TokenizedBuffer* tokens);
+// Makes error_at_token append to a buffer on the calling thread rather than
+// print, so errors found by workers can be printed in order. NULL prints
+// again, and the buffer it replaces is returned to be put back after.
+DynamicArray(char)* capture_errors(DynamicArray(char)* buffer);
+void print_captured_errors(DynamicArray(char) errors); // Captured again if this thread is capturing
+
+AST* parse(Arena* arena, SourceContents source, TokenizedBuffer* tokens, int flags);
+AST* parse_parallel(Arena* arena, SourceContents source, TokenizedBuffer* tokens, int flags, int num_threads);
+bool find_functions(TokenizedBuffer* tokens, DynamicArray(int)* fn_starts);
 void ast_dump(AST* ast);
 
 SemContext* sem_init(Arena* arena);
 SemFile* check_ast(SemContext* context, SourceContents source, AST* ast);
-uint64_t* sem_reachable(Arena* arena, SemFunc* func);
+SemFile* check_ast_parallel(SemContext* context, SourceContents source, AST* ast, int num_threads);
+bool check_fn(SemContext* context, SourceContents source, AST* ast, uint32_t fn, SemFunc* func_out);
+SemFile* check_postorder(SemContext* context, SourceContents source, AST* ast);
+
+// Lowers a postorder stream to SemInsts as it is produced, so a parser can
+// drive it without building an AST. lower_visit fails on the first error,
+// which it reports.
+typedef struct Lowering Lowering;
+
+Lowering* new_lowering(Allocator* allocator, SemContext* context, SourceContents source, TokenizedBuffer* tokens);
+bool lower_visit(Lowering* lowering, PostorderKind kind, ASTKind node_kind, uint32_t token);
+SemFile* lowering_finish(Lowering* lowering);
+
+SemFile* parse_and_check(SemContext* context, SourceContents source, TokenizedBuffer* tokens);
+
+// Reads functions in the form sem_dump prints them. Instruction tokens are
+// their lines in the text. Only SSA form can be read, as once out of SSA a
+// name stands for a register that any number of instructions write.
+SemFile* sem_read(SemContext* context, SourceContents source);
+uint64_t* sem_reachable(SemContext* context, Arena* arena, SemFunc* func);
 bool sem_analyze(SemContext* context, SourceContents source, SemFile* file);
-void sem_dump(SemFile* file);
\ No newline at end of file
+bool sem_analyze_parallel(SemContext* context, SourceContents source, SemFile* file, int num_threads);
+bool sem_analyze_func(SemContext* context, SourceContents source, TokenizedBuffer* tokens, SemFunc* func);
+void sem_block_insert(Arena* arena, SemFunc* func, uint32_t block, uint32_t index, uint32_t inst);
+void sem_block_append(Arena* arena, SemFunc* func, uint32_t block, uint32_t inst);
+uint32_t sem_num_phis(SemFunc* func, uint32_t block); // Phis come first in a block
+bool sem_has_local(SemFunc* func, uint32_t block); // A copy of the block's code would make a different local
+uint32_t sem_new_block(SemFunc* func);
+void sem_add_edge(Arena* arena, SemFunc* func, uint32_t from, uint32_t to);
+void sem_remove_edge(SemFunc* func, uint32_t from, int succ); // Keeps the order of the rest
+void sem_redirect_edge(Arena* arena, SemFunc* func, uint32_t from, int succ, uint32_t to); // Keeps its place among from's successors, and from must have no edge to it already
+int sem_pred_index(SemFunc* func, uint32_t from, int succ); // Where an edge is in its target's predecessors
+int sem_succ_index(SemFunc* func, uint32_t to, int pred); // The other way round
+bool sem_has_succ(SemFunc* func, uint32_t block, uint32_t succ);
+uint32_t sem_split_edge(Arena* arena, SemFunc* func, uint32_t from, int succ); // Returns the block put on the edge
+void sem_invalidate_cfg(SemFunc* func);
+void sem_rpo(SemContext* context, SemFunc* func); // Fills SemFunc::rpo unless it is still valid
+
+SemDominators* sem_dominators(SemContext* context, SemFunc* func);
+SemDominators* sem_dominance_frontiers(SemContext* context, SemFunc* func);
+
+// A block dominates itself. Needs sem_dominators.
+inline bool sem_dominates(SemFunc* func, uint32_t a, uint32_t b) {
+  SemDominators* dom = func->dom;
+  assert(dom);
+
+  if (dom->idom[a] == SEM_UNREACHABLE || dom->idom[b] == SEM_UNREACHABLE) {
+    return a == b;
+  }
+
+  return dom->pre[a] <= dom->pre[b] && dom->post[b] <= dom->post[a];
+}
+
+// Creating and rewriting instructions, keeping the use lists up to date. The
+// token is relative to the function's first, like SemFunc::tokens.
+SemFunc sem_new_func(Allocator* allocator, uint32_t first_token); // No blocks, and no instructions but ID 0
+uint32_t sem_new_inst(SemFunc* func, SemOp op, uint32_t token, int num_ins, uint32_t data);
+uint32_t sem_new_constant(SemFunc* func, uint32_t token, uint64_t value); // An INT_CONST, with its value added to SemFunc::constants
+void sem_remove_inst(SemFunc* func, uint32_t inst); // Takes it out of its block and drops its operands
+void sem_sweep(SemFunc* func, uint64_t* dead); // sem_remove_inst on every instruction in the bitset
+void sem_set_operand(SemFunc* func, uint32_t inst, int i, uint32_t value);
+void sem_add_operand(SemFunc* func, uint32_t inst, uint32_t value);
+void sem_remove_operand(SemFunc* func, uint32_t inst, int i); // Moves the later ones down
+void sem_replace_all_uses_with(SemFunc* func, uint32_t value, uint32_t replacement); // O(1)
+bool sem_may_trap(SemFunc* func, uint32_t inst); // A division that can't be shown to have a safe divisor
+DynamicArray(char) sem_write(Arena* arena, SemFile* file); // What sem_dump prints
+void sem_dump(SemFile* file);
+
+// Optimization passes, which expect a function that passed sem_analyze
+void sem_optimize(SemContext* context, SemFile* file);
+int sem_promote_locals(SemContext* context, SemFunc* func); // Returns how many locals became SSA values
+bool sem_is_promotable(SemFunc* func, uint32_t local); // Only ever loaded from and stored to, so nothing else can see it change
+
+typedef struct {
+  int folded; // Instructions that became constants
+  int branches; // Branches on a constant that became gotos
+  int unreachable; // Instructions removed from blocks that are never reached
+} SemFoldCounts;
+
+// Sparse conditional constant propagation. Folds arithmetic the way the
+// interpreter wraps it, but never a division that would trap. Blocks it finds
+// unreachable are left empty, without edges, for later passes to remove.
+SemFoldCounts sem_propagate_constants(SemContext* context, SemFunc* func);
+
+// Global value numbering. Replaces arithmetic, constants and phis that compute
+// the same value as one in a dominating block, and returns how many it removed.
+int sem_number_values(SemContext* context, SemFunc* func);
+
+typedef struct {
+  int blocks; // Blocks the entry can't reach
+  int insts; // Reachable instructions nothing needed
+  int stores; // Stores to locals that no load reads
+} SemDeadCounts;
+
+// Removes unreachable blocks, renumbering the rest in order, then dead stores
+// and every instruction that no terminator, remaining store or division that
+// may trap needs. Needs SSA form, as once out of it copies are read through
+// registers.
+SemDeadCounts sem_eliminate_dead_code(SemContext* context, SemFunc* func);
+int sem_remove_unreachable(SemContext* context, SemFunc* func); // Just the blocks, returning how many went
+
+typedef struct {
+  int forwarded; // Edges pointed past a block with nothing but a goto
+  int merged; // Blocks merged into their only predecessor
+  int threaded; // Edges pointed past a branch on a phi they bring a constant to
+} SemCfgCounts;
+
+// Simplifies control flow without copying any instructions, and then removes
+// the blocks nothing jumps to any more. Never threads into a loop header, so
+// loops keep a single entry.
+SemCfgCounts sem_simplify_cfg(SemContext* context, SemFunc* func);
+
+#define SEM_NO_LOOP UINT32_MAX
+#define SEM_NO_BLOCK UINT32_MAX
+
+// A natural loop, the header and every block that reaches a back edge into it
+// without passing through it
+typedef struct {
+  uint32_t header;
+  uint32_t preheader; // The only block outside that enters it, if it goes nowhere else, or SEM_NO_BLOCK
+  uint32_t latch; // Where the only back edge comes from, or SEM_NO_BLOCK if there are more
+  uint32_t parent; // The innermost loop around it, or SEM_NO_LOOP
+  uint32_t depth; // 1 for an outermost loop
+
+  // Its blocks are SemLoops::blocks[first_block] up to first_block + num_blocks,
+  // header first
+  uint32_t first_block;
+  uint32_t num_blocks;
+} SemLoop;
+
+// Loops are in reverse postorder of their headers, so every loop comes after
+// the ones around it
+typedef struct {
+  int num_loops;
+  SemLoop* loops;
+  uint32_t* blocks;
+  uint32_t* loop_of; // Per block, the innermost loop it is in, or SEM_NO_LOOP
+} SemLoops;
+
+// Finds loops from the back edges, which are those into a block that dominates
+// where they come from. Nothing may change the CFG while the result is in use.
+SemLoops* sem_find_loops(SemContext* context, Arena* arena, SemFunc* func);
+bool sem_loop_contains(SemLoops* loops, uint32_t loop, uint32_t block); // Directly or in a loop inside it
+int sem_insert_preheaders(SemContext* context, SemFunc* func); // Returns how many blocks it added
+
+// Loop-invariant code motion. Moves arithmetic whose operands are all defined
+// outside a loop, and loads of locals the loop never stores to, into its
+// preheader, innermost loops first so values can move out several levels.
+// Divisions that may trap stay, as the loop body might never have run them.
+int sem_hoist_invariants(SemContext* context, SemFunc* func);
+
+// Turns loops that test at the top into ones guarded before they start and
+// tested at the bottom, by copying the header into the preheader. Headers of
+// more than a few instructions are left as they are. Every loop has a
+// preheader again afterwards. Returns how many loops it rotated.
+int sem_rotate_loops(SemContext* context, SemFunc* func);
+
+// A header phi that the latch brings back as itself plus or minus an amount
+// the loop doesn't change
+typedef struct {
+  uint32_t phi;
+  uint32_t init; // What the preheader brings
+  uint32_t next; // What the latch brings
+  uint32_t step;
+  bool decreasing;
+} SemInduction;
+
+// Both need a preheader and a single latch
+DynamicArray(SemInduction) sem_find_inductions(Allocator* allocator, SemFunc* func, SemLoops* loops, uint32_t loop);
+
+// How many times the body runs, when the only way out is the latch testing a
+// variable that starts and steps by constants against a constant it reaches.
+// Fills in that variable.
+bool sem_trip_count(SemFunc* func, SemLoops* loops, uint32_t loop, SemInduction* var, uint64_t* count);
+
+typedef struct {
+  int basic;
+  int derived; // A basic variable plus, minus or times an invariant
+  int reduced; // Multiplications turned into variables of their own
+  int exit_values; // Uses after a loop of a variable given its final value
+} SemInductionCounts;
+
+// Strength reduces multiplications of induction variables, and where a loop
+// runs a known number of times, uses after it of its variables become the
+// constants they finish as
+SemInductionCounts sem_simplify_inductions(SemContext* context, SemFunc* func);
+
+typedef struct {
+  int full;
+  int partial;
+  int copies; // Of loop bodies, in all
+} SemUnrollCounts;
+
+// Unrolls innermost loops of a single block that run a known number of times.
+// Short ones are replaced by copies of the body in the preheader, and others
+// get a loop in front running several copies per iteration, leaving the
+// original to run what is left over. Wants constants propagated again after.
+SemUnrollCounts sem_unroll_loops(SemContext* context, SemFunc* func);
+
+typedef struct {
+  int naive; // A copy per phi and per phi operand
+  int coalesced;
+  int cycle_temps; // Extra copies to break swaps
+  int remaining;
+} SemCopyCounts;
+
+// Replaces phis with copies into registers, and coalesces as many copies away
+// as possible. The function is no longer in SSA form afterwards.
+SemCopyCounts sem_leave_ssa(SemContext* context, SemFunc* func);
+
+// Renumbers blocks in reverse postorder and instructions in the order they
+// then appear, into freshly allocated arrays
+void sem_compact(SemContext* context, SemFunc* func);
+
+// A file of functions that is mapped and read where it lies. Everything in it
+// refers to the rest by offset from the start of the file, and every offset is
+// a multiple of 8, so nothing needs fixing up after loading.
+#define SEM_BINARY_MAGIC 0x4d45534b // "KSEM", little endian
+#define SEM_BINARY_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size; // Of the whole file
+
+  uint32_t num_funcs;
+  uint32_t pad;
+  uint64_t funcs; // SemBinaryFunc[num_funcs]
+} SemBinaryHeader;
+
+typedef struct {
+  uint32_t first_inst; // Range of SemBinaryFunc::block_insts
+  uint32_t num_insts;
+  uint32_t first_pred; // Range of SemBinaryFunc::preds
+  uint32_t num_preds;
+  uint32_t num_succs;
+  uint32_t succs[SEM_MAX_SUCCS];
+  uint32_t pad;
+} SemBinaryBlock;
+
+// Only instructions in a block keep their operands, and operands hold the
+// value they resolve to, so there is nothing like SemFunc::replaced_by
+typedef struct {
+  uint64_t name; // Not terminated
+  uint32_t name_length;
+  uint32_t first_token;
+
+  uint32_t num_insts;
+  uint32_t num_uses;
+  uint32_t num_constants;
+  uint32_t num_blocks;
+  uint32_t num_block_insts;
+  uint32_t num_preds;
+  uint32_t num_regs;
+
+  uint32_t pad;
+
+  uint64_t insts; // SemInst[num_insts]
+  uint64_t tokens; // uint32_t[num_insts]
+  uint64_t first_use; // uint32_t[num_insts]
+  uint64_t uses; // SemUse[num_uses]
+  uint64_t constants; // uint64_t[num_constants]
+  uint64_t blocks; // SemBinaryBlock[num_blocks]
+  uint64_t block_insts; // uint32_t[num_block_insts]
+  uint64_t preds; // uint32_t[num_preds]
+  uint64_t regs; // uint32_t[num_insts], 0 in SSA form
+} SemBinaryFunc;
+
+typedef struct {
+  char* path;
+  void* data;
+  uint64_t size;
+  bool quiet; // Validating doesn't report why a file is invalid
+
+  SemBinaryHeader* header;
+  SemBinaryFunc* funcs;
+} SemBinary;
+
+inline void* sem_binary_at(SemBinary* binary, uint64_t offset) {
+  return (uint8_t*)binary->data + offset;
+}
+
+// Source tokens are not kept, so a loaded SemFile has no TokenizedBuffer. Only
+// the header and function table are checked on loading, so a file from
+// somewhere else should go through sem_binary_validate before it is read.
+bool sem_binary_write(SemFile* file, char* path);
+SemBinary* sem_binary_load(Arena* arena, char* path);
+bool sem_binary_validate(SemBinary* binary); // Every offset and index is in bounds, and use lists are whole
+void sem_binary_close(SemBinary* binary);
+SemFunc sem_binary_func(SemContext* context, SemBinary* binary, int i); // A copy that passes can change
+SemFile* sem_binary_file(SemContext* context, SemBinary* binary);
+
+// Keeps a file's tokens, AST and checked functions between edits, so an edit
+// only re-lexes, re-parses and re-checks the functions it touches
+typedef struct Session Session;
+
+Session* session_open(SourceContents source);
+void session_close(Session* session);
+bool session_edit(Session* session, int start, int end, char* text, int text_length); // Replaces bytes [start, end), false if the new text has errors
+SourceContents session_source(Session* session);
+SemFile* session_file(Session* session); // NULL if the current text has errors
+
+int run_benchmarks(char* name); // NULL runs all of them
\ No newline at end of file
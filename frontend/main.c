@@ -3,32 +3,103 @@
 #include "frontend.h"
 #include "allocator.h"
 
-static ScratchLibrary* global_scratch_lib;
+int main(int argc, char** argv) {
+  init_global_scratch();
 
-Scratch global_scratch(int num_conflicts, Arena** conflicts) {
-  return scratch_get(global_scratch_lib, num_conflicts, conflicts);
-}
+  if (argc > 1 && strcmp(argv[1], "-bench") == 0) {
+    return run_benchmarks(argc > 2 ? argv[2] : NULL);
+  }
 
-int main() {
-  global_scratch_lib = new_scratch_library();
+  bool direct = false; // Lowers while parsing, without an AST to dump
+  bool optimize = false;
+  bool out_of_ssa = false; // Dumps with registers instead of phis
+  bool ir = false; // Reads what sem_dump prints instead of source
+  bool binary = false; // Reads what sem_binary_write wrote instead of source
+  char* output_path = NULL; // Writes a binary file there instead of dumping
 
-  Arena* arena = new_arena();
+  for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+    if (strcmp(argv[1], "-direct") == 0) {
+      direct = true;
+    }
+    else if (strcmp(argv[1], "-O") == 0) {
+      optimize = true;
+    }
+    else if (strcmp(argv[1], "-out-of-ssa") == 0) {
+      out_of_ssa = true;
+    }
+    else if (strcmp(argv[1], "-ir") == 0) {
+      ir = true;
+    }
+    else if (strcmp(argv[1], "-binary") == 0) {
+      binary = true;
+    }
+    else if (strcmp(argv[1], "-o") == 0 && argc > 2) {
+      output_path = argv[2];
+      argc--, argv++;
+    }
+    else {
+      fprintf(stderr, "Unknown flag '%s'\n", argv[1]);
+      return 1;
+    }
+  }
 
-  char* source_path = "examples/test.kale";
-  SourceContents source = load_source(arena, source_path);
-  TokenizedBuffer tokens = tokenize(arena, source);
+  Arena* arena = new_arena();
 
-  AST* ast = parse(arena, source, &tokens);
-  if (!ast) { return 1; }
-  ast_dump(ast);
+  char* source_path = argc > 1 ? argv[1] : "examples/test.kale";
+  SourceContents source = {0};
 
   SemContext* sem = sem_init(arena);
+  SemFile* sem_file = NULL;
+
+  if (binary) {
+    // Written after sem_analyze, and without the tokens to report errors at
+    SemBinary* loaded = sem_binary_load(arena, source_path);
+    if (!loaded || !sem_binary_validate(loaded)) { return 1; }
+
+    sem_file = sem_binary_file(sem, loaded);
+    sem_binary_close(loaded);
+  }
+  else {
+    source = load_source(arena, source_path);
+
+    if (ir) {
+      sem_file = sem_read(sem, source);
+    }
+    else {
+      TokenizedBuffer* tokens = tokenize(arena, source);
+      if (!tokens) { return 1; }
 
-  SemFile* sem_file = check_ast(sem, source, ast);
-  if (!sem_file) { return 1; }
+      if (direct) {
+        sem_file = parse_and_check(sem, source, tokens);
+      }
+      else {
+        AST* ast = parse(arena, source, tokens, 0);
+        if (!ast) { return 1; }
+        ast_dump(ast);
+
+        sem_file = check_ast(sem, source, ast);
+      }
+    }
+
+    if (!sem_file) { return 1; }
+
+    if (!sem_analyze(sem, source, sem_file)) {
+      return 1;
+    }
+  }
+
+  if (optimize) {
+    sem_optimize(sem, sem_file);
+  }
+
+  if (out_of_ssa) {
+    for_range(int, i, sem_file->num_funcs) {
+      sem_leave_ssa(sem, &sem_file->funcs[i]);
+    }
+  }
 
-  if (!sem_analyze(sem, source, sem_file)) {
-    return 1;
+  if (output_path) {
+    return sem_binary_write(sem_file, output_path) ? 0 : 1;
   }
 
   sem_dump(sem_file);
@@ -5,69 +5,60 @@
 
 typedef struct {
   int depth;
-  uint64_t* first_child;
-  AST* node;
+  bool last_child;
+  uint32_t node;
 } IndentedItem;
 
-static IndentedItem indented_item(Arena* arena, int depth, uint64_t* parent_first_child, bool is_first_child, AST* node) {
-  uint64_t* first_child = arena_array(arena, uint64_t, bitset_num_u64(depth+1));
-  memcpy(first_child, parent_first_child, bitset_num_u64(depth) * sizeof(uint64_t));
-
-  if (is_first_child) {
-    bitset_set(first_child, depth);
-  }
-
-  return (IndentedItem) {
-    .depth = depth,
-    .first_child = first_child,
-    .node = node
-  };
-}
-
-static void print_indentation(IndentedItem item) {
-  for (int i = 1; i < item.depth+1; ++i) {
-    if (bitset_query(item.first_child, i)) {
-      printf("%c", i == item.depth ? 192 : ' ');
+// Nodes come off the stack in preorder, so when one does, last_child holds
+// the flag of each of its ancestors at their depth
+static void write_indentation(DynamicArray(char)* text, DynamicArray(bool) last_child, int depth) {
+  for (int i = 1; i < depth+1; ++i) {
+    if (last_child[i]) {
+      dynamic_array_put(*text, i == depth ? (char)192 : ' ');
     }
     else {
-      printf("%c", i == item.depth ? 195 : 179);
+      dynamic_array_put(*text, i == depth ? (char)195 : (char)179);
     }
 
-    printf("%c", i == item.depth ? 196 : ' ');
+    dynamic_array_put(*text, i == depth ? (char)196 : ' ');
   }
 }
 
 void ast_dump(AST* ast) {
   Scratch scratch = global_scratch(0, NULL);
 
+  DynamicArray(char) text = new_dynamic_array(scratch.allocator);
+  DynamicArray(bool) last_child = new_dynamic_array(scratch.allocator);
   DynamicArray(IndentedItem) stack = new_dynamic_array(scratch.allocator);
-  dynamic_array_put(stack, indented_item(
-    scratch.arena,
-    0,
-    NULL,
-    true,
-    ast
-  ));
+
+  dynamic_array_put(stack, ((IndentedItem) { .depth = 0, .last_child = true, .node = ast->root }));
 
   while (dynamic_array_length(stack)) {
     IndentedItem item = dynamic_array_pop(stack);
-    AST* node = item.node;
+    ASTNode* node = ast_node(ast, item.node);
+    Token token = ast_token(ast, item.node);
 
-    print_indentation(item);
-    printf("%s: '%.*s'\n", ast_kind_string[node->kind], node->token.length, node->token.start);
+    if (item.depth == dynamic_array_length(last_child)) {
+      dynamic_array_put(last_child, item.last_child);
+    }
+    else {
+      last_child[item.depth] = item.last_child;
+    }
 
-    for_range_rev (int, i, node->num_children) {
-      dynamic_array_put(stack, indented_item(
-        scratch.arena,
-        item.depth + 1,
-        item.first_child,
-        i == node->num_children-1,
-        node->children[i]
-      ));
+    write_indentation(&text, last_child, item.depth);
+    write_text(&text, "%s: '%.*s'\n", ast_kind_string[node->kind], token.length, token.start);
+
+    for_range_rev (int, i, (int)node->num_children) {
+      dynamic_array_put(stack, ((IndentedItem) {
+        .depth = item.depth + 1,
+        .last_child = i == (int)node->num_children-1,
+        .node = ast_child(ast, item.node, i)
+      }));
     }
   }
 
-  printf("\n");
+  write_text(&text, "\n");
+  fwrite(text, 1, dynamic_array_length(text), stdout);
 
   scratch_release(&scratch);
-}
\ No newline at end of file
+}
@@ -14,7 +14,7 @@ typedef struct {
   union {
     struct {
       int cur_prec;
-      Token op;
+      int op; // -1 when there is no operator yet
     } bin_infix;
 
     struct {
@@ -22,66 +22,108 @@ typedef struct {
     } bin;
 
     struct {
-      Token if_token;
+      int if_token;
     } els;
 
     struct {
-      Token lbrace;
+      int lbrace;
       int num_children;
     } block_stmt;
 
     struct {
       ASTKind kind;
-      Token token;
+      int token;
       int num_children;
     } complete;
 
     struct {
       int count;
     } top_level;
+
+    struct {
+      PostorderKind kind;
+      int token;
+    } marker;
   } as;
 } State;
 
 typedef struct {
-  Arena* node_arena;
   SourceContents source;
 
   TokenizedBuffer* token_buffer;
   int cur_token;
 
   DynamicArray(State) state_stack;
-  DynamicArray(AST*) node_stack;
+  DynamicArray(uint32_t) node_stack;
+
+  DynamicArray(ASTNode) nodes;
+  DynamicArray(uint32_t) children;
+
+  DynamicArray(PostorderItem) postorder; // NULL unless PARSE_POSTORDER
+
+  // Set by parse_and_check, which lowers as it parses and builds no AST
+  Lowering* lowering;
+  bool lowering_failed;
 
   State state;
+
+  // Functions can be parsed out of order, so the first error is kept for the
+  // caller to report rather than printed straight away
+  Token error_token;
+  char* error_message;
 } Parser;
 
-static Token peekn(Parser* p, int offset) {
+static void parse_error(Parser* p, Token token, char* message) {
+  p->error_token = token;
+  p->error_message = message;
+}
+
+static void report_error(Parser* p) {
+  if (p->error_message) { // Lowering errors have already been reported
+    error_at_token(p->source, p->error_token, "%s", p->error_message);
+  }
+}
+
+static int peekn_index(Parser* p, int offset) {
   int index = p->cur_token + offset;
 
   if (index >= p->token_buffer->length) {
     index = p->token_buffer->length - 1;
   }
 
+  return index;
+}
+
+static int peek_index(Parser* p) {
+  return peekn_index(p, 0);
+}
+
+static Token token_at(Parser* p, int index) {
   return p->token_buffer->tokens[index];
 }
 
+static Token peekn(Parser* p, int offset) {
+  return token_at(p, peekn_index(p, offset));
+}
+
 static Token peek(Parser* p) {
   return peekn(p, 0);
 }
 
-static Token lex(Parser* p) {
-  Token tok = peek(p);
+// Returns the index of the consumed token
+static int lex(Parser* p) {
+  int index = peek_index(p);
 
   if (p->cur_token < p->token_buffer->length-1) {
     p->cur_token++;
   }
 
-  return tok;
+  return index;
 }
 
 static bool match(Parser* p, int token_kind, char* message) {
   if (peek(p).kind != token_kind) {
-    error_at_token(p->source, peek(p), message);
+    parse_error(p, peek(p), message);
     return false;
   }
 
@@ -102,7 +144,7 @@ static State basic_state(StateKind kind) {
   };
 }
 
-static State complete(ASTKind kind, Token token, int num_children) {
+static State complete(ASTKind kind, int token, int num_children) {
   return (State) {
     .kind = STATE_COMPLETE,
     .as.complete.kind = kind,
@@ -115,30 +157,90 @@ static void push_state(Parser* p, State state) {
   dynamic_array_put(p->state_stack, state);
 }
 
-static void new_node(Parser* p, ASTKind kind, Token token, int num_children) {
-  AST* node = arena_type(p->node_arena, AST);
+static void emit(Parser* p, PostorderKind kind, uint32_t index) {
+  if (p->postorder) {
+    PostorderItem item = {
+      .kind = kind,
+      .index = index
+    };
 
-  node->kind = kind;
-  node->token = token;
-  node->num_children = num_children;
+    dynamic_array_put(p->postorder, item);
+  }
+}
 
-  node->children = arena_array(p->node_arena, AST*, num_children);
+static void lower(Parser* p, PostorderKind kind, ASTKind node_kind, int token) {
+  if (p->lowering && !lower_visit(p->lowering, kind, node_kind, token)) {
+    p->lowering_failed = true;
+  }
+}
 
-  for_range_rev(int,i, num_children) {
-    node->children[i] = dynamic_array_pop(p->node_stack);
+static void emit_marker(Parser* p, PostorderKind kind, int token) {
+  emit(p, kind, token);
+  lower(p, kind, AST_INVALID, token);
+}
+
+static State marker(PostorderKind kind, int token) {
+  return (State) {
+    .kind = STATE_MARKER,
+    .as.marker.kind = kind,
+    .as.marker.token = token
+  };
+}
+
+static void add_node(Parser* p, ASTKind kind, int token, int num_children, bool visited) {
+  if (p->lowering) {
+    if (visited) {
+      lower(p, POSTORDER_NODE, kind, token);
+    }
+
+    return;
+  }
+
+  ASTNode node = {
+    .kind = kind,
+    .token = token,
+    .first_child = dynamic_array_length(p->children),
+    .num_children = num_children
+  };
+
+  // The children are the top of the node stack, already in order
+  int first = dynamic_array_length(p->node_stack) - num_children;
+
+  for_range(int, i, num_children) {
+    dynamic_array_put(p->children, p->node_stack[first + i]);
+  }
+
+  for_range(int, i, num_children) {
+    (void)dynamic_array_pop(p->node_stack);
   }
 
-  dynamic_array_put(p->node_stack, node); 
+  uint32_t index = dynamic_array_length(p->nodes);
+
+  dynamic_array_put(p->node_stack, index);
+  dynamic_array_put(p->nodes, node);
+
+  if (visited) {
+    emit(p, POSTORDER_NODE, index);
+  }
+}
+
+static void new_node(Parser* p, ASTKind kind, int token, int num_children) {
+  add_node(p, kind, token, num_children, true);
 }
 
-static void new_leaf(Parser* p, ASTKind kind, Token token) {
+static void new_leaf(Parser* p, ASTKind kind, int token) {
   new_node(p, kind, token, 0);
 }
 
+// A leaf that is only read through its parent, so the checker never visits it
+static void new_name_leaf(Parser* p, int token) {
+  add_node(p, AST_IDENTIFIER, token, 0, false);
+}
+
 static bool do_PRIMARY(Parser* p) {
   switch (peek(p).kind) {
     default:
-      error_at_token(p->source, peek(p), "expected an expression");
+      parse_error(p, peek(p), "expected an expression");
       return false;
     case TOKEN_INTEGER_LITERAL:
       new_leaf(p, AST_INT_LITERAL, lex(p));
@@ -152,7 +254,8 @@ static bool do_PRIMARY(Parser* p) {
 static bool do_BINARY(Parser* p) {
   push_state(p, (State) {
     .kind = STATE_BINARY_INFIX,
-    .as.bin_infix.cur_prec = p->state.as.bin.cur_prec
+    .as.bin_infix.cur_prec = p->state.as.bin.cur_prec,
+    .as.bin_infix.op = -1
   });
 
   push_state(p, basic_state(STATE_PRIMARY));
@@ -194,14 +297,14 @@ static ASTKind binary_kind(Token op) {
 }
 
 static bool do_BINARY_INFIX(Parser* p) {
-  Token op = p->state.as.bin_infix.op;
+  int op = p->state.as.bin_infix.op;
 
-  if (op.start) {
-    new_node(p, binary_kind(op), op, 2);
+  if (op != -1) {
+    new_node(p, binary_kind(token_at(p, op)), op, 2);
   }
 
   if (binary_prec(peek(p), false) > p->state.as.bin_infix.cur_prec) {
-    Token next_op = lex(p);
+    int next_op = lex(p);
 
     push_state(p, (State) {
       .kind = STATE_BINARY_INFIX,
@@ -211,7 +314,7 @@ static bool do_BINARY_INFIX(Parser* p) {
 
     push_state(p, (State) {
       .kind = STATE_BINARY,
-      .as.bin.cur_prec = binary_prec(next_op, true)
+      .as.bin.cur_prec = binary_prec(token_at(p, next_op), true)
     });
   }
 
@@ -223,6 +326,11 @@ static bool do_COMPLETE(Parser* p) {
   return true;
 }
 
+static bool do_MARKER(Parser* p) {
+  emit_marker(p, p->state.as.marker.kind, p->state.as.marker.token);
+  return true;
+}
+
 static bool do_EXPR(Parser* p) {
   push_state(p, (State) {
     .kind = STATE_BINARY,
@@ -233,9 +341,11 @@ static bool do_EXPR(Parser* p) {
 }
 
 static bool do_BLOCK(Parser* p) {
-  Token lbrace = peek(p);
+  int lbrace = peek_index(p);
   REQUIRE(p, '{', "expected a block '{'");
 
+  emit_marker(p, POSTORDER_BLOCK_BEGIN, lbrace);
+
   push_state(p, (State){
     .kind = STATE_BLOCK_STMT,
     .as.block_stmt.lbrace = lbrace
@@ -251,7 +361,7 @@ static bool do_BLOCK_STMT(Parser* p) {
       new_node(p, AST_BLOCK, p->state.as.block_stmt.lbrace, p->state.as.block_stmt.num_children);
       return true;
     case TOKEN_EOF:
-      error_at_token(p->source, p->state.as.block_stmt.lbrace, "this brace has no closing brace");
+      parse_error(p, token_at(p, p->state.as.block_stmt.lbrace), "this brace has no closing brace");
       return false;
   }
 
@@ -294,7 +404,7 @@ static bool do_BLOCK_STMT(Parser* p) {
       break;
 
     case TOKEN_KEYWORD_ELSE:
-      error_at_token(p->source, peek(p), "an else statement must follow an if '{}' body");
+      parse_error(p, peek(p), "an else statement must follow an if '{}' body");
       return false;
   }
 
@@ -302,18 +412,21 @@ static bool do_BLOCK_STMT(Parser* p) {
 }
 
 static bool do_WHILE(Parser* p) {
-  Token while_tok = peek(p);
+  int while_tok = peek_index(p);
   REQUIRE(p, TOKEN_KEYWORD_WHILE, "expected a 'while' loop");
 
+  emit_marker(p, POSTORDER_WHILE_BEGIN, while_tok);
+
   push_state(p, complete(AST_WHILE, while_tok, 2));
   push_state(p, basic_state(STATE_BLOCK));
+  push_state(p, marker(POSTORDER_WHILE_BODY, while_tok));
   push_state(p, basic_state(STATE_EXPR));
 
   return true;
 }
 
 static bool do_IF(Parser* p) {
-  Token if_tok = peek(p);
+  int if_tok = peek_index(p);
   REQUIRE(p, TOKEN_KEYWORD_IF, "expected a 'if' statement");
 
   push_state(p, (State){
@@ -322,6 +435,7 @@ static bool do_IF(Parser* p) {
   });
 
   push_state(p, basic_state(STATE_BLOCK));
+  push_state(p, marker(POSTORDER_IF_THEN, if_tok));
   push_state(p, basic_state(STATE_EXPR));
 
   return true;
@@ -329,12 +443,12 @@ static bool do_IF(Parser* p) {
 
 static bool do_ELSE(Parser* p) {
   if (peek(p).kind == TOKEN_KEYWORD_ELSE) {
-    lex(p);
+    emit_marker(p, POSTORDER_IF_ELSE, lex(p));
     push_state(p, complete(AST_IF, p->state.as.els.if_token, 3));
 
     switch (peek(p).kind) {
       default:
-        error_at_token(p->source, peek(p), "only an if statement or a '{}' block can follow an else statement");
+        parse_error(p, peek(p), "only an if statement or a '{}' block can follow an else statement");
         return false;
       case '{':
         push_state(p, basic_state(STATE_BLOCK));
@@ -357,22 +471,22 @@ static bool do_SEMI(Parser* p) {
 }
 
 static bool do_LOCAL(Parser* p) {
-  Token name_tok = peek(p);
+  int name_tok = peek_index(p);
   REQUIRE(p, TOKEN_IDENTIFIER, "expected a local declaration, so expected a name here");
 
-  Token colon_tok = peek(p);
+  int colon_tok = peek_index(p);
   REQUIRE(p, ':', "expected a local declaration, so expected a ':' here");
 
-  Token type_tok = peek(p);
+  int type_tok = peek_index(p);
   REQUIRE(p, TOKEN_IDENTIFIER, "expected a local declaration, so expected a typename here");
 
-  new_leaf(p, AST_IDENTIFIER, name_tok);
-  new_leaf(p, AST_IDENTIFIER, type_tok);
+  new_name_leaf(p, name_tok);
+  new_name_leaf(p, type_tok);
 
   new_node(p, AST_LOCAL, colon_tok, 2);
 
   if (peek(p).kind == '=') {
-    Token equal_tok = lex(p);
+    int equal_tok = lex(p);
     push_state(p, complete(AST_INITIALIZE, equal_tok, 2));
     push_state(p, basic_state(STATE_EXPR));
   }
@@ -381,13 +495,15 @@ static bool do_LOCAL(Parser* p) {
 }
 
 static bool do_FN(Parser* p) {
-  Token fn_tok = peek(p);
+  int fn_tok = peek_index(p);
   REQUIRE(p, TOKEN_KEYWORD_FN, "expected a function");
 
-  Token name_tok = peek(p);
+  int name_tok = peek_index(p);
   REQUIRE(p, TOKEN_IDENTIFIER, "there must be a name after the 'fn' keyword");
 
-  new_leaf(p, AST_IDENTIFIER, name_tok);
+  emit_marker(p, POSTORDER_FN_BEGIN, fn_tok);
+
+  new_name_leaf(p, name_tok);
   push_state(p, complete(AST_FN, fn_tok, 2));
   push_state(p, basic_state(STATE_BLOCK));
 
@@ -396,7 +512,7 @@ static bool do_FN(Parser* p) {
 
 static bool do_TOP_LEVEL(Parser* p) {
   if (peek(p).kind == TOKEN_EOF) {
-    new_node(p, AST_FILE, peek(p), p->state.as.top_level.count);
+    new_node(p, AST_FILE, peek_index(p), p->state.as.top_level.count);
     return true;
   }
 
@@ -407,7 +523,7 @@ static bool do_TOP_LEVEL(Parser* p) {
 
   switch (peek(p).kind) {
     default:
-      error_at_token(p->source, peek(p), "expected a top-level statement; struct, fn, etc...");
+      parse_error(p, peek(p), "expected a top-level statement; struct, fn, etc...");
       return false;
 
     case TOKEN_KEYWORD_FN:
@@ -416,28 +532,28 @@ static bool do_TOP_LEVEL(Parser* p) {
   }
 }
 
-AST* parse(Arena* arena, SourceContents source, TokenizedBuffer* tokens) {
-  Scratch scratch = global_scratch(1, &arena);
-
-  AST* result = NULL;
-
-  Parser p = {
-    .node_arena = arena,
+static Parser new_parser(Allocator* allocator, SourceContents source, TokenizedBuffer* tokens, int flags) {
+  return (Parser) {
     .source = source,
     .token_buffer = tokens,
-    .state_stack = new_dynamic_array(scratch.allocator),
-    .node_stack = new_dynamic_array(scratch.allocator),
+    .state_stack = new_dynamic_array(allocator),
+    .node_stack = new_dynamic_array(allocator),
+    .nodes = new_dynamic_array(allocator),
+    .children = new_dynamic_array(allocator),
+    .postorder = (flags & PARSE_POSTORDER) ? new_dynamic_array(allocator) : NULL
   };
+}
 
-  push_state(&p, basic_state(STATE_TOP_LEVEL));
 
-  while (dynamic_array_length(p.state_stack)) {
-    p.state = dynamic_array_pop(p.state_stack);
+// Runs until the state stack is empty
+static bool run_parser(Parser* p) {
+  while (dynamic_array_length(p->state_stack)) {
+    p->state = dynamic_array_pop(p->state_stack);
 
     bool state_result = false;
     
-    #define X(name, ...) case STATE_##name: state_result = do_##name(&p); break;
-    switch (p.state.kind) {
+    #define X(name, ...) case STATE_##name: state_result = do_##name(p); break;
+    switch (p->state.kind) {
       default:
         assert(false);
         break;
@@ -445,14 +561,305 @@ AST* parse(Arena* arena, SourceContents source, TokenizedBuffer* tokens) {
     }
     #undef X
 
-    if (!state_result) {
+    if (!state_result || p->lowering_failed) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static AST* parse_serial(Arena* arena, SourceContents source, TokenizedBuffer* tokens, int flags) {
+  Scratch scratch = global_scratch(1, &arena);
+
+  AST* result = NULL;
+
+  Parser p = new_parser(scratch.allocator, source, tokens, flags);
+  push_state(&p, basic_state(STATE_TOP_LEVEL));
+
+  if (!run_parser(&p)) {
+    report_error(&p);
+    goto end;
+  }
+
+  result = arena_type(arena, AST);
+  result->tokens = tokens;
+  result->root = dynamic_array_pop(p.node_stack);
+  result->num_nodes = dynamic_array_length(p.nodes);
+  result->nodes = dynamic_array_bake(arena, p.nodes);
+  result->num_children = dynamic_array_length(p.children);
+  result->children = dynamic_array_bake(arena, p.children);
+
+  if (p.postorder) {
+    result->num_postorder = dynamic_array_length(p.postorder);
+    result->postorder = dynamic_array_bake(arena, p.postorder);
+  }
+
+  end:
+  scratch_release(&scratch);
+  return result;
+}
+
+// Lowers each node to SemInsts the moment the parser completes it, instead of
+// building an AST and walking it again. Errors come in source order, so a check
+// error is reported ahead of a parse error in a later function.
+SemFile* parse_and_check(SemContext* context, SourceContents source, TokenizedBuffer* tokens) {
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  SemFile* result = NULL;
+
+  Parser p = {
+    .source = source,
+    .token_buffer = tokens,
+    .state_stack = new_dynamic_array(scratch.allocator),
+    .lowering = new_lowering(scratch.allocator, context, source, tokens)
+  };
+
+  push_state(&p, basic_state(STATE_TOP_LEVEL));
+
+  if (!run_parser(&p)) {
+    report_error(&p);
+    goto end;
+  }
+
+  result = lowering_finish(p.lowering);
+
+  end:
+  scratch_release(&scratch);
+  return result;
+}
+
+// Files with fewer tokens than this are not worth the cost of starting threads
+#define PARALLEL_PARSE_THRESHOLD (256 * 1024)
+
+AST* parse(Arena* arena, SourceContents source, TokenizedBuffer* tokens, int flags) {
+  if (tokens->length >= PARALLEL_PARSE_THRESHOLD) {
+    return parse_parallel(arena, source, tokens, flags, hardware_thread_count());
+  }
+
+  return parse_serial(arena, source, tokens, flags);
+}
+
+// Finds the first token of every top-level function by brace matching. Fails
+// if the file is anything but a list of 'fn name { ... }', in which case the
+// serial parser is left to report the problem.
+bool find_functions(TokenizedBuffer* tokens, DynamicArray(int)* fn_starts) {
+  Token* t = tokens->tokens;
+  int i = 0;
+
+  while (t[i].kind != TOKEN_EOF) {
+    if (t[i].kind != TOKEN_KEYWORD_FN || t[i+1].kind != TOKEN_IDENTIFIER || t[i+2].kind != '{') {
+      return false;
+    }
+
+    dynamic_array_put(*fn_starts, i);
+
+    int depth = 1;
+    i += 3;
+
+    while (depth) {
+      switch (t[i++].kind) {
+        case '{':
+          depth++;
+          break;
+        case '}':
+          depth--;
+          break;
+        case TOKEN_EOF:
+          return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// A contiguous run of functions parsed by one worker into its own arena
+typedef struct {
+  int first_fn;
+  int num_fns;
+
+  Arena* arena;
+  Parser parser;
+  bool success;
+
+  int first_node;
+  int first_child;
+  int first_postorder;
+} ParseBatch;
+
+typedef struct {
+  SourceContents source;
+  TokenizedBuffer* tokens;
+  int flags;
+
+  int* fn_starts;
+  ParseBatch* batches;
+
+  AST* ast;
+} ParallelParse;
+
+static void parse_batch(void* data, int index) {
+  ParallelParse* pp = data;
+  ParseBatch* batch = &pp->batches[index];
+
+  batch->arena = new_arena();
+  batch->parser = new_parser(new_allocator(batch->arena), pp->source, pp->tokens, pp->flags);
+  batch->success = true;
+
+  Parser* p = &batch->parser;
+
+  for_range(int, i, batch->num_fns) {
+    p->cur_token = pp->fn_starts[batch->first_fn + i];
+    push_state(p, basic_state(STATE_FN));
+
+    // Brace matching guarantees the function ends where the prescan said, or
+    // fails before it, so nothing here depends on the functions around it
+    if (!run_parser(p)) {
+      batch->success = false;
+      return;
+    }
+  }
+}
+
+static void gather_batch(void* data, int index) {
+  ParallelParse* pp = data;
+  ParseBatch* batch = &pp->batches[index];
+  Parser* p = &batch->parser;
+  AST* ast = pp->ast;
+
+  ASTNode* nodes = ast->nodes + batch->first_node;
+
+  for_range(int, i, dynamic_array_length(p->nodes)) {
+    nodes[i] = p->nodes[i];
+    nodes[i].first_child += batch->first_child;
+  }
+
+  uint32_t* children = ast->children + batch->first_child;
+
+  for_range(int, i, dynamic_array_length(p->children)) {
+    children[i] = p->children[i] + batch->first_node;
+  }
+
+  // The function roots are the children of the file node, at the very end
+  uint32_t* roots = ast->children + ast->nodes[ast->root].first_child + batch->first_fn;
+
+  for_range(int, i, batch->num_fns) {
+    roots[i] = p->node_stack[i] + batch->first_node;
+  }
+
+  if (p->postorder) {
+    PostorderItem* postorder = ast->postorder + batch->first_postorder;
+
+    for_range(int, i, dynamic_array_length(p->postorder)) {
+      postorder[i] = p->postorder[i];
+
+      if (postorder[i].kind == POSTORDER_NODE) {
+        postorder[i].index += batch->first_node;
+      }
+    }
+  }
+}
+
+// Top-level functions do not depend on each other, so after a prescan that
+// finds where each one starts they are parsed in batches across threads and
+// stitched back together. The result is identical to the serial parse, errors
+// included since the first batch to fail holds the first error in the file.
+AST* parse_parallel(Arena* arena, SourceContents source, TokenizedBuffer* tokens, int flags, int num_threads) {
+  if (num_threads <= 1) {
+    return parse_serial(arena, source, tokens, flags);
+  }
+
+  Scratch scratch = global_scratch(1, &arena);
+
+  AST* result = NULL;
+  ParseBatch* batches = NULL;
+  int num_batches = 0;
+
+  DynamicArray(int) fn_starts = new_dynamic_array(scratch.allocator);
+
+  if (!find_functions(tokens, &fn_starts)) {
+    result = parse_serial(arena, source, tokens, flags);
+    goto end;
+  }
+
+  int num_fns = dynamic_array_length(fn_starts);
+
+  num_batches = count_batches(num_fns, num_threads);
+  batches = arena_array(scratch.arena, ParseBatch, num_batches);
+
+  for_range(int, i, num_batches) {
+    batch_range(num_fns, num_batches, i, &batches[i].first_fn, &batches[i].num_fns);
+  }
+
+  ParallelParse pp = {
+    .source = source,
+    .tokens = tokens,
+    .flags = flags,
+    .fn_starts = fn_starts,
+    .batches = batches
+  };
+
+  parallel_for(num_threads, num_batches, parse_batch, &pp);
+
+  for_range(int, i, num_batches) {
+    if (!batches[i].success) {
+      report_error(&batches[i].parser);
       goto end;
     }
   }
 
-  result = dynamic_array_pop(p.node_stack);
+  int num_nodes = 0;
+  int num_children = 0;
+  int num_postorder = 0;
+
+  for_range(int, i, num_batches) {
+    Parser* p = &batches[i].parser;
+
+    batches[i].first_node = num_nodes;
+    batches[i].first_child = num_children;
+    batches[i].first_postorder = num_postorder;
+
+    num_nodes += dynamic_array_length(p->nodes);
+    num_children += dynamic_array_length(p->children);
+    num_postorder += p->postorder ? dynamic_array_length(p->postorder) : 0;
+  }
+
+  result = arena_type(arena, AST);
+  result->tokens = tokens;
+  result->root = num_nodes;
+  result->num_nodes = num_nodes + 1;
+  result->nodes = arena_array(arena, ASTNode, result->num_nodes);
+  result->num_children = num_children + num_fns;
+  result->children = arena_array(arena, uint32_t, result->num_children);
+
+  result->nodes[result->root] = (ASTNode) {
+    .kind = AST_FILE,
+    .token = tokens->length - 1,
+    .first_child = num_children,
+    .num_children = num_fns
+  };
+
+  if (flags & PARSE_POSTORDER) {
+    result->num_postorder = num_postorder + 1;
+    result->postorder = arena_array(arena, PostorderItem, result->num_postorder);
+
+    result->postorder[num_postorder] = (PostorderItem) {
+      .kind = POSTORDER_NODE,
+      .index = result->root
+    };
+  }
+
+  pp.ast = result;
+  parallel_for(num_threads, num_batches, gather_batch, &pp);
 
   end:
+  for_range(int, i, num_batches) {
+    if (batches[i].arena) {
+      free_arena(batches[i].arena);
+    }
+  }
+
   scratch_release(&scratch);
   return result;
-}
\ No newline at end of file
+}
@@ -33,24 +33,101 @@ static int isident(int c) {
   return c == '_' || isalnum(c);
 }
 
-TokenizedBuffer tokenize(Arena* arena, SourceContents source) {
-  Scratch scratch = global_scratch(1, &arena);
+// The input has already been validated as UTF-8, so non-ASCII characters can
+// be decoded without checks. ASCII identifiers never leave the first loop.
+static char* identifier_end(char* cur_char) {
+  while (true) {
+    while (isident((uint8_t)*cur_char)) {
+      ++cur_char;
+    }
+
+    if ((uint8_t)*cur_char < 0x80) {
+      return cur_char;
+    }
 
-  DynamicArray(Token) tokens = new_dynamic_array(scratch.allocator);
+    uint32_t codepoint;
+    int length = utf8_decode(cur_char, &codepoint);
+
+    if (!is_xid_continue(codepoint)) {
+      return cur_char;
+    }
+
+    cur_char += length;
+  }
+}
 
-  char* cur_char = source.contents;
-  int cur_line = 1;
+// Parses eight ascii digits at once, most significant digit first. Each step
+// combines adjacent lanes, pairs of digits, then pairs of pairs, then pairs of
+// those, with one multiply. Relies on a little-endian load.
+static uint64_t parse_eight_digits(char* digits) {
+  uint64_t value;
+  memcpy(&value, digits, sizeof(value));
+
+  value = (value & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+  value = (value & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+  return (value & 0x0000FFFF0000FFFF) * 42949672960001 >> 32;
+}
+
+// Returns false if the literal does not fit in 64 bits
+static bool decode_integer(char* digits, int length, uint64_t* out) {
+  while (length > 1 && digits[0] == '0') {
+    digits++;
+    length--;
+  }
+
+  char max_digits[] = "18446744073709551615";
+  int max_length = (int)LENGTH(max_digits) - 1;
+
+  if (length > max_length || (length == max_length && memcmp(digits, max_digits, max_length) > 0)) {
+    return false;
+  }
+
+  // At most 20 digits, so the value cannot overflow until the last digits
+  uint64_t value = 0;
+  int i = 0;
+
+  for (; i + 8 <= length; i += 8) {
+    value = value * 100000000 + parse_eight_digits(digits + i);
+  }
+
+  for (; i < length; ++i) {
+    value = value * 10 + (digits[i] - '0');
+  }
+
+  *out = value;
+  return true;
+}
+
+typedef struct {
+  DynamicArray(Token) tokens;
+  DynamicArray(uint64_t) literals;
+  DynamicArray(int) overflows; // Indices of integer literal tokens that do not fit in 64 bits
+} TokenizeOutput;
+
+static TokenizeOutput new_tokenize_output(Allocator* allocator) {
+  return (TokenizeOutput) {
+    .tokens = new_dynamic_array(allocator),
+    .literals = new_dynamic_array(allocator),
+    .overflows = new_dynamic_array(allocator)
+  };
+}
+
+// Tokenizes [cur_char, end). end must be the start of a line or the end of the
+// source, so that no token or comment crosses it. Returns the number of
+// newlines consumed, lines of the tokens are offset from first_line.
+static int tokenize_range(TokenizeOutput* out, char* cur_char, char* end, int first_line) {
+  int cur_line = first_line;
 
   while (true) {
     while (true) {
-      while (isspace(*cur_char)) {
+      while (cur_char < end && isspace((uint8_t)*cur_char)) {
         if (*cur_char == '\n') {
           ++cur_line;
         }
         ++cur_char;
       }
 
-      if (cur_char[0] == '/' && cur_char[1] == '/') {
+      if (cur_char < end && cur_char[0] == '/' && cur_char[1] == '/') {
         while (*cur_char != '\0' && *cur_char != '\n') {
           ++cur_char;
         }
@@ -60,55 +137,342 @@ TokenizedBuffer tokenize(Arena* arena, SourceContents source) {
       }
     }
 
-    if (*cur_char == '\0') {
+    if (cur_char >= end || *cur_char == '\0') {
       break;
     }
 
     char* start = cur_char++;
-    int kind = *start;
+    int kind = (uint8_t)*start;
     int line = cur_line;
+    int literal = 0;
 
     switch (*start) {
       default:
-        if (isdigit(*start)) {
-          while (isdigit(*cur_char)) {
+        if (isdigit(kind)) {
+          while (isdigit((uint8_t)*cur_char)) {
             ++cur_char;
           }
           kind = TOKEN_INTEGER_LITERAL;
-        }
-        else if (isident(*start)) {
-          while (isident(*cur_char)) {
-            ++cur_char;
+
+          uint64_t value = 0;
+
+          if (!decode_integer(start, (int)(cur_char - start), &value)) {
+            dynamic_array_put(out->overflows, dynamic_array_length(out->tokens));
           }
+
+          literal = dynamic_array_length(out->literals);
+          dynamic_array_put(out->literals, value);
+        }
+        else if (isident(kind)) {
+          cur_char = identifier_end(cur_char);
           kind = identifier_kind(start, cur_char);
         }
+        else if (kind >= 0x80) {
+          uint32_t codepoint;
+          cur_char = start + utf8_decode(start, &codepoint);
+
+          if (is_xid_start(codepoint)) {
+            cur_char = identifier_end(cur_char);
+            kind = TOKEN_IDENTIFIER;
+          }
+        }
         break;
     }
 
     Token token = {
       .kind = kind,
-      .line = line,
       .length = (int)(cur_char - start),
+      .line = line,
+      .literal = literal,
       .start = start
     };
 
-    dynamic_array_put(tokens, token);
+    dynamic_array_put(out->tokens, token);
   }
 
-  Token eof_token = {
+  return cur_line - first_line;
+}
+
+static Token eof_token(SourceContents source, int line) {
+  return (Token) {
     .kind = TOKEN_EOF,
-    .line = cur_line,
+    .line = line,
     .length = 0,
-    .start = cur_char
+    .start = source.contents + source.length
+  };
+}
+
+static void report_overflow(SourceContents source, Token token) {
+  error_at_token(source, token, "this integer literal does not fit in 64 bits");
+}
+
+static void report_invalid_utf8(SourceContents source, int offset) {
+  int line = 1;
+
+  for_range(int, i, offset) {
+    if (source.contents[i] == '\n') {
+      ++line;
+    }
+  }
+
+  Token token = {
+    .length = 1,
+    .line = line,
+    .start = source.contents + offset
+  };
+
+  error_at_token(source, token, "invalid UTF-8");
+}
+
+static TokenizedBuffer* tokenize_serial(Arena* arena, SourceContents source) {
+  int invalid_utf8 = utf8_validate(source.contents, source.length);
+
+  if (invalid_utf8 != -1) {
+    report_invalid_utf8(source, invalid_utf8);
+    return NULL;
+  }
+
+  Scratch scratch = global_scratch(1, &arena);
+
+  TokenizedBuffer* result = NULL;
+  TokenizeOutput out = new_tokenize_output(scratch.allocator);
+
+  int num_lines = tokenize_range(&out, source.contents, source.contents + source.length, 1);
+  dynamic_array_put(out.tokens, eof_token(source, 1 + num_lines));
+
+  for_range(int, i, dynamic_array_length(out.overflows)) {
+    report_overflow(source, out.tokens[out.overflows[i]]);
+  }
+
+  if (dynamic_array_length(out.overflows)) {
+    goto end;
+  }
+
+  result = arena_type(arena, TokenizedBuffer);
+  result->length = dynamic_array_length(out.tokens);
+  result->tokens = dynamic_array_bake(arena, out.tokens);
+  result->num_literals = dynamic_array_length(out.literals);
+  result->literals = dynamic_array_bake(arena, out.literals);
+
+  end:
+  scratch_release(&scratch);
+  return result;
+}
+
+// Tokenizes source.contents[start, end) on its own, for re-lexing part of an
+// edited file. Both ends must fall between tokens, with no comment running
+// past the end. Returns NULL without reporting anything if the range holds
+// invalid UTF-8 or an overflowing literal; tokenize on the whole file reports
+// those properly.
+TokenizedBuffer* tokenize_region(Arena* arena, SourceContents source, int start, int end, int first_line) {
+  if (utf8_validate(source.contents + start, end - start) != -1) {
+    return NULL;
+  }
+
+  Scratch scratch = global_scratch(1, &arena);
+
+  TokenizedBuffer* result = NULL;
+  TokenizeOutput out = new_tokenize_output(scratch.allocator);
+
+  int num_lines = tokenize_range(&out, source.contents + start, source.contents + end, first_line);
+
+  if (dynamic_array_length(out.overflows)) {
+    goto end;
+  }
+
+  Token eof = {
+    .kind = TOKEN_EOF,
+    .line = first_line + num_lines,
+    .start = source.contents + end
   };
 
-  dynamic_array_put(tokens, eof_token);
+  dynamic_array_put(out.tokens, eof);
 
-  TokenizedBuffer result;
-  result.length = dynamic_array_length(tokens);
-  result.tokens = dynamic_array_bake(arena, tokens);
+  result = arena_type(arena, TokenizedBuffer);
+  result->length = dynamic_array_length(out.tokens);
+  result->tokens = dynamic_array_bake(arena, out.tokens);
+  result->num_literals = dynamic_array_length(out.literals);
+  result->literals = dynamic_array_bake(arena, out.literals);
 
+  end:
   scratch_release(&scratch);
+  return result;
+}
+
+// Files smaller than this are not worth the cost of starting threads
+#define PARALLEL_TOKENIZE_THRESHOLD (1024 * 1024)
+
+TokenizedBuffer* tokenize(Arena* arena, SourceContents source) {
+  if (source.length >= PARALLEL_TOKENIZE_THRESHOLD) {
+    return tokenize_parallel(arena, source, hardware_thread_count());
+  }
+
+  return tokenize_serial(arena, source);
+}
+
+typedef struct {
+  char* start;
+  char* end;
+
+  int invalid_utf8; // Offset into the source, or -1
+
+  Arena* arena;
+  TokenizeOutput out;
+  int num_lines;
+
+  int first_token;
+  int first_literal;
+  int first_line;
+} TokenizeChunk;
+
+typedef struct {
+  SourceContents source;
+  char* tokens_end; // The first NUL, where tokenizing the whole file would stop
+  TokenizeChunk* chunks;
+  Token* tokens;
+  uint64_t* literals;
+} ParallelTokenize;
+
+static void tokenize_chunk(void* data, int index) {
+  ParallelTokenize* pt = data;
+  TokenizeChunk* chunk = &pt->chunks[index];
+
+  // Chunks are split after a newline, which is never part of a multi-byte sequence
+  chunk->invalid_utf8 = utf8_validate(chunk->start, (int)(chunk->end - chunk->start));
+
+  if (chunk->invalid_utf8 != -1) {
+    chunk->invalid_utf8 += (int)(chunk->start - pt->source.contents);
+    return;
+  }
+
+  char* end = chunk->end < pt->tokens_end ? chunk->end : pt->tokens_end;
+
+  chunk->arena = new_arena();
+  chunk->out = new_tokenize_output(new_allocator(chunk->arena));
+  chunk->num_lines = tokenize_range(&chunk->out, chunk->start, end > chunk->start ? end : chunk->start, 0);
+}
+
+static void gather_chunk(void* data, int index) {
+  ParallelTokenize* pt = data;
+  TokenizeChunk* chunk = &pt->chunks[index];
+
+  Token* out = pt->tokens + chunk->first_token;
+
+  for_range(int, i, dynamic_array_length(chunk->out.tokens)) {
+    out[i] = chunk->out.tokens[i];
+    out[i].line += chunk->first_line;
+
+    if (out[i].kind == TOKEN_INTEGER_LITERAL) {
+      out[i].literal += chunk->first_literal;
+    }
+  }
+
+  memcpy(pt->literals + chunk->first_literal, chunk->out.literals, dynamic_array_length(chunk->out.literals) * sizeof(uint64_t));
+}
+
+// Kale has no tokens that span lines, and comments end at a newline, so a file
+// can be tokenized as independent chunks split after newlines, with the line
+// numbers fixed up once the chunk sizes are known.
+TokenizedBuffer* tokenize_parallel(Arena* arena, SourceContents source, int num_threads) {
+  if (num_threads <= 1) {
+    return tokenize_serial(arena, source);
+  }
+
+  Scratch scratch = global_scratch(1, &arena);
 
+  TokenizedBuffer* result = NULL;
+  char* source_end = source.contents + source.length;
+
+  int num_chunks = num_threads;
+  TokenizeChunk* chunks = arena_array(scratch.arena, TokenizeChunk, num_chunks);
+
+  char* split = source.contents;
+
+  for_range(int, i, num_chunks) {
+    chunks[i].start = split;
+
+    if (i == num_chunks-1) {
+      split = source_end;
+    }
+    else {
+      char* target = source.contents + (int64_t)source.length * (i+1) / num_chunks;
+
+      if (target < split) {
+        target = split;
+      }
+
+      char* newline = memchr(target, '\n', source_end - target);
+      split = newline ? newline + 1 : source_end;
+    }
+
+    chunks[i].end = split;
+  }
+
+  // The serial tokenizer stops at a NUL, so chunks past one have no tokens,
+  // though all of the file is still checked for invalid UTF-8
+  char* nul = memchr(source.contents, '\0', source.length);
+
+  ParallelTokenize pt = {
+    .source = source,
+    .tokens_end = nul ? nul : source_end,
+    .chunks = chunks
+  };
+
+  parallel_for(num_threads, num_chunks, tokenize_chunk, &pt);
+
+  for_range(int, i, num_chunks) {
+    if (chunks[i].invalid_utf8 != -1) {
+      report_invalid_utf8(source, chunks[i].invalid_utf8);
+      goto end;
+    }
+  }
+
+  int num_tokens = 0;
+  int num_literals = 0;
+  int line = 1;
+
+  for_range(int, i, num_chunks) {
+    chunks[i].first_token = num_tokens;
+    chunks[i].first_literal = num_literals;
+    chunks[i].first_line = line;
+
+    num_tokens += dynamic_array_length(chunks[i].out.tokens);
+    num_literals += dynamic_array_length(chunks[i].out.literals);
+    line += chunks[i].num_lines;
+  }
+
+  pt.tokens = arena_push(arena, (num_tokens + 1) * sizeof(Token));
+  pt.literals = arena_push(arena, num_literals * sizeof(uint64_t));
+  parallel_for(num_threads, num_chunks, gather_chunk, &pt);
+
+  pt.tokens[num_tokens] = eof_token(source, line);
+
+  bool overflowed = false;
+
+  for_range(int, i, num_chunks) {
+    TokenizeChunk* chunk = &chunks[i];
+
+    for_range(int, j, dynamic_array_length(chunk->out.overflows)) {
+      report_overflow(source, pt.tokens[chunk->first_token + chunk->out.overflows[j]]);
+      overflowed = true;
+    }
+  }
+
+  if (!overflowed) {
+    result = arena_type(arena, TokenizedBuffer);
+    result->length = num_tokens + 1;
+    result->tokens = pt.tokens;
+    result->num_literals = num_literals;
+    result->literals = pt.literals;
+  }
+
+  end:
+  for_range(int, i, num_chunks) {
+    if (chunks[i].arena) {
+      free_arena(chunks[i].arena);
+    }
+  }
+
+  scratch_release(&scratch);
   return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,372 @@
+#include "frontend.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+  #define UTF8_SIMD
+  #include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+  #define TARGET(features)
+#else
+  #define TARGET(features) __attribute__((target(features)))
+#endif
+
+// Length of the valid UTF-8 sequence at data, or 0 if it is not valid
+static int sequence_length(uint8_t* data, uint8_t* end) {
+  uint8_t lead = data[0];
+
+  if (lead < 0x80) {
+    return 1;
+  }
+
+  int length;
+  uint32_t codepoint;
+  uint32_t minimum;
+
+  if ((lead & 0xE0) == 0xC0) {
+    length = 2;
+    codepoint = lead & 0x1F;
+    minimum = 0x80;
+  }
+  else if ((lead & 0xF0) == 0xE0) {
+    length = 3;
+    codepoint = lead & 0x0F;
+    minimum = 0x800;
+  }
+  else if ((lead & 0xF8) == 0xF0) {
+    length = 4;
+    codepoint = lead & 0x07;
+    minimum = 0x10000;
+  }
+  else {
+    return 0;
+  }
+
+  if (end - data < length) {
+    return 0;
+  }
+
+  for (int i = 1; i < length; ++i) {
+    if ((data[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+
+    codepoint = (codepoint << 6) | (data[i] & 0x3F);
+  }
+
+  if (codepoint < minimum || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+    return 0;
+  }
+
+  return length;
+}
+
+static int validate_scalar(uint8_t* data, int length) {
+  int i = 0;
+
+  while (i < length) {
+    if (data[i] < 0x80) {
+      ++i;
+      continue;
+    }
+
+    int n = sequence_length(data + i, data + length);
+
+    if (!n) {
+      return i;
+    }
+
+    i += n;
+  }
+
+  return -1;
+}
+
+#ifdef UTF8_SIMD
+
+// Lookup table validation from Keiser & Lemire, "Validating UTF-8 In Less Than
+// One Instruction Per Byte". Every error is a property of two adjacent bytes,
+// so three 16-entry tables indexed by the high and low nibble of the previous
+// byte, and the high nibble of the current byte, each give the set of errors
+// that nibble allows. Their intersection is non-zero only where there is an
+// error. The remaining case, a missing 2nd or 3rd continuation byte, is
+// caught by checking which bytes must be continuations from the bytes 2 and 3
+// back.
+
+#define TOO_SHORT ((char)(1 << 0)) // 11______ 0_______, or 11______ 11______
+#define TOO_LONG ((char)(1 << 1)) // 0_______ 10______
+#define OVERLONG_3 ((char)(1 << 2)) // 11100000 100_____
+#define TOO_LARGE ((char)(1 << 3)) // 11110100 1001____, or 11110100 101_____, etc
+#define SURROGATE ((char)(1 << 4)) // 11101101 101_____
+#define OVERLONG_2 ((char)(1 << 5)) // 1100000_ 10______
+#define TOO_LARGE_1000 ((char)(1 << 6)) // 11110101 1000____, etc
+#define OVERLONG_4 ((char)(1 << 6)) // 11110000 1000____
+#define TWO_CONTS ((char)(1 << 7)) // 10______ 10______
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define BYTE_1_HIGH_TABLE \
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+  TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+  TOO_SHORT | OVERLONG_2, \
+  TOO_SHORT, \
+  TOO_SHORT | OVERLONG_3 | SURROGATE, \
+  TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define BYTE_1_LOW_TABLE \
+  CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+  CARRY | OVERLONG_2, \
+  CARRY, \
+  CARRY, \
+  CARRY | TOO_LARGE, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000, \
+  CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define BYTE_2_HIGH_TABLE \
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+  TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+// A block ending in one of these lead bytes needs continuation bytes from the next block
+#define INCOMPLETE_TAIL (char)(0xF0-1), (char)(0xE0-1), (char)(0xC0-1)
+
+typedef struct {
+  __m128i error;
+  __m128i prev_input;
+  __m128i prev_incomplete;
+} SSEValidator;
+
+TARGET("sse4.1")
+static void sse_validate_block(SSEValidator* v, __m128i input) {
+  if (_mm_movemask_epi8(input) == 0) {
+    v->error = _mm_or_si128(v->error, v->prev_incomplete);
+    v->prev_incomplete = _mm_setzero_si128();
+    v->prev_input = input;
+    return;
+  }
+
+  __m128i nibble_mask = _mm_set1_epi8(0x0F);
+
+  __m128i prev1 = _mm_alignr_epi8(input, v->prev_input, 15);
+  __m128i prev2 = _mm_alignr_epi8(input, v->prev_input, 14);
+  __m128i prev3 = _mm_alignr_epi8(input, v->prev_input, 13);
+
+  __m128i byte_1_high = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_1_HIGH_TABLE), _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble_mask));
+  __m128i byte_1_low = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_1_LOW_TABLE), _mm_and_si128(prev1, nibble_mask));
+  __m128i byte_2_high = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_2_HIGH_TABLE), _mm_and_si128(_mm_srli_epi16(input, 4), nibble_mask));
+
+  __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+  __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0-0x80)));
+  __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0-0x80)));
+  __m128i must_be_continuation = _mm_and_si128(_mm_or_si128(is_third, is_fourth), _mm_set1_epi8((char)0x80));
+
+  v->error = _mm_or_si128(v->error, _mm_xor_si128(must_be_continuation, special));
+
+  __m128i max_tail = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, INCOMPLETE_TAIL);
+  v->prev_incomplete = _mm_subs_epu8(input, max_tail);
+  v->prev_input = input;
+}
+
+TARGET("sse4.1")
+static bool validate_sse41(uint8_t* data, int length) {
+  SSEValidator v = {
+    .error = _mm_setzero_si128(),
+    .prev_input = _mm_setzero_si128(),
+    .prev_incomplete = _mm_setzero_si128()
+  };
+
+  int i = 0;
+
+  for (; i + 16 <= length; i += 16) {
+    sse_validate_block(&v, _mm_loadu_si128((__m128i*)(data + i)));
+  }
+
+  if (i < length) {
+    uint8_t tail[16] = {0};
+    memcpy(tail, data + i, length - i);
+    sse_validate_block(&v, _mm_loadu_si128((__m128i*)tail));
+  }
+
+  __m128i error = _mm_or_si128(v.error, v.prev_incomplete);
+  return _mm_testz_si128(error, error);
+}
+
+typedef struct {
+  __m256i error;
+  __m256i prev_input;
+  __m256i prev_incomplete;
+} AVXValidator;
+
+// The byte shuffles only work within 128-bit lanes, so the previous bytes for
+// the low lane come from the high lane of the previous block
+#define AVX_PREV(input, prev_input, n) _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16-(n))
+
+TARGET("avx2")
+static void avx_validate_block(AVXValidator* v, __m256i input) {
+  if (_mm256_movemask_epi8(input) == 0) {
+    v->error = _mm256_or_si256(v->error, v->prev_incomplete);
+    v->prev_incomplete = _mm256_setzero_si256();
+    v->prev_input = input;
+    return;
+  }
+
+  __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+
+  __m256i prev1 = AVX_PREV(input, v->prev_input, 1);
+  __m256i prev2 = AVX_PREV(input, v->prev_input, 2);
+  __m256i prev3 = AVX_PREV(input, v->prev_input, 3);
+
+  __m256i byte_1_high = _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_1_HIGH_TABLE, BYTE_1_HIGH_TABLE), _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble_mask));
+  __m256i byte_1_low = _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_1_LOW_TABLE, BYTE_1_LOW_TABLE), _mm256_and_si256(prev1, nibble_mask));
+  __m256i byte_2_high = _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_2_HIGH_TABLE, BYTE_2_HIGH_TABLE), _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble_mask));
+
+  __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+  __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0-0x80)));
+  __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0-0x80)));
+  __m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8((char)0x80));
+
+  v->error = _mm256_or_si256(v->error, _mm256_xor_si256(must_be_continuation, special));
+
+  __m256i max_tail = _mm256_setr_epi8(
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, INCOMPLETE_TAIL
+  );
+
+  v->prev_incomplete = _mm256_subs_epu8(input, max_tail);
+  v->prev_input = input;
+}
+
+TARGET("avx2")
+static bool validate_avx2(uint8_t* data, int length) {
+  AVXValidator v = {
+    .error = _mm256_setzero_si256(),
+    .prev_input = _mm256_setzero_si256(),
+    .prev_incomplete = _mm256_setzero_si256()
+  };
+
+  int i = 0;
+
+  for (; i + 32 <= length; i += 32) {
+    avx_validate_block(&v, _mm256_loadu_si256((__m256i*)(data + i)));
+  }
+
+  if (i < length) {
+    uint8_t tail[32] = {0};
+    memcpy(tail, data + i, length - i);
+    avx_validate_block(&v, _mm256_loadu_si256((__m256i*)tail));
+  }
+
+  __m256i error = _mm256_or_si256(v.error, v.prev_incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+#endif
+
+int utf8_validate_with(char* data, int length, int features) {
+  uint8_t* bytes = (uint8_t*)data;
+
+  #ifdef UTF8_SIMD
+  bool valid;
+
+  if (features & CPU_FEATURE_AVX2) {
+    valid = validate_avx2(bytes, length);
+  }
+  else if (features & CPU_FEATURE_SSE41) {
+    valid = validate_sse41(bytes, length);
+  }
+  else {
+    return validate_scalar(bytes, length);
+  }
+
+  // The vector validators only say whether there is an error, so find it again
+  return valid ? -1 : validate_scalar(bytes, length);
+  #else
+  (void)features;
+  return validate_scalar(bytes, length);
+  #endif
+}
+
+int utf8_validate(char* data, int length) {
+  return utf8_validate_with(data, length, cpu_features());
+}
+
+int utf8_decode(char* data, uint32_t* codepoint) {
+  uint8_t* s = (uint8_t*)data;
+
+  if (s[0] < 0x80) {
+    *codepoint = s[0];
+    return 1;
+  }
+
+  if (s[0] < 0xE0) {
+    *codepoint = ((s[0] & 0x1F) << 6) | (s[1] & 0x3F);
+    return 2;
+  }
+
+  if (s[0] < 0xF0) {
+    *codepoint = ((s[0] & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+    return 3;
+  }
+
+  *codepoint = ((s[0] & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+  return 4;
+}
+
+typedef struct {
+  uint32_t first;
+  uint32_t last;
+} CodepointRange;
+
+#define X(first, last) { first, last },
+static CodepointRange xid_start_ranges[] = {
+  #include "xid_start.def"
+};
+
+static CodepointRange xid_continue_ranges[] = {
+  #include "xid_continue.def"
+};
+#undef X
+
+static bool in_ranges(CodepointRange* ranges, int count, uint32_t codepoint) {
+  int lo = 0;
+  int hi = count-1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+
+    if (codepoint < ranges[mid].first) {
+      hi = mid-1;
+    }
+    else if (codepoint > ranges[mid].last) {
+      lo = mid+1;
+    }
+    else {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool is_xid_start(uint32_t codepoint) {
+  return in_ranges(xid_start_ranges, (int)LENGTH(xid_start_ranges), codepoint);
+}
+
+bool is_xid_continue(uint32_t codepoint) {
+  return in_ranges(xid_continue_ranges, (int)LENGTH(xid_continue_ranges), codepoint);
+}
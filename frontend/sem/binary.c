@@ -0,0 +1,597 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "frontend.h"
+
+// Writes a function's arrays one after another as they are laid out, then the
+// function table, then goes back for the header. Functions are streamed out
+// one at a time, so a file is never held in memory whole.
+
+typedef struct {
+  FILE* file;
+  uint64_t offset;
+  bool failed;
+} Writer;
+
+// Returns where the data went, and pads so the next write starts aligned
+static uint64_t put(Writer* w, void* data, uint64_t size) {
+  static uint8_t zeros[8];
+  uint64_t offset = w->offset;
+
+  if (size) {
+    w->failed |= fwrite(data, 1, size, w->file) != size;
+  }
+
+  uint64_t padding = (8 - size % 8) % 8;
+  w->failed |= fwrite(zeros, 1, padding, w->file) != padding;
+
+  w->offset += size + padding;
+  return offset;
+}
+
+// Operands are relinked into fresh use lists as they are written, in code
+// order, so the file has no replaced values and no slots of dropped operands
+static SemBinaryFunc write_func(Writer* w, SemFunc* func) {
+  Scratch scratch = global_scratch(0, NULL);
+
+  int num_insts = dynamic_array_length(func->insts);
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  uint64_t* placed = arena_array(scratch.arena, uint64_t, bitset_num_u64(num_insts));
+  uint32_t num_block_insts = 0;
+  uint32_t num_preds = 0;
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_insts) {
+      bitset_set(placed, block->insts[i]);
+    }
+
+    num_block_insts += block->num_insts;
+    num_preds += block->num_preds;
+  }
+
+  SemInst* insts = arena_push(scratch.arena, num_insts * sizeof(SemInst));
+  uint32_t* first_use = arena_array(scratch.arena, uint32_t, num_insts);
+  DynamicArray(SemUse) uses = new_dynamic_array(scratch.allocator);
+
+  SemUse no_use = {0};
+  dynamic_array_put(uses, no_use);
+
+  insts[0] = func->insts[0];
+
+  for (int n = 1; n < num_insts; ++n) {
+    SemInst inst = func->insts[n];
+
+    if (!bitset_query(placed, n)) {
+      inst.num_ins = 0;
+      inst.block = 0;
+    }
+
+    inst.ins = inst.num_ins ? dynamic_array_length(uses) : 0;
+
+    for_range(int, j, inst.num_ins) {
+      uint32_t value = sem_operand(func, n, j);
+      uint32_t use = dynamic_array_length(uses);
+
+      SemUse u = {
+        .value = value,
+        .user = n,
+        .prev = use,
+        .next = use
+      };
+
+      if (value && first_use[value]) {
+        uint32_t head = first_use[value];
+        uint32_t tail = uses[head].prev;
+
+        u.prev = tail;
+        u.next = head;
+        uses[tail].next = use;
+        uses[head].prev = use;
+      }
+      else if (value) {
+        first_use[value] = use;
+      }
+
+      dynamic_array_put(uses, u);
+    }
+
+    insts[n] = inst;
+  }
+
+  SemBinaryBlock* blocks = arena_array(scratch.arena, SemBinaryBlock, num_blocks);
+  uint32_t* block_insts = arena_push(scratch.arena, num_block_insts * sizeof(uint32_t));
+  uint32_t* preds = arena_push(scratch.arena, num_preds * sizeof(uint32_t));
+
+  uint32_t next_inst = 0;
+  uint32_t next_pred = 0;
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    blocks[b] = (SemBinaryBlock) {
+      .first_inst = next_inst,
+      .num_insts = block->num_insts,
+      .first_pred = next_pred,
+      .num_preds = block->num_preds,
+      .num_succs = block->num_succs
+    };
+
+    memcpy(blocks[b].succs, block->succs, block->num_succs * sizeof(uint32_t));
+    memcpy(block_insts + next_inst, block->insts, block->num_insts * sizeof(uint32_t));
+    memcpy(preds + next_pred, block->preds, block->num_preds * sizeof(uint32_t));
+
+    next_inst += block->num_insts;
+    next_pred += block->num_preds;
+  }
+
+  SemBinaryFunc result = {
+    .name_length = func->name.length,
+    .first_token = func->first_token,
+    .num_insts = num_insts,
+    .num_uses = dynamic_array_length(uses),
+    .num_constants = dynamic_array_length(func->constants),
+    .num_blocks = num_blocks,
+    .num_block_insts = num_block_insts,
+    .num_preds = num_preds,
+    .num_regs = func->num_regs
+  };
+
+  result.name = put(w, func->name.str, func->name.length);
+  result.insts = put(w, insts, num_insts * sizeof(SemInst));
+  result.tokens = put(w, func->tokens, num_insts * sizeof(uint32_t));
+  result.first_use = put(w, first_use, num_insts * sizeof(uint32_t));
+  result.uses = put(w, uses, result.num_uses * sizeof(SemUse));
+  result.constants = put(w, func->constants, result.num_constants * sizeof(uint64_t));
+  result.blocks = put(w, blocks, num_blocks * sizeof(SemBinaryBlock));
+  result.block_insts = put(w, block_insts, num_block_insts * sizeof(uint32_t));
+  result.preds = put(w, preds, num_preds * sizeof(uint32_t));
+  result.regs = func->regs ? put(w, func->regs, num_insts * sizeof(uint32_t)) : 0;
+
+  scratch_release(&scratch);
+  return result;
+}
+
+bool sem_binary_write(SemFile* file, char* path) {
+  FILE* f = fopen(path, "wb");
+
+  if (!f) {
+    fprintf(stderr, "Failed to open '%s' for writing\n", path);
+    return false;
+  }
+
+  Scratch scratch = global_scratch(0, NULL);
+  Writer w = { .file = f };
+
+  SemBinaryHeader header = {
+    .magic = SEM_BINARY_MAGIC,
+    .version = SEM_BINARY_VERSION,
+    .num_funcs = file->num_funcs
+  };
+
+  // Filled in once everything after it is written
+  put(&w, &header, sizeof(header));
+
+  SemBinaryFunc* funcs = arena_push(scratch.arena, file->num_funcs * sizeof(SemBinaryFunc));
+
+  for_range(int, i, file->num_funcs) {
+    funcs[i] = write_func(&w, &file->funcs[i]);
+  }
+
+  header.funcs = put(&w, funcs, file->num_funcs * sizeof(SemBinaryFunc));
+  header.size = w.offset;
+
+  rewind(f);
+  w.failed |= fwrite(&header, 1, sizeof(header), f) != sizeof(header);
+  w.failed |= fclose(f) != 0;
+
+  scratch_release(&scratch);
+
+  if (w.failed) {
+    fprintf(stderr, "Failed to write '%s'\n", path);
+  }
+
+  return !w.failed;
+}
+
+static bool invalid(SemBinary* binary, char* fmt, ...) {
+  if (binary->quiet) {
+    return false;
+  }
+
+  va_list ap;
+  va_start(ap, fmt);
+
+  fprintf(stderr, "Invalid Sem binary '%s': ", binary->path);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+
+  va_end(ap);
+  return false;
+}
+
+static bool in_bounds(SemBinary* binary, uint64_t offset, uint64_t count, uint64_t stride) {
+  return offset % 8 == 0 && offset <= binary->size && count <= (binary->size - offset) / stride;
+}
+
+SemBinary* sem_binary_load(Arena* arena, char* path) {
+  uint64_t size;
+  void* data = map_file(path, &size);
+
+  if (!data) {
+    fprintf(stderr, "Failed to map '%s'\n", path);
+    return NULL;
+  }
+
+  SemBinary* binary = arena_type(arena, SemBinary);
+  binary->path = copy_cstr(arena, path).str;
+  binary->data = data;
+  binary->size = size;
+
+  SemBinaryHeader* header = data;
+  bool ok = false;
+
+  if (size < sizeof(SemBinaryHeader) || header->magic != SEM_BINARY_MAGIC) {
+    invalid(binary, "not a Sem binary");
+  }
+  else if (header->version != SEM_BINARY_VERSION) {
+    invalid(binary, "version %u, but only version %u can be read", header->version, SEM_BINARY_VERSION);
+  }
+  else if (header->size != size) {
+    invalid(binary, "%llu bytes long, but should be %llu", (unsigned long long)size, (unsigned long long)header->size);
+  }
+  else if (!in_bounds(binary, header->funcs, header->num_funcs, sizeof(SemBinaryFunc))) {
+    invalid(binary, "the function table is out of bounds");
+  }
+  else {
+    ok = true;
+  }
+
+  if (!ok) {
+    unmap_file(data);
+    return NULL;
+  }
+
+  binary->header = header;
+  binary->funcs = sem_binary_at(binary, header->funcs);
+
+  return binary;
+}
+
+void sem_binary_close(SemBinary* binary) {
+  unmap_file(binary->data);
+  binary->data = NULL;
+}
+
+static bool validate_func(SemBinary* binary, int func_id, Scratch* scratch) {
+  SemBinaryFunc* f = &binary->funcs[func_id];
+
+  bool arrays_in_bounds = in_bounds(binary, f->name, f->name_length, 1)
+    && in_bounds(binary, f->insts, f->num_insts, sizeof(SemInst))
+    && in_bounds(binary, f->tokens, f->num_insts, sizeof(uint32_t))
+    && in_bounds(binary, f->first_use, f->num_insts, sizeof(uint32_t))
+    && in_bounds(binary, f->uses, f->num_uses, sizeof(SemUse))
+    && in_bounds(binary, f->constants, f->num_constants, sizeof(uint64_t))
+    && in_bounds(binary, f->blocks, f->num_blocks, sizeof(SemBinaryBlock))
+    && in_bounds(binary, f->block_insts, f->num_block_insts, sizeof(uint32_t))
+    && in_bounds(binary, f->preds, f->num_preds, sizeof(uint32_t))
+    && (!f->regs || in_bounds(binary, f->regs, f->num_insts, sizeof(uint32_t)));
+
+  if (!arrays_in_bounds) {
+    return invalid(binary, "function %d has an array out of bounds", func_id);
+  }
+
+  // ID 0 and use 0 have to exist, as they stand for none
+  if (!f->num_insts || !f->num_uses) {
+    return invalid(binary, "function %d has no instruction 0 or use 0", func_id);
+  }
+
+  SemInst* insts = sem_binary_at(binary, f->insts);
+  uint32_t* first_use = sem_binary_at(binary, f->first_use);
+  SemUse* uses = sem_binary_at(binary, f->uses);
+  SemBinaryBlock* blocks = sem_binary_at(binary, f->blocks);
+  uint32_t* block_insts = sem_binary_at(binary, f->block_insts);
+  uint32_t* preds = sem_binary_at(binary, f->preds);
+  uint32_t* regs = f->regs ? sem_binary_at(binary, f->regs) : NULL;
+
+  uint64_t total_ins = 0;
+
+  for_range(uint32_t, i, f->num_insts) {
+    SemInst* inst = &insts[i];
+    bool valid_op = i == 0
+      ? inst->op == SEM_OP_INVALID && !inst->num_ins
+      : inst->op != SEM_OP_INVALID && inst->op < (int)LENGTH(sem_op_str);
+
+    if (!valid_op) {
+      return invalid(binary, "function %d, instruction %u has an invalid op", func_id, i);
+    }
+
+    int num_ins = sem_op_num_ins[inst->op];
+
+    if (inst->num_ins && num_ins != -1 && inst->num_ins != num_ins) {
+      return invalid(binary, "function %d, instruction %u has %u operands rather than %d", func_id, i, inst->num_ins, num_ins);
+    }
+
+    if (inst->num_ins && (inst->ins == 0 || (uint64_t)inst->ins + inst->num_ins > f->num_uses)) {
+      return invalid(binary, "function %d, instruction %u has operands out of bounds", func_id, i);
+    }
+
+    if (inst->block >= f->num_blocks && (inst->block || inst->num_ins)) {
+      return invalid(binary, "function %d, instruction %u is in a block that does not exist", func_id, i);
+    }
+
+    if (inst->op == SEM_OP_INT_CONST && inst->data >= f->num_constants) {
+      return invalid(binary, "function %d, instruction %u has a constant out of bounds", func_id, i);
+    }
+
+    total_ins += inst->num_ins;
+  }
+
+  // Every use is in its user's range, and there are as many uses as operands,
+  // so the ranges cannot overlap
+  if (total_ins != f->num_uses - 1) {
+    return invalid(binary, "function %d has %u uses for %llu operands", func_id, f->num_uses - 1, (unsigned long long)total_ins);
+  }
+
+  uint32_t* num_uses_of = arena_array(scratch->arena, uint32_t, f->num_insts);
+
+  for (uint32_t u = 1; u < f->num_uses; ++u) {
+    SemUse* use = &uses[u];
+
+    if (use->value >= f->num_insts || use->user == 0 || use->user >= f->num_insts) {
+      return invalid(binary, "function %d, use %u is out of bounds", func_id, u);
+    }
+
+    SemInst* user = &insts[use->user];
+
+    if (u < user->ins || u >= user->ins + user->num_ins) {
+      return invalid(binary, "function %d, use %u is not an operand of its user", func_id, u);
+    }
+
+    bool linked = use->value
+      ? use->next && use->next < f->num_uses && uses[use->next].prev == u && uses[use->next].value == use->value
+      : use->next == u && use->prev == u;
+
+    if (!linked) {
+      return invalid(binary, "function %d, use %u is not linked to the other uses of its value", func_id, u);
+    }
+
+    num_uses_of[use->value]++;
+  }
+
+  // Each value's uses are one list, and only one
+  for (uint32_t v = 1; v < f->num_insts; ++v) {
+    uint32_t head = first_use[v];
+
+    if (!head) {
+      if (num_uses_of[v]) {
+        return invalid(binary, "function %d, instruction %u is used but has no use list", func_id, v);
+      }
+
+      continue;
+    }
+
+    if (head >= f->num_uses || uses[head].value != v) {
+      return invalid(binary, "function %d, instruction %u has a use list out of bounds", func_id, v);
+    }
+
+    uint32_t length = 1;
+
+    for (uint32_t u = uses[head].next; u != head && length <= num_uses_of[v]; u = uses[u].next) {
+      length++;
+    }
+
+    if (length != num_uses_of[v]) {
+      return invalid(binary, "function %d, instruction %u has %u uses not in its use list", func_id, v, num_uses_of[v] - length);
+    }
+  }
+
+  uint64_t num_succs = 0;
+  uint64_t num_preds = 0;
+
+  bool* placed = arena_array(scratch->arena, bool, f->num_insts);
+  uint32_t* num_edges_from = arena_array(scratch->arena, uint32_t, f->num_blocks); // Into the block being checked
+
+  for_range(uint32_t, b, f->num_blocks) {
+    SemBinaryBlock* block = &blocks[b];
+
+    bool in_range = (uint64_t)block->first_inst + block->num_insts <= f->num_block_insts
+      && (uint64_t)block->first_pred + block->num_preds <= f->num_preds
+      && block->num_succs <= SEM_MAX_SUCCS;
+
+    if (!in_range) {
+      return invalid(binary, "function %d, block %u is out of bounds", func_id, b);
+    }
+
+    for_range(uint32_t, j, block->num_succs) {
+      if (block->succs[j] >= f->num_blocks) {
+        return invalid(binary, "function %d, block %u has a successor that does not exist", func_id, b);
+      }
+    }
+
+    for_range(uint32_t, j, block->num_insts) {
+      uint32_t inst = block_insts[block->first_inst + j];
+
+      if (inst == 0 || inst >= f->num_insts || insts[inst].block != b) {
+        return invalid(binary, "function %d, block %u has an instruction that is not in it", func_id, b);
+      }
+
+      if (placed[inst]) {
+        return invalid(binary, "function %d, instruction %u is in more than one place", func_id, inst);
+      }
+
+      placed[inst] = true;
+
+      // Only instructions out of any block may have dropped their operands
+      int num_ins = sem_op_num_ins[insts[inst].op];
+
+      if (num_ins != -1 && insts[inst].num_ins != num_ins) {
+        return invalid(binary, "function %d, instruction %u is in a block without its operands", func_id, inst);
+      }
+
+      // One terminator, at the end
+      if (sem_is_terminator(insts[inst].op) != (j == block->num_insts-1)) {
+        return invalid(binary, "function %d, block %u does not end in its only terminator", func_id, b);
+      }
+
+      if (insts[inst].op == SEM_OP_PHI && insts[inst].num_ins != block->num_preds) {
+        return invalid(binary, "function %d, block %u has a phi without an operand per predecessor", func_id, b);
+      }
+
+      // Values out of any block never get a register of their own
+      if (regs && sem_op_has_value[insts[inst].op] && regs[inst] >= f->num_regs) {
+        return invalid(binary, "function %d, instruction %u has a register out of bounds", func_id, inst);
+      }
+    }
+
+    // Blocks emptied by a pass are cut off from the rest
+    uint32_t expected_succs = 0;
+
+    if (block->num_insts) {
+      SemOp end = insts[block_insts[block->first_inst + block->num_insts-1]].op;
+      expected_succs = end == SEM_OP_GOTO ? 1 : end == SEM_OP_BRANCH ? 2 : 0;
+    }
+    else if (block->num_preds) {
+      return invalid(binary, "function %d, block %u is empty but has predecessors", func_id, b);
+    }
+
+    if (block->num_succs != expected_succs) {
+      return invalid(binary, "function %d, block %u has %u successors for its terminator", func_id, b, block->num_succs);
+    }
+
+    for_range(uint32_t, j, block->num_preds) {
+      uint32_t pred = preds[block->first_pred + j];
+
+      if (pred >= f->num_blocks) {
+        return invalid(binary, "function %d, block %u has a predecessor that does not exist", func_id, b);
+      }
+
+      num_edges_from[pred]++;
+    }
+
+    // A block is a predecessor once per edge from it, which together with
+    // there being as many predecessors as edges makes them the same edges
+    for_range(uint32_t, j, block->num_preds) {
+      uint32_t pred = preds[block->first_pred + j];
+
+      if (!num_edges_from[pred]) {
+        continue;
+      }
+
+      SemBinaryBlock* p = &blocks[pred];
+      uint32_t num_edges = 0;
+
+      for_range(uint32_t, k, p->num_succs <= SEM_MAX_SUCCS ? p->num_succs : 0) {
+        num_edges += p->succs[k] == b;
+      }
+
+      if (num_edges != num_edges_from[pred]) {
+        return invalid(binary, "function %d, block %u has bb_%u as a predecessor %u times for %u edges", func_id, b, pred, num_edges_from[pred], num_edges);
+      }
+
+      num_edges_from[pred] = 0;
+    }
+
+    num_succs += block->num_succs;
+    num_preds += block->num_preds;
+  }
+
+  if (num_succs != num_preds) {
+    return invalid(binary, "function %d has %llu edges but %llu predecessors", func_id, (unsigned long long)num_succs, (unsigned long long)num_preds);
+  }
+
+  return true;
+}
+
+bool sem_binary_validate(SemBinary* binary) {
+  Scratch scratch = global_scratch(0, NULL);
+  bool ok = true;
+
+  for (int i = 0; ok && i < (int)binary->header->num_funcs; ++i) {
+    Scratch func_scratch = global_scratch(1, &scratch.arena);
+    ok = validate_func(binary, i, &func_scratch);
+    scratch_release(&func_scratch);
+  }
+
+  scratch_release(&scratch);
+  return ok;
+}
+
+// A growable copy of an array in the file
+static void* copy_array(Allocator* allocator, void* data, uint32_t count, size_t stride) {
+  void* da = _dynamic_array_resize(new_dynamic_array(allocator), count, stride);
+  memcpy(da, data, count * stride);
+  return da;
+}
+
+SemFunc sem_binary_func(SemContext* context, SemBinary* binary, int i) {
+  SemBinaryFunc* f = &binary->funcs[i];
+  Allocator* allocator = context->allocator;
+
+  char* name = arena_push(context->arena, f->name_length + 1);
+  memcpy(name, sem_binary_at(binary, f->name), f->name_length);
+  name[f->name_length] = '\0';
+
+  SemFunc func = {
+    .name = { .length = f->name_length, .str = name },
+    .first_token = f->first_token,
+    .insts = copy_array(allocator, sem_binary_at(binary, f->insts), f->num_insts, sizeof(SemInst)),
+    .tokens = copy_array(allocator, sem_binary_at(binary, f->tokens), f->num_insts, sizeof(uint32_t)),
+    .first_use = copy_array(allocator, sem_binary_at(binary, f->first_use), f->num_insts, sizeof(uint32_t)),
+    .replaced_by = new_dynamic_array(allocator),
+    .uses = copy_array(allocator, sem_binary_at(binary, f->uses), f->num_uses, sizeof(SemUse)),
+    .constants = copy_array(allocator, sem_binary_at(binary, f->constants), f->num_constants, sizeof(uint64_t)),
+    .blocks = new_dynamic_array(allocator),
+    .num_regs = f->num_regs
+  };
+
+  dynamic_array_resize(func.replaced_by, f->num_insts);
+  memset(func.replaced_by, 0, f->num_insts * sizeof(uint32_t));
+
+  // Blocks grow in the arena, so their lists are copied there in one piece
+  uint32_t* block_insts = arena_push(context->arena, f->num_block_insts * sizeof(uint32_t));
+  uint32_t* preds = arena_push(context->arena, f->num_preds * sizeof(uint32_t));
+
+  memcpy(block_insts, sem_binary_at(binary, f->block_insts), f->num_block_insts * sizeof(uint32_t));
+  memcpy(preds, sem_binary_at(binary, f->preds), f->num_preds * sizeof(uint32_t));
+
+  SemBinaryBlock* blocks = sem_binary_at(binary, f->blocks);
+  dynamic_array_resize(func.blocks, f->num_blocks);
+
+  for_range(uint32_t, b, f->num_blocks) {
+    SemBinaryBlock* block = &blocks[b];
+
+    func.blocks[b] = (SemBlock) {
+      .insts = block_insts + block->first_inst,
+      .num_insts = block->num_insts,
+      .capacity = block->num_insts,
+      .num_succs = block->num_succs,
+      .preds = preds + block->first_pred,
+      .num_preds = block->num_preds,
+      .preds_capacity = block->num_preds
+    };
+
+    memcpy(func.blocks[b].succs, block->succs, sizeof(block->succs));
+  }
+
+  if (f->regs) {
+    func.regs = arena_push(context->arena, f->num_insts * sizeof(uint32_t));
+    memcpy(func.regs, sem_binary_at(binary, f->regs), f->num_insts * sizeof(uint32_t));
+  }
+
+  return func;
+}
+
+SemFile* sem_binary_file(SemContext* context, SemBinary* binary) {
+  SemFile* file = arena_type(context->arena, SemFile);
+  file->num_funcs = binary->header->num_funcs;
+  file->funcs = arena_push(context->arena, file->num_funcs * sizeof(SemFunc));
+
+  for_range(int, i, file->num_funcs) {
+    file->funcs[i] = sem_binary_func(context, binary, i);
+  }
+
+  return file;
+}
@@ -2,7 +2,7 @@
 
 typedef struct {
   int processed;
-  AST* node;
+  uint32_t node;
 
   union {
     struct { int start_tail; int then_head; int then_tail; int else_head; int end; } _if;
@@ -13,7 +13,7 @@ typedef struct {
 
 typedef struct {
   String name;
-  SemInst* val;
+  uint32_t val;
 } Symbol;
 
 typedef struct Scope Scope;
@@ -24,18 +24,37 @@ struct Scope {
   Symbol* table;
 };
 
+typedef struct {
+  uint64_t value;
+  uint32_t inst;
+  uint32_t generation; // Stale unless it is ConstantTable::generation
+} ConstantEntry;
+
+// The INT_CONSTs of the block being lowered, so a literal repeated in it reuses
+// the first. Earlier blocks may not dominate later ones, so moving to another
+// block makes every entry stale instead of having to clear the table.
+typedef struct {
+  int capacity;
+  int count;
+  int block;
+  uint32_t generation;
+  ConstantEntry* table;
+} ConstantTable;
+
 typedef struct {
   SemContext* context;
   SourceContents source;
+  TokenizedBuffer* tokens;
+  AST* ast;
   Allocator* scratch_allocator;
 
   DynamicArray(CheckItem) item_stack;
-  DynamicArray(SemInst*) value_stack;
+  DynamicArray(CheckItem) control_stack; // Open control flow in check_postorder
+  DynamicArray(uint32_t) value_stack;
   DynamicArray(Scope) scope_stack;
+  ConstantTable constants;
 
-  DynamicArray(SemBlock) blocks;
-  
-  int next_value;
+  SemFunc func; // The function being lowered
 } Checker;
 
 static String token_string_view(Token token) {
@@ -57,11 +76,31 @@ static String token_string(SemContext* context, Token token) {
   };
 }
 
+static ASTKind node_kind(Checker* c, uint32_t node) {
+  return ast_node(c->ast, node)->kind;
+}
+
+static uint32_t node_token(Checker* c, uint32_t node) {
+  return ast_node(c->ast, node)->token;
+}
+
+static Token token_index(Checker* c, uint32_t token) {
+  return c->tokens->tokens[token];
+}
+
+static int num_children(Checker* c, uint32_t node) {
+  return (int)ast_node(c->ast, node)->num_children;
+}
+
+static uint32_t child(Checker* c, uint32_t node, int i) {
+  return ast_child(c->ast, node, i);
+}
+
 static void push_item(Checker* c, CheckItem item) {
   dynamic_array_put(c->item_stack, item);
 }
 
-static void push_node(Checker* c, AST* node) {
+static void push_node(Checker* c, uint32_t node) {
   CheckItem item = {
     .node = node
   };
@@ -69,90 +108,49 @@ static void push_node(Checker* c, AST* node) {
   push_item(c, item);
 }
 
-static SemInst* peek_value(Checker* c) {
+static uint32_t peek_value(Checker* c) {
   return dynamic_array_back(c->value_stack);
 }
 
-static void push_value(Checker* c, SemInst* val) {
+static void push_value(Checker* c, uint32_t val) {
   dynamic_array_put(c->value_stack, val);
 }
 
-static SemInst* pop_value(Checker* c) {
+static uint32_t pop_value(Checker* c) {
   return dynamic_array_pop(c->value_stack);
 }
 
+static void new_func(Checker* c, uint32_t first_token) {
+  c->func = sem_new_func(c->context->allocator, first_token);
+  c->constants.block = -1;
+}
+
 static int _new_block(Checker* c) {
-  SemBlock block = {0};
-  dynamic_array_put(c->blocks, block);
-  return dynamic_array_length(c->blocks)-1;
+  return sem_new_block(&c->func);
 }
 
 static void new_block(Checker* c, int* cur, int* new) {
-  *cur =  dynamic_array_length(c->blocks)-1;
+  *cur =  dynamic_array_length(c->func.blocks)-1;
   *new = _new_block(c);
 }
 
-static void block_append(Checker* c, int block, SemInst* inst) {
-  SemBlock* b = &c->blocks[block];
-
-  inst->block = block;
-
-  inst->prev = b->end;
-  inst->next = NULL;
-
-  if (inst->prev) {
-    inst->prev->next = inst;
-  }
-  else {
-    b->start = inst;
-  }
-
-  b->end = inst;
-}
-
-static void inst_remove(Checker* c, SemInst* inst) {
-  SemBlock* b = &c->blocks[inst->block];
-
-  if (inst->prev) {
-    inst->prev->next = inst->next;
-  }
-  else {
-    b->start = inst->next;
-  }
-
-  if (inst->next) {
-    inst->next->prev = inst->prev;
-  }
-  else {
-    b->end = inst->prev;
-  }
-}
-
-static void add_inst_in_block(Checker* c, int block, SemOp op, Token token, bool has_def, int num_ins, void* data) {
-  assert(num_ins <= SEM_MAX_INS);
-
-  SemInst* inst = arena_type(c->context->arena, SemInst);
-  inst->op = op;
-  inst->token = token;
-  inst->num_ins = num_ins;
-  inst->data = data;
+static void add_inst_in_block(Checker* c, int block, SemOp op, uint32_t token, int num_ins, uint32_t data) {
+  uint32_t inst = sem_new_inst(&c->func, op, token - c->func.first_token, num_ins, data);
 
   for_range_rev(int, i, num_ins) {
-    inst->ins[i] = dynamic_array_pop(c->value_stack);
+    sem_set_operand(&c->func, inst, i, dynamic_array_pop(c->value_stack));
   }
 
-  if (has_def) {
-    inst->def = c->next_value++;
-
+  if (sem_op_has_value[op]) {
     dynamic_array_put(c->value_stack, inst);
   }
 
-  block_append(c, block, inst);
+  sem_block_append(c->context->arena, &c->func, block, inst);
 }
 
-static void add_inst(Checker* c, SemOp op, Token token, bool has_def, int num_ins, void* data) {
-  int cur_block = dynamic_array_length(c->blocks)-1;
-  add_inst_in_block(c, cur_block, op, token, has_def, num_ins, data);
+static void add_inst(Checker* c, SemOp op, uint32_t token, int num_ins, uint32_t data) {
+  int cur_block = dynamic_array_length(c->func.blocks)-1;
+  add_inst_in_block(c, cur_block, op, token, num_ins, data);
 }
 
 static int scope_find(Scope* scope, String key) {
@@ -192,7 +190,7 @@ static void _add_local(Scope* scope, Symbol symbol) {
   }
 }
 
-static void add_local(Checker* c, Scope* scope, String name, SemInst* val) {
+static void add_local(Checker* c, Scope* scope, String name, uint32_t val) {
   if (!scope->capacity || (float)scope->count > (float)scope->capacity * 0.5f) {
     int new_capacity = scope->capacity ? scope->capacity * 2 : 8;
 
@@ -202,6 +200,9 @@ static void add_local(Checker* c, Scope* scope, String name, SemInst* val) {
       .table = allocator_alloc(c->scratch_allocator, new_capacity * sizeof(scope->table[0]))
     };
 
+    // Freed memory gets reused, so the occupancy bits start out as garbage
+    memset(new_scope.occ, 0, bitset_num_u64(new_capacity) * sizeof(uint64_t));
+
     for_range(int, i, scope->capacity) {
       if (bitset_query(scope->occ, i)) {
         _add_local(&new_scope, scope->table[i]);
@@ -215,7 +216,7 @@ static void add_local(Checker* c, Scope* scope, String name, SemInst* val) {
   _add_local(scope, (Symbol){.name = name, .val = val});
 }
 
-static SemInst* find_local(Checker* c, String name) {
+static uint32_t find_local(Checker* c, String name) {
   for_range_rev(int, s, dynamic_array_length(c->scope_stack)) {
     Scope* scope = &c->scope_stack[s];
 
@@ -231,60 +232,116 @@ static SemInst* find_local(Checker* c, String name) {
   return 0;
 }
 
-static bool check_ast_INT_LITERAL(Checker* c, CheckItem item) {
-  uint64_t value = 0;
-  Token token = item.node->token;
+static int constant_find(ConstantTable* t, uint64_t value) {
+  int i = fnv1a_hash(&value, sizeof(value)) % t->capacity;
 
-  for_range (int, i, token.length) {
-    value *= 10;
-    value += token.start[i] - '0';
+  while (t->table[i].generation == t->generation && t->table[i].value != value) {
+    i = (i + 1) % t->capacity;
   }
 
-  add_inst(c, SEM_OP_INT_CONST, token, true, 0, (void*)value);
+  return i;
+}
+
+static void grow_constants(Checker* c) {
+  ConstantTable* t = &c->constants;
+  ConstantTable new_table = *t;
+
+  new_table.capacity = t->capacity ? t->capacity * 2 : 16;
+  new_table.table = allocator_alloc(c->scratch_allocator, new_table.capacity * sizeof(t->table[0]));
+
+  // Freed memory gets reused, so the generations start out as garbage
+  memset(new_table.table, 0, new_table.capacity * sizeof(t->table[0]));
+
+  for_range(int, i, t->capacity) {
+    if (t->table[i].generation == t->generation) {
+      new_table.table[constant_find(&new_table, t->table[i].value)] = t->table[i];
+    }
+  }
+
+  allocator_free(c->scratch_allocator, t->table);
+  *t = new_table;
+}
+
+static void lower_int_literal(Checker* c, uint32_t token) {
+  ConstantTable* t = &c->constants;
+
+  uint64_t value = c->tokens->literals[token_index(c, token).literal];
+  int cur_block = dynamic_array_length(c->func.blocks)-1;
 
+  if (t->block != cur_block) {
+    t->block = cur_block;
+    t->count = 0;
+    t->generation++;
+  }
+
+  if (!t->capacity || t->count >= t->capacity / 2) {
+    grow_constants(c);
+  }
+
+  int i = constant_find(t, value);
+
+  if (t->table[i].generation == t->generation) {
+    push_value(c, t->table[i].inst);
+    return;
+  }
+
+  uint32_t constant = dynamic_array_length(c->func.constants);
+  dynamic_array_put(c->func.constants, value);
+
+  add_inst(c, SEM_OP_INT_CONST, token, 0, constant);
+
+  t->table[i] = (ConstantEntry) {
+    .value = value,
+    .inst = peek_value(c),
+    .generation = t->generation
+  };
+
+  t->count++;
+}
+
+static bool check_ast_INT_LITERAL(Checker* c, CheckItem item) {
+  lower_int_literal(c, node_token(c, item.node));
   return true;
 }
 
 #define INVALID() \
   do { \
-    error_at_token(c->source, item.node->token, "compiler bug(check): was not expecting this '%s' here", ast_kind_string[item.node->kind]); \
+    error_at_token(c->source, token_index(c, node_token(c, item.node)), "compiler bug(check): was not expecting this '%s' here", ast_kind_string[node_kind(c, item.node)]); \
     return false; \
   } while (false)
 
-static bool check_ast_IDENTIFIER(Checker* c, CheckItem item) {
-  Token name_tok = item.node->token;
-  String name = token_string_view(name_tok);
+static bool lower_identifier(Checker* c, uint32_t name_tok) {
+  String name = token_string_view(token_index(c, name_tok));
 
-  SemInst* val = find_local(c, name);
+  uint32_t val = find_local(c, name);
 
   if (!val) {
-    error_at_token(c->source, name_tok, "this symbol does not exist in the current scope");
+    error_at_token(c->source, token_index(c, name_tok), "this symbol does not exist in the current scope");
     return false;
   }
 
   dynamic_array_put(c->value_stack, val);
-  add_inst(c, SEM_OP_LOAD, name_tok, true, 1, NULL);
+  add_inst(c, SEM_OP_LOAD, name_tok, 1, 0);
 
   return true;
 }
 
-static bool check_ast_LOCAL(Checker* c, CheckItem item) {
-  assert(item.node->num_children == 2);
-
-  Token name_tok = item.node->children[0]->token;
-  Token ty_tok = item.node->children[1]->token;
+static bool check_ast_IDENTIFIER(Checker* c, CheckItem item) {
+  return lower_identifier(c, node_token(c, item.node));
+}
 
-  if (strncmp("int", ty_tok.start, 3) != 0) {
-    error_at_token(c->source, ty_tok, "only 'int' type supported");
+static bool lower_local(Checker* c, uint32_t colon_tok, uint32_t name_tok, uint32_t ty_tok) {
+  if (strncmp("int", token_index(c, ty_tok).start, 3) != 0) {
+    error_at_token(c->source, token_index(c, ty_tok), "only 'int' type supported");
     return false;
   }
 
-  add_inst(c, SEM_OP_LOCAL, item.node->token, true, 0, NULL);
-  SemInst* val = dynamic_array_back(c->value_stack);
+  add_inst(c, SEM_OP_LOCAL, colon_tok, 0, 0);
+  uint32_t val = dynamic_array_back(c->value_stack);
 
-  String name = token_string_view(name_tok);
+  String name = token_string_view(token_index(c, name_tok));
   if (find_local(c, name)) {
-    error_at_token(c->source, name_tok, "this symbol name overwrites an existing symbol");
+    error_at_token(c->source, token_index(c, name_tok), "this symbol name overwrites an existing symbol");
     return false;
   }
 
@@ -293,36 +350,66 @@ static bool check_ast_LOCAL(Checker* c, CheckItem item) {
   return true;
 }
 
-static bool check_binary(Checker* c, CheckItem item, SemOp op, Token token) {
+static bool check_ast_LOCAL(Checker* c, CheckItem item) {
+  assert(num_children(c, item.node) == 2);
+
+  uint32_t name_tok = node_token(c, child(c, item.node, 0));
+  uint32_t ty_tok = node_token(c, child(c, item.node, 1));
+
+  return lower_local(c, node_token(c, item.node), name_tok, ty_tok);
+}
+
+static bool check_binary(Checker* c, CheckItem item, SemOp op, uint32_t token) {
   if (!item.processed) {
     item.processed = 1;
     push_item(c, item);
 
-    assert(item.node->num_children == 2);
-    push_node(c, item.node->children[1]);
-    push_node(c, item.node->children[0]);
+    assert(num_children(c, item.node) == 2);
+    push_node(c, child(c, item.node, 1));
+    push_node(c, child(c, item.node, 0));
   }
   else {
-    add_inst(c, op, token, true, 2, NULL);
+    add_inst(c, op, token, 2, 0);
   }
 
   return true;
 }
 
 static bool check_ast_ADD(Checker* c, CheckItem item) {
-  return check_binary(c, item, SEM_OP_ADD, item.node->token);
+  return check_binary(c, item, SEM_OP_ADD, node_token(c, item.node));
 }
 
 static bool check_ast_SUB(Checker* c, CheckItem item) {
-  return check_binary(c, item, SEM_OP_SUB, item.node->token);
+  return check_binary(c, item, SEM_OP_SUB, node_token(c, item.node));
 }
 
 static bool check_ast_MUL(Checker* c, CheckItem item) {
-  return check_binary(c, item, SEM_OP_MUL, item.node->token);
+  return check_binary(c, item, SEM_OP_MUL, node_token(c, item.node));
 }
 
 static bool check_ast_DIV(Checker* c, CheckItem item) {
-  return check_binary(c, item, SEM_OP_DIV, item.node->token);
+  return check_binary(c, item, SEM_OP_DIV, node_token(c, item.node));
+}
+
+// Turns the load the destination was lowered to back into the local's address
+static bool assign_dest(Checker* c, uint32_t dest, uint32_t dest_tok) {
+  if (c->func.insts[dest].op != SEM_OP_LOAD) {
+    error_at_token(c->source, token_index(c, dest_tok), "this value is not assignable");
+    return false;
+  }
+
+  push_value(c, sem_operand(&c->func, dest, 0));
+  sem_remove_inst(&c->func, dest); // This is probably safe to do...
+
+  return true;
+}
+
+static void lower_assign(Checker* c, uint32_t token) {
+  // We want this node to produce a value, but it should be the rhs expression,
+  // not the store instruction
+  uint32_t val = dynamic_array_back(c->value_stack);
+  add_inst(c, SEM_OP_STORE, token, 2, 0);
+  dynamic_array_put(c->value_stack, val);
 }
 
 static bool check_ast_ASSIGN(Checker* c, CheckItem item) {
@@ -330,31 +417,21 @@ static bool check_ast_ASSIGN(Checker* c, CheckItem item) {
     case 0: {
       item.processed = 1;
       push_item(c, item);
-      push_node(c, item.node->children[0]);
+      push_node(c, child(c, item.node, 0));
     } break;
 
     case 1: {
-      SemInst* dest = pop_value(c);
-
-      if (dest->op != SEM_OP_LOAD) {
-        error_at_token(c->source, item.node->children[0]->token, "this value is not assignable");
+      if (!assign_dest(c, pop_value(c), node_token(c, child(c, item.node, 0)))) {
         return false;
       }
 
-      push_value(c, dest->ins[0]);
-      inst_remove(c, dest); // This is probably safe to do...
-
       item.processed = 2;
       push_item(c, item);
-      push_node(c, item.node->children[1]);
+      push_node(c, child(c, item.node, 1));
     } break;
 
     case 2: {
-      // We want this node to produce a value, but it should be the rhs expression,
-      // not the store instruction
-      SemInst* val = dynamic_array_back(c->value_stack);
-      add_inst(c, SEM_OP_STORE, item.node->token, false, 2, NULL);
-      dynamic_array_put(c->value_stack, val);
+      lower_assign(c, node_token(c, item.node));
     } break;
   }
 
@@ -366,145 +443,170 @@ static bool check_ast_INITIALIZE(Checker* c, CheckItem item) {
     item.processed = 1;
     push_item(c, item);
 
-    assert(item.node->num_children == 2);
-    push_node(c, item.node->children[1]);
-    push_node(c, item.node->children[0]);
+    assert(num_children(c, item.node) == 2);
+    push_node(c, child(c, item.node, 1));
+    push_node(c, child(c, item.node, 0));
   }
   else {
-    add_inst(c, SEM_OP_STORE, item.node->token, false, 2, NULL);
+    add_inst(c, SEM_OP_STORE, node_token(c, item.node), 2, 0);
   }
 
   return true;
 }
 
+// Returns the value stack count to restore when the scope ends
+static int begin_scope(Checker* c) {
+  Scope new_scope = {0};
+  dynamic_array_put(c->scope_stack, new_scope);
+
+  return dynamic_array_length(c->value_stack);
+}
+
+static void end_scope(Checker* c, int og_stack_count) {
+  while (dynamic_array_length(c->value_stack) > og_stack_count) {
+    (void)dynamic_array_pop(c->value_stack);
+  }
+
+  free_scope(c, dynamic_array_pop(c->scope_stack));
+}
+
 static bool check_ast_BLOCK(Checker* c, CheckItem item) {
   switch (item.processed) {
     case 0: {
-      Scope new_scope = {0};
-      dynamic_array_put(c->scope_stack, new_scope);
-
       item.processed += 1;
-      item.data.block.og_stack_count = dynamic_array_length(c->value_stack);
+      item.data.block.og_stack_count = begin_scope(c);
       push_item(c, item);
 
-      for_range_rev(int, i, item.node->num_children) {
-        push_node(c, item.node->children[i]);
+      for_range_rev(int, i, num_children(c, item.node)) {
+        push_node(c, child(c, item.node, i));
       }
     } break;
 
     case 1: {
-      while (dynamic_array_length(c->value_stack) > item.data.block.og_stack_count) {
-        dynamic_array_pop(c->value_stack);
-      }
-
-      free_scope(c, dynamic_array_pop(c->scope_stack));
+      end_scope(c, item.data.block.og_stack_count);
     } break;
   }
 
   return true;
 }
 
+static void lower_return(Checker* c, uint32_t token) {
+  add_inst(c, SEM_OP_RETURN, token, 1, 0);
+  _new_block(c);
+}
+
 static bool check_ast_RETURN(Checker* c, CheckItem item) {
   if (!item.processed) {
     item.processed = 1;
     push_item(c, item);
 
-    assert(item.node->num_children == 1);
-    push_node(c, item.node->children[0]);
+    assert(num_children(c, item.node) == 1);
+    push_node(c, child(c, item.node, 0));
   }
   else {
-    add_inst(c, SEM_OP_RETURN, item.node->token, false, 1, NULL);
-    _new_block(c);
+    lower_return(c, node_token(c, item.node));
   }
 
   return true;
 }
 
-static void add_branch(Checker* c, Token if_token, int tail, int then_head, int else_head) {
-  int* locs = arena_array(c->context->arena, int, 2);
-  locs[0] = then_head;
-  locs[1] = else_head;
+static void add_branch(Checker* c, uint32_t if_token, int tail, int then_head, int else_head) {
+  add_inst_in_block(c, tail, SEM_OP_BRANCH, if_token, 1, 0);
+  sem_add_edge(c->context->arena, &c->func, tail, then_head);
+  sem_add_edge(c->context->arena, &c->func, tail, else_head);
+}
+
+static void add_goto(Checker* c, uint32_t token, int tail, int head) {
+  add_inst_in_block(c, tail, SEM_OP_GOTO, token, 0, 0);
+  sem_add_edge(c->context->arena, &c->func, tail, head);
+}
+
+// Returns the head of the block that evaluates the predicate
+static int begin_while(Checker* c, uint32_t token) {
+  int prev_tail, start_head;
+  new_block(c, &prev_tail, &start_head);
+
+  add_goto(c, token, prev_tail, start_head);
 
-  add_inst_in_block(c, tail, SEM_OP_BRANCH, if_token, false, 1, locs);
+  return start_head;
 }
 
-static void add_goto(Checker* c, Token token, int tail, int head) {
-  int* locs = arena_type(c->context->arena, int);
-  locs[0] = head;
-  add_inst_in_block(c, tail, SEM_OP_GOTO, token, false, 0, locs);
+static void end_while(Checker* c, uint32_t token, int start_head, int start_tail, int body_head) {
+  int body_tail, end_head;
+  new_block(c, &body_tail, &end_head);
+  add_branch(c, token, start_tail, body_head, end_head);
+  add_goto(c, token, body_tail, start_head);
 }
 
 static bool check_ast_WHILE(Checker* c, CheckItem item) {
   switch (item.processed) {
     case 0: {
-      int prev_tail, start_head;
-      new_block(c, &prev_tail, &start_head);
-
-      add_goto(c, item.node->token, prev_tail, start_head);
-
-      item.data._while.start_head = start_head;
+      item.data._while.start_head = begin_while(c, node_token(c, item.node));
       item.processed = 1;
       push_item(c, item);
-      push_node(c, item.node->children[0]); // Predicate
+      push_node(c, child(c, item.node, 0)); // Predicate
     } break;
 
     case 1: {
       new_block(c, &item.data._while.start_tail, &item.data._while.body_head);
       item.processed = 2;
       push_item(c, item);
-      push_node(c, item.node->children[1]); // Body
+      push_node(c, child(c, item.node, 1)); // Body
     } break;
     
     case 2: {
-      int body_tail, end_head;
-      new_block(c, &body_tail, &end_head);
-      add_branch(c, item.node->token, item.data._while.start_tail, item.data._while.body_head, end_head);
-      add_goto(c, item.node->token, body_tail, item.data._while.start_head);
+      end_while(c, node_token(c, item.node), item.data._while.start_head, item.data._while.start_tail, item.data._while.body_head);
     } break;
   }
 
   return true;
 }
 
+static void end_if(Checker* c, uint32_t if_token, int start_tail, int then_head) {
+  int then_tail, end_head;
+  new_block(c, &then_tail, &end_head);
+  add_branch(c, if_token, start_tail, then_head, end_head);
+  add_goto(c, if_token, then_tail, end_head);
+}
+
+static void end_if_else(Checker* c, uint32_t if_token, int start_tail, int then_head, int then_tail, int else_head) {
+  int else_tail, end_head;
+  new_block(c, &else_tail, &end_head);
+
+  add_branch(c, if_token, start_tail, then_head, else_head);
+  add_goto(c, if_token, then_tail, end_head);
+  add_goto(c, if_token, else_tail, end_head);
+}
+
 static bool check_ast_IF(Checker* c, CheckItem item) {
   switch (item.processed) {
     case 0: {
       item.processed = 1;
       push_item(c, item);
-      push_node(c, item.node->children[0]); // Predicate
+      push_node(c, child(c, item.node, 0)); // Predicate
     } break;
 
     case 1: {
       new_block(c, &item.data._if.start_tail, &item.data._if.then_head);
       item.processed = 2;
       push_item(c, item);
-      push_node(c, item.node->children[1]); // Body
+      push_node(c, child(c, item.node, 1)); // Body
     } break;
 
     case 2: {
-      if (item.node->num_children == 3) { // Has else 
+      if (num_children(c, item.node) == 3) { // Has else 
         new_block(c, &item.data._if.then_tail, &item.data._if.else_head);
         item.processed = 3;
         push_item(c, item);
-        push_node(c, item.node->children[2]); // else
+        push_node(c, child(c, item.node, 2)); // else
       }
       else {
-        int then_tail, end_head;
-        new_block(c, &then_tail, &end_head);
-        add_branch(c, item.node->token, item.data._if.start_tail, item.data._if.then_head, end_head);
-        add_goto(c, item.node->token, then_tail, end_head);
+        end_if(c, node_token(c, item.node), item.data._if.start_tail, item.data._if.then_head);
       }
     } break;
 
     case 3: {
-      int then_tail = item.data._if.then_tail;
-      int else_tail, end_head;
-      new_block(c, &else_tail, &end_head);
-
-      Token if_token = item.node->token;
-      add_branch(c, if_token, item.data._if.start_tail, item.data._if.then_head, item.data._if.else_head);
-      add_goto(c, if_token, then_tail, end_head);
-      add_goto(c, if_token, else_tail, end_head);
+      end_if_else(c, node_token(c, item.node), item.data._if.start_tail, item.data._if.then_head, item.data._if.then_tail, item.data._if.else_head);
     } break;
   }
 
@@ -519,30 +621,34 @@ static bool check_ast_FILE(Checker* c, CheckItem item) {
   INVALID();
 }
 
-static bool check_fn(SemContext* context, SourceContents source, AST* fn, SemFunc* func_out) {
-  Scratch scratch = global_scratch(1, &context->arena);
-
-  Checker c = {
+static Checker new_checker(SemContext* context, SourceContents source, TokenizedBuffer* tokens, AST* ast, Allocator* scratch_allocator) {
+  return (Checker) {
     .context = context,
     .source = source,
+    .tokens = tokens,
+    .ast = ast,
 
-    .scratch_allocator = scratch.allocator,
+    .scratch_allocator = scratch_allocator,
 
-    .item_stack = new_dynamic_array(scratch.allocator),
-    .value_stack = new_dynamic_array(scratch.allocator),
-    .scope_stack = new_dynamic_array(scratch.allocator),
+    .item_stack = new_dynamic_array(scratch_allocator),
+    .control_stack = new_dynamic_array(scratch_allocator),
+    .value_stack = new_dynamic_array(scratch_allocator),
+    .scope_stack = new_dynamic_array(scratch_allocator)
+  };
+}
 
-    .blocks = new_dynamic_array(context->allocator),
+bool check_fn(SemContext* context, SourceContents source, AST* ast, uint32_t fn, SemFunc* func_out) {
+  Scratch scratch = global_scratch(1, &context->arena);
 
-    .next_value = 1
-  };
+  Checker c = new_checker(context, source, ast->tokens, ast, scratch.allocator);
 
-  assert(fn->num_children == 2);
-  AST* name = fn->children[0];
-  AST* body = fn->children[1];
+  assert(num_children(&c, fn) == 2);
+  uint32_t name = child(&c, fn, 0);
+  uint32_t body = child(&c, fn, 1);
 
-  assert(name->kind == AST_IDENTIFIER);
-  func_out->name = token_string(context, name->token);
+  assert(node_kind(&c, name) == AST_IDENTIFIER);
+  new_func(&c, node_token(&c, fn));
+  c.func.name = token_string(context, token_index(&c, node_token(&c, name)));
 
   push_node(&c, body);
   _new_block(&c);
@@ -555,7 +661,7 @@ static bool check_fn(SemContext* context, SourceContents source, AST* fn, SemFun
     bool result;
 
     #define X(name, ...) case AST_##name: result = check_ast_##name(&c, item); break;
-    switch (item.node->kind) {
+    switch (node_kind(&c, item.node)) {
       default:
         assert(false);
         result = false;
@@ -564,40 +670,43 @@ static bool check_fn(SemContext* context, SourceContents source, AST* fn, SemFun
     }
     #undef X
 
+    // What failed left the value stack short, so nothing after it can be checked
     if (!result) {
       had_error = true;
+      break;
     }
   }
 
   bool ret_val = !had_error;
 
   if (!had_error) {
-    func_out->blocks = c.blocks;
+    *func_out = c.func;
   }
 
   scratch_release(&scratch);
   return ret_val;
 }
 
-SemFile* check_ast(SemContext* context, SourceContents source, AST* ast) {
+static SemFile* check_ast_serial(SemContext* context, SourceContents source, AST* ast) {
   Scratch scratch = global_scratch(1, &context->arena);
 
   SemFile* ret_val = NULL;
 
-  assert(ast->kind == AST_FILE);
+  ASTNode* file = ast_node(ast, ast->root);
+  assert(file->kind == AST_FILE);
   DynamicArray(SemFunc) funcs = new_dynamic_array(scratch.allocator);
 
-  for_range (int, i, ast->num_children) {
-    AST* node = ast->children[i]; 
+  for_range (int, i, (int)file->num_children) {
+    uint32_t node = ast_child(ast, ast->root, i);
 
-    switch (node->kind) {
+    switch (ast_node(ast, node)->kind) {
       default:
         assert(false && "top level statement not handled in check");
         break;
 
       case AST_FN: {
         SemFunc func;
-        if (!check_fn(context, source, node, &func)) {
+        if (!check_fn(context, source, ast, node, &func)) {
           goto end;
         }
         dynamic_array_put(funcs, func);
@@ -607,10 +716,414 @@ SemFile* check_ast(SemContext* context, SourceContents source, AST* ast) {
   }
 
   ret_val = arena_type(context->arena, SemFile);
+  ret_val->tokens = ast->tokens;
   ret_val->num_funcs = dynamic_array_length(funcs);
   ret_val->funcs = dynamic_array_bake(context->arena, funcs);
 
   end:
   scratch_release(&scratch);
   return ret_val;
-}
\ No newline at end of file
+}
+
+// Files with fewer functions than this are not worth the cost of starting threads
+#define PARALLEL_CHECK_THRESHOLD 256
+
+SemFile* check_ast(SemContext* context, SourceContents source, AST* ast) {
+  if (ast_node(ast, ast->root)->num_children >= PARALLEL_CHECK_THRESHOLD) {
+    return check_ast_parallel(context, source, ast, hardware_thread_count());
+  }
+
+  return check_ast_serial(context, source, ast);
+}
+
+// A contiguous run of functions checked by one worker into its own arena
+typedef struct {
+  int first_fn;
+  int num_fns;
+
+  Arena* arena;
+  SemFunc* funcs;
+  DynamicArray(char) errors;
+  volatile bool failed;
+} CheckBatch;
+
+typedef struct {
+  SourceContents source;
+  AST* ast;
+
+  CheckBatch* batches;
+  volatile int num_failed;
+} ParallelCheck;
+
+// Only the first error in the file is reported, so once a batch before this
+// one has failed nothing this one finds matters
+static bool earlier_batch_failed(ParallelCheck* pc, int index) {
+  if (!pc->num_failed) {
+    return false;
+  }
+
+  for_range(int, i, index) {
+    if (pc->batches[i].failed) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void check_batch(void* data, int index) {
+  ParallelCheck* pc = data;
+  CheckBatch* batch = &pc->batches[index];
+
+  batch->arena = new_arena();
+  batch->funcs = arena_array(batch->arena, SemFunc, batch->num_fns);
+
+  SemContext* context = sem_init(batch->arena);
+  batch->errors = new_dynamic_array(context->allocator);
+
+  // The calling thread takes batches too, and may be capturing itself
+  DynamicArray(char)* outer = capture_errors(&batch->errors);
+
+  for_range(int, i, batch->num_fns) {
+    if (earlier_batch_failed(pc, index)) {
+      break;
+    }
+
+    uint32_t node = ast_child(pc->ast, pc->ast->root, batch->first_fn + i);
+
+    if (!check_fn(context, pc->source, pc->ast, node, &batch->funcs[i])) {
+      batch->failed = true;
+      atomic_increment(&pc->num_failed);
+      break;
+    }
+  }
+
+  capture_errors(outer);
+}
+
+// Copies a function out of a worker's arena into the context, with its block
+// lists packed into one allocation each
+static SemFunc adopt_func(SemContext* context, SemFunc* func) {
+  Allocator* allocator = context->allocator;
+
+  char* name = arena_push(context->arena, (func->name.length+1) * sizeof(char));
+  memcpy(name, func->name.str, (func->name.length+1) * sizeof(char));
+
+  SemFunc result = {
+    .name = { .str = name, .length = func->name.length },
+    .first_token = func->first_token,
+    .insts = dynamic_array_copy(allocator, func->insts),
+    .tokens = dynamic_array_copy(allocator, func->tokens),
+    .first_use = dynamic_array_copy(allocator, func->first_use),
+    .replaced_by = dynamic_array_copy(allocator, func->replaced_by),
+    .uses = dynamic_array_copy(allocator, func->uses),
+    .constants = dynamic_array_copy(allocator, func->constants),
+    .blocks = dynamic_array_copy(allocator, func->blocks)
+  };
+
+  int num_blocks = dynamic_array_length(result.blocks);
+  size_t num_block_insts = 0;
+  size_t num_preds = 0;
+
+  for_range(int, b, num_blocks) {
+    num_block_insts += result.blocks[b].num_insts;
+    num_preds += result.blocks[b].num_preds;
+  }
+
+  uint32_t* block_insts = arena_push(context->arena, num_block_insts * sizeof(uint32_t));
+  uint32_t* preds = arena_push(context->arena, num_preds * sizeof(uint32_t));
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &result.blocks[b];
+
+    memcpy(block_insts, block->insts, block->num_insts * sizeof(uint32_t));
+    memcpy(preds, block->preds, block->num_preds * sizeof(uint32_t));
+
+    block->insts = block_insts;
+    block->capacity = block->num_insts;
+    block->preds = preds;
+    block->preds_capacity = block->num_preds;
+
+    block_insts += block->num_insts;
+    preds += block->num_preds;
+  }
+
+  return result;
+}
+
+// Functions are checked independently of each other, so they are checked in
+// batches across threads and copied into the context in source order. Errors
+// are held back until every batch is done, then only the first failed batch's
+// are printed, which are exactly what the serial check would print.
+SemFile* check_ast_parallel(SemContext* context, SourceContents source, AST* ast, int num_threads) {
+  if (num_threads <= 1) {
+    return check_ast_serial(context, source, ast);
+  }
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  SemFile* ret_val = NULL;
+
+  ASTNode* file = ast_node(ast, ast->root);
+  assert(file->kind == AST_FILE);
+
+  int num_fns = (int)file->num_children;
+
+  for_range(int, i, num_fns) {
+    assert(ast_node(ast, ast_child(ast, ast->root, i))->kind == AST_FN && "top level statement not handled in check");
+  }
+
+  int num_batches = count_batches(num_fns, num_threads);
+  CheckBatch* batches = arena_array(scratch.arena, CheckBatch, num_batches);
+
+  for_range(int, i, num_batches) {
+    batch_range(num_fns, num_batches, i, &batches[i].first_fn, &batches[i].num_fns);
+  }
+
+  ParallelCheck pc = {
+    .source = source,
+    .ast = ast,
+    .batches = batches
+  };
+
+  parallel_for(num_threads, num_batches, check_batch, &pc);
+
+  for_range(int, i, num_batches) {
+    if (batches[i].failed) {
+      print_captured_errors(batches[i].errors);
+      goto end;
+    }
+  }
+
+  ret_val = arena_type(context->arena, SemFile);
+  ret_val->tokens = ast->tokens;
+  ret_val->num_funcs = num_fns;
+  ret_val->funcs = arena_array(context->arena, SemFunc, num_fns);
+
+  for_range(int, i, num_batches) {
+    for_range(int, j, batches[i].num_fns) {
+      ret_val->funcs[batches[i].first_fn + j] = adopt_func(context, &batches[i].funcs[j]);
+    }
+  }
+
+  end:
+  for_range(int, i, num_batches) {
+    free_arena(batches[i].arena);
+  }
+
+  scratch_release(&scratch);
+  return ret_val;
+}
+
+// The postorder stream puts every operand before its user, so expressions are
+// lowered straight off the value stack. Control flow records what it needs on
+// the control stack at its markers and takes it back off at its node.
+
+static void push_control(Checker* c, CheckItem item) {
+  dynamic_array_put(c->control_stack, item);
+}
+
+static CheckItem* top_control(Checker* c) {
+  return &dynamic_array_back(c->control_stack);
+}
+
+static CheckItem pop_control(Checker* c) {
+  return dynamic_array_pop(c->control_stack);
+}
+
+static bool check_postorder_node(Checker* c, ASTKind kind, uint32_t token) {
+  switch (kind) {
+    default:
+      error_at_token(c->source, token_index(c, token), "compiler bug(check): was not expecting this '%s' here", ast_kind_string[kind]);
+      return false;
+
+    case AST_INT_LITERAL:
+      lower_int_literal(c, token);
+      return true;
+
+    case AST_IDENTIFIER:
+      return lower_identifier(c, token);
+
+    case AST_LOCAL: // The parser requires 'name: type'
+      return lower_local(c, token, token-1, token+1);
+
+    case AST_ADD:
+      add_inst(c, SEM_OP_ADD, token, 2, 0);
+      return true;
+    case AST_SUB:
+      add_inst(c, SEM_OP_SUB, token, 2, 0);
+      return true;
+    case AST_MUL:
+      add_inst(c, SEM_OP_MUL, token, 2, 0);
+      return true;
+    case AST_DIV:
+      add_inst(c, SEM_OP_DIV, token, 2, 0);
+      return true;
+
+    case AST_ASSIGN: {
+      uint32_t val = pop_value(c);
+      uint32_t dest = pop_value(c);
+
+      if (!assign_dest(c, dest, c->func.first_token + c->func.tokens[dest])) {
+        return false;
+      }
+
+      push_value(c, val);
+      lower_assign(c, token);
+    } return true;
+
+    case AST_INITIALIZE:
+      add_inst(c, SEM_OP_STORE, token, 2, 0);
+      return true;
+
+    case AST_BLOCK:
+      end_scope(c, pop_control(c).data.block.og_stack_count);
+      return true;
+
+    case AST_RETURN:
+      lower_return(c, token);
+      return true;
+
+    case AST_WHILE: {
+      CheckItem item = pop_control(c);
+      end_while(c, token, item.data._while.start_head, item.data._while.start_tail, item.data._while.body_head);
+    } return true;
+
+    case AST_IF: {
+      CheckItem item = pop_control(c);
+
+      if (item.processed == 3) { // Has else
+        end_if_else(c, token, item.data._if.start_tail, item.data._if.then_head, item.data._if.then_tail, item.data._if.else_head);
+      }
+      else {
+        end_if(c, token, item.data._if.start_tail, item.data._if.then_head);
+      }
+    } return true;
+  }
+}
+
+static bool check_postorder_item(Checker* c, PostorderKind kind, ASTKind node_kind, uint32_t token) {
+  switch (kind) {
+    default:
+      assert(false);
+      return false;
+
+    case POSTORDER_NODE:
+      return check_postorder_node(c, node_kind, token);
+
+    case POSTORDER_BLOCK_BEGIN: {
+      CheckItem control = { .data.block.og_stack_count = begin_scope(c) };
+      push_control(c, control);
+    } return true;
+
+    case POSTORDER_WHILE_BEGIN: {
+      CheckItem control = { .data._while.start_head = begin_while(c, token) };
+      push_control(c, control);
+    } return true;
+
+    case POSTORDER_WHILE_BODY: {
+      CheckItem* control = top_control(c);
+      new_block(c, &control->data._while.start_tail, &control->data._while.body_head);
+    } return true;
+
+    case POSTORDER_IF_THEN: {
+      CheckItem control = { .processed = 2 };
+      new_block(c, &control.data._if.start_tail, &control.data._if.then_head);
+      push_control(c, control);
+    } return true;
+
+    case POSTORDER_IF_ELSE: {
+      CheckItem* control = top_control(c);
+      new_block(c, &control->data._if.then_tail, &control->data._if.else_head);
+      control->processed = 3;
+    } return true;
+  }
+}
+
+struct Lowering {
+  Checker c;
+  DynamicArray(SemFunc) funcs;
+};
+
+Lowering* new_lowering(Allocator* allocator, SemContext* context, SourceContents source, TokenizedBuffer* tokens) {
+  Lowering* l = allocator_alloc(allocator, sizeof(Lowering));
+
+  *l = (Lowering) {
+    .c = new_checker(context, source, tokens, NULL, allocator),
+    .funcs = new_dynamic_array(allocator)
+  };
+
+  return l;
+}
+
+// Unlike check_fn this stops at the first error, as everything after it
+// assumes every node before it produced its value
+bool lower_visit(Lowering* l, PostorderKind kind, ASTKind node_kind, uint32_t token) {
+  Checker* c = &l->c;
+
+  if (kind == POSTORDER_FN_BEGIN) {
+    new_func(c, token);
+    c->func.name = token_string(c->context, token_index(c, token + 1)); // 'fn name'
+    _new_block(c);
+
+    return true;
+  }
+
+  if (kind == POSTORDER_NODE) {
+    switch (node_kind) {
+      case AST_FN:
+        dynamic_array_put(l->funcs, c->func);
+        return true;
+
+      case AST_FILE:
+        return true;
+
+      default:
+        break;
+    }
+  }
+
+  return check_postorder_item(c, kind, node_kind, token);
+}
+
+SemFile* lowering_finish(Lowering* l) {
+  SemContext* context = l->c.context;
+
+  SemFile* file = arena_type(context->arena, SemFile);
+  file->tokens = l->c.tokens;
+  file->num_funcs = dynamic_array_length(l->funcs);
+  file->funcs = dynamic_array_bake(context->arena, l->funcs);
+
+  return file;
+}
+
+SemFile* check_postorder(SemContext* context, SourceContents source, AST* ast) {
+  assert(ast->postorder && "parse with PARSE_POSTORDER");
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  SemFile* ret_val = NULL;
+  Lowering* l = new_lowering(scratch.allocator, context, source, ast->tokens);
+
+  for_range(int, i, ast->num_postorder) {
+    PostorderItem item = ast->postorder[i];
+
+    ASTKind node_kind = AST_INVALID;
+    uint32_t token = item.index;
+
+    if (item.kind == POSTORDER_NODE) {
+      node_kind = ast_node(ast, item.index)->kind;
+      token = ast_node(ast, item.index)->token;
+    }
+
+    if (!lower_visit(l, item.kind, node_kind, token)) {
+      goto end;
+    }
+  }
+
+  ret_val = lowering_finish(l);
+
+  end:
+  scratch_release(&scratch);
+  return ret_val;
+}
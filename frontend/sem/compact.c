@@ -0,0 +1,219 @@
+#include "frontend.h"
+
+// Passes leave removed instructions behind, append new ones at the end and
+// move operands around, so IDs stop following the code. This rebuilds a
+// function with its blocks in reverse postorder (unreachable ones last) and
+// its instructions numbered in the order they then appear, so a walk over the
+// code reads every array front to back.
+
+// Instructions no longer in a block can still be read by a register's other
+// copies once out of SSA, so they are kept after the rest, without operands
+static uint32_t number_unplaced(SemFunc* func, uint32_t* new_id, uint32_t* old_id, uint32_t next) {
+  uint32_t num_placed = next;
+
+  for (uint32_t n = 1; n < num_placed; ++n) {
+    uint32_t old = old_id[n];
+
+    for_range(int, j, func->insts[old].num_ins) {
+      uint32_t value = sem_operand(func, old, j);
+
+      if (value && !new_id[value]) {
+        new_id[value] = next;
+        old_id[next++] = value;
+      }
+    }
+  }
+
+  return next;
+}
+
+void sem_compact(SemContext* context, SemFunc* func) {
+  Scratch scratch = global_scratch(1, &context->arena);
+  Allocator* allocator = context->allocator;
+
+  sem_rpo(context, func);
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  int num_insts = dynamic_array_length(func->insts);
+
+  uint32_t* block_order = arena_push(scratch.arena, num_blocks * sizeof(uint32_t));
+  uint32_t* new_block = arena_push(scratch.arena, num_blocks * sizeof(uint32_t));
+
+  memcpy(block_order, func->rpo, func->num_rpo * sizeof(uint32_t));
+  uint32_t num_ordered = func->num_rpo;
+
+  for_range(int, b, num_blocks) {
+    if (func->rpo_index[b] == SEM_UNREACHABLE) {
+      block_order[num_ordered++] = b;
+    }
+  }
+
+  for_range(int, b, num_blocks) {
+    new_block[block_order[b]] = b;
+  }
+
+  // 0 stays the ID of no value
+  uint32_t* new_id = arena_array(scratch.arena, uint32_t, num_insts);
+  uint32_t* old_id = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+  uint32_t next = 1;
+
+  size_t num_block_insts = 0;
+  size_t num_preds = 0;
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[block_order[b]];
+
+    for_range(uint32_t, i, block->num_insts) {
+      new_id[block->insts[i]] = next;
+      old_id[next++] = block->insts[i];
+    }
+
+    num_block_insts += block->num_insts;
+    num_preds += block->num_preds;
+  }
+
+  uint32_t num_placed = next;
+  next = number_unplaced(func, new_id, old_id, next);
+
+  DynamicArray(SemInst) insts = new_dynamic_array(allocator);
+  DynamicArray(uint32_t) tokens = new_dynamic_array(allocator);
+  DynamicArray(uint32_t) first_use = new_dynamic_array(allocator);
+  DynamicArray(uint32_t) replaced_by = new_dynamic_array(allocator);
+  DynamicArray(SemUse) uses = new_dynamic_array(allocator);
+  DynamicArray(uint64_t) constants = new_dynamic_array(allocator);
+  DynamicArray(SemBlock) blocks = new_dynamic_array(allocator);
+
+  dynamic_array_reserve(insts, next);
+  dynamic_array_reserve(tokens, next);
+  dynamic_array_reserve(first_use, next);
+  dynamic_array_reserve(replaced_by, next);
+  dynamic_array_reserve(blocks, num_blocks);
+
+  SemInst none = {0};
+  dynamic_array_put(insts, none);
+  dynamic_array_put(tokens, 0);
+
+  // Operands can come before their value, in phis
+  for_range(uint32_t, n, next) {
+    dynamic_array_put(first_use, 0);
+    dynamic_array_put(replaced_by, 0);
+  }
+
+  SemUse no_use = {0};
+  dynamic_array_put(uses, no_use);
+
+  for (uint32_t n = 1; n < next; ++n) {
+    uint32_t old = old_id[n];
+    SemInst* in = &func->insts[old];
+
+    SemInst inst = {
+      .op = in->op,
+      .num_ins = n < num_placed ? in->num_ins : 0,
+      .block = n < num_placed ? new_block[in->block] : 0,
+      .ins = dynamic_array_length(uses),
+      .data = in->data
+    };
+
+    if (in->op == SEM_OP_INT_CONST) {
+      inst.data = dynamic_array_length(constants);
+      dynamic_array_put(constants, func->constants[in->data]);
+    }
+
+    // Appended to the end of each value's list, so uses stay in code order
+    for_range(int, j, inst.num_ins) {
+      uint32_t value = new_id[sem_operand(func, old, j)];
+      uint32_t use = dynamic_array_length(uses);
+
+      SemUse u = {
+        .value = value,
+        .user = n,
+        .prev = use,
+        .next = use
+      };
+
+      if (value && first_use[value]) {
+        uint32_t head = first_use[value];
+        uint32_t tail = uses[head].prev;
+
+        u.prev = tail;
+        u.next = head;
+        uses[tail].next = use;
+        uses[head].prev = use;
+      }
+      else if (value) {
+        first_use[value] = use;
+      }
+
+      dynamic_array_put(uses, u);
+    }
+
+    dynamic_array_put(insts, inst);
+    dynamic_array_put(tokens, func->tokens[old]);
+  }
+
+  // Every block's instructions and predecessors in one allocation each
+  uint32_t* block_insts = arena_push(context->arena, num_block_insts * sizeof(uint32_t));
+  uint32_t* preds = arena_push(context->arena, num_preds * sizeof(uint32_t));
+
+  for_range(int, b, num_blocks) {
+    SemBlock* old = &func->blocks[block_order[b]];
+
+    SemBlock block = {
+      .insts = block_insts,
+      .num_insts = old->num_insts,
+      .capacity = old->num_insts,
+      .num_succs = old->num_succs,
+      .preds = preds,
+      .num_preds = old->num_preds,
+      .preds_capacity = old->num_preds
+    };
+
+    for_range(uint32_t, i, old->num_insts) {
+      block_insts[i] = new_id[old->insts[i]];
+    }
+
+    for_range(uint32_t, i, old->num_succs) {
+      block.succs[i] = new_block[old->succs[i]];
+    }
+
+    for_range(uint32_t, i, old->num_preds) {
+      preds[i] = new_block[old->preds[i]];
+    }
+
+    block_insts += old->num_insts;
+    preds += old->num_preds;
+
+    dynamic_array_put(blocks, block);
+  }
+
+  if (func->regs) {
+    uint32_t* regs = arena_push(context->arena, next * sizeof(uint32_t));
+    regs[0] = 0;
+
+    for (uint32_t n = 1; n < next; ++n) {
+      regs[n] = func->regs[old_id[n]];
+    }
+
+    func->regs = regs;
+  }
+
+  free_dynamic_array(func->insts);
+  free_dynamic_array(func->tokens);
+  free_dynamic_array(func->first_use);
+  free_dynamic_array(func->replaced_by);
+  free_dynamic_array(func->uses);
+  free_dynamic_array(func->constants);
+  free_dynamic_array(func->blocks);
+
+  func->insts = insts;
+  func->tokens = tokens;
+  func->first_use = first_use;
+  func->replaced_by = replaced_by;
+  func->uses = uses;
+  func->constants = constants;
+  func->blocks = blocks;
+
+  sem_invalidate_cfg(func);
+
+  scratch_release(&scratch);
+}
@@ -0,0 +1,276 @@
+#include "frontend.h"
+
+// Dead code elimination. Blocks the entry can't reach are dropped and the rest
+// renumbered, then stores no load can see are marked dead, and everything that
+// nothing with an effect needs is swept along with them.
+
+#define NO_SLOT UINT32_MAX
+
+int sem_remove_unreachable(SemContext* context, SemFunc* func) {
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  uint64_t* reachable = sem_reachable(context, scratch.arena, func);
+
+  if ((int)func->num_rpo == num_blocks) {
+    scratch_release(&scratch);
+    return 0;
+  }
+
+  uint64_t* dead = arena_array(scratch.arena, uint64_t, bitset_num_u64(dynamic_array_length(func->insts)));
+
+  // Cutting the edges out of them also drops the phi operands they fed
+  for_range(int, b, num_blocks) {
+    if (bitset_query(reachable, b)) {
+      continue;
+    }
+
+    SemBlock* block = &func->blocks[b];
+
+    for_range_rev(int, s, (int)block->num_succs) {
+      sem_remove_edge(func, b, s);
+    }
+
+    for_range(uint32_t, i, block->num_insts) {
+      bitset_set(dead, block->insts[i]);
+    }
+  }
+
+  sem_sweep(func, dead);
+
+  uint32_t* new_block = arena_push(scratch.arena, num_blocks * sizeof(uint32_t));
+  int num_kept = 0;
+
+  for_range(int, b, num_blocks) {
+    if (bitset_query(reachable, b)) {
+      new_block[b] = num_kept;
+      func->blocks[num_kept++] = func->blocks[b];
+    }
+  }
+
+  for_range(int, b, num_kept) {
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_insts) {
+      func->insts[block->insts[i]].block = b;
+    }
+
+    for_range(uint32_t, i, block->num_succs) {
+      block->succs[i] = new_block[block->succs[i]];
+    }
+
+    for_range(uint32_t, i, block->num_preds) {
+      block->preds[i] = new_block[block->preds[i]];
+    }
+  }
+
+  dynamic_array_resize(func->blocks, num_kept);
+  sem_invalidate_cfg(func);
+
+  scratch_release(&scratch);
+  return num_blocks - num_kept;
+}
+
+// Which local a load or store is of, NO_SLOT if it isn't one of the tracked
+static uint32_t slot_of(SemFunc* func, uint32_t* slot, uint32_t inst) {
+  SemOp op = func->insts[inst].op;
+
+  if (op != SEM_OP_LOAD && op != SEM_OP_STORE) {
+    return NO_SLOT;
+  }
+
+  return slot[sem_operand(func, inst, 0)];
+}
+
+// Backwards liveness of locals, where a load reads one and a store overwrites
+// it. A store to a local that isn't live after it is never read.
+static int mark_dead_stores(SemContext* context, SemFunc* func, Scratch* scratch, uint64_t* dead) {
+  int num_blocks = dynamic_array_length(func->blocks);
+  int num_insts = dynamic_array_length(func->insts);
+
+  uint32_t* slot = arena_push(scratch->arena, num_insts * sizeof(uint32_t));
+  uint32_t num_locals = 0;
+
+  for_range(int, i, num_insts) {
+    slot[i] = NO_SLOT;
+
+    if (func->insts[i].op == SEM_OP_LOCAL && sem_is_promotable(func, i)) {
+      slot[i] = num_locals++;
+    }
+  }
+
+  if (!num_locals) {
+    return 0;
+  }
+
+  size_t words = bitset_num_u64(num_locals);
+
+  // Per block, loaded before any store in it, stored in it, and live on entry
+  uint64_t* gen = arena_array(scratch->arena, uint64_t, num_blocks * words);
+  uint64_t* kill = arena_array(scratch->arena, uint64_t, num_blocks * words);
+  uint64_t* live_in = arena_array(scratch->arena, uint64_t, num_blocks * words);
+  uint64_t* live = arena_push(scratch->arena, words * sizeof(uint64_t));
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    for_range_rev(int, i, (int)block->num_insts) {
+      uint32_t inst = block->insts[i];
+      uint32_t s = slot_of(func, slot, inst);
+
+      if (s == NO_SLOT) {
+        continue;
+      }
+
+      if (func->insts[inst].op == SEM_OP_STORE) {
+        bitset_unset(gen + b * words, s);
+        bitset_set(kill + b * words, s);
+      }
+      else if (func->first_use[inst]) {
+        bitset_set(gen + b * words, s);
+      }
+    }
+  }
+
+  // In postorder, so most successors are done before their predecessors
+  sem_rpo(context, func);
+
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    for_range_rev(int, r, (int)func->num_rpo) {
+      uint32_t b = func->rpo[r];
+      SemBlock* block = &func->blocks[b];
+
+      for_range(size_t, w, words) {
+        uint64_t out = 0;
+
+        for_range(uint32_t, s, block->num_succs) {
+          out |= live_in[block->succs[s] * words + w];
+        }
+
+        uint64_t in = gen[b * words + w] | (out & ~kill[b * words + w]);
+        changed |= in != live_in[b * words + w];
+        live_in[b * words + w] = in;
+      }
+    }
+  }
+
+  int num_dead = 0;
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+    memset(live, 0, words * sizeof(uint64_t));
+
+    for_range(uint32_t, s, block->num_succs) {
+      for_range(size_t, w, words) {
+        live[w] |= live_in[block->succs[s] * words + w];
+      }
+    }
+
+    for_range_rev(int, i, (int)block->num_insts) {
+      uint32_t inst = block->insts[i];
+      uint32_t s = slot_of(func, slot, inst);
+
+      if (s == NO_SLOT) {
+        continue;
+      }
+
+      if (func->insts[inst].op == SEM_OP_LOAD) {
+        if (func->first_use[inst]) {
+          bitset_set(live, s);
+        }
+
+        continue;
+      }
+
+      if (!bitset_query(live, s)) {
+        bitset_set(dead, inst);
+        num_dead++;
+      }
+
+      bitset_unset(live, s);
+    }
+  }
+
+  return num_dead;
+}
+
+// Marks what terminators, live stores and divisions that may trap need, directly or through others,
+// and the rest dead
+static int mark_unused(SemFunc* func, Scratch* scratch, uint64_t* dead) {
+  int num_insts = dynamic_array_length(func->insts);
+
+  uint64_t* needed = arena_array(scratch->arena, uint64_t, bitset_num_u64(num_insts));
+  DynamicArray(uint32_t) work = new_dynamic_array(scratch->allocator);
+
+  for_range(int, b, dynamic_array_length(func->blocks)) {
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_insts) {
+      uint32_t inst = block->insts[i];
+      SemOp op = func->insts[inst].op;
+
+      if (!bitset_query(dead, inst) && (sem_is_terminator(op) || op == SEM_OP_STORE || sem_may_trap(func, inst))) {
+        bitset_set(needed, inst);
+        dynamic_array_put(work, inst);
+      }
+    }
+  }
+
+  while (dynamic_array_length(work)) {
+    uint32_t inst = dynamic_array_pop(work);
+
+    for_range(int, i, func->insts[inst].num_ins) {
+      uint32_t value = sem_operand(func, inst, i);
+
+      if (value && !bitset_query(needed, value)) {
+        bitset_set(needed, value);
+        dynamic_array_put(work, value);
+      }
+    }
+  }
+
+  int num_dead = 0;
+
+  for_range(int, b, dynamic_array_length(func->blocks)) {
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_insts) {
+      uint32_t inst = block->insts[i];
+
+      if (!bitset_query(needed, inst) && !bitset_query(dead, inst)) {
+        bitset_set(dead, inst);
+        num_dead++;
+      }
+    }
+  }
+
+  return num_dead;
+}
+
+SemDeadCounts sem_eliminate_dead_code(SemContext* context, SemFunc* func) {
+  assert(!func->regs);
+
+  SemDeadCounts counts = {0};
+
+  if (!dynamic_array_length(func->blocks)) {
+    return counts;
+  }
+
+  counts.blocks = sem_remove_unreachable(context, func);
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  uint64_t* dead = arena_array(scratch.arena, uint64_t, bitset_num_u64(dynamic_array_length(func->insts)));
+
+  counts.stores = mark_dead_stores(context, func, &scratch, dead);
+  counts.insts = mark_unused(func, &scratch, dead);
+
+  sem_sweep(func, dead);
+
+  scratch_release(&scratch);
+  return counts;
+}
@@ -0,0 +1,212 @@
+#include "frontend.h"
+
+// Cooper, Harvey and Kennedy's iterative algorithm. Blocks are compared by
+// their reverse postorder position, so walking up from two blocks meets at
+// their common dominator.
+static uint32_t intersect(uint32_t* doms, uint32_t a, uint32_t b) {
+  while (a != b) {
+    while (a > b) {
+      a = doms[a];
+    }
+
+    while (b > a) {
+      b = doms[b];
+    }
+  }
+
+  return a;
+}
+
+SemDominators* sem_dominators(SemContext* context, SemFunc* func) {
+  sem_rpo(context, func);
+
+  if (func->dom) {
+    return func->dom;
+  }
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  uint32_t num_rpo = func->num_rpo;
+
+  // Indexed by reverse postorder position
+  uint32_t* doms = arena_push(scratch.arena, num_rpo * sizeof(uint32_t));
+
+  for_range(uint32_t, i, num_rpo) {
+    doms[i] = SEM_UNREACHABLE;
+  }
+
+  if (num_rpo) {
+    doms[0] = 0;
+  }
+
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    for (uint32_t i = 1; i < num_rpo; ++i) {
+      SemBlock* b = &func->blocks[func->rpo[i]];
+      uint32_t new_idom = SEM_UNREACHABLE;
+
+      for_range(uint32_t, j, b->num_preds) {
+        uint32_t p = func->rpo_index[b->preds[j]];
+
+        if (p == SEM_UNREACHABLE || doms[p] == SEM_UNREACHABLE) {
+          continue;
+        }
+
+        new_idom = new_idom == SEM_UNREACHABLE ? p : intersect(doms, p, new_idom);
+      }
+
+      if (doms[i] != new_idom) {
+        doms[i] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  SemDominators* dom = arena_type(context->arena, SemDominators);
+  dom->idom = arena_push(context->arena, num_blocks * sizeof(uint32_t));
+  dom->first_child = arena_array(context->arena, uint32_t, num_blocks + 1);
+  dom->children = arena_push(context->arena, num_rpo * sizeof(uint32_t));
+  dom->pre = arena_push(context->arena, num_blocks * sizeof(uint32_t));
+  dom->post = arena_push(context->arena, num_blocks * sizeof(uint32_t));
+
+  for_range(int, i, num_blocks) {
+    dom->idom[i] = SEM_UNREACHABLE;
+    dom->pre[i] = SEM_UNREACHABLE;
+    dom->post[i] = SEM_UNREACHABLE;
+  }
+
+  for_range(uint32_t, i, num_rpo) {
+    dom->idom[func->rpo[i]] = func->rpo[doms[i]];
+  }
+
+  // Children grouped by parent, in reverse postorder
+  for (uint32_t i = 1; i < num_rpo; ++i) {
+    dom->first_child[dom->idom[func->rpo[i]] + 1]++;
+  }
+
+  for_range(int, i, num_blocks) {
+    dom->first_child[i + 1] += dom->first_child[i];
+  }
+
+  uint32_t* fill = arena_push(scratch.arena, num_blocks * sizeof(uint32_t));
+  memcpy(fill, dom->first_child, num_blocks * sizeof(uint32_t));
+
+  for (uint32_t i = 1; i < num_rpo; ++i) {
+    uint32_t b = func->rpo[i];
+    dom->children[fill[dom->idom[b]]++] = b;
+  }
+
+  // Interval numbering from a walk of the tree
+  if (num_rpo) {
+    typedef struct {
+      uint32_t block;
+      uint32_t next_child;
+    } Visit;
+
+    DynamicArray(Visit) stack = new_dynamic_array(scratch.allocator);
+    dynamic_array_put(stack, ((Visit){ .block = func->rpo[0] }));
+
+    uint32_t clock = 0;
+    dom->pre[func->rpo[0]] = clock++;
+
+    while (dynamic_array_length(stack)) {
+      Visit* top = &dynamic_array_back(stack);
+
+      if (dom->first_child[top->block] + top->next_child < dom->first_child[top->block + 1]) {
+        uint32_t child = dom->children[dom->first_child[top->block] + top->next_child++];
+        dom->pre[child] = clock++;
+        dynamic_array_put(stack, ((Visit){ .block = child }));
+      }
+      else {
+        dom->post[top->block] = clock++;
+        (void)dynamic_array_pop(stack);
+      }
+    }
+  }
+
+  func->dom = dom;
+
+  scratch_release(&scratch);
+  return dom;
+}
+
+// A join point is in the frontier of every block on the way up from each of
+// its predecessors to its immediate dominator
+SemDominators* sem_dominance_frontiers(SemContext* context, SemFunc* func) {
+  SemDominators* dom = sem_dominators(context, func);
+
+  if (dom->first_frontier) {
+    return dom;
+  }
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  typedef struct {
+    uint32_t block;
+    uint32_t frontier;
+  } Entry;
+
+  DynamicArray(Entry) entries = new_dynamic_array(scratch.allocator);
+
+  // The last join added to each block's frontier, as a join is found once
+  // per predecessor
+  uint32_t* last = arena_push(scratch.arena, num_blocks * sizeof(uint32_t));
+
+  for_range(int, i, num_blocks) {
+    last[i] = SEM_UNREACHABLE;
+  }
+
+  for_range(uint32_t, i, func->num_rpo) {
+    uint32_t b = func->rpo[i];
+    SemBlock* block = &func->blocks[b];
+
+    if (block->num_preds < 2) {
+      continue;
+    }
+
+    for_range(uint32_t, j, block->num_preds) {
+      uint32_t runner = block->preds[j];
+
+      if (dom->idom[runner] == SEM_UNREACHABLE) {
+        continue;
+      }
+
+      while (runner != dom->idom[b] && last[runner] != b) {
+        Entry entry = { runner, b };
+        dynamic_array_put(entries, entry);
+
+        last[runner] = b;
+        runner = dom->idom[runner];
+      }
+    }
+  }
+
+  int num_entries = dynamic_array_length(entries);
+
+  dom->first_frontier = arena_array(context->arena, uint32_t, num_blocks + 1);
+  dom->frontiers = arena_push(context->arena, num_entries * sizeof(uint32_t));
+
+  for_range(int, i, num_entries) {
+    dom->first_frontier[entries[i].block + 1]++;
+  }
+
+  for_range(int, i, num_blocks) {
+    dom->first_frontier[i + 1] += dom->first_frontier[i];
+  }
+
+  uint32_t* fill = arena_push(scratch.arena, num_blocks * sizeof(uint32_t));
+  memcpy(fill, dom->first_frontier, num_blocks * sizeof(uint32_t));
+
+  for_range(int, i, num_entries) {
+    dom->frontiers[fill[entries[i].block]++] = entries[i].frontier;
+  }
+
+  scratch_release(&scratch);
+  return dom;
+}
@@ -0,0 +1,167 @@
+#include "frontend.h"
+
+// Global value numbering over the dominator tree. Blocks are visited in
+// preorder, so by the time a block is reached every block that dominates it
+// has been, and a pure instruction that matches one from a dominating block
+// is replaced by it. Pure instructions are hash-consed by op, operands and
+// constant, with commutative operands put in ID order first.
+
+typedef struct {
+  SemFunc* func;
+
+  uint32_t capacity; // A power of two
+  uint32_t* table; // Instructions, 0 if empty
+} ValueTable;
+
+static bool is_numbered(SemOp op) {
+  switch (op) {
+    default:
+      return false;
+
+    // Dividing by zero traps, but an identical division in a dominating block
+    // would have trapped first
+    case SEM_OP_INT_CONST:
+    case SEM_OP_ADD:
+    case SEM_OP_SUB:
+    case SEM_OP_MUL:
+    case SEM_OP_DIV:
+    case SEM_OP_UNDEF:
+    case SEM_OP_PHI:
+      return true;
+  }
+}
+
+static bool is_commutative(SemOp op) {
+  return op == SEM_OP_ADD || op == SEM_OP_MUL;
+}
+
+static uint64_t hash_value(SemFunc* func, uint32_t inst) {
+  SemInst* in = sem_inst(func, inst);
+  uint64_t hash = fnv1a_hash(&in->op, sizeof(in->op));
+
+  // Phis in different blocks merge different edges, so are never the same
+  if (in->op == SEM_OP_PHI) {
+    hash = (hash ^ in->block) * 0x100000001b3;
+  }
+
+  if (in->op == SEM_OP_INT_CONST) {
+    hash = (hash ^ func->constants[in->data]) * 0x100000001b3;
+  }
+
+  for_range(int, i, in->num_ins) {
+    hash = (hash ^ sem_operand(func, inst, i)) * 0x100000001b3;
+  }
+
+  // Multiplying only carries bits upwards, so fold the top into the bottom
+  return hash ^ (hash >> 32);
+}
+
+static bool same_value(SemFunc* func, uint32_t a, uint32_t b) {
+  SemInst* x = sem_inst(func, a);
+  SemInst* y = sem_inst(func, b);
+
+  if (x->op != y->op || x->num_ins != y->num_ins) {
+    return false;
+  }
+
+  if (x->op == SEM_OP_PHI && x->block != y->block) {
+    return false;
+  }
+
+  if (x->op == SEM_OP_INT_CONST && func->constants[x->data] != func->constants[y->data]) {
+    return false;
+  }
+
+  for_range(int, i, x->num_ins) {
+    if (sem_operand(func, a, i) != sem_operand(func, b, i)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// The slot holding a value the same as inst, or the empty slot it would go in
+static uint32_t find_slot(ValueTable* t, uint32_t inst) {
+  uint32_t mask = t->capacity - 1;
+  uint32_t i = (uint32_t)hash_value(t->func, inst) & mask;
+
+  while (t->table[i] && !same_value(t->func, t->table[i], inst)) {
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+int sem_number_values(SemContext* context, SemFunc* func) {
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  int num_insts = dynamic_array_length(func->insts);
+
+  if (!num_blocks) {
+    scratch_release(&scratch);
+    return 0;
+  }
+
+  SemDominators* dom = sem_dominators(context, func);
+
+  // Every value gets at most one slot, and the table stays at most half full
+  ValueTable t = { .func = func, .capacity = 16 };
+
+  while (t.capacity < 2 * (uint32_t)num_insts) {
+    t.capacity *= 2;
+  }
+
+  t.table = arena_array(scratch.arena, uint32_t, t.capacity);
+
+  uint64_t* dead = arena_array(scratch.arena, uint64_t, bitset_num_u64(num_insts));
+  DynamicArray(uint32_t) stack = new_dynamic_array(scratch.allocator);
+
+  int num_replaced = 0;
+
+  dynamic_array_put(stack, func->rpo[0]);
+
+  while (dynamic_array_length(stack)) {
+    uint32_t b = dynamic_array_pop(stack);
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_insts) {
+      uint32_t inst = block->insts[i];
+      SemOp op = func->insts[inst].op;
+
+      if (!is_numbered(op)) {
+        continue;
+      }
+
+      if (is_commutative(op) && sem_operand(func, inst, 0) > sem_operand(func, inst, 1)) {
+        uint32_t x = sem_operand(func, inst, 0);
+        sem_set_operand(func, inst, 0, sem_operand(func, inst, 1));
+        sem_set_operand(func, inst, 1, x);
+      }
+
+      uint32_t slot = find_slot(&t, inst);
+      uint32_t existing = t.table[slot];
+
+      // One from a block off to the side is never seen again once the walk
+      // has left its subtree, so this one takes its place
+      if (existing && sem_dominates(func, func->insts[existing].block, b)) {
+        sem_replace_all_uses_with(func, inst, existing);
+        bitset_set(dead, inst);
+        num_replaced++;
+      }
+      else {
+        t.table[slot] = inst;
+      }
+    }
+
+    for (uint32_t c = dom->first_child[b]; c < dom->first_child[b+1]; ++c) {
+      dynamic_array_put(stack, dom->children[c]);
+    }
+  }
+
+  sem_sweep(func, dead);
+
+  scratch_release(&scratch);
+  return num_replaced;
+}
@@ -0,0 +1,369 @@
+#include "frontend.h"
+
+// Induction variables. A basic one is a header phi that comes back round the
+// latch plus or minus the same invariant amount, and a derived one is a basic
+// one plus, minus or times an invariant. A multiplication is strength reduced
+// into a variable of its own that goes up by its share of the step. When a
+// loop's only exit tests a basic variable against a constant it reaches, how
+// many times it goes round is known, and with it what every variable that
+// starts and steps by a constant leaves the loop as.
+
+static bool is_invariant(SemFunc* func, SemLoops* loops, uint32_t loop, uint32_t value) {
+  return !sem_loop_contains(loops, loop, func->insts[value].block);
+}
+
+static bool as_induction(SemFunc* func, SemLoops* loops, uint32_t loop, uint32_t phi, SemInduction* var) {
+  SemLoop* l = &loops->loops[loop];
+  SemBlock* header = &func->blocks[l->header];
+
+  if (func->insts[phi].op != SEM_OP_PHI || func->insts[phi].block != l->header) {
+    return false;
+  }
+
+  if (l->preheader == SEM_NO_BLOCK || l->latch == SEM_NO_BLOCK || header->num_preds != 2) {
+    return false;
+  }
+
+  int back = header->preds[0] == l->latch ? 0 : 1;
+  uint32_t next = sem_operand(func, phi, back);
+  SemOp op = func->insts[next].op;
+
+  if (op != SEM_OP_ADD && op != SEM_OP_SUB) {
+    return false;
+  }
+
+  uint32_t a = sem_operand(func, next, 0);
+  uint32_t b = sem_operand(func, next, 1);
+
+  if (op == SEM_OP_ADD && b == phi) {
+    b = a;
+    a = phi;
+  }
+
+  if (a != phi || !is_invariant(func, loops, loop, b)) {
+    return false;
+  }
+
+  *var = (SemInduction) {
+    .phi = phi,
+    .init = sem_operand(func, phi, 1 - back),
+    .next = next,
+    .step = b,
+    .decreasing = op == SEM_OP_SUB
+  };
+
+  return true;
+}
+
+DynamicArray(SemInduction) sem_find_inductions(Allocator* allocator, SemFunc* func, SemLoops* loops, uint32_t loop) {
+  DynamicArray(SemInduction) vars = new_dynamic_array(allocator);
+  SemBlock* header = &func->blocks[loops->loops[loop].header];
+
+  for (uint32_t i = 0; i < header->num_insts && func->insts[header->insts[i]].op == SEM_OP_PHI; ++i) {
+    SemInduction var;
+
+    if (as_induction(func, loops, loop, header->insts[i], &var)) {
+      dynamic_array_put(vars, var);
+    }
+  }
+
+  return vars;
+}
+
+static bool constant_of(SemFunc* func, uint32_t value, uint64_t* constant) {
+  SemInst* in = sem_inst(func, value);
+
+  if (in->op != SEM_OP_INT_CONST) {
+    return false;
+  }
+
+  *constant = func->constants[in->data];
+  return true;
+}
+
+// A phi plus or minus a constant
+static bool offset_of(SemFunc* func, uint32_t value, uint32_t* phi, uint64_t* offset) {
+  SemInst* in = sem_inst(func, value);
+  uint64_t c;
+
+  if (in->op == SEM_OP_PHI) {
+    *phi = value;
+    *offset = 0;
+    return true;
+  }
+
+  if (in->op != SEM_OP_ADD && in->op != SEM_OP_SUB) {
+    return false;
+  }
+
+  uint32_t a = sem_operand(func, value, 0);
+  uint32_t b = sem_operand(func, value, 1);
+
+  if (in->op == SEM_OP_ADD && constant_of(func, a, &c)) {
+    a = b;
+  }
+  else if (constant_of(func, b, &c)) {
+    c = in->op == SEM_OP_SUB ? 0 - c : c;
+  }
+  else {
+    return false;
+  }
+
+  if (func->insts[a].op != SEM_OP_PHI) {
+    return false;
+  }
+
+  *phi = a;
+  *offset = c;
+  return true;
+}
+
+bool sem_trip_count(SemFunc* func, SemLoops* loops, uint32_t loop, SemInduction* var, uint64_t* count) {
+  SemLoop* l = &loops->loops[loop];
+
+  if (l->latch == SEM_NO_BLOCK) {
+    return false;
+  }
+
+  // Leaving from anywhere but the latch would be part way round
+  for_range(uint32_t, i, l->num_blocks) {
+    uint32_t b = loops->blocks[l->first_block + i];
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, s, block->num_succs) {
+      if (b != l->latch && !sem_loop_contains(loops, loop, block->succs[s])) {
+        return false;
+      }
+    }
+  }
+
+  SemBlock* latch = &func->blocks[l->latch];
+  uint32_t end = latch->insts[latch->num_insts-1];
+
+  if (func->insts[end].op != SEM_OP_BRANCH || latch->succs[0] != l->header || sem_loop_contains(loops, loop, latch->succs[1])) {
+    return false;
+  }
+
+  // Going round while the tested value minus a constant isn't zero
+  uint32_t tested = sem_operand(func, end, 0);
+  uint64_t bound = 0;
+
+  if (func->insts[tested].op == SEM_OP_SUB) {
+    uint32_t a = sem_operand(func, tested, 0);
+    uint32_t b = sem_operand(func, tested, 1);
+
+    if (constant_of(func, b, &bound)) {
+      tested = a;
+    }
+    else if (constant_of(func, a, &bound)) {
+      tested = b;
+    }
+  }
+
+  uint32_t phi;
+  uint64_t offset;
+  uint64_t init, step;
+
+  if (!offset_of(func, tested, &phi, &offset) || !as_induction(func, loops, loop, phi, var)) {
+    return false;
+  }
+
+  if (!constant_of(func, var->init, &init) || !constant_of(func, var->step, &step)) {
+    return false;
+  }
+
+  int64_t limit = (int64_t)1 << 30;
+  int64_t s = (int64_t)step;
+
+  if (s == 0 || s <= -limit || s >= limit) {
+    return false;
+  }
+
+  s = var->decreasing ? -s : s;
+
+  // Wrapping round is fine, the interpreter does too, as long as the first
+  // time it lands on the bound is the one found
+  int64_t distance = (int64_t)(bound - init - offset);
+
+  if (distance == INT64_MIN || distance % s) {
+    return false;
+  }
+
+  int64_t k = distance / s;
+
+  if (k < 0 || k >= limit) {
+    return false;
+  }
+
+  *count = k + 1;
+  return true;
+}
+
+static uint32_t insert_before_end(SemContext* context, SemFunc* func, uint32_t block, uint32_t inst) {
+  sem_block_insert(context->arena, func, block, func->blocks[block].num_insts-1, inst);
+  return inst;
+}
+
+static uint32_t new_binary(SemFunc* func, SemOp op, uint32_t token, uint32_t a, uint32_t b) {
+  uint32_t inst = sem_new_inst(func, op, token, 2, 0);
+  sem_set_operand(func, inst, 0, a);
+  sem_set_operand(func, inst, 1, b);
+  return inst;
+}
+
+// A variable of its own for var times factor, starting at its share of the
+// start and stepping by its share of the step
+static uint32_t reduce(SemContext* context, SemFunc* func, SemLoop* loop, SemInduction* var, uint32_t factor, uint32_t token) {
+  uint32_t init = insert_before_end(context, func, loop->preheader, new_binary(func, SEM_OP_MUL, token, var->init, factor));
+  uint32_t step = insert_before_end(context, func, loop->preheader, new_binary(func, SEM_OP_MUL, token, var->step, factor));
+
+  SemBlock* header = &func->blocks[loop->header];
+  uint32_t phi = sem_new_inst(func, SEM_OP_PHI, token, header->num_preds, 0);
+
+  SemOp op = var->decreasing ? SEM_OP_SUB : SEM_OP_ADD;
+  uint32_t next = insert_before_end(context, func, loop->latch, new_binary(func, op, token, phi, step));
+
+  for_range(uint32_t, i, header->num_preds) {
+    sem_set_operand(func, phi, i, header->preds[i] == loop->latch ? next : init);
+  }
+
+  sem_block_insert(context->arena, func, loop->header, 0, phi);
+  return phi;
+}
+
+// Where a use is, or for a phi, the block it merges into
+static uint32_t user_block(SemFunc* func, uint32_t use) {
+  return func->insts[func->uses[use].user].block;
+}
+
+static int replace_exit_uses(SemContext* context, SemFunc* func, SemLoops* loops, uint32_t loop, uint32_t value, uint64_t exit_value, DynamicArray(uint32_t)* uses) {
+  dynamic_array_clear(*uses);
+
+  for (uint32_t use = func->first_use[value]; use; use = sem_next_use(func, value, use)) {
+    if (!sem_loop_contains(loops, loop, user_block(func, use))) {
+      dynamic_array_put(*uses, use);
+    }
+  }
+
+  if (!dynamic_array_length(*uses)) {
+    return 0;
+  }
+
+  uint32_t c = insert_before_end(context, func, loops->loops[loop].preheader, sem_new_constant(func, func->tokens[value], exit_value));
+
+  for_range(int, i, dynamic_array_length(*uses)) {
+    uint32_t use = (*uses)[i];
+    uint32_t user = func->uses[use].user;
+
+    sem_set_operand(func, user, use - func->insts[user].ins, c);
+  }
+
+  return dynamic_array_length(*uses);
+}
+
+SemInductionCounts sem_simplify_inductions(SemContext* context, SemFunc* func) {
+  SemInductionCounts counts = {0};
+
+  if (!dynamic_array_length(func->blocks)) {
+    return counts;
+  }
+
+  sem_insert_preheaders(context, func);
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  SemLoops* loops = sem_find_loops(context, scratch.arena, func);
+  int num_insts = dynamic_array_length(func->insts);
+
+  // Per phi, one more than the loop it is a basic variable of, and which
+  uint32_t* var_loop = arena_array(scratch.arena, uint32_t, num_insts);
+  uint32_t* var_index = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+
+  DynamicArray(uint32_t) muls = new_dynamic_array(scratch.allocator);
+  DynamicArray(uint32_t) uses = new_dynamic_array(scratch.allocator);
+
+  for_range(int, l, loops->num_loops) {
+    SemLoop* loop = &loops->loops[l];
+    DynamicArray(SemInduction) vars = sem_find_inductions(scratch.allocator, func, loops, l);
+
+    counts.basic += dynamic_array_length(vars);
+
+    for_range(int, v, dynamic_array_length(vars)) {
+      var_loop[vars[v].phi] = l + 1;
+      var_index[vars[v].phi] = v;
+    }
+
+    dynamic_array_clear(muls);
+
+    for_range(uint32_t, i, loop->num_blocks) {
+      SemBlock* block = &func->blocks[loops->blocks[loop->first_block + i]];
+
+      for_range(uint32_t, j, block->num_insts) {
+        uint32_t inst = block->insts[j];
+        SemOp op = func->insts[inst].op;
+
+        if (op != SEM_OP_ADD && op != SEM_OP_SUB && op != SEM_OP_MUL) {
+          continue;
+        }
+
+        for_range(int, k, 2) {
+          uint32_t a = sem_operand(func, inst, k);
+          uint32_t b = sem_operand(func, inst, 1 - k);
+          bool is_var = (int)a < num_insts && var_loop[a] == (uint32_t)l + 1 && vars[var_index[a]].next != inst;
+
+          if (is_var && is_invariant(func, loops, l, b)) {
+            counts.derived++;
+
+            if (op == SEM_OP_MUL) {
+              dynamic_array_put(muls, inst);
+            }
+
+            break;
+          }
+        }
+      }
+    }
+
+    for_range(int, i, dynamic_array_length(muls)) {
+      uint32_t mul = muls[i];
+      uint32_t a = sem_operand(func, mul, 0);
+      uint32_t b = sem_operand(func, mul, 1);
+
+      if (!((int)a < num_insts && var_loop[a] == (uint32_t)l + 1)) {
+        b = a;
+        a = sem_operand(func, mul, 1);
+      }
+
+      uint32_t phi = reduce(context, func, loop, &vars[var_index[a]], b, func->tokens[mul]);
+
+      sem_replace_all_uses_with(func, mul, phi);
+      sem_remove_inst(func, mul);
+
+      counts.reduced++;
+    }
+
+    SemInduction counter;
+    uint64_t trips;
+
+    if (!sem_trip_count(func, loops, l, &counter, &trips)) {
+      continue;
+    }
+
+    for_range(int, v, dynamic_array_length(vars)) {
+      SemInduction* var = &vars[v];
+      uint64_t init, step;
+
+      if (!constant_of(func, var->init, &init) || !constant_of(func, var->step, &step)) {
+        continue;
+      }
+
+      step = var->decreasing ? 0 - step : step;
+
+      counts.exit_values += replace_exit_uses(context, func, loops, l, var->phi, init + step * (trips - 1), &uses);
+      counts.exit_values += replace_exit_uses(context, func, loops, l, var->next, init + step * trips, &uses);
+    }
+  }
+
+  scratch_release(&scratch);
+  return counts;
+}
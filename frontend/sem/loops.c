@@ -0,0 +1,400 @@
+#include <stdlib.h>
+
+#include "frontend.h"
+
+// Loop analysis and loop-invariant code motion. A loop is found from the back
+// edges into its header and walked backwards from them, outer loops before the
+// ones inside them. A preheader gives each loop a single block to move code
+// into, which then runs once however many times the loop goes round.
+
+SemLoops* sem_find_loops(SemContext* context, Arena* arena, SemFunc* func) {
+  Scratch scratch = global_scratch(2, (Arena*[]) { context->arena, arena });
+
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  SemLoops* result = arena_type(arena, SemLoops);
+  result->loop_of = arena_push(arena, num_blocks * sizeof(uint32_t));
+
+  for_range(int, b, num_blocks) {
+    result->loop_of[b] = SEM_NO_LOOP;
+  }
+
+  if (!num_blocks) {
+    scratch_release(&scratch);
+    return result;
+  }
+
+  sem_dominators(context, func);
+
+  DynamicArray(SemLoop) loops = new_dynamic_array(scratch.allocator);
+  DynamicArray(uint32_t) blocks = new_dynamic_array(scratch.allocator);
+  DynamicArray(uint32_t) work = new_dynamic_array(scratch.allocator);
+
+  // Per block, one more than the last loop it was found in
+  uint32_t* mark = arena_array(scratch.arena, uint32_t, num_blocks);
+
+  for_range(uint32_t, r, func->num_rpo) {
+    uint32_t h = func->rpo[r];
+    SemBlock* header = &func->blocks[h];
+
+    bool is_header = false;
+
+    for_range(uint32_t, i, header->num_preds) {
+      is_header |= sem_dominates(func, h, header->preds[i]);
+    }
+
+    if (!is_header) {
+      continue;
+    }
+
+    uint32_t index = dynamic_array_length(loops);
+    uint32_t stamp = index + 1;
+
+    // Headers come in reverse postorder, so the innermost loop found so far
+    // that has this header in it is the one around it
+    SemLoop loop = {
+      .header = h,
+      .preheader = SEM_NO_BLOCK,
+      .parent = result->loop_of[h],
+      .first_block = dynamic_array_length(blocks)
+    };
+
+    loop.depth = loop.parent == SEM_NO_LOOP ? 1 : loops[loop.parent].depth + 1;
+
+    mark[h] = stamp;
+    dynamic_array_put(blocks, h);
+
+    int num_back_edges = 0;
+
+    for_range(uint32_t, i, header->num_preds) {
+      uint32_t latch = header->preds[i];
+
+      if (!sem_dominates(func, h, latch)) {
+        continue;
+      }
+
+      loop.latch = latch;
+      num_back_edges++;
+
+      if (mark[latch] != stamp) {
+        mark[latch] = stamp;
+        dynamic_array_put(blocks, latch);
+        dynamic_array_put(work, latch);
+      }
+    }
+
+    if (num_back_edges != 1) {
+      loop.latch = SEM_NO_BLOCK;
+    }
+
+    // Every reachable predecessor of a block the header dominates, other than
+    // the header itself, is dominated by it too
+    while (dynamic_array_length(work)) {
+      SemBlock* block = &func->blocks[dynamic_array_pop(work)];
+
+      for_range(uint32_t, i, block->num_preds) {
+        uint32_t pred = block->preds[i];
+
+        if (mark[pred] != stamp && func->rpo_index[pred] != SEM_UNREACHABLE) {
+          mark[pred] = stamp;
+          dynamic_array_put(blocks, pred);
+          dynamic_array_put(work, pred);
+        }
+      }
+    }
+
+    loop.num_blocks = dynamic_array_length(blocks) - loop.first_block;
+
+    for_range(uint32_t, i, loop.num_blocks) {
+      result->loop_of[blocks[loop.first_block + i]] = index;
+    }
+
+    uint32_t entry = SEM_NO_BLOCK;
+    int num_entries = 0;
+
+    for_range(uint32_t, i, header->num_preds) {
+      if (mark[header->preds[i]] != stamp) {
+        entry = header->preds[i];
+        num_entries++;
+      }
+    }
+
+    if (num_entries == 1 && func->blocks[entry].num_succs == 1) {
+      loop.preheader = entry;
+    }
+
+    dynamic_array_put(loops, loop);
+  }
+
+  result->num_loops = dynamic_array_length(loops);
+  result->loops = dynamic_array_bake(arena, loops);
+  result->blocks = dynamic_array_bake(arena, blocks);
+
+  scratch_release(&scratch);
+  return result;
+}
+
+bool sem_loop_contains(SemLoops* loops, uint32_t loop, uint32_t block) {
+  for (uint32_t l = loops->loop_of[block]; l != SEM_NO_LOOP; l = loops->loops[l].parent) {
+    if (l == loop) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Moves every edge entering the loop on to a new block that goes to the
+// header. The header's phis take one operand from it, a phi there merging what
+// they took from each entry.
+static void merge_entries(SemContext* context, SemFunc* func, SemLoops* loops, uint32_t loop, uint32_t* values) {
+  Arena* arena = context->arena;
+  uint32_t h = loops->loops[loop].header;
+
+  uint32_t num_phis = sem_num_phis(func, h);
+
+  uint32_t preheader = sem_new_block(func);
+
+  for_range(uint32_t, i, num_phis) {
+    uint32_t phi = func->blocks[h].insts[i];
+    sem_block_append(arena, func, preheader, sem_new_inst(func, SEM_OP_PHI, func->tokens[phi], 0, 0));
+  }
+
+  sem_add_edge(arena, func, preheader, h);
+
+  // The preheader's own edge is last, and stays after the ones yet to move
+  for_range_rev(int, i, (int)func->blocks[h].num_preds - 1) {
+    uint32_t from = func->blocks[h].preds[i];
+
+    if (sem_loop_contains(loops, loop, from)) {
+      continue;
+    }
+
+    int succ = sem_succ_index(func, h, i);
+
+    // Both ways out of a branch can't go to the preheader
+    if (sem_has_succ(func, from, preheader)) {
+      from = sem_split_edge(arena, func, from, succ);
+      succ = 0;
+    }
+
+    SemBlock* header = &func->blocks[h];
+    SemBlock* p = &func->blocks[preheader];
+
+    for_range(uint32_t, j, num_phis) {
+      values[j] = sem_operand(func, header->insts[j], i);
+    }
+
+    sem_redirect_edge(arena, func, from, succ, preheader);
+
+    for_range(uint32_t, j, num_phis) {
+      sem_set_operand(func, p->insts[j], p->num_preds-1, values[j]);
+    }
+  }
+
+  SemBlock* header = &func->blocks[h];
+  SemBlock* p = &func->blocks[preheader];
+  int pred = sem_pred_index(func, preheader, 0);
+
+  for_range(uint32_t, j, num_phis) {
+    sem_set_operand(func, header->insts[j], pred, p->insts[j]);
+  }
+
+  uint32_t token = func->tokens[header->insts[0]];
+  sem_block_append(arena, func, preheader, sem_new_inst(func, SEM_OP_GOTO, token, 0, 0));
+}
+
+int sem_insert_preheaders(SemContext* context, SemFunc* func) {
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  SemLoops* loops = sem_find_loops(context, scratch.arena, func);
+  uint32_t* values = arena_push(scratch.arena, dynamic_array_length(func->insts) * sizeof(uint32_t));
+
+  int num_added = 0;
+
+  // Only edges into a loop's own header change, so the loops found still hold
+  // for the blocks that were there to begin with
+  for_range(int, l, loops->num_loops) {
+    SemLoop* loop = &loops->loops[l];
+    SemBlock* header = &func->blocks[loop->header];
+
+    if (loop->preheader != SEM_NO_BLOCK) {
+      continue;
+    }
+
+    int num_entries = 0;
+    int entry = -1;
+
+    for_range(uint32_t, i, header->num_preds) {
+      if (!sem_loop_contains(loops, l, header->preds[i])) {
+        entry = i;
+        num_entries++;
+      }
+    }
+
+    // The entry block can't have anything before it
+    if (!num_entries) {
+      continue;
+    }
+
+    if (num_entries == 1) {
+      uint32_t from = header->preds[entry];
+      sem_split_edge(context->arena, func, from, sem_succ_index(func, loop->header, entry));
+    }
+    else {
+      merge_entries(context, func, loops, l, values);
+    }
+
+    num_added++;
+  }
+
+  if (num_added) {
+    sem_invalidate_cfg(func);
+  }
+
+  scratch_release(&scratch);
+  return num_added;
+}
+
+typedef struct {
+  SemFunc* func;
+
+  uint32_t stamp; // One more than the loop being hoisted out of
+  uint32_t* mark; // Per block, the stamp of the last loop it was found in
+  uint32_t* stored; // Per local, the stamp of the last loop that stores to it
+  uint64_t* promotable;
+} Hoisting;
+
+static bool is_invariant(Hoisting* h, uint32_t inst) {
+  SemFunc* func = h->func;
+  SemInst* in = sem_inst(func, inst);
+
+  switch (in->op) {
+    default:
+      return false;
+
+    case SEM_OP_INT_CONST:
+    case SEM_OP_ADD:
+    case SEM_OP_SUB:
+    case SEM_OP_MUL:
+    case SEM_OP_UNDEF:
+    case SEM_OP_LOCAL:
+      break;
+
+    case SEM_OP_DIV:
+      if (sem_may_trap(func, inst)) {
+        return false;
+      }
+      break;
+
+    // Nothing else can write to a promotable local
+    case SEM_OP_LOAD: {
+      uint32_t local = sem_operand(func, inst, 0);
+
+      if (!bitset_query(h->promotable, local) || h->stored[local] == h->stamp) {
+        return false;
+      }
+    } break;
+  }
+
+  for_range(int, i, in->num_ins) {
+    if (h->mark[func->insts[sem_operand(func, inst, i)].block] == h->stamp) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(uint64_t*)a;
+  uint64_t y = *(uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+int sem_hoist_invariants(SemContext* context, SemFunc* func) {
+  if (!dynamic_array_length(func->blocks)) {
+    return 0;
+  }
+
+  sem_insert_preheaders(context, func);
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  int num_insts = dynamic_array_length(func->insts);
+
+  SemLoops* loops = sem_find_loops(context, scratch.arena, func);
+
+  Hoisting h = {
+    .func = func,
+    .mark = arena_array(scratch.arena, uint32_t, num_blocks),
+    .stored = arena_array(scratch.arena, uint32_t, num_insts),
+    .promotable = arena_array(scratch.arena, uint64_t, bitset_num_u64(num_insts))
+  };
+
+  for_range(int, i, num_insts) {
+    if (func->insts[i].op == SEM_OP_LOCAL && sem_is_promotable(func, i)) {
+      bitset_set(h.promotable, i);
+    }
+  }
+
+  // Blocks by their place in reverse postorder, then their index
+  uint64_t* order = arena_push(scratch.arena, num_blocks * sizeof(uint64_t));
+  int num_hoisted = 0;
+
+  // Inner loops first, so what leaves one can then leave the next one out
+  for_range_rev(int, l, loops->num_loops) {
+    SemLoop* loop = &loops->loops[l];
+    uint32_t* blocks = loops->blocks + loop->first_block;
+
+    if (loop->preheader == SEM_NO_BLOCK) {
+      continue;
+    }
+
+    h.stamp = l + 1;
+
+    for_range(uint32_t, i, loop->num_blocks) {
+      SemBlock* block = &func->blocks[blocks[i]];
+      h.mark[blocks[i]] = h.stamp;
+
+      for_range(uint32_t, j, block->num_insts) {
+        uint32_t inst = block->insts[j];
+
+        if (func->insts[inst].op == SEM_OP_STORE) {
+          h.stored[sem_operand(func, inst, 0)] = h.stamp;
+        }
+      }
+
+      order[i] = (uint64_t)func->rpo_index[blocks[i]] << 32 | blocks[i];
+    }
+
+    // A value defined in the loop is then seen before anything that uses it
+    qsort(order, loop->num_blocks, sizeof(uint64_t), compare_u64);
+
+    for_range(uint32_t, i, loop->num_blocks) {
+      uint32_t b = (uint32_t)order[i];
+      SemBlock* block = &func->blocks[b];
+      uint32_t num_kept = 0;
+
+      for_range(uint32_t, j, block->num_insts) {
+        uint32_t inst = block->insts[j];
+
+        if (!is_invariant(&h, inst)) {
+          block->insts[num_kept++] = inst;
+          continue;
+        }
+
+        SemBlock* preheader = &func->blocks[loop->preheader];
+        sem_block_insert(context->arena, func, loop->preheader, preheader->num_insts-1, inst);
+
+        num_hoisted++;
+      }
+
+      block->num_insts = num_kept;
+    }
+  }
+
+  scratch_release(&scratch);
+  return num_hoisted;
+}
@@ -0,0 +1,671 @@
+#include <stdlib.h>
+
+#include "frontend.h"
+
+// Out of SSA, after Boissinot et al, "Revisiting Out-of-SSA Translation for
+// Correctness, Code Quality, and Efficiency". Each phi gets a copy of every
+// operand at the end of its predecessor and a copy of itself after it, so the
+// phi and its operands' copies can share a register. Classes of values that
+// share one are then merged across copies wherever none of their values
+// interfere, and the copies left are ordered so that none overwrites a
+// register another has yet to read.
+
+#define NONE UINT32_MAX
+
+// Past this many pairs to check, two classes are left apart rather than let
+// merging go quadratic
+#define MAX_INTERFERENCE_CHECKS 4096
+
+typedef struct {
+  SemContext* context;
+  SemFunc* func;
+  Scratch* scratch;
+
+  // Copies that happen at once, at the end of a phi's predecessor or after
+  // its phis, are numbered from 1 as a group
+  uint32_t* group;
+
+  uint32_t* pos; // Within its block, the same for all phis and for a group
+  uint32_t* value; // What a value is a copy of, followed back to the original
+
+  // Liveness is only kept for what coalescing compares: phis, copies and
+  // what the copies read. Each has a sorted run of the blocks it is live into
+  // and out of, so the sets grow with live ranges rather than with every
+  // value in every block.
+  uint32_t* live_index; // Per instruction, or NONE
+  uint32_t* live_in_start; // Per live_index, with one past the last
+  uint32_t* live_out_start;
+  DynamicArray(uint32_t) live_in;
+  DynamicArray(uint32_t) live_out;
+
+  // Classes of values that share a register, as a union-find with a list of
+  // members from each root
+  uint32_t* parent;
+  uint32_t* next_member;
+  uint32_t* last_member;
+  uint32_t* size;
+} OutOfSSA;
+
+static bool is_phi(SemFunc* func, uint32_t inst) {
+  return func->insts[inst].op == SEM_OP_PHI;
+}
+
+static void split_critical_edges(OutOfSSA* o) {
+  SemFunc* func = o->func;
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  // Copies for one successor's phis would run on the way to the other
+  for_range(int, b, num_blocks) {
+    for_range(int, j, (int)func->blocks[b].num_succs) {
+      SemBlock* block = &func->blocks[b];
+      SemBlock* succ = &func->blocks[block->succs[j]];
+
+      if (block->num_succs > 1 && succ->num_insts && is_phi(func, succ->insts[0])) {
+        sem_split_edge(o->context->arena, func, b, j);
+      }
+    }
+  }
+}
+
+// Returns the number of copies added, and which group each is in
+static int insert_copies(OutOfSSA* o, DynamicArray(uint32_t)* copy_group) {
+  SemFunc* func = o->func;
+  Arena* arena = o->context->arena;
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  uint32_t* end_group = arena_array(o->scratch->arena, uint32_t, num_blocks);
+  uint32_t num_groups = 0;
+  int num_copies = 0;
+
+  DynamicArray(uint32_t) users = new_dynamic_array(o->scratch->allocator);
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    uint32_t num_phis = sem_num_phis(func, b);
+
+    if (!num_phis) {
+      continue;
+    }
+
+    for_range(uint32_t, i, block->num_preds) {
+      uint32_t pred = func->blocks[b].preds[i];
+
+      if (!end_group[pred]) {
+        end_group[pred] = ++num_groups;
+      }
+
+      for_range(uint32_t, k, num_phis) {
+        uint32_t phi = func->blocks[b].insts[k];
+        uint32_t copy = sem_new_inst(func, SEM_OP_COPY, func->tokens[phi], 1, 0);
+
+        sem_set_operand(func, copy, 0, sem_operand(func, phi, i));
+        sem_set_operand(func, phi, i, copy);
+
+        // Before the terminator, which is a GOTO as the edge is not critical
+        SemBlock* p = &func->blocks[pred];
+        sem_block_insert(arena, func, pred, p->num_insts - 1, copy);
+
+        dynamic_array_put(*copy_group, end_group[pred]);
+        num_copies++;
+      }
+    }
+
+    uint32_t start_group = ++num_groups;
+
+    for_range(uint32_t, k, num_phis) {
+      uint32_t phi = func->blocks[b].insts[k];
+      uint32_t copy = sem_new_inst(func, SEM_OP_COPY, func->tokens[phi], 1, 0);
+
+      // Everything that used the phi uses the copy, even the phi's own
+      // operands' copies in a loop
+      dynamic_array_clear(users);
+
+      for (uint32_t use = func->first_use[phi]; use; use = sem_next_use(func, phi, use)) {
+        dynamic_array_put(users, use);
+      }
+
+      for_range(int, u, dynamic_array_length(users)) {
+        uint32_t user = func->uses[users[u]].user;
+        sem_set_operand(func, user, users[u] - func->insts[user].ins, copy);
+      }
+
+      sem_set_operand(func, copy, 0, phi);
+      sem_block_insert(arena, func, b, num_phis + k, copy);
+
+      dynamic_array_put(*copy_group, start_group);
+      num_copies++;
+    }
+  }
+
+  return num_copies;
+}
+
+typedef struct {
+  uint32_t* in_mark; // Per block, which live_index it was last added for, plus 1
+  uint32_t* out_mark;
+  DynamicArray(uint32_t) work;
+} LivenessWalk;
+
+static void mark_live_in(OutOfSSA* o, LivenessWalk* w, uint32_t block, uint32_t mark) {
+  if (w->in_mark[block] != mark) {
+    w->in_mark[block] = mark;
+    dynamic_array_put(o->live_in, block);
+    dynamic_array_put(w->work, block);
+  }
+}
+
+static void mark_live_out(OutOfSSA* o, LivenessWalk* w, uint32_t block, uint32_t mark) {
+  if (w->out_mark[block] != mark) {
+    w->out_mark[block] = mark;
+    dynamic_array_put(o->live_out, block);
+  }
+}
+
+static int compare_u32(const void* a, const void* b) {
+  uint32_t x = *(uint32_t*)a;
+  uint32_t y = *(uint32_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Whether block is in a value's sorted run of blocks
+static bool live_at(uint32_t* blocks, uint32_t* start, uint32_t index, uint32_t block) {
+  uint32_t lo = start[index];
+  uint32_t hi = start[index + 1];
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (blocks[mid] < block) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  return lo < start[index + 1] && blocks[lo] == block;
+}
+
+// Walks up from each use to the definition, so values are only live where
+// they need to be
+static void compute_liveness(OutOfSSA* o, int num_tracked) {
+  SemFunc* func = o->func;
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  LivenessWalk w = {
+    .in_mark = arena_array(o->scratch->arena, uint32_t, num_blocks),
+    .out_mark = arena_array(o->scratch->arena, uint32_t, num_blocks),
+    .work = new_dynamic_array(o->scratch->allocator)
+  };
+
+  o->live_in_start = arena_push(o->scratch->arena, (num_tracked + 1) * sizeof(uint32_t));
+  o->live_out_start = arena_push(o->scratch->arena, (num_tracked + 1) * sizeof(uint32_t));
+  o->live_in = new_dynamic_array(o->scratch->allocator);
+  o->live_out = new_dynamic_array(o->scratch->allocator);
+
+  for_range(uint32_t, value, (uint32_t)dynamic_array_length(func->insts)) {
+    uint32_t index = o->live_index[value];
+
+    if (index == NONE) {
+      continue;
+    }
+
+    uint32_t b = func->insts[value].block;
+    uint32_t mark = index + 1;
+
+    o->live_in_start[index] = dynamic_array_length(o->live_in);
+    o->live_out_start[index] = dynamic_array_length(o->live_out);
+
+    for (uint32_t use = func->first_use[value]; use; use = sem_next_use(func, value, use)) {
+      uint32_t user = func->uses[use].user;
+      uint32_t user_block = func->insts[user].block;
+
+      // Phi operands are used at the end of their predecessor
+      if (is_phi(func, user)) {
+        uint32_t pred = func->blocks[user_block].preds[use - func->insts[user].ins];
+        mark_live_out(o, &w, pred, mark);
+
+        if (pred != b) {
+          mark_live_in(o, &w, pred, mark);
+        }
+      }
+      else if (user_block != b) {
+        mark_live_in(o, &w, user_block, mark);
+      }
+
+      while (dynamic_array_length(w.work)) {
+        SemBlock* in = &func->blocks[dynamic_array_pop(w.work)];
+
+        for_range(uint32_t, p, in->num_preds) {
+          uint32_t pred = in->preds[p];
+          mark_live_out(o, &w, pred, mark);
+
+          if (pred != b) {
+            mark_live_in(o, &w, pred, mark);
+          }
+        }
+      }
+    }
+
+    uint32_t num_in = dynamic_array_length(o->live_in) - o->live_in_start[index];
+    uint32_t num_out = dynamic_array_length(o->live_out) - o->live_out_start[index];
+
+    qsort(o->live_in + o->live_in_start[index], num_in, sizeof(uint32_t), compare_u32);
+    qsort(o->live_out + o->live_out_start[index], num_out, sizeof(uint32_t), compare_u32);
+  }
+
+  o->live_in_start[num_tracked] = dynamic_array_length(o->live_in);
+  o->live_out_start[num_tracked] = dynamic_array_length(o->live_out);
+}
+
+static bool def_dominates(OutOfSSA* o, uint32_t x, uint32_t y) {
+  uint32_t bx = o->func->insts[x].block;
+  uint32_t by = o->func->insts[y].block;
+
+  if (bx == by) {
+    return o->pos[x] <= o->pos[y];
+  }
+
+  return o->func->rpo_index[bx] != SEM_UNREACHABLE && o->func->rpo_index[by] != SEM_UNREACHABLE && sem_dominates(o->func, bx, by);
+}
+
+// Whether x, defined at or before y, is still live once y is defined
+static bool live_after(OutOfSSA* o, uint32_t x, uint32_t y) {
+  SemFunc* func = o->func;
+  uint32_t b = func->insts[y].block;
+
+  uint32_t index = o->live_index[x];
+  assert(index != NONE);
+
+  if (func->insts[x].block != b && !live_at(o->live_in, o->live_in_start, index, b)) {
+    return false;
+  }
+
+  if (live_at(o->live_out, o->live_out_start, index, b)) {
+    return true;
+  }
+
+  for (uint32_t use = func->first_use[x]; use; use = sem_next_use(func, x, use)) {
+    uint32_t user = func->uses[use].user;
+
+    if (!is_phi(func, user) && func->insts[user].block == b && o->pos[user] > o->pos[y]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Values holding the same thing never clash, otherwise in SSA the one
+// defined first has to be live where the other is defined
+static bool interfere(OutOfSSA* o, uint32_t x, uint32_t y) {
+  // Copies in a group are written at once, so each needs its own register
+  if (o->group[x] && o->group[x] == o->group[y]) {
+    return true;
+  }
+
+  if (o->value[x] == o->value[y]) {
+    return false;
+  }
+
+  return (def_dominates(o, x, y) && live_after(o, x, y)) || (def_dominates(o, y, x) && live_after(o, y, x));
+}
+
+static uint32_t find(OutOfSSA* o, uint32_t x) {
+  while (o->parent[x] != x) {
+    o->parent[x] = o->parent[o->parent[x]];
+    x = o->parent[x];
+  }
+
+  return x;
+}
+
+static void merge(OutOfSSA* o, uint32_t a, uint32_t b) {
+  if (o->size[a] < o->size[b]) {
+    uint32_t t = a;
+    a = b;
+    b = t;
+  }
+
+  o->parent[b] = a;
+  o->next_member[o->last_member[a]] = b;
+  o->last_member[a] = o->last_member[b];
+  o->size[a] += o->size[b];
+}
+
+static bool classes_interfere(OutOfSSA* o, uint32_t a, uint32_t b) {
+  if (o->size[a] * o->size[b] > MAX_INTERFERENCE_CHECKS) {
+    return true;
+  }
+
+  for (uint32_t x = a; x != NONE; x = o->next_member[x]) {
+    for (uint32_t y = b; y != NONE; y = o->next_member[y]) {
+      if (interfere(o, x, y)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// All per register
+typedef struct {
+  uint32_t* loc; // Where its old value is now, or NONE
+  uint32_t* loc_inst; // The instruction that put it there
+  uint32_t* pred; // The register it is copied from, or NONE
+  uint32_t* by_dest; // The copy into it
+  uint32_t temp; // A spare register for breaking cycles
+
+  DynamicArray(uint32_t) ready;
+  DynamicArray(uint32_t) todo;
+} Sequencer;
+
+// Orders one group of parallel copies (Boissinot et al, algorithm 1). The
+// copies are appended to out, along with any copy into the spare register.
+static int sequentialize(SemFunc* func, Sequencer* s, uint32_t* regs, uint32_t* copies, int num_copies, DynamicArray(uint32_t)* out) {
+  uint32_t* by_dest = s->by_dest;
+
+  dynamic_array_clear(s->ready);
+  dynamic_array_clear(s->todo);
+
+  int num_temps = 0;
+
+  for_range(int, i, num_copies) {
+    uint32_t src = regs[sem_operand(func, copies[i], 0)];
+    uint32_t dest = regs[copies[i]];
+
+    s->loc[dest] = NONE;
+    s->pred[src] = NONE;
+  }
+
+  for_range(int, i, num_copies) {
+    uint32_t src_inst = sem_operand(func, copies[i], 0);
+    uint32_t src = regs[src_inst];
+    uint32_t dest = regs[copies[i]];
+
+    s->loc[src] = src;
+    s->loc_inst[src] = src_inst;
+    s->pred[dest] = src;
+    by_dest[dest] = copies[i];
+
+    dynamic_array_put(s->todo, dest);
+  }
+
+  for_range(int, i, num_copies) {
+    uint32_t dest = regs[copies[i]];
+
+    if (s->loc[dest] == NONE) {
+      dynamic_array_put(s->ready, dest);
+    }
+  }
+
+  while (dynamic_array_length(s->todo)) {
+    while (dynamic_array_length(s->ready)) {
+      uint32_t b = dynamic_array_pop(s->ready);
+      uint32_t a = s->pred[b];
+      uint32_t c = s->loc[a];
+      uint32_t copy = by_dest[b];
+
+      sem_set_operand(func, copy, 0, s->loc_inst[a]);
+      dynamic_array_put(*out, copy);
+
+      s->loc[a] = b;
+      s->loc_inst[a] = copy;
+
+      if (a == c && s->pred[a] != NONE) {
+        dynamic_array_put(s->ready, a);
+      }
+    }
+
+    uint32_t b = dynamic_array_pop(s->todo);
+
+    // Still holding its own value, so it is on a cycle. Saving the value
+    // elsewhere frees it to be written.
+    if (b == s->loc[b]) {
+      uint32_t temp = sem_new_inst(func, SEM_OP_COPY, func->tokens[by_dest[b]], 1, 0);
+      sem_set_operand(func, temp, 0, s->loc_inst[b]);
+      dynamic_array_put(*out, temp);
+
+      s->loc[b] = s->temp;
+      s->loc_inst[b] = temp;
+      num_temps++;
+
+      dynamic_array_put(s->ready, b);
+    }
+  }
+
+  return num_temps;
+}
+
+SemCopyCounts sem_leave_ssa(SemContext* context, SemFunc* func) {
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  OutOfSSA o = {
+    .context = context,
+    .func = func,
+    .scratch = &scratch
+  };
+
+  SemCopyCounts counts = {0};
+
+  split_critical_edges(&o);
+
+  sem_dominators(context, func);
+
+  uint32_t first_copy = dynamic_array_length(func->insts);
+  DynamicArray(uint32_t) copy_group = new_dynamic_array(scratch.allocator);
+
+  counts.naive = insert_copies(&o, &copy_group);
+
+  int num_insts = dynamic_array_length(func->insts);
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  o.group = arena_array(scratch.arena, uint32_t, num_insts);
+  o.pos = arena_array(scratch.arena, uint32_t, num_insts);
+  o.value = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+
+  for_range(int, i, dynamic_array_length(copy_group)) {
+    o.group[first_copy + i] = copy_group[i];
+  }
+
+  for_range(int, i, num_insts) {
+    o.value[i] = i;
+  }
+
+  // Definitions come before their uses in reverse postorder
+  for_range(uint32_t, i, func->num_rpo) {
+    SemBlock* block = &func->blocks[func->rpo[i]];
+    uint32_t pos = 0;
+
+    for_range(uint32_t, j, block->num_insts) {
+      uint32_t inst = block->insts[j];
+      bool same_group = j > 0 && o.group[inst] && o.group[inst] == o.group[block->insts[j-1]];
+
+      if (!is_phi(func, inst) && !same_group) {
+        pos++;
+      }
+
+      o.pos[inst] = pos;
+
+      if (func->insts[inst].op == SEM_OP_COPY) {
+        o.value[inst] = o.value[sem_operand(func, inst, 0)];
+      }
+    }
+  }
+
+  o.live_index = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+
+  for_range(int, i, num_insts) {
+    o.live_index[i] = is_phi(func, i) || o.group[i] ? 0 : NONE;
+  }
+
+  for (uint32_t copy = first_copy; copy < (uint32_t)num_insts; ++copy) {
+    o.live_index[sem_operand(func, copy, 0)] = 0;
+  }
+
+  int num_tracked = 0;
+
+  for_range(int, i, num_insts) {
+    if (o.live_index[i] != NONE) {
+      o.live_index[i] = num_tracked++;
+    }
+  }
+
+  compute_liveness(&o, num_tracked);
+
+  o.parent = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+  o.next_member = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+  o.last_member = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+  o.size = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+
+  for_range(int, i, num_insts) {
+    o.parent[i] = i;
+    o.next_member[i] = NONE;
+    o.last_member[i] = i;
+    o.size[i] = 1;
+  }
+
+  // A phi and the copies of its operands make a class to begin with, as
+  // none of them are ever live at once
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    for (uint32_t i = 0; i < block->num_insts && is_phi(func, block->insts[i]); ++i) {
+      uint32_t phi = block->insts[i];
+
+      for_range(int, j, func->insts[phi].num_ins) {
+        merge(&o, find(&o, phi), find(&o, sem_operand(func, phi, j)));
+      }
+    }
+  }
+
+  for (uint32_t copy = first_copy; copy < (uint32_t)num_insts; ++copy) {
+    uint32_t a = find(&o, copy);
+    uint32_t b = find(&o, sem_operand(func, copy, 0));
+
+    if (a != b && !classes_interfere(&o, a, b)) {
+      merge(&o, a, b);
+    }
+  }
+
+  // One register per class, numbered in the order they are first written,
+  // plus a spare for cycles
+  uint32_t* regs = arena_push(scratch.arena, num_insts * sizeof(uint32_t));
+  uint32_t num_regs = 0;
+
+  for_range(int, i, num_insts) {
+    regs[i] = NONE;
+  }
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_insts) {
+      uint32_t root = find(&o, block->insts[i]);
+
+      if (sem_op_has_value[func->insts[root].op] && regs[root] == NONE) {
+        regs[root] = num_regs++;
+      }
+    }
+  }
+
+  for_range(int, i, num_insts) {
+    regs[i] = regs[find(&o, i)];
+  }
+
+  Sequencer seq = {
+    .loc = arena_push(scratch.arena, (num_regs + 1) * sizeof(uint32_t)),
+    .loc_inst = arena_push(scratch.arena, (num_regs + 1) * sizeof(uint32_t)),
+    .pred = arena_push(scratch.arena, (num_regs + 1) * sizeof(uint32_t)),
+    .by_dest = arena_push(scratch.arena, (num_regs + 1) * sizeof(uint32_t)),
+    .temp = num_regs,
+    .ready = new_dynamic_array(scratch.allocator),
+    .todo = new_dynamic_array(scratch.allocator)
+  };
+
+  DynamicArray(uint32_t) out = new_dynamic_array(scratch.allocator);
+  DynamicArray(uint32_t) group = new_dynamic_array(scratch.allocator);
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+    dynamic_array_clear(out);
+
+    uint32_t i = 0;
+
+    while (i < block->num_insts) {
+      uint32_t inst = block->insts[i];
+
+      // Phis go once every block is done, as they keep their operands'
+      // copies alive until then
+      if (is_phi(func, inst)) {
+        i++;
+        continue;
+      }
+
+      if (!o.group[inst]) {
+        dynamic_array_put(out, inst);
+        i++;
+        continue;
+      }
+
+      // Copies that end up within a register go away
+      dynamic_array_clear(group);
+
+      for (; i < block->num_insts && o.group[block->insts[i]] == o.group[inst]; ++i) {
+        uint32_t copy = block->insts[i];
+        uint32_t src = sem_operand(func, copy, 0);
+
+        if (!func->first_use[copy] || regs[copy] == regs[src]) {
+          sem_replace_all_uses_with(func, copy, src);
+          sem_set_operand(func, copy, 0, 0);
+          counts.coalesced++;
+        }
+        else {
+          dynamic_array_put(group, copy);
+        }
+      }
+
+      counts.cycle_temps += sequentialize(func, &seq, regs, group, dynamic_array_length(group), &out);
+    }
+
+    int length = dynamic_array_length(out);
+
+    if ((uint32_t)length > block->capacity) {
+      block->insts = arena_push(context->arena, length * sizeof(uint32_t));
+      block->capacity = length;
+    }
+
+    memcpy(block->insts, out, length * sizeof(uint32_t));
+    block->num_insts = length;
+
+    // Temps for cycles are new, so have no block yet
+    for_range(int, j, length) {
+      func->insts[out[j]].block = b;
+      counts.remaining += func->insts[out[j]].op == SEM_OP_COPY;
+    }
+  }
+
+  for (uint32_t phi = 1; phi < first_copy; ++phi) {
+    if (is_phi(func, phi)) {
+      for_range(int, j, func->insts[phi].num_ins) {
+        sem_set_operand(func, phi, j, 0);
+      }
+    }
+  }
+
+  int final_insts = dynamic_array_length(func->insts);
+
+  func->num_regs = num_regs + (counts.cycle_temps ? 1 : 0);
+  func->regs = arena_push(context->arena, final_insts * sizeof(uint32_t));
+
+  memcpy(func->regs, regs, num_insts * sizeof(uint32_t));
+
+  for (int i = num_insts; i < final_insts; ++i) {
+    func->regs[i] = seq.temp;
+  }
+
+  scratch_release(&scratch);
+  return counts;
+}
@@ -0,0 +1,628 @@
+#include "frontend.h"
+
+// Reads the text sem_dump prints back into functions. Operands can name
+// values defined further down, in phis, so a function is read whole before
+// any of it is built. Values are then created in the order of their names,
+// which sem_dump numbers in creation order, so dumping what was read gives
+// back the same text. The order of a block's predecessors, which sem_dump
+// only shows through phis, comes from its first phi.
+
+#define MAX_VALUE_NAME (1 << 24)
+
+typedef struct {
+  SemOp op;
+  uint32_t name; // 0 if it has no value
+  uint32_t block;
+  uint32_t token; // Relative to the function's first
+  uint32_t data;
+  int num_ins;
+} ParsedInst;
+
+typedef struct {
+  uint32_t inst; // Index into Reader::insts until the function is built
+  int index; // For phis only known once the predecessors are
+  uint32_t name;
+  uint32_t pred; // The block a phi operand comes in from
+  Token token;
+} PendingOperand;
+
+typedef struct {
+  uint32_t from;
+  uint32_t to;
+  Token token;
+} PendingEdge;
+
+typedef struct {
+  SemContext* context;
+  SourceContents source;
+
+  char* cur;
+  char* end;
+  int line;
+
+  DynamicArray(Token) tokens;
+
+  SemFunc func;
+  SemOp last_op; // Of the block being read, INVALID if it is empty
+
+  DynamicArray(ParsedInst) insts;
+  DynamicArray(uint32_t) values; // Per name, 1 + its index into insts, then its ID once built
+  DynamicArray(PendingOperand) operands;
+  DynamicArray(PendingEdge) edges;
+} Reader;
+
+static bool at_end(Reader* r) {
+  return r->cur >= r->end || *r->cur == '\0';
+}
+
+static void skip_space(Reader* r) {
+  while (!at_end(r)) {
+    if (*r->cur == '\n') {
+      r->line++;
+      r->cur++;
+    }
+    else if (*r->cur == ' ' || *r->cur == '\t' || *r->cur == '\r') {
+      r->cur++;
+    }
+    else if (*r->cur == '/' && r->cur + 1 < r->end && r->cur[1] == '/') {
+      while (!at_end(r) && *r->cur != '\n') {
+        r->cur++;
+      }
+    }
+    else {
+      break;
+    }
+  }
+}
+
+static bool is_word_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// The word at the cursor, or its one character, for errors and instruction tokens
+static Token token_here(Reader* r) {
+  int length = 0;
+
+  while (r->cur + length < r->end && is_word_char(r->cur[length])) {
+    length++;
+  }
+
+  return (Token) {
+    .kind = TOKEN_IDENTIFIER,
+    .length = length ? length : 1,
+    .line = r->line,
+    .start = r->cur
+  };
+}
+
+static bool error_here(Reader* r, char* message) {
+  error_at_token(r->source, token_here(r), "%s", message);
+  return false;
+}
+
+static bool peek(Reader* r, char* text) {
+  skip_space(r);
+  size_t length = strlen(text);
+  return (size_t)(r->end - r->cur) >= length && memcmp(r->cur, text, length) == 0;
+}
+
+static bool accept(Reader* r, char* text) {
+  if (!peek(r, text)) {
+    return false;
+  }
+
+  r->cur += strlen(text);
+  return true;
+}
+
+static bool expect(Reader* r, char* text) {
+  if (accept(r, text)) {
+    return true;
+  }
+
+  error_at_token(r->source, token_here(r), "expected '%s'", text);
+  return false;
+}
+
+static bool read_number(Reader* r, uint64_t max, uint64_t* out) {
+  skip_space(r);
+
+  if (at_end(r) || *r->cur < '0' || *r->cur > '9') {
+    return error_here(r, "expected a number");
+  }
+
+  Token token = token_here(r);
+  uint64_t value = 0;
+
+  while (!at_end(r) && *r->cur >= '0' && *r->cur <= '9') {
+    uint64_t digit = *r->cur++ - '0';
+
+    if (value > (max - digit) / 10) {
+      error_at_token(r->source, token, "this number is too large");
+      return false;
+    }
+
+    value = value * 10 + digit;
+  }
+
+  *out = value;
+  return true;
+}
+
+static bool read_name(Reader* r, uint32_t* name, Token* token) {
+  if (!expect(r, "%")) {
+    return false;
+  }
+
+  uint64_t value;
+  *token = token_here(r);
+
+  if (!read_number(r, MAX_VALUE_NAME, &value)) {
+    return false;
+  }
+
+  *name = (uint32_t)value;
+  return true;
+}
+
+static bool read_block_ref(Reader* r, uint32_t* block, Token* token) {
+  uint64_t value;
+  *token = token_here(r);
+
+  if (!expect(r, "bb_") || !read_number(r, UINT32_MAX - 1, &value)) {
+    return false;
+  }
+
+  *block = (uint32_t)value;
+  return true;
+}
+
+static bool add_edge(Reader* r, uint32_t from) {
+  PendingEdge edge = { .from = from };
+
+  if (!read_block_ref(r, &edge.to, &edge.token)) {
+    return false;
+  }
+
+  dynamic_array_put(r->edges, edge);
+  return true;
+}
+
+static bool read_operand(Reader* r, uint32_t inst, int index) {
+  PendingOperand operand = {
+    .inst = inst,
+    .index = index
+  };
+
+  if (r->insts[inst].op == SEM_OP_PHI) {
+    Token block_token;
+
+    if (!expect(r, "[") || !read_name(r, &operand.name, &operand.token) || !expect(r, ",") || !read_block_ref(r, &operand.pred, &block_token) || !expect(r, "]")) {
+      return false;
+    }
+  }
+  else if (!read_name(r, &operand.name, &operand.token)) {
+    return false;
+  }
+
+  dynamic_array_put(r->operands, operand);
+  return true;
+}
+
+// A phi takes as many operands as are listed, and is checked against the
+// predecessors once they are known
+static int count_phi_operands(Reader* r) {
+  char* start = r->cur;
+  int start_line = r->line;
+
+  int count = 0;
+
+  while (peek(r, "[")) {
+    while (!at_end(r) && *r->cur != ']') {
+      r->cur++;
+    }
+
+    count++;
+
+    if (!accept(r, "]") || !accept(r, ",")) {
+      break;
+    }
+  }
+
+  r->cur = start;
+  r->line = start_line;
+
+  return count;
+}
+
+static bool read_inst(Reader* r, uint32_t block) {
+  ParsedInst inst = { .block = block };
+  Token name_token;
+
+  if (peek(r, "%")) {
+    if (!read_name(r, &inst.name, &name_token) || !expect(r, "=")) {
+      return false;
+    }
+
+    if (!inst.name) {
+      error_at_token(r->source, name_token, "%%0 is not a name, as ID 0 stands for no value");
+      return false;
+    }
+  }
+
+  skip_space(r);
+  Token op_token = token_here(r);
+
+  for (int i = 1; i < (int)LENGTH(sem_op_str); ++i) {
+    if (strlen(sem_op_str[i]) == (size_t)op_token.length && memcmp(sem_op_str[i], op_token.start, op_token.length) == 0) {
+      inst.op = (SemOp)i;
+    }
+  }
+
+  if (inst.op == SEM_OP_INVALID) {
+    return error_here(r, "expected an instruction");
+  }
+
+  r->cur += op_token.length;
+
+  if (sem_op_has_value[inst.op] != (inst.name != 0)) {
+    error_at_token(r->source, op_token, inst.name ? "this instruction has no value to name" : "this instruction has a value, so needs a name");
+    return false;
+  }
+
+  if (sem_is_terminator(r->last_op)) {
+    error_at_token(r->source, op_token, "nothing can follow the end of a block");
+    return false;
+  }
+
+  if (inst.op == SEM_OP_PHI && r->last_op != SEM_OP_INVALID && r->last_op != SEM_OP_PHI) {
+    error_at_token(r->source, op_token, "phis must come first in their block");
+    return false;
+  }
+
+  r->last_op = inst.op;
+
+  inst.num_ins = inst.op == SEM_OP_PHI ? count_phi_operands(r) : sem_op_num_ins[inst.op];
+
+  if (inst.num_ins > SEM_MAX_INS) {
+    error_at_token(r->source, op_token, "this phi has too many operands");
+    return false;
+  }
+
+  if (inst.op == SEM_OP_INT_CONST) {
+    uint64_t value;
+
+    if (!read_number(r, UINT64_MAX, &value)) {
+      return false;
+    }
+
+    inst.data = dynamic_array_length(r->func.constants);
+    dynamic_array_put(r->func.constants, value);
+  }
+
+  inst.token = dynamic_array_length(r->tokens) - r->func.first_token;
+  dynamic_array_put(r->tokens, op_token);
+
+  uint32_t index = dynamic_array_length(r->insts);
+  dynamic_array_put(r->insts, inst);
+
+  for_range(int, i, inst.num_ins) {
+    if ((i > 0 && !expect(r, ",")) || !read_operand(r, index, i)) {
+      return false;
+    }
+  }
+
+  switch (inst.op) {
+    default:
+      break;
+
+    case SEM_OP_GOTO: {
+      if (!add_edge(r, block)) {
+        return false;
+      }
+    } break;
+
+    case SEM_OP_BRANCH: {
+      if (!expect(r, "[") || !add_edge(r, block) || !expect(r, ":") || !add_edge(r, block) || !expect(r, "]")) {
+        return false;
+      }
+    } break;
+  }
+
+  if (inst.name) {
+    while ((uint32_t)dynamic_array_length(r->values) <= inst.name) {
+      dynamic_array_put(r->values, 0);
+    }
+
+    if (r->values[inst.name]) {
+      error_at_token(r->source, name_token, "%%%u is already defined, and only SSA form can be read", inst.name);
+      return false;
+    }
+
+    r->values[inst.name] = index + 1;
+  }
+
+  return true;
+}
+
+// Values first, in the order of their names, then everything else
+static void build_insts(Reader* r) {
+  Scratch scratch = global_scratch(1, &r->context->arena);
+  SemFunc* func = &r->func;
+
+  int num_parsed = dynamic_array_length(r->insts);
+  uint32_t* ids = arena_push(scratch.arena, num_parsed * sizeof(uint32_t));
+
+  for_range(int, name, dynamic_array_length(r->values)) {
+    if (r->values[name]) {
+      uint32_t i = r->values[name]-1;
+      ParsedInst* inst = &r->insts[i];
+
+      ids[i] = sem_new_inst(func, inst->op, inst->token, inst->num_ins, inst->data);
+      r->values[name] = ids[i];
+    }
+  }
+
+  for_range(int, i, num_parsed) {
+    ParsedInst* inst = &r->insts[i];
+
+    if (!inst->name) {
+      ids[i] = sem_new_inst(func, inst->op, inst->token, inst->num_ins, inst->data);
+    }
+
+    sem_block_append(r->context->arena, func, inst->block, ids[i]);
+  }
+
+  for_range(int, i, dynamic_array_length(r->operands)) {
+    r->operands[i].inst = ids[r->operands[i].inst];
+  }
+
+  scratch_release(&scratch);
+}
+
+// Edges are added in the order their terminators were read, then each block
+// with phis has its predecessors put in the order its first phi lists them
+static bool link_blocks(Reader* r) {
+  SemFunc* func = &r->func;
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  for_range(int, i, dynamic_array_length(r->edges)) {
+    PendingEdge* edge = &r->edges[i];
+
+    if (edge->to >= (uint32_t)num_blocks) {
+      error_at_token(r->source, edge->token, "this block does not exist");
+      return false;
+    }
+
+    SemBlock* from = &func->blocks[edge->from];
+    SemBlock* to = &func->blocks[edge->to];
+
+    from->succs[from->num_succs++] = edge->to;
+
+    if (to->num_preds == to->preds_capacity) {
+      uint32_t capacity = to->preds_capacity ? to->preds_capacity * 2 : 2;
+      uint32_t* preds = arena_push(r->context->arena, capacity * sizeof(uint32_t));
+
+      memcpy(preds, to->preds, to->num_preds * sizeof(uint32_t));
+
+      to->preds = preds;
+      to->preds_capacity = capacity;
+    }
+
+    to->preds[to->num_preds++] = edge->from;
+  }
+
+  Scratch scratch = global_scratch(1, &r->context->arena);
+  bool ret_val = false;
+
+  // Operands are kept in the order they were read, so each phi's are
+  // together and come in the order of the blocks
+  int next_operand = 0;
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    for (uint32_t i = 0; i < block->num_insts && func->insts[block->insts[i]].op == SEM_OP_PHI; ++i) {
+      uint32_t phi = block->insts[i];
+
+      if (func->insts[phi].num_ins != block->num_preds) {
+        Token phi_token = r->tokens[func->first_token + func->tokens[phi]];
+        error_at_token(r->source, phi_token, "this phi needs an operand for each of the %u predecessors of its block", block->num_preds);
+        goto end;
+      }
+
+      if (!block->num_preds) {
+        continue;
+      }
+
+      while (r->operands[next_operand].inst != phi) {
+        next_operand++;
+      }
+
+      // Each operand takes the first predecessor it matches that no other
+      // operand has, as a block can be a predecessor twice
+      bool* taken = arena_array(scratch.arena, bool, block->num_preds);
+
+      for_range(uint32_t, j, block->num_preds) {
+        PendingOperand* operand = &r->operands[next_operand + j];
+        uint32_t p = 0;
+
+        while (p < block->num_preds && (taken[p] || block->preds[p] != operand->pred)) {
+          p++;
+        }
+
+        if (p == block->num_preds) {
+          error_at_token(r->source, operand->token, "bb_%u is not a predecessor of this block, or is listed too many times", operand->pred);
+          goto end;
+        }
+
+        taken[p] = true;
+        operand->index = p;
+      }
+
+      if (i == 0) {
+        for_range(uint32_t, j, block->num_preds) {
+          PendingOperand* operand = &r->operands[next_operand + j];
+          block->preds[j] = operand->pred;
+          operand->index = j;
+        }
+      }
+    }
+  }
+
+  ret_val = true;
+
+  end:
+  scratch_release(&scratch);
+  return ret_val;
+}
+
+static bool resolve_operands(Reader* r) {
+  for_range(int, i, dynamic_array_length(r->operands)) {
+    PendingOperand* operand = &r->operands[i];
+
+    uint32_t value = operand->name < (uint32_t)dynamic_array_length(r->values) ? r->values[operand->name] : 0;
+
+    if (!value) {
+      error_at_token(r->source, operand->token, "%%%u is not defined in this function", operand->name);
+      return false;
+    }
+
+    sem_set_operand(&r->func, operand->inst, operand->index, value);
+  }
+
+  return true;
+}
+
+static bool read_func(Reader* r) {
+  skip_space(r);
+  uint32_t first_token = dynamic_array_length(r->tokens);
+  Token fn_token = token_here(r);
+
+  if (!expect(r, "fn") || !expect(r, "@")) {
+    return false;
+  }
+
+  fn_token.kind = TOKEN_KEYWORD_FN;
+  dynamic_array_put(r->tokens, fn_token);
+
+  r->func = sem_new_func(r->context->allocator, first_token);
+
+  char* name = r->cur;
+
+  while (!at_end(r) && *r->cur != '(' && *r->cur != ' ' && *r->cur != '\n') {
+    r->cur++;
+  }
+
+  if (r->cur == name) {
+    return error_here(r, "expected a function name");
+  }
+
+  int name_length = (int)(r->cur - name);
+  char* name_buf = arena_push(r->context->arena, (name_length+1) * sizeof(char));
+  memcpy(name_buf, name, name_length * sizeof(char));
+  name_buf[name_length] = '\0';
+
+  r->func.name = (String) {
+    .length = name_length,
+    .str = name_buf
+  };
+
+  if (!expect(r, "(") || !expect(r, ")") || !expect(r, "{")) {
+    return false;
+  }
+
+  dynamic_array_clear(r->insts);
+  dynamic_array_clear(r->values);
+  dynamic_array_clear(r->operands);
+  dynamic_array_clear(r->edges);
+
+  uint32_t block = SEM_UNREACHABLE;
+
+  while (!accept(r, "}")) {
+    if (at_end(r)) {
+      return error_here(r, "expected '}'");
+    }
+
+    if (peek(r, "!")) {
+      Token label_token = token_here(r);
+      uint64_t label;
+
+      if (!expect(r, "!bb_") || !read_number(r, UINT32_MAX - 1, &label) || !expect(r, ":")) {
+        return false;
+      }
+
+      if (label != (uint64_t)dynamic_array_length(r->func.blocks)) {
+        error_at_token(r->source, label_token, "blocks must be numbered in order from bb_0");
+        return false;
+      }
+
+      block = sem_new_block(&r->func);
+      r->last_op = SEM_OP_INVALID;
+    }
+    else if (block == SEM_UNREACHABLE) {
+      return error_here(r, "expected a block label like '!bb_0:'");
+    }
+    else if (!read_inst(r, block)) {
+      return false;
+    }
+  }
+
+  if (!dynamic_array_length(r->func.blocks)) {
+    error_at_token(r->source, fn_token, "this function has no blocks");
+    return false;
+  }
+
+  build_insts(r);
+  return link_blocks(r) && resolve_operands(r);
+}
+
+SemFile* sem_read(SemContext* context, SourceContents source) {
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  SemFile* ret_val = NULL;
+
+  Reader r = {
+    .context = context,
+    .source = source,
+    .cur = source.contents,
+    .end = source.contents + source.length,
+    .line = 1,
+    .tokens = new_dynamic_array(scratch.allocator),
+    .insts = new_dynamic_array(scratch.allocator),
+    .values = new_dynamic_array(scratch.allocator),
+    .operands = new_dynamic_array(scratch.allocator),
+    .edges = new_dynamic_array(scratch.allocator)
+  };
+
+  DynamicArray(SemFunc) funcs = new_dynamic_array(scratch.allocator);
+
+  for (skip_space(&r); !at_end(&r); skip_space(&r)) {
+    if (!read_func(&r)) {
+      goto end;
+    }
+
+    dynamic_array_put(funcs, r.func);
+  }
+
+  Token eof = {
+    .kind = TOKEN_EOF,
+    .line = r.line,
+    .start = r.cur
+  };
+
+  dynamic_array_put(r.tokens, eof);
+
+  TokenizedBuffer* tokens = arena_type(context->arena, TokenizedBuffer);
+  tokens->length = dynamic_array_length(r.tokens);
+  tokens->tokens = dynamic_array_bake(context->arena, r.tokens);
+
+  ret_val = arena_type(context->arena, SemFile);
+  ret_val->tokens = tokens;
+  ret_val->num_funcs = dynamic_array_length(funcs);
+  ret_val->funcs = dynamic_array_bake(context->arena, funcs);
+
+  end:
+  scratch_release(&scratch);
+  return ret_val;
+}
@@ -0,0 +1,270 @@
+#include "frontend.h"
+
+// Loop rotation. A loop whose header tests whether to go round again is
+// turned into one that tests at the bottom: the header's code is copied into
+// the preheader as a guard that goes straight to the body or past the loop,
+// and the old header is then only reached from the latches. Once the latch
+// and the old header are merged, each iteration takes one conditional branch
+// instead of a branch and a jump back.
+
+// Headers are copied whole, so large ones are left alone
+#define MAX_HEADER_INSTS 16
+
+typedef struct {
+  uint32_t header;
+  uint32_t preheader;
+  uint32_t body; // Where the header goes to stay in the loop
+  uint32_t exit;
+} Rotation;
+
+typedef struct {
+  SemContext* context;
+  SemFunc* func;
+
+  // As they were before any loop was rotated. Rotating one only reroutes
+  // paths through its header, which a body or an exit never is, so whether
+  // one of those dominates a block stays the same.
+  SemDominators* dom;
+
+  uint32_t* copy; // Per header instruction, its copy in the guard
+  DynamicArray(uint32_t) uses;
+} Rotator;
+
+static bool is_rotatable(SemFunc* func, SemLoops* loops, uint32_t loop) {
+  SemLoop* l = &loops->loops[loop];
+  SemBlock* header = &func->blocks[l->header];
+
+  if (l->preheader == SEM_NO_BLOCK || func->insts[header->insts[header->num_insts-1]].op != SEM_OP_BRANCH) {
+    return false;
+  }
+
+  // Going round straight from the header means it tests at the bottom already
+  if (header->succs[0] == l->header || header->succs[1] == l->header) {
+    return false;
+  }
+
+  if (sem_loop_contains(loops, loop, header->succs[0]) == sem_loop_contains(loops, loop, header->succs[1])) {
+    return false;
+  }
+
+  if (sem_has_local(func, l->header)) {
+    return false;
+  }
+
+  uint32_t num_copied = header->num_insts - sem_num_phis(func, l->header) - 1;
+
+  return num_copied <= MAX_HEADER_INSTS;
+}
+
+static bool dominated_before(Rotator* r, uint32_t a, uint32_t b) {
+  SemDominators* dom = r->dom;
+
+  if (dom->idom[a] == SEM_UNREACHABLE || dom->idom[b] == SEM_UNREACHABLE) {
+    return a == b;
+  }
+
+  return dom->pre[a] <= dom->pre[b] && dom->post[b] <= dom->post[a];
+}
+
+// Where a use reads its value, which for a phi is the end of the predecessor
+static uint32_t use_block(SemFunc* func, uint32_t use) {
+  SemInst* in = sem_inst(func, func->uses[use].user);
+
+  if (in->op == SEM_OP_PHI) {
+    return func->blocks[in->block].preds[use - in->ins];
+  }
+
+  return in->block;
+}
+
+// Every value the header defines is only used in the header, or where the
+// body or the exit dominates, so it can be merged with its copy there
+static bool uses_are_split(Rotator* r, Rotation* rot) {
+  SemFunc* func = r->func;
+  SemBlock* header = &func->blocks[rot->header];
+
+  for_range(uint32_t, i, header->num_insts-1) {
+    uint32_t value = header->insts[i];
+
+    for (uint32_t use = func->first_use[value]; use; use = sem_next_use(func, value, use)) {
+      uint32_t block = use_block(func, use);
+
+      if (block != rot->header && !dominated_before(r, rot->body, block) && !dominated_before(r, rot->exit, block)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static uint32_t copy_of(Rotator* r, uint32_t header, uint32_t value) {
+  return r->func->insts[value].block == header ? r->copy[value] : value;
+}
+
+// A phi at the start of a block entered from the header and the guard
+static uint32_t merge(Rotator* r, uint32_t block, uint32_t header, uint32_t value) {
+  SemFunc* func = r->func;
+  SemBlock* b = &func->blocks[block];
+
+  uint32_t phi = sem_new_inst(func, SEM_OP_PHI, func->tokens[value], b->num_preds, 0);
+
+  for_range(uint32_t, i, b->num_preds) {
+    sem_set_operand(func, phi, i, b->preds[i] == header ? value : copy_of(r, header, value));
+  }
+
+  sem_block_insert(r->context->arena, func, block, 0, phi);
+  return phi;
+}
+
+static bool rotate(Rotator* r, Rotation* rot) {
+  SemFunc* func = r->func;
+  Arena* arena = r->context->arena;
+
+  uint32_t h = rot->header;
+  uint32_t p = rot->preheader;
+
+  if (!uses_are_split(r, rot)) {
+    return false;
+  }
+
+  int entry = sem_pred_index(func, p, 0);
+  SemBlock* preheader = &func->blocks[p];
+
+  sem_remove_inst(func, preheader->insts[preheader->num_insts-1]);
+
+  // The guard is the header as the preheader would have run it
+  for_range(uint32_t, i, func->blocks[h].num_insts) {
+    uint32_t inst = func->blocks[h].insts[i];
+    SemInst in = func->insts[inst];
+
+    if (in.op == SEM_OP_PHI) {
+      r->copy[inst] = sem_operand(func, inst, entry);
+      continue;
+    }
+
+    uint32_t copy = sem_new_inst(func, in.op, func->tokens[inst], in.num_ins, in.data);
+
+    for_range(int, j, in.num_ins) {
+      sem_set_operand(func, copy, j, copy_of(r, h, sem_operand(func, inst, j)));
+    }
+
+    sem_block_append(arena, func, p, copy);
+    r->copy[inst] = copy;
+  }
+
+  sem_remove_edge(func, p, 0);
+
+  for_range(int, s, 2) {
+    uint32_t succ = func->blocks[h].succs[s];
+    SemBlock* b = &func->blocks[succ];
+
+    sem_add_edge(arena, func, p, succ);
+
+    int from_header = sem_pred_index(func, h, s);
+
+    for (uint32_t i = 0; i < b->num_insts && func->insts[b->insts[i]].op == SEM_OP_PHI; ++i) {
+      uint32_t phi = b->insts[i];
+      sem_set_operand(func, phi, b->num_preds-1, copy_of(r, h, sem_operand(func, phi, from_header)));
+    }
+  }
+
+  // Past the header, a value it defines may now come from the guard instead
+  for_range(uint32_t, i, func->blocks[h].num_insts-1) {
+    uint32_t value = func->blocks[h].insts[i];
+    uint32_t merged[2] = { 0, 0 };
+
+    dynamic_array_clear(r->uses);
+
+    for (uint32_t use = func->first_use[value]; use; use = sem_next_use(func, value, use)) {
+      dynamic_array_put(r->uses, use);
+    }
+
+    for_range(int, j, dynamic_array_length(r->uses)) {
+      uint32_t use = r->uses[j];
+      uint32_t block = use_block(func, use);
+
+      if (block == h) {
+        continue;
+      }
+
+      int side = dominated_before(r, rot->body, block) ? 0 : 1;
+
+      if (!merged[side]) {
+        merged[side] = merge(r, side ? rot->exit : rot->body, h, value);
+      }
+
+      uint32_t user = func->uses[use].user;
+      sem_set_operand(func, user, use - func->insts[user].ins, merged[side]);
+    }
+  }
+
+  return true;
+}
+
+int sem_rotate_loops(SemContext* context, SemFunc* func) {
+  if (!dynamic_array_length(func->blocks)) {
+    return 0;
+  }
+
+  sem_insert_preheaders(context, func);
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  SemLoops* loops = sem_find_loops(context, scratch.arena, func);
+  DynamicArray(Rotation) rotations = new_dynamic_array(scratch.allocator);
+
+  // The body and the exit each get a block entered only from the header, for
+  // what the guard and the header bring to meet in
+  for_range(int, l, loops->num_loops) {
+    if (!is_rotatable(func, loops, l)) {
+      continue;
+    }
+
+    uint32_t h = loops->loops[l].header;
+    int body = sem_loop_contains(loops, l, func->blocks[h].succs[0]) ? 0 : 1;
+
+    Rotation rot = {
+      .header = h,
+      .preheader = loops->loops[l].preheader
+    };
+
+    for_range(int, s, 2) {
+      uint32_t succ = func->blocks[h].succs[s];
+
+      if (func->blocks[succ].num_preds != 1) {
+        succ = sem_split_edge(context->arena, func, h, s);
+      }
+
+      if (s == body) {
+        rot.body = succ;
+      }
+      else {
+        rot.exit = succ;
+      }
+    }
+
+    dynamic_array_put(rotations, rot);
+  }
+
+  Rotator r = {
+    .context = context,
+    .func = func,
+    .dom = sem_dominators(context, func),
+    .copy = arena_push(scratch.arena, dynamic_array_length(func->insts) * sizeof(uint32_t)),
+    .uses = new_dynamic_array(scratch.allocator)
+  };
+
+  int num_rotated = 0;
+
+  for_range(int, i, dynamic_array_length(rotations)) {
+    num_rotated += rotate(&r, &rotations[i]);
+  }
+
+  scratch_release(&scratch);
+
+  // The guard branches, so the rotated loops need a preheader again
+  sem_insert_preheaders(context, func);
+
+  return num_rotated;
+}
@@ -0,0 +1,414 @@
+#include "frontend.h"
+
+// Sparse conditional constant propagation (Wegman and Zadeck). Every value
+// starts out unknown and can only move down to a constant and then to
+// overdefined, and a block is only evaluated once an edge into it is known to
+// be taken, so a branch on a constant never lets its other side's values in.
+// Blocks that are never reached are emptied and cut off from the rest.
+// Each value moves down at most twice and each edge is taken at most once,
+// which keeps it linear.
+
+enum {
+  LATTICE_UNKNOWN,
+  LATTICE_CONSTANT,
+  LATTICE_OVERDEFINED
+};
+
+typedef struct {
+  SemFunc* func;
+
+  uint8_t* state; // Per instruction
+  uint64_t* value; // Per instruction, if constant
+
+  // Edges are numbered by where they sit among their target's predecessors,
+  // so a phi finds which of its operands come in on a taken edge by position
+  uint32_t* first_pred; // Per block
+  uint32_t* edge; // Per block and successor
+  uint32_t* edge_target;
+  bool* taken; // Per edge
+  bool* visited; // Per block
+
+  DynamicArray(uint32_t) edge_work;
+  DynamicArray(uint32_t) value_work;
+} Propagation;
+
+static void lower(Propagation* p, uint32_t inst, uint8_t state, uint64_t value) {
+  uint8_t old = p->state[inst];
+
+  if (old == LATTICE_CONSTANT && state == LATTICE_CONSTANT && p->value[inst] != value) {
+    state = LATTICE_OVERDEFINED;
+  }
+
+  if (state <= old) {
+    return;
+  }
+
+  p->state[inst] = state;
+  p->value[inst] = value;
+
+  dynamic_array_put(p->value_work, inst);
+}
+
+static void take_edge(Propagation* p, uint32_t block, int succ) {
+  uint32_t edge = p->edge[block * SEM_MAX_SUCCS + succ];
+
+  if (!p->taken[edge]) {
+    p->taken[edge] = true;
+    dynamic_array_put(p->edge_work, edge);
+  }
+}
+
+// Wraps like the interpreter, and leaves alone what it would trap on
+static bool fold(SemOp op, uint64_t x, uint64_t y, uint64_t* result) {
+  switch (op) {
+    default:
+      assert(false);
+      return false;
+
+    case SEM_OP_ADD:
+      *result = x + y;
+      return true;
+    case SEM_OP_SUB:
+      *result = x - y;
+      return true;
+    case SEM_OP_MUL:
+      *result = x * y;
+      return true;
+
+    case SEM_OP_DIV:
+      if (y == 0 || ((int64_t)x == INT64_MIN && (int64_t)y == -1)) {
+        return false;
+      }
+
+      *result = (uint64_t)((int64_t)x / (int64_t)y);
+      return true;
+  }
+}
+
+static void evaluate(Propagation* p, uint32_t inst) {
+  SemFunc* func = p->func;
+  SemInst* in = sem_inst(func, inst);
+
+  switch (in->op) {
+    default:
+      assert(false);
+      break;
+
+    case SEM_OP_INT_CONST:
+      lower(p, inst, LATTICE_CONSTANT, func->constants[in->data]);
+      break;
+
+    // Reads what it was given, which could be anything
+    case SEM_OP_UNDEF:
+    case SEM_OP_LOCAL:
+    case SEM_OP_LOAD:
+      lower(p, inst, LATTICE_OVERDEFINED, 0);
+      break;
+
+    case SEM_OP_STORE:
+    case SEM_OP_RETURN:
+      break;
+
+    case SEM_OP_COPY: {
+      uint32_t x = sem_operand(func, inst, 0);
+      lower(p, inst, p->state[x], p->value[x]);
+    } break;
+
+    case SEM_OP_ADD:
+    case SEM_OP_SUB:
+    case SEM_OP_MUL:
+    case SEM_OP_DIV: {
+      uint32_t x = sem_operand(func, inst, 0);
+      uint32_t y = sem_operand(func, inst, 1);
+      uint64_t result = 0;
+
+      // Anything times 0 is 0, whatever the other side turns out to be
+      bool zero = in->op == SEM_OP_MUL
+        && ((p->state[x] == LATTICE_CONSTANT && p->value[x] == 0) || (p->state[y] == LATTICE_CONSTANT && p->value[y] == 0));
+
+      if (zero) {
+        lower(p, inst, LATTICE_CONSTANT, 0);
+      }
+      else if (p->state[x] == LATTICE_OVERDEFINED || p->state[y] == LATTICE_OVERDEFINED) {
+        lower(p, inst, LATTICE_OVERDEFINED, 0);
+      }
+      else if (p->state[x] == LATTICE_CONSTANT && p->state[y] == LATTICE_CONSTANT) {
+        bool folded = fold(in->op, p->value[x], p->value[y], &result);
+        lower(p, inst, folded ? LATTICE_CONSTANT : LATTICE_OVERDEFINED, result);
+      }
+    } break;
+
+    // Only operands that come in on a taken edge count
+    case SEM_OP_PHI: {
+      uint32_t first = p->first_pred[in->block];
+
+      for_range(int, i, in->num_ins) {
+        if (!p->taken[first + i]) {
+          continue;
+        }
+
+        uint32_t x = sem_operand(func, inst, i);
+
+        if (p->state[x] != LATTICE_UNKNOWN) {
+          lower(p, inst, p->state[x], p->value[x]);
+        }
+      }
+    } break;
+
+    case SEM_OP_GOTO:
+      take_edge(p, in->block, 0);
+      break;
+
+    case SEM_OP_BRANCH: {
+      uint32_t x = sem_operand(func, inst, 0);
+
+      if (p->state[x] == LATTICE_CONSTANT) {
+        take_edge(p, in->block, p->value[x] ? 0 : 1);
+      }
+      else if (p->state[x] == LATTICE_OVERDEFINED) {
+        take_edge(p, in->block, 0);
+        take_edge(p, in->block, 1);
+      }
+    } break;
+  }
+}
+
+static void visit_block(Propagation* p, uint32_t b) {
+  SemBlock* block = &p->func->blocks[b];
+  bool first_visit = !p->visited[b];
+
+  p->visited[b] = true;
+
+  // Past the first visit, only the phis have a new operand to take in
+  for_range(uint32_t, i, block->num_insts) {
+    uint32_t inst = block->insts[i];
+
+    if (!first_visit && p->func->insts[inst].op != SEM_OP_PHI) {
+      break;
+    }
+
+    evaluate(p, inst);
+  }
+}
+
+static void number_edges(Propagation* p, Scratch* scratch) {
+  SemFunc* func = p->func;
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  p->first_pred = arena_push(scratch->arena, (num_blocks + 1) * sizeof(uint32_t));
+  p->edge = arena_push(scratch->arena, num_blocks * SEM_MAX_SUCCS * sizeof(uint32_t));
+
+  uint32_t num_edges = 0;
+
+  for_range(int, b, num_blocks) {
+    p->first_pred[b] = num_edges;
+    num_edges += func->blocks[b].num_preds;
+  }
+
+  p->first_pred[num_blocks] = num_edges;
+  p->edge_target = arena_push(scratch->arena, num_edges * sizeof(uint32_t));
+  p->taken = arena_array(scratch->arena, bool, num_edges);
+
+  // Predecessors are in the order their edges were added, so the nth edge
+  // from a block to another is the nth time it appears among the other's
+  uint8_t* matched = arena_array(scratch->arena, uint8_t, num_blocks);
+
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_preds) {
+      uint32_t pred = block->preds[i];
+      SemBlock* from = &func->blocks[pred];
+
+      for (uint32_t j = matched[pred]; j < from->num_succs; ++j) {
+        if (from->succs[j] == (uint32_t)b) {
+          p->edge[pred * SEM_MAX_SUCCS + j] = p->first_pred[b] + i;
+          matched[pred] = (uint8_t)(j + 1);
+          break;
+        }
+      }
+
+      p->edge_target[p->first_pred[b] + i] = b;
+    }
+
+    // Edges into the next block start from the first successor again
+    for_range(uint32_t, i, block->num_preds) {
+      matched[block->preds[i]] = 0;
+    }
+  }
+}
+
+// Constants that replace phis go right after the block's remaining phis, as
+// the block dominates everything the phi did
+static void place_after_phis(SemContext* context, SemFunc* func, uint32_t b, DynamicArray(uint32_t) consts) {
+  SemBlock* block = &func->blocks[b];
+  uint32_t num_phis = sem_num_phis(func, b);
+
+  uint32_t num_consts = dynamic_array_length(consts);
+  uint32_t length = block->num_insts + num_consts;
+
+  uint32_t* insts = block->insts;
+
+  if (length > block->capacity) {
+    insts = arena_push(context->arena, length * sizeof(uint32_t));
+    memcpy(insts, block->insts, num_phis * sizeof(uint32_t));
+    block->capacity = length;
+  }
+
+  memmove(insts + num_phis + num_consts, block->insts + num_phis, (block->num_insts - num_phis) * sizeof(uint32_t));
+  memcpy(insts + num_phis, consts, num_consts * sizeof(uint32_t));
+
+  block->insts = insts;
+  block->num_insts = length;
+
+  for_range(uint32_t, i, num_consts) {
+    func->insts[consts[i]].block = b;
+  }
+}
+
+SemFoldCounts sem_propagate_constants(SemContext* context, SemFunc* func) {
+  Scratch scratch = global_scratch(1, &context->arena);
+  SemFoldCounts counts = {0};
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  int num_insts = dynamic_array_length(func->insts);
+
+  if (!num_blocks) {
+    scratch_release(&scratch);
+    return counts;
+  }
+
+  Propagation p = {
+    .func = func,
+    .state = arena_array(scratch.arena, uint8_t, num_insts),
+    .value = arena_array(scratch.arena, uint64_t, num_insts),
+    .visited = arena_array(scratch.arena, bool, num_blocks),
+    .edge_work = new_dynamic_array(scratch.allocator),
+    .value_work = new_dynamic_array(scratch.allocator)
+  };
+
+  number_edges(&p, &scratch);
+  visit_block(&p, 0);
+
+  while (dynamic_array_length(p.edge_work) || dynamic_array_length(p.value_work)) {
+    if (dynamic_array_length(p.edge_work)) {
+      uint32_t edge = dynamic_array_pop(p.edge_work);
+      visit_block(&p, p.edge_target[edge]);
+      continue;
+    }
+
+    uint32_t value = dynamic_array_pop(p.value_work);
+
+    for (uint32_t use = func->first_use[value]; use; use = sem_next_use(func, value, use)) {
+      uint32_t user = func->uses[use].user;
+
+      if (p.visited[func->insts[user].block]) {
+        evaluate(&p, user);
+      }
+    }
+  }
+
+  // Only the taken side of a branch on a constant was evaluated, so the
+  // other edge goes, along with its operands in the target's phis. This goes
+  // first, while every condition is still the instruction it was.
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    if (!p.visited[b] || !block->num_insts) {
+      continue;
+    }
+
+    uint32_t last = block->insts[block->num_insts-1];
+    SemInst* in = sem_inst(func, last);
+
+    if (in->op != SEM_OP_BRANCH || p.state[sem_operand(func, last, 0)] != LATTICE_CONSTANT) {
+      continue;
+    }
+
+    int taken = p.value[sem_operand(func, last, 0)] ? 0 : 1;
+
+    sem_remove_edge(func, b, 1 - taken);
+    sem_remove_operand(func, last, 0);
+    in->op = SEM_OP_GOTO;
+
+    counts.branches++;
+  }
+
+  uint64_t* dead = arena_array(scratch.arena, uint64_t, bitset_num_u64(num_insts));
+  DynamicArray(uint32_t)* phi_consts = arena_array(scratch.arena, DynamicArray(uint32_t), num_blocks);
+
+  for_range(int, b, num_blocks) {
+    if (!p.visited[b]) {
+      continue;
+    }
+
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_insts) {
+      uint32_t inst = block->insts[i];
+      SemInst* in = sem_inst(func, inst);
+
+      if (p.state[inst] != LATTICE_CONSTANT || in->op == SEM_OP_INT_CONST) {
+        continue;
+      }
+
+      counts.folded++;
+
+      // Phis have to stay first in their block, so a new constant takes over
+      if (in->op == SEM_OP_PHI) {
+        uint32_t c = sem_new_constant(func, func->tokens[inst], p.value[inst]);
+        sem_replace_all_uses_with(func, inst, c);
+        bitset_set(dead, inst);
+
+        if (!phi_consts[b]) {
+          phi_consts[b] = new_dynamic_array(scratch.allocator);
+        }
+
+        dynamic_array_put(phi_consts[b], c);
+        continue;
+      }
+
+      // Otherwise it becomes the constant where it is, keeping its ID
+      while (in->num_ins) {
+        sem_remove_operand(func, inst, in->num_ins - 1);
+      }
+
+      in->op = SEM_OP_INT_CONST;
+      in->data = dynamic_array_length(func->constants);
+
+      dynamic_array_put(func->constants, p.value[inst]);
+    }
+  }
+
+  // Blocks never reached can only have their values used in blocks they
+  // dominate and on their own edges out, so once those edges go nothing
+  // outside them is left reading their code
+  for_range(int, b, num_blocks) {
+    SemBlock* block = &func->blocks[b];
+
+    if (p.visited[b]) {
+      continue;
+    }
+
+    while (block->num_succs) {
+      sem_remove_edge(func, b, block->num_succs - 1);
+    }
+
+    for_range(uint32_t, i, block->num_insts) {
+      bitset_set(dead, block->insts[i]);
+    }
+
+    counts.unreachable += block->num_insts;
+  }
+
+  sem_sweep(func, dead);
+
+  for_range(int, b, num_blocks) {
+    if (phi_consts[b]) {
+      place_after_phis(context, func, b, phi_consts[b]);
+    }
+  }
+
+  scratch_release(&scratch);
+  return counts;
+}
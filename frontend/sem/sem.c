@@ -9,116 +9,649 @@ SemContext* sem_init(Arena* arena) {
   return ctx;
 }
 
-void sem_dump(SemFile* file) {
+SemFunc sem_new_func(Allocator* allocator, uint32_t first_token) {
+  SemFunc func = {
+    .first_token = first_token,
+    .insts = new_dynamic_array(allocator),
+    .tokens = new_dynamic_array(allocator),
+    .first_use = new_dynamic_array(allocator),
+    .replaced_by = new_dynamic_array(allocator),
+    .uses = new_dynamic_array(allocator),
+    .constants = new_dynamic_array(allocator),
+    .blocks = new_dynamic_array(allocator)
+  };
+
+  // ID 0 means no value, and use 0 is the end of a use list
+  SemInst none = {0};
+  dynamic_array_put(func.insts, none);
+  dynamic_array_put(func.tokens, 0);
+  dynamic_array_put(func.first_use, 0);
+  dynamic_array_put(func.replaced_by, 0);
+
+  SemUse no_use = {0};
+  dynamic_array_put(func.uses, no_use);
+
+  return func;
+}
+
+void sem_block_insert(Arena* arena, SemFunc* func, uint32_t block, uint32_t index, uint32_t inst) {
+  SemBlock* b = &func->blocks[block];
+  assert(index <= b->num_insts);
+
+  if (b->num_insts == b->capacity) {
+    uint32_t capacity = b->capacity ? b->capacity * 2 : 4;
+    uint32_t* insts = arena_push(arena, capacity * sizeof(uint32_t));
+
+    if (b->num_insts) {
+      memcpy(insts, b->insts, b->num_insts * sizeof(uint32_t));
+    }
+
+    b->insts = insts;
+    b->capacity = capacity;
+  }
+
+  memmove(b->insts + index + 1, b->insts + index, (b->num_insts - index) * sizeof(uint32_t));
+  b->insts[index] = inst;
+  b->num_insts++;
+
+  func->insts[inst].block = block;
+}
+
+void sem_block_append(Arena* arena, SemFunc* func, uint32_t block, uint32_t inst) {
+  sem_block_insert(arena, func, block, func->blocks[block].num_insts, inst);
+}
+
+// Follows replacements to the value a use stands for now, and shortens the
+// chain on the way so the next lookup is direct
+uint32_t sem_num_phis(SemFunc* func, uint32_t block) {
+  SemBlock* b = &func->blocks[block];
+  uint32_t count = 0;
+
+  while (count < b->num_insts && func->insts[b->insts[count]].op == SEM_OP_PHI) {
+    count++;
+  }
+
+  return count;
+}
+
+bool sem_has_local(SemFunc* func, uint32_t block) {
+  SemBlock* b = &func->blocks[block];
+
+  for_range(uint32_t, i, b->num_insts) {
+    if (func->insts[b->insts[i]].op == SEM_OP_LOCAL) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+uint32_t sem_resolve(SemFunc* func, uint32_t value) {
+  uint32_t result = value;
+
+  while (func->replaced_by[result]) {
+    result = func->replaced_by[result];
+  }
+
+  while (func->replaced_by[value] && func->replaced_by[value] != result) {
+    uint32_t next = func->replaced_by[value];
+    func->replaced_by[value] = result;
+    value = next;
+  }
+
+  return result;
+}
+
+// A use sits in the list of what its value resolves to
+static void link_use(SemFunc* func, uint32_t use, uint32_t value) {
+  SemUse* u = &func->uses[use];
+  u->value = value;
+
+  if (!value) {
+    return;
+  }
+
+  uint32_t head = func->first_use[value];
+
+  if (!head) {
+    u->prev = use;
+    u->next = use;
+    func->first_use[value] = use;
+    return;
+  }
+
+  uint32_t tail = func->uses[head].prev;
+
+  u->prev = tail;
+  u->next = head;
+  func->uses[tail].next = use;
+  func->uses[head].prev = use;
+}
+
+static void unlink_use(SemFunc* func, uint32_t use) {
+  SemUse* u = &func->uses[use];
+
+  if (!u->value) {
+    return;
+  }
+
+  uint32_t value = sem_resolve(func, u->value);
+
+  if (u->next == use) {
+    func->first_use[value] = 0;
+  }
+  else {
+    func->uses[u->prev].next = u->next;
+    func->uses[u->next].prev = u->prev;
+
+    if (func->first_use[value] == use) {
+      func->first_use[value] = u->next;
+    }
+  }
+
+  u->value = 0;
+}
+
+uint32_t sem_new_inst(SemFunc* func, SemOp op, uint32_t token, int num_ins, uint32_t data) {
+  assert(num_ins <= SEM_MAX_INS);
+
+  uint32_t id = dynamic_array_length(func->insts);
+
+  SemInst inst = {
+    .op = (uint8_t)op,
+    .num_ins = (uint16_t)num_ins,
+    .ins = dynamic_array_length(func->uses),
+    .data = data
+  };
+
+  SemUse unset = { .user = id };
+
+  for_range(int, i, num_ins) {
+    dynamic_array_put(func->uses, unset);
+  }
+
+  dynamic_array_put(func->insts, inst);
+  dynamic_array_put(func->tokens, token);
+  dynamic_array_put(func->first_use, 0);
+  dynamic_array_put(func->replaced_by, 0);
+
+  return id;
+}
+
+uint32_t sem_new_constant(SemFunc* func, uint32_t token, uint64_t value) {
+  uint32_t data = dynamic_array_length(func->constants);
+  dynamic_array_put(func->constants, value);
+  return sem_new_inst(func, SEM_OP_INT_CONST, token, 0, data);
+}
+
+void sem_remove_inst(SemFunc* func, uint32_t inst) {
+  SemBlock* b = &func->blocks[func->insts[inst].block];
+
+  for_range_rev(int, i, (int)b->num_insts) {
+    if (b->insts[i] == inst) {
+      memmove(b->insts + i, b->insts + i + 1, (b->num_insts - i - 1) * sizeof(b->insts[0]));
+      b->num_insts--;
+      break;
+    }
+  }
+
+  for_range(int, i, func->insts[inst].num_ins) {
+    unlink_use(func, func->insts[inst].ins + i);
+  }
+}
+
+// One pass over the blocks, rather than a search per instruction
+void sem_sweep(SemFunc* func, uint64_t* dead) {
+  for_range(int, b, dynamic_array_length(func->blocks)) {
+    SemBlock* block = &func->blocks[b];
+    uint32_t kept = 0;
+
+    for_range(uint32_t, i, block->num_insts) {
+      uint32_t inst = block->insts[i];
+
+      if (!bitset_query(dead, inst)) {
+        block->insts[kept++] = inst;
+        continue;
+      }
+
+      for_range(int, j, func->insts[inst].num_ins) {
+        unlink_use(func, func->insts[inst].ins + j);
+      }
+    }
+
+    block->num_insts = kept;
+  }
+}
+
+void sem_set_operand(SemFunc* func, uint32_t inst, int i, uint32_t value) {
+  assert(i < func->insts[inst].num_ins);
+
+  uint32_t use = func->insts[inst].ins + i;
+
+  unlink_use(func, use);
+  link_use(func, use, value ? sem_resolve(func, value) : 0);
+}
+
+// Operands are contiguous, so unless the instruction's are the last ones they
+// move to the end first
+void sem_add_operand(SemFunc* func, uint32_t inst, uint32_t value) {
+  SemInst* in = &func->insts[inst];
+  assert(in->num_ins < SEM_MAX_INS);
+
+  if (in->ins + in->num_ins != (uint32_t)dynamic_array_length(func->uses)) {
+    uint32_t ins = dynamic_array_length(func->uses);
+
+    for_range(int, i, in->num_ins) {
+      uint32_t old = in->ins + i;
+      uint32_t value_i = func->uses[old].value;
+
+      SemUse moved = { .user = inst };
+      dynamic_array_put(func->uses, moved);
+
+      unlink_use(func, old);
+      link_use(func, ins + i, value_i ? sem_resolve(func, value_i) : 0);
+    }
+
+    in->ins = ins;
+  }
+
+  SemUse use = { .user = inst };
+  dynamic_array_put(func->uses, use);
+  in->num_ins++;
+
+  link_use(func, in->ins + in->num_ins - 1, value ? sem_resolve(func, value) : 0);
+}
+
+void sem_remove_operand(SemFunc* func, uint32_t inst, int i) {
+  SemInst* in = &func->insts[inst];
+  assert(i < in->num_ins);
+
+  for (int j = i; j + 1 < in->num_ins; ++j) {
+    sem_set_operand(func, inst, j, sem_operand(func, inst, j + 1));
+  }
+
+  sem_set_operand(func, inst, in->num_ins - 1, 0);
+  in->num_ins--;
+}
+
+// Moves the whole use list over and leaves the old value pointing at its
+// replacement, so the uses themselves are only rewritten when next read
+void sem_replace_all_uses_with(SemFunc* func, uint32_t value, uint32_t replacement) {
+  value = sem_resolve(func, value);
+  replacement = sem_resolve(func, replacement);
+
+  if (value == replacement) {
+    return;
+  }
+
+  uint32_t from = func->first_use[value];
+  uint32_t to = func->first_use[replacement];
+
+  if (from && to) {
+    uint32_t from_tail = func->uses[from].prev;
+    uint32_t to_tail = func->uses[to].prev;
+
+    func->uses[to_tail].next = from;
+    func->uses[from].prev = to_tail;
+    func->uses[from_tail].next = to;
+    func->uses[to].prev = from_tail;
+  }
+  else if (from) {
+    func->first_use[replacement] = from;
+  }
+
+  func->first_use[value] = 0;
+  func->replaced_by[value] = replacement;
+}
+
+// Division traps on zero and on INT64_MIN / -1
+bool sem_may_trap(SemFunc* func, uint32_t inst) {
+  if (func->insts[inst].op != SEM_OP_DIV) {
+    return false;
+  }
+
+  SemInst* divisor = sem_inst(func, sem_operand(func, inst, 1));
+
+  if (divisor->op != SEM_OP_INT_CONST) {
+    return true;
+  }
+
+  uint64_t value = func->constants[divisor->data];
+  return value == 0 || value == UINT64_MAX;
+}
+
+DynamicArray(char) sem_write(Arena* arena, SemFile* file) {
+  Scratch scratch = global_scratch(1, &arena);
+  DynamicArray(char) text = new_dynamic_array(new_allocator(arena));
+
   for_range(int, func_id, file->num_funcs) {
     SemFunc* func = &file->funcs[func_id];
-    printf("fn @%s() {\n", func->name.str);
+    write_text(&text, "fn @%s() {\n", func->name.str);
+
+    // Values still in a block are named in the order they were created, so
+    // sem_read can create them in the same order. Once out of SSA they are
+    // named after their register instead, which values out of any block can
+    // still be read through.
+    int num_insts = dynamic_array_length(func->insts);
+    int* names = arena_array(scratch.arena, int, num_insts);
+    int next_name = 1;
+
+    for_range(int, b, dynamic_array_length(func->blocks)) {
+      for_range(uint32_t, i, func->blocks[b].num_insts) {
+        names[func->blocks[b].insts[i]] = -1;
+      }
+    }
+
+    for (int i = 1; i < num_insts; ++i) {
+      if (!sem_op_has_value[func->insts[i].op]) {
+        names[i] = 0;
+      }
+      else if (func->regs) {
+        names[i] = (int)func->regs[i] + 1;
+      }
+      else {
+        names[i] = names[i] ? next_name++ : 0;
+      }
+    }
 
     for_range (int, block_id, dynamic_array_length(func->blocks)) {
       SemBlock* block = &func->blocks[block_id];
-      printf("!bb_%d:\n", block_id);
+      write_text(&text, "!bb_%d:\n", block_id);
 
-      for_list(SemInst, inst, block->start) {
-        printf("  ");
+      for_range(int, i, (int)block->num_insts) {
+        uint32_t id = block->insts[i];
+        SemInst* inst = sem_inst(func, id);
 
-        if (inst->def) {
-          printf("%%%d = ", inst->def);
+        if (names[id]) {
+          write_text(&text, "  %%%d = %s ", names[id], sem_op_str[inst->op]);
+        }
+        else {
+          write_text(&text, "  %s ", sem_op_str[inst->op]);
         }
 
-        printf("%s ", sem_op_str[inst->op]);
-
-        for_range(int, i, inst->num_ins) {
-          if (i > 0) {
-            printf(", ");
+        for_range(int, j, inst->num_ins) {
+          if (j > 0) {
+            write_text(&text, ", ");
           }
 
-          printf("%%%d", inst->ins[i]->def);
+          // Which predecessor each operand is for, so the order survives sem_read
+          if (inst->op == SEM_OP_PHI) {
+            write_text(&text, "[%%%d, bb_%u]", names[sem_operand(func, id, j)], block->preds[j]);
+          }
+          else {
+            write_text(&text, "%%%d", names[sem_operand(func, id, j)]);
+          }
         }
 
         switch (inst->op) {
           case SEM_OP_INT_CONST:
-            printf("%llu", (uint64_t)inst->data);
+            write_text(&text, "%llu", func->constants[inst->data]);
             break;
 
-          case SEM_OP_BRANCH: {
-            int* targs = (int*)inst->data;
-            printf(" [bb_%d:bb_%d]", targs[0], targs[1]);
-          } break;
+          case SEM_OP_BRANCH:
+            write_text(&text, " [bb_%d:bb_%d]", block->succs[0], block->succs[1]);
+            break;
 
-          case SEM_OP_GOTO: {
-            int* targs = (int*)inst->data;
-            printf("bb_%d", targs[0]);
-          } break;
+          case SEM_OP_GOTO:
+            write_text(&text, "bb_%d", block->succs[0]);
+            break;
         }
 
-        printf("\n");
+        write_text(&text, "\n");
       }
     }
 
-    printf("}\n\n");
+    write_text(&text, "}\n\n");
   }
+
+  scratch_release(&scratch);
+  return text;
 }
 
-typedef struct {
-  int count;
-  int blocks[2];
-} Successors;
+void sem_dump(SemFile* file) {
+  Scratch scratch = global_scratch(0, NULL);
+
+  DynamicArray(char) text = sem_write(scratch.arena, file);
+  fwrite(text, 1, dynamic_array_length(text), stdout);
+
+  scratch_release(&scratch);
+}
+
+uint32_t sem_new_block(SemFunc* func) {
+  SemBlock block = {0};
+  dynamic_array_put(func->blocks, block);
 
-static Successors get_successors(SemFunc* func, int block) {
-  Successors result = {0};
+  sem_invalidate_cfg(func);
+  return dynamic_array_length(func->blocks)-1;
+}
+
+// Phis come first in a block and have an operand per predecessor, so edges
+// coming and going add and remove operands
+static void add_pred(Arena* arena, SemFunc* func, uint32_t from, uint32_t to) {
+  SemBlock* t = &func->blocks[to];
+
+  if (t->num_preds == t->preds_capacity) {
+    uint32_t capacity = t->preds_capacity ? t->preds_capacity * 2 : 2;
+    uint32_t* preds = arena_push(arena, capacity * sizeof(uint32_t));
+
+    if (t->num_preds) {
+      memcpy(preds, t->preds, t->num_preds * sizeof(uint32_t));
+    }
 
+    t->preds = preds;
+    t->preds_capacity = capacity;
+  }
+
+  t->preds[t->num_preds++] = from;
+
+  for (uint32_t i = 0; i < t->num_insts && func->insts[t->insts[i]].op == SEM_OP_PHI; ++i) {
+    sem_add_operand(func, t->insts[i], 0);
+  }
+}
+
+void sem_add_edge(Arena* arena, SemFunc* func, uint32_t from, uint32_t to) {
+  SemBlock* f = &func->blocks[from];
+
+  assert(f->num_succs < SEM_MAX_SUCCS);
+  f->succs[f->num_succs++] = to;
+
+  add_pred(arena, func, from, to);
+  sem_invalidate_cfg(func);
+}
+
+int sem_pred_index(SemFunc* func, uint32_t from, int succ) {
+  SemBlock* f = &func->blocks[from];
+  uint32_t to = f->succs[succ];
+  int nth = 0;
+
+  for_range(int, i, succ) {
+    nth += f->succs[i] == to;
+  }
+
+  SemBlock* t = &func->blocks[to];
+
+  for_range(int, i, (int)t->num_preds) {
+    if (t->preds[i] == from && nth-- == 0) {
+      return i;
+    }
+  }
+
+  assert(false);
+  return -1;
+}
+
+bool sem_has_succ(SemFunc* func, uint32_t block, uint32_t succ) {
   SemBlock* b = &func->blocks[block];
 
-  if (b->end) {
-    switch (b->end->op) {
-      default:
-        assert(false);
-        break;
+  for_range(uint32_t, i, b->num_succs) {
+    if (b->succs[i] == succ) {
+      return true;
+    }
+  }
 
-      case SEM_OP_RETURN:
-        break;
+  return false;
+}
 
-      case SEM_OP_GOTO: {
-        int* loc = b->end->data;
-        result.blocks[result.count++] = *loc;
-      } break;
+int sem_succ_index(SemFunc* func, uint32_t to, int pred) {
+  uint32_t from = func->blocks[to].preds[pred];
+  SemBlock* f = &func->blocks[from];
 
-      case SEM_OP_BRANCH: {
-        int* locs = b->end->data;
-        result.blocks[result.count++] = locs[0];
-        result.blocks[result.count++] = locs[1];
-      } break;
+  for_range(int, s, (int)f->num_succs) {
+    if (f->succs[s] == to && sem_pred_index(func, from, s) == pred) {
+      return s;
     }
   }
 
-  return result;
+  assert(false);
+  return -1;
+}
+
+// The edge keeps its place among the target's predecessors, so phis need no
+// changes
+uint32_t sem_split_edge(Arena* arena, SemFunc* func, uint32_t from, int succ) {
+  uint32_t to = func->blocks[from].succs[succ];
+  int pred = sem_pred_index(func, from, succ);
+
+  uint32_t mid = sem_new_block(func);
+  SemBlock* f = &func->blocks[from];
+  SemBlock* m = &func->blocks[mid];
+
+  f->succs[succ] = mid;
+  func->blocks[to].preds[pred] = mid;
+
+  m->num_succs = 1;
+  m->succs[0] = to;
+
+  m->preds = arena_push(arena, sizeof(uint32_t));
+  m->preds[0] = from;
+  m->num_preds = 1;
+  m->preds_capacity = 1;
+
+  uint32_t terminator = f->insts[f->num_insts-1];
+  sem_block_append(arena, func, mid, sem_new_inst(func, SEM_OP_GOTO, func->tokens[terminator], 0, 0));
+
+  return mid;
+}
+
+static void remove_pred(SemFunc* func, uint32_t to, int pred) {
+  SemBlock* t = &func->blocks[to];
+
+  memmove(t->preds + pred, t->preds + pred + 1, (t->num_preds - pred - 1) * sizeof(uint32_t));
+  t->num_preds--;
+
+  for (uint32_t i = 0; i < t->num_insts && func->insts[t->insts[i]].op == SEM_OP_PHI; ++i) {
+    sem_remove_operand(func, t->insts[i], pred);
+  }
+}
+
+void sem_remove_edge(SemFunc* func, uint32_t from, int succ) {
+  SemBlock* f = &func->blocks[from];
+  assert(succ < (int)f->num_succs);
+
+  uint32_t to = f->succs[succ];
+  int pred = sem_pred_index(func, from, succ);
+
+  memmove(f->succs + succ, f->succs + succ + 1, (f->num_succs - succ - 1) * sizeof(uint32_t));
+  f->num_succs--;
+
+  remove_pred(func, to, pred);
+  sem_invalidate_cfg(func);
 }
 
-uint64_t* sem_reachable(Arena* arena, SemFunc* func) {
+void sem_redirect_edge(Arena* arena, SemFunc* func, uint32_t from, int succ, uint32_t to) {
+  SemBlock* f = &func->blocks[from];
+  assert(succ < (int)f->num_succs);
+
+  for_range(int, i, (int)f->num_succs) {
+    assert(f->succs[i] != to);
+  }
+
+  remove_pred(func, f->succs[succ], sem_pred_index(func, from, succ));
+
+  f->succs[succ] = to;
+  add_pred(arena, func, from, to);
+
+  sem_invalidate_cfg(func);
+}
+
+void sem_invalidate_cfg(SemFunc* func) {
+  func->num_rpo = 0;
+  func->rpo = NULL;
+  func->rpo_index = NULL;
+  func->dom = NULL;
+}
+
+void sem_rpo(SemContext* context, SemFunc* func) {
+  if (func->rpo) {
+    return;
+  }
+
+  Arena* arena = context->arena;
   Scratch scratch = global_scratch(1, &arena);
 
-  DynamicArray(int) stack = new_dynamic_array(scratch.allocator);
-  dynamic_array_put(stack, 0);
+  int num_blocks = dynamic_array_length(func->blocks);
 
-  uint64_t* reachable = arena_array(arena, uint64_t, bitset_num_u64(dynamic_array_length(func->blocks)));
+  func->rpo = arena_push(arena, num_blocks * sizeof(uint32_t));
+  func->rpo_index = arena_push(arena, num_blocks * sizeof(uint32_t));
 
-  while (dynamic_array_length(stack)) {
-    int b = dynamic_array_pop(stack);
+  for_range(int, i, num_blocks) {
+    func->rpo_index[i] = SEM_UNREACHABLE;
+  }
 
-    if (bitset_query(reachable, b)) {
-      continue;
-    }
+  // Blocks on the stack with how many of their successors have been visited.
+  // Postorder fills rpo from the back, and is then shifted to the front.
+  typedef struct {
+    uint32_t block;
+    uint32_t next_succ;
+  } Visit;
 
-    bitset_set(reachable, b);
+  DynamicArray(Visit) stack = new_dynamic_array(scratch.allocator);
+  uint64_t* seen = arena_array(scratch.arena, uint64_t, bitset_num_u64(num_blocks));
 
-    Successors successors = get_successors(func, b);
+  uint32_t next = num_blocks;
+
+  if (num_blocks) {
+    bitset_set(seen, 0);
+    dynamic_array_put(stack, ((Visit){ .block = 0 }));
+  }
 
-    for_range(int, i, successors.count) {
-      dynamic_array_put(stack, successors.blocks[i]);
+  while (dynamic_array_length(stack)) {
+    Visit* top = &dynamic_array_back(stack);
+    SemBlock* b = &func->blocks[top->block];
+
+    if (top->next_succ < b->num_succs) {
+      uint32_t succ = b->succs[top->next_succ++];
+
+      if (!bitset_query(seen, succ)) {
+        bitset_set(seen, succ);
+        dynamic_array_put(stack, ((Visit){ .block = succ }));
+      }
     }
+    else {
+      func->rpo[--next] = top->block;
+      (void)dynamic_array_pop(stack);
+    }
+  }
+
+  func->num_rpo = num_blocks - next;
+  memmove(func->rpo, func->rpo + next, func->num_rpo * sizeof(uint32_t));
+
+  for_range(int, i, (int)func->num_rpo) {
+    func->rpo_index[func->rpo[i]] = i;
   }
 
   scratch_release(&scratch);
+}
+
+uint64_t* sem_reachable(SemContext* context, Arena* arena, SemFunc* func) {
+  sem_rpo(context, func);
+
+  uint64_t* reachable = arena_array(arena, uint64_t, bitset_num_u64(dynamic_array_length(func->blocks)));
+
+  for_range(int, i, (int)func->num_rpo) {
+    bitset_set(reachable, func->rpo[i]);
+  }
+
   return reachable;
 }
 
@@ -127,49 +660,167 @@ static bool is_user_code(SemInst* inst) {
     default:
       return true;
     case SEM_OP_GOTO:
+    case SEM_OP_UNDEF:
+    case SEM_OP_PHI:
+    case SEM_OP_COPY:
       return false;
   }
 }
 
-static SemInst* contains_user_code(SemBlock* block) {
-  for_list(SemInst, inst, block->start) {
-    if (is_user_code(inst)) {
-      return inst;
+static uint32_t contains_user_code(SemFunc* func, SemBlock* block) {
+  for_range(int, i, (int)block->num_insts) {
+    if (is_user_code(sem_inst(func, block->insts[i]))) {
+      return block->insts[i];
     }
   }
 
-  return NULL;
+  return 0;
 }
 
-static bool analyze_func(SemContext* context, SourceContents source, SemFunc* func) {
-  Scratch scratch = global_scratch(1, &context->arena);
+bool sem_analyze_func(SemContext* context, SourceContents source, TokenizedBuffer* tokens, SemFunc* func) {
   bool ret_val = true;
 
-  uint64_t* reachable = sem_reachable(scratch.arena, func);
+  sem_rpo(context, func);
 
   for_range(int, b, dynamic_array_length(func->blocks)) {
-    if (bitset_query(reachable, b)) {
+    if (func->rpo_index[b] != SEM_UNREACHABLE) {
       continue;
     }
 
-    SemInst* user_code = contains_user_code(&func->blocks[b]);
+    uint32_t user_code = contains_user_code(func, &func->blocks[b]);
 
     if (user_code) {
-      error_at_token(source, user_code->token, "this code is unreachable");
+      error_at_token(source, sem_token(func, tokens, user_code), "this code is unreachable");
       ret_val = false;
     }
   }
 
-  scratch_release(&scratch);
   return ret_val;
 }
 
-bool sem_analyze(SemContext* context, SourceContents source, SemFile* file) {
+// Files with fewer functions than this are not worth the cost of starting threads
+#define PARALLEL_ANALYZE_THRESHOLD 256
+
+static bool analyze_serial(SemContext* context, SourceContents source, SemFile* file) {
   bool result = true;
 
   for_range(int, i, file->num_funcs) {
-    result &= analyze_func(context, source, &file->funcs[i]);
+    result &= sem_analyze_func(context, source, file->tokens, &file->funcs[i]);
+  }
+
+  return result;
+}
+
+bool sem_analyze(SemContext* context, SourceContents source, SemFile* file) {
+  if (file->num_funcs >= PARALLEL_ANALYZE_THRESHOLD) {
+    return sem_analyze_parallel(context, source, file, hardware_thread_count());
+  }
+
+  return analyze_serial(context, source, file);
+}
+
+// A contiguous run of functions analyzed by one worker, which keeps what it
+// computes and the errors it finds in its own arena
+typedef struct {
+  int first_fn;
+  int num_fns;
+
+  Arena* arena;
+  DynamicArray(char) errors;
+  bool success;
+} AnalyzeBatch;
+
+typedef struct {
+  SourceContents source;
+  SemFile* file;
+  AnalyzeBatch* batches;
+} ParallelAnalyze;
+
+static void analyze_batch(void* data, int index) {
+  ParallelAnalyze* pa = data;
+  AnalyzeBatch* batch = &pa->batches[index];
+
+  batch->arena = new_arena();
+  batch->success = true;
+
+  SemContext* context = sem_init(batch->arena);
+  batch->errors = new_dynamic_array(context->allocator);
+
+  DynamicArray(char)* outer = capture_errors(&batch->errors);
+
+  for_range(int, i, batch->num_fns) {
+    SemFunc* func = &pa->file->funcs[batch->first_fn + i];
+    batch->success &= sem_analyze_func(context, pa->source, pa->file->tokens, func);
+
+    // Its CFG was cached in the worker's arena
+    sem_invalidate_cfg(func);
+  }
+
+  capture_errors(outer);
+}
+
+// Every function is analyzed whatever the others hold, so batches run across
+// threads and their errors are printed afterwards in source order
+bool sem_analyze_parallel(SemContext* context, SourceContents source, SemFile* file, int num_threads) {
+  if (num_threads <= 1) {
+    return analyze_serial(context, source, file);
+  }
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  int num_batches = count_batches(file->num_funcs, num_threads);
+  AnalyzeBatch* batches = arena_array(scratch.arena, AnalyzeBatch, num_batches);
+
+  for_range(int, i, num_batches) {
+    batch_range(file->num_funcs, num_batches, i, &batches[i].first_fn, &batches[i].num_fns);
+  }
+
+  ParallelAnalyze pa = {
+    .source = source,
+    .file = file,
+    .batches = batches
+  };
+
+  parallel_for(num_threads, num_batches, analyze_batch, &pa);
+
+  bool result = true;
+
+  for_range(int, i, num_batches) {
+    print_captured_errors(batches[i].errors);
+    result &= batches[i].success;
+
+    free_arena(batches[i].arena);
   }
 
+  scratch_release(&scratch);
   return result;
-}
\ No newline at end of file
+}
+
+void sem_optimize(SemContext* context, SemFile* file) {
+  for_range(int, i, file->num_funcs) {
+    SemFunc* func = &file->funcs[i];
+
+    sem_promote_locals(context, func);
+    sem_rotate_loops(context, func); // Before folding, which can often drop the guard
+    sem_propagate_constants(context, func);
+    sem_hoist_invariants(context, func);
+    sem_number_values(context, func);
+    sem_eliminate_dead_code(context, func);
+    sem_simplify_cfg(context, func);
+    sem_eliminate_dead_code(context, func); // What threaded edges no longer bring
+
+    // Once merged, more loops are a single block, which is all unrolling takes
+    SemInductionCounts inductions = sem_simplify_inductions(context, func);
+    SemUnrollCounts unrolled = sem_unroll_loops(context, func);
+
+    if (inductions.reduced || inductions.exit_values || unrolled.full || unrolled.partial) {
+      sem_propagate_constants(context, func);
+      sem_number_values(context, func);
+      sem_eliminate_dead_code(context, func);
+      sem_simplify_cfg(context, func);
+      sem_eliminate_dead_code(context, func);
+    }
+
+    sem_compact(context, func);
+  }
+}
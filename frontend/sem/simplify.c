@@ -0,0 +1,313 @@
+#include "frontend.h"
+
+// Control flow simplification. Edges into blocks that only jump on are pointed
+// past them, a block is merged into its predecessor when each is the other's
+// only neighbour, and an edge into a block that only branches on a phi goes
+// straight to the side it takes when that edge brings a constant.
+
+typedef struct {
+  SemContext* context;
+  SemFunc* func;
+
+  bool* is_header; // Targets of a back edge, kept up to date as edges move
+  DynamicArray(uint32_t) values; // What a bypassed edge brings to the target's phis
+
+  SemCfgCounts counts;
+} Simplification;
+
+static SemInst* terminator(SemFunc* func, uint32_t block) {
+  SemBlock* b = &func->blocks[block];
+  return b->num_insts ? sem_inst(func, b->insts[b->num_insts-1]) : NULL;
+}
+
+// Moves the edge at through's pred on to target. Target's phis take what they
+// took from through's edge at target_pred, or for a phi of through, what that
+// phi took from the moved edge.
+static void bypass(Simplification* s, uint32_t through, int pred, uint32_t target, int target_pred) {
+  SemFunc* func = s->func;
+  SemBlock* t = &func->blocks[target];
+
+  dynamic_array_clear(s->values);
+
+  for (uint32_t i = 0; i < t->num_insts && func->insts[t->insts[i]].op == SEM_OP_PHI; ++i) {
+    uint32_t value = sem_operand(func, t->insts[i], target_pred);
+
+    if (value && func->insts[value].op == SEM_OP_PHI && func->insts[value].block == through) {
+      value = sem_operand(func, value, pred);
+    }
+
+    dynamic_array_put(s->values, value);
+  }
+
+  uint32_t from = func->blocks[through].preds[pred];
+  sem_redirect_edge(s->context->arena, func, from, sem_succ_index(func, through, pred), target);
+
+  for_range(int, i, dynamic_array_length(s->values)) {
+    sem_set_operand(func, t->insts[i], t->num_preds-1, s->values[i]);
+  }
+}
+
+// Empties a block no longer entered, so it stops being a predecessor of where
+// it went and nothing here takes it for one that jumps
+static void disconnect(SemFunc* func, uint32_t block) {
+  SemBlock* b = &func->blocks[block];
+
+  for_range_rev(int, i, (int)b->num_succs) {
+    sem_remove_edge(func, block, i);
+  }
+
+  for_range_rev(int, i, (int)b->num_insts) {
+    sem_remove_inst(func, b->insts[i]);
+  }
+}
+
+static bool forward_gotos(Simplification* s, uint32_t b) {
+  SemFunc* func = s->func;
+  SemBlock* block = &func->blocks[b];
+
+  if (b == 0 || block->num_insts != 1 || terminator(func, b)->op != SEM_OP_GOTO) {
+    return false;
+  }
+
+  uint32_t target = block->succs[0];
+  int target_pred = sem_pred_index(func, b, 0);
+
+  if (target == b) {
+    return false;
+  }
+
+  bool changed = false;
+
+  for_range_rev(int, i, (int)block->num_preds) {
+    uint32_t from = block->preds[i];
+
+    if (from == b || sem_has_succ(func, from, target)) {
+      continue;
+    }
+
+    bypass(s, b, i, target, target_pred);
+    s->counts.forwarded++;
+    changed = true;
+  }
+
+  // Back edges into this block now go to the target. Threading and merging
+  // never add one, so nothing else can make a header.
+  s->is_header[target] |= s->is_header[b];
+
+  if (!block->num_preds) {
+    disconnect(func, b);
+  }
+
+  return changed;
+}
+
+// Takes in the block's only successor while that has no other predecessor
+static bool merge_succs(Simplification* s, uint32_t b) {
+  SemFunc* func = s->func;
+  bool changed = false;
+
+  while (true) {
+    SemBlock* block = &func->blocks[b];
+    SemInst* end = terminator(func, b);
+
+    if (!end || end->op != SEM_OP_GOTO) {
+      return changed;
+    }
+
+    uint32_t succ = block->succs[0];
+    SemBlock* next = &func->blocks[succ];
+
+    if (succ == b || succ == 0 || next->num_preds != 1) {
+      return changed;
+    }
+
+    // A phi that is its own operand is in a loop that lost its entry this
+    // round, which is removed at the end anyway
+    for (uint32_t i = 0; i < next->num_insts && func->insts[next->insts[i]].op == SEM_OP_PHI; ++i) {
+      if (sem_operand(func, next->insts[i], 0) == next->insts[i]) {
+        return changed;
+      }
+    }
+
+    // With one predecessor a phi is just its operand
+    while (next->num_insts && func->insts[next->insts[0]].op == SEM_OP_PHI) {
+      uint32_t phi = next->insts[0];
+
+      sem_replace_all_uses_with(func, phi, sem_operand(func, phi, 0));
+      sem_remove_inst(func, phi);
+    }
+
+    sem_remove_inst(func, block->insts[block->num_insts-1]);
+
+    for_range(uint32_t, i, next->num_insts) {
+      sem_block_append(s->context->arena, func, b, next->insts[i]);
+    }
+
+    block = &func->blocks[b];
+    next = &func->blocks[succ];
+
+    // Each edge keeps its place among its target's predecessors, so phis
+    // there stay as they are
+    for_range(uint32_t, i, next->num_succs) {
+      SemBlock* after = &func->blocks[next->succs[i]];
+
+      for_range(uint32_t, j, after->num_preds) {
+        if (after->preds[j] == succ) {
+          after->preds[j] = b;
+        }
+      }
+
+      block->succs[i] = next->succs[i];
+    }
+
+    block->num_succs = next->num_succs;
+
+    next->num_insts = 0;
+    next->num_succs = 0;
+    next->num_preds = 0;
+
+    sem_invalidate_cfg(func);
+
+    s->counts.merged++;
+    changed = true;
+  }
+}
+
+// Nothing in the block but phis, used only by its branch or by phis on its
+// outgoing edges, so skipping it leaves nothing a later block could have used
+static bool is_threadable(SemFunc* func, uint32_t b) {
+  SemBlock* block = &func->blocks[b];
+  SemInst* end = terminator(func, b);
+
+  if (!end || end->op != SEM_OP_BRANCH) {
+    return false;
+  }
+
+  uint32_t branch = block->insts[block->num_insts-1];
+  uint32_t cond = sem_operand(func, branch, 0);
+
+  if (func->insts[cond].op != SEM_OP_PHI || func->insts[cond].block != b) {
+    return false;
+  }
+
+  for_range(uint32_t, i, block->num_insts-1) {
+    uint32_t phi = block->insts[i];
+
+    if (func->insts[phi].op != SEM_OP_PHI) {
+      return false;
+    }
+
+    for (uint32_t use = func->first_use[phi]; use; use = sem_next_use(func, phi, use)) {
+      uint32_t user = func->uses[use].user;
+      SemInst* in = sem_inst(func, user);
+
+      if (user == branch) {
+        continue;
+      }
+
+      if (in->op != SEM_OP_PHI || func->blocks[in->block].preds[use - in->ins] != b) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool thread_jumps(Simplification* s, uint32_t b) {
+  SemFunc* func = s->func;
+
+  // Jumping into the middle of a loop would leave it with two entries
+  if (b == 0 || s->is_header[b] || !is_threadable(func, b)) {
+    return false;
+  }
+
+  SemBlock* block = &func->blocks[b];
+  uint32_t cond = sem_operand(func, block->insts[block->num_insts-1], 0);
+
+  bool changed = false;
+
+  for_range_rev(int, i, (int)block->num_preds) {
+    uint32_t value = sem_operand(func, cond, i);
+    SemInst* in = sem_inst(func, value);
+
+    if (!value || in->op != SEM_OP_INT_CONST) {
+      continue;
+    }
+
+    int taken = func->constants[in->data] ? 0 : 1;
+    uint32_t target = block->succs[taken];
+    uint32_t from = block->preds[i];
+
+    if (target == b || from == b || sem_has_succ(func, from, target)) {
+      continue;
+    }
+
+    bypass(s, b, i, target, sem_pred_index(func, b, taken));
+    s->counts.threaded++;
+    changed = true;
+  }
+
+  if (!block->num_preds) {
+    disconnect(func, b);
+  }
+
+  return changed;
+}
+
+static void find_headers(Simplification* s) {
+  SemFunc* func = s->func;
+  sem_rpo(s->context, func);
+
+  for_range(int, b, dynamic_array_length(func->blocks)) {
+    SemBlock* block = &func->blocks[b];
+    s->is_header[b] = false;
+
+    for_range(uint32_t, i, block->num_preds) {
+      uint32_t pred = block->preds[i];
+
+      // Every block is reachable by now, so this is an edge going back
+      if (func->rpo_index[pred] >= func->rpo_index[b]) {
+        s->is_header[b] = true;
+      }
+    }
+  }
+}
+
+SemCfgCounts sem_simplify_cfg(SemContext* context, SemFunc* func) {
+  Simplification s = {
+    .context = context,
+    .func = func
+  };
+
+  if (!dynamic_array_length(func->blocks)) {
+    return s.counts;
+  }
+
+  // Unreachable blocks would count as predecessors
+  sem_remove_unreachable(context, func);
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  int num_blocks = dynamic_array_length(func->blocks);
+  s.is_header = arena_push(scratch.arena, num_blocks * sizeof(bool));
+  s.values = new_dynamic_array(scratch.allocator);
+
+  find_headers(&s);
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    for_range(int, b, num_blocks) {
+      changed |= merge_succs(&s, b);
+      changed |= forward_gotos(&s, b);
+      changed |= thread_jumps(&s, b);
+    }
+  }
+
+  scratch_release(&scratch);
+
+  sem_remove_unreachable(context, func);
+  return s.counts;
+}
@@ -0,0 +1,330 @@
+#include "frontend.h"
+
+// Promotes locals to SSA values. Phis go on the iterated dominance frontier
+// of each local's stores, then a walk down the dominator tree replaces every
+// load with the value stored last on the way there (Cytron et al).
+
+#define NO_SLOT UINT32_MAX
+
+bool sem_is_promotable(SemFunc* func, uint32_t local) {
+  for (uint32_t use = func->first_use[local]; use; use = sem_next_use(func, local, use)) {
+    SemInst* user = sem_inst(func, func->uses[use].user);
+
+    if (use != user->ins || (user->op != SEM_OP_LOAD && user->op != SEM_OP_STORE)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+typedef struct {
+  SemContext* context;
+  SemFunc* func;
+
+  int num_locals;
+  uint32_t* locals; // Per slot, the LOCAL it stands for
+  uint32_t* slot; // Per instruction that existed before, NO_SLOT unless promoted
+
+  uint32_t first_phi; // Phis from here on were added for a local
+  DynamicArray(uint32_t) phi_slot;
+
+  uint32_t undef; // What a load reads before any store
+} Promotion;
+
+// Which promoted local an instruction reads or writes
+static uint32_t slot_of(Promotion* p, uint32_t inst) {
+  SemInst* in = sem_inst(p->func, inst);
+
+  switch (in->op) {
+    default:
+      return NO_SLOT;
+
+    case SEM_OP_PHI:
+      return inst >= p->first_phi ? p->phi_slot[inst - p->first_phi] : NO_SLOT;
+
+    case SEM_OP_LOAD:
+    case SEM_OP_STORE:
+      return p->slot[sem_operand(p->func, inst, 0)];
+  }
+}
+
+static void place_phis(Promotion* p, Scratch* scratch) {
+  SemFunc* func = p->func;
+  SemDominators* dom = func->dom;
+
+  int num_blocks = dynamic_array_length(func->blocks);
+
+  // Stamped with the slot being placed, so they never need clearing
+  uint32_t* has_phi = arena_push(scratch->arena, num_blocks * sizeof(uint32_t));
+  uint32_t* queued = arena_push(scratch->arena, num_blocks * sizeof(uint32_t));
+
+  for_range(int, i, num_blocks) {
+    has_phi[i] = NO_SLOT;
+    queued[i] = NO_SLOT;
+  }
+
+  // Blocks that store to each slot
+  DynamicArray(uint32_t)* stores = arena_array(scratch->arena, DynamicArray(uint32_t), p->num_locals);
+
+  for_range(int, s, p->num_locals) {
+    stores[s] = new_dynamic_array(scratch->allocator);
+  }
+
+  for_range(uint32_t, i, func->num_rpo) {
+    uint32_t b = func->rpo[i];
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, j, block->num_insts) {
+      uint32_t inst = block->insts[j];
+      uint32_t s = slot_of(p, inst);
+
+      if (s != NO_SLOT && func->insts[inst].op == SEM_OP_STORE && queued[b] != s) {
+        queued[b] = s;
+        dynamic_array_put(stores[s], b);
+      }
+    }
+  }
+
+  for_range(int, i, num_blocks) {
+    queued[i] = NO_SLOT;
+  }
+
+  // Phis go at the start of a block, and are all placed before any of them
+  // are inserted so each block only shifts once
+  DynamicArray(uint32_t)* phis = arena_array(scratch->arena, DynamicArray(uint32_t), num_blocks);
+  DynamicArray(uint32_t) work = new_dynamic_array(scratch->allocator);
+
+  for_range(uint32_t, s, (uint32_t)p->num_locals) {
+    for_range(int, i, dynamic_array_length(stores[s])) {
+      queued[stores[s][i]] = s;
+      dynamic_array_put(work, stores[s][i]);
+    }
+
+    while (dynamic_array_length(work)) {
+      uint32_t b = dynamic_array_pop(work);
+
+      for (uint32_t i = dom->first_frontier[b]; i < dom->first_frontier[b+1]; ++i) {
+        uint32_t f = dom->frontiers[i];
+
+        if (has_phi[f] == s) {
+          continue;
+        }
+
+        has_phi[f] = s;
+
+        uint32_t local = p->locals[s];
+        uint32_t phi = sem_new_inst(func, SEM_OP_PHI, func->tokens[local], func->blocks[f].num_preds, 0);
+        dynamic_array_put(p->phi_slot, s);
+
+        if (!phis[f]) {
+          phis[f] = new_dynamic_array(scratch->allocator);
+        }
+
+        dynamic_array_put(phis[f], phi);
+
+        // A phi is a store too
+        if (queued[f] != s) {
+          queued[f] = s;
+          dynamic_array_put(work, f);
+        }
+      }
+    }
+  }
+
+  for_range(int, b, num_blocks) {
+    if (!phis[b]) {
+      continue;
+    }
+
+    for_range(int, i, dynamic_array_length(phis[b])) {
+      sem_block_insert(p->context->arena, func, b, i, phis[b][i]);
+    }
+  }
+}
+
+static void rename(Promotion* p, Scratch* scratch, uint64_t* dead) {
+  SemFunc* func = p->func;
+  SemDominators* dom = func->dom;
+
+  // The value each slot holds at the current point of the walk, 0 if nothing
+  // has been stored yet
+  uint32_t* current = arena_array(scratch->arena, uint32_t, p->num_locals);
+
+  typedef struct {
+    uint32_t slot;
+    uint32_t value;
+  } Undo;
+
+  typedef struct {
+    uint32_t block;
+    uint32_t next_child;
+    uint32_t undo_length;
+  } Visit;
+
+  DynamicArray(Undo) undo = new_dynamic_array(scratch->allocator);
+  DynamicArray(Visit) stack = new_dynamic_array(scratch->allocator);
+
+  if (func->num_rpo) {
+    dynamic_array_put(stack, ((Visit){ .block = 0, .next_child = SEM_UNREACHABLE }));
+  }
+
+  while (dynamic_array_length(stack)) {
+    Visit* top = &dynamic_array_back(stack);
+    uint32_t b = top->block;
+
+    // First time here, so rewrite the block and its successors' phis
+    if (top->next_child == SEM_UNREACHABLE) {
+      top->next_child = dom->first_child[b];
+      top->undo_length = dynamic_array_length(undo);
+
+      SemBlock* block = &func->blocks[b];
+
+      for_range(uint32_t, i, block->num_insts) {
+        uint32_t inst = block->insts[i];
+        uint32_t s = slot_of(p, inst);
+
+        if (s == NO_SLOT) {
+          continue;
+        }
+
+        switch (func->insts[inst].op) {
+          case SEM_OP_PHI: {
+            dynamic_array_put(undo, ((Undo){ s, current[s] }));
+            current[s] = inst;
+          } break;
+
+          case SEM_OP_LOAD: {
+            sem_replace_all_uses_with(func, inst, current[s] ? current[s] : p->undef);
+            bitset_set(dead, inst);
+          } break;
+
+          case SEM_OP_STORE: {
+            dynamic_array_put(undo, ((Undo){ s, current[s] }));
+            current[s] = sem_operand(func, inst, 1);
+            bitset_set(dead, inst);
+          } break;
+        }
+      }
+
+      for_range(int, j, (int)block->num_succs) {
+        SemBlock* succ = &func->blocks[block->succs[j]];
+        int pred = sem_pred_index(func, b, j);
+
+        for (uint32_t i = 0; i < succ->num_insts; ++i) {
+          uint32_t phi = succ->insts[i];
+
+          if (func->insts[phi].op != SEM_OP_PHI) {
+            break;
+          }
+
+          uint32_t s = slot_of(p, phi);
+
+          if (s != NO_SLOT) {
+            sem_set_operand(func, phi, pred, current[s] ? current[s] : p->undef);
+          }
+        }
+      }
+    }
+
+    if (top->next_child < dom->first_child[b+1]) {
+      uint32_t child = dom->children[top->next_child++];
+      dynamic_array_put(stack, ((Visit){ .block = child, .next_child = SEM_UNREACHABLE }));
+    }
+    else {
+      while ((uint32_t)dynamic_array_length(undo) > top->undo_length) {
+        Undo u = dynamic_array_pop(undo);
+        current[u.slot] = u.value;
+      }
+
+      (void)dynamic_array_pop(stack);
+    }
+  }
+}
+
+int sem_promote_locals(SemContext* context, SemFunc* func) {
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  int num_insts = dynamic_array_length(func->insts);
+
+  Promotion p = {
+    .context = context,
+    .func = func,
+    .locals = arena_push(scratch.arena, num_insts * sizeof(uint32_t)),
+    .slot = arena_push(scratch.arena, num_insts * sizeof(uint32_t)),
+    .first_phi = num_insts,
+    .phi_slot = new_dynamic_array(scratch.allocator)
+  };
+
+  for_range(int, i, num_insts) {
+    p.slot[i] = NO_SLOT;
+
+    if (func->insts[i].op == SEM_OP_LOCAL && sem_is_promotable(func, i)) {
+      p.slot[i] = p.num_locals;
+      p.locals[p.num_locals++] = i;
+    }
+  }
+
+  if (!p.num_locals) {
+    scratch_release(&scratch);
+    return 0;
+  }
+
+  sem_dominance_frontiers(context, func);
+  place_phis(&p, &scratch);
+
+  // Made up front, as adding it to the entry block mid-walk would shift the
+  // instructions being walked
+  p.undef = sem_new_inst(func, SEM_OP_UNDEF, 0, 0, 0);
+  sem_block_insert(context->arena, func, 0, 0, p.undef);
+
+  uint64_t* dead = arena_array(scratch.arena, uint64_t, bitset_num_u64(dynamic_array_length(func->insts) + 1));
+
+  rename(&p, &scratch, dead);
+
+  // Unreachable blocks never see a store, and edges from them never get to
+  // fill in their phi operand
+  for_range(int, b, dynamic_array_length(func->blocks)) {
+    SemBlock* block = &func->blocks[b];
+
+    for_range(uint32_t, i, block->num_insts) {
+      uint32_t inst = block->insts[i];
+      uint32_t s = slot_of(&p, inst);
+
+      if (s == NO_SLOT) {
+        continue;
+      }
+
+      SemInst* in = sem_inst(func, inst);
+
+      if (func->rpo_index[b] == SEM_UNREACHABLE && in->op != SEM_OP_PHI) {
+        if (in->op == SEM_OP_LOAD) {
+          sem_replace_all_uses_with(func, inst, p.undef);
+        }
+
+        bitset_set(dead, inst);
+      }
+
+      if (in->op == SEM_OP_PHI) {
+        for_range(int, j, in->num_ins) {
+          if (!sem_operand(func, inst, j)) {
+            sem_set_operand(func, inst, j, p.undef);
+          }
+        }
+      }
+    }
+  }
+
+  for_range(int, s, p.num_locals) {
+    bitset_set(dead, p.locals[s]);
+  }
+
+  if (!func->first_use[p.undef]) {
+    bitset_set(dead, p.undef);
+  }
+
+  sem_sweep(func, dead);
+
+  scratch_release(&scratch);
+  return p.num_locals;
+}
@@ -0,0 +1,232 @@
+#include "frontend.h"
+
+// Loop unrolling, for loops of a single block that branches back to itself
+// and runs a known number of times. A short one is unrolled fully: all but
+// its last iteration are copied into the preheader one after another, and the
+// loop itself is left to run once, which constant propagation then sees
+// through. Otherwise a loop running several copies of the body per iteration
+// goes in front, for as long as a whole iteration of it fits, and the original
+// loop runs the iterations left over.
+
+#define MAX_FULL_TRIPS 32
+#define MAX_FULL_INSTS 256 // In all the copies a full unroll makes
+#define MAX_UNROLLED_INSTS 64 // In the body of the loop in front
+#define MAX_FACTOR 8
+
+typedef struct {
+  uint32_t block;
+  uint32_t preheader;
+  uint64_t trips;
+  SemInduction counter; // What the latch tests
+  uint32_t factor; // Copies per iteration of the loop in front, or 0 to unroll fully
+} Unrolling;
+
+typedef struct {
+  SemContext* context;
+  SemFunc* func;
+
+  uint32_t* copy; // Per body instruction, its latest copy
+  DynamicArray(uint32_t) values; // Per phi, what the next copy starts from
+} Unroller;
+
+static uint32_t copy_of(Unroller* u, uint32_t body, uint32_t value) {
+  return u->func->insts[value].block == body ? u->copy[value] : value;
+}
+
+// Copies the body in before the end of a block, with each phi standing for
+// what values has for it, and leaves values with what the copy sends round
+static void copy_body(Unroller* u, uint32_t body, int back, uint32_t to) {
+  SemFunc* func = u->func;
+  uint32_t phis = dynamic_array_length(u->values);
+
+  for_range(uint32_t, i, phis) {
+    u->copy[func->blocks[body].insts[i]] = u->values[i];
+  }
+
+  for (uint32_t i = phis; i < func->blocks[body].num_insts-1; ++i) {
+    uint32_t inst = func->blocks[body].insts[i];
+    SemInst in = func->insts[inst];
+
+    uint32_t copy = sem_new_inst(func, in.op, func->tokens[inst], in.num_ins, in.data);
+
+    for_range(int, j, in.num_ins) {
+      sem_set_operand(func, copy, j, copy_of(u, body, sem_operand(func, inst, j)));
+    }
+
+    sem_block_insert(u->context->arena, func, to, func->blocks[to].num_insts-1, copy);
+    u->copy[inst] = copy;
+  }
+
+  for_range(uint32_t, i, phis) {
+    u->values[i] = copy_of(u, body, sem_operand(func, func->blocks[body].insts[i], back));
+  }
+}
+
+static void unroll_fully(Unroller* u, Unrolling* plan) {
+  SemFunc* func = u->func;
+  uint32_t body = plan->block;
+
+  int entry = sem_pred_index(func, plan->preheader, 0);
+  uint32_t phis = sem_num_phis(func, body);
+
+  dynamic_array_clear(u->values);
+
+  for_range(uint32_t, i, phis) {
+    dynamic_array_put(u->values, sem_operand(func, func->blocks[body].insts[i], entry));
+  }
+
+  for (uint64_t i = 1; i < plan->trips; ++i) {
+    copy_body(u, body, 1 - entry, plan->preheader);
+  }
+
+  for_range(uint32_t, i, phis) {
+    sem_set_operand(func, func->blocks[body].insts[i], entry, u->values[i]);
+  }
+}
+
+static void unroll_partially(Unroller* u, Unrolling* plan) {
+  SemFunc* func = u->func;
+  Arena* arena = u->context->arena;
+  uint32_t body = plan->block;
+
+  int entry = sem_pred_index(func, plan->preheader, 0);
+  uint32_t wide = sem_split_edge(arena, func, plan->preheader, 0);
+  uint32_t phis = sem_num_phis(func, body);
+  uint32_t counter = 0;
+
+  dynamic_array_clear(u->values);
+
+  for_range(uint32_t, i, phis) {
+    uint32_t phi = func->blocks[body].insts[i];
+    uint32_t merged = sem_new_inst(func, SEM_OP_PHI, func->tokens[phi], 1, 0);
+
+    sem_set_operand(func, merged, 0, sem_operand(func, phi, entry));
+    sem_block_insert(arena, func, wide, i, merged);
+
+    dynamic_array_put(u->values, merged);
+    counter = phi == plan->counter.phi ? i : counter;
+  }
+
+  for_range(uint32_t, i, plan->factor) {
+    copy_body(u, body, 1 - entry, wide);
+  }
+
+  // Round again until the counter gets to where the last whole iteration
+  // leaves it
+  uint64_t init = func->constants[func->insts[plan->counter.init].data];
+  uint64_t step = func->constants[func->insts[plan->counter.step].data];
+  uint64_t iterations = (plan->trips - 1) / plan->factor;
+
+  step = plan->counter.decreasing ? 0 - step : step;
+
+  SemBlock* w = &func->blocks[wide];
+  uint32_t token = func->tokens[w->insts[w->num_insts-1]];
+
+  uint32_t bound = sem_new_constant(func, token, init + step * plan->factor * iterations);
+  uint32_t test = sem_new_inst(func, SEM_OP_SUB, token, 2, 0);
+  uint32_t branch = sem_new_inst(func, SEM_OP_BRANCH, token, 1, 0);
+
+  sem_set_operand(func, test, 0, u->values[counter]);
+  sem_set_operand(func, test, 1, bound);
+  sem_set_operand(func, branch, 0, test);
+
+  sem_remove_inst(func, func->blocks[wide].insts[func->blocks[wide].num_insts-1]);
+  sem_remove_edge(func, wide, 0);
+
+  sem_block_append(arena, func, wide, bound);
+  sem_block_append(arena, func, wide, test);
+  sem_block_append(arena, func, wide, branch);
+
+  // Staying is the first successor
+  sem_add_edge(arena, func, wide, wide);
+  sem_add_edge(arena, func, wide, body);
+
+  uint32_t from_wide = func->blocks[body].num_preds-1;
+
+  for_range(uint32_t, i, phis) {
+    sem_set_operand(func, func->blocks[wide].insts[i], 1, u->values[i]);
+    sem_set_operand(func, func->blocks[body].insts[i], from_wide, u->values[i]);
+  }
+}
+
+static bool plan_unrolling(SemFunc* func, SemLoops* loops, uint32_t loop, Unrolling* plan) {
+  SemLoop* l = &loops->loops[loop];
+
+  if (l->num_blocks != 1 || l->preheader == SEM_NO_BLOCK || l->latch != l->header) {
+    return false;
+  }
+
+  if (sem_has_local(func, l->header)) {
+    return false;
+  }
+
+  SemBlock* block = &func->blocks[l->header];
+  uint32_t num_copied = block->num_insts - sem_num_phis(func, l->header) - 1;
+
+  *plan = (Unrolling) {
+    .block = l->header,
+    .preheader = l->preheader
+  };
+
+  if (!sem_trip_count(func, loops, loop, &plan->counter, &plan->trips) || plan->trips < 2) {
+    return false;
+  }
+
+  if (plan->trips <= MAX_FULL_TRIPS && num_copied * (plan->trips - 1) <= MAX_FULL_INSTS) {
+    return true;
+  }
+
+  plan->factor = MAX_FACTOR;
+
+  while (plan->factor > 1 && (num_copied * plan->factor > MAX_UNROLLED_INSTS || plan->trips - 1 < plan->factor)) {
+    plan->factor /= 2;
+  }
+
+  return plan->factor > 1;
+}
+
+SemUnrollCounts sem_unroll_loops(SemContext* context, SemFunc* func) {
+  SemUnrollCounts counts = {0};
+
+  if (!dynamic_array_length(func->blocks)) {
+    return counts;
+  }
+
+  Scratch scratch = global_scratch(1, &context->arena);
+
+  SemLoops* loops = sem_find_loops(context, scratch.arena, func);
+  DynamicArray(Unrolling) plans = new_dynamic_array(scratch.allocator);
+
+  for_range(int, l, loops->num_loops) {
+    Unrolling plan;
+
+    if (plan_unrolling(func, loops, l, &plan)) {
+      dynamic_array_put(plans, plan);
+    }
+  }
+
+  Unroller u = {
+    .context = context,
+    .func = func,
+    .copy = arena_push(scratch.arena, dynamic_array_length(func->insts) * sizeof(uint32_t)),
+    .values = new_dynamic_array(scratch.allocator)
+  };
+
+  for_range(int, i, dynamic_array_length(plans)) {
+    Unrolling* plan = &plans[i];
+
+    if (plan->factor) {
+      unroll_partially(&u, plan);
+      counts.partial++;
+      counts.copies += plan->factor;
+    }
+    else {
+      unroll_fully(&u, plan);
+      counts.full++;
+      counts.copies += (int)(plan->trips - 1);
+    }
+  }
+
+  scratch_release(&scratch);
+  return counts;
+}
@@ -0,0 +1,562 @@
+#include "frontend.h"
+
+// Where each top-level function lives in the token, literal, node and child
+// arrays. Every function owns a contiguous range of each, in source order.
+typedef struct {
+  int first_token; // Its 'fn', the range runs through its closing '}'
+  int num_tokens;
+  int first_literal;
+  int num_literals;
+  int first_node; // Its AST_FN node is the last of the range
+  int num_nodes;
+  int first_child;
+  int num_children;
+} SessionFunc;
+
+struct Session {
+  Arena* arena;
+  Arena* sem_arena; // Checked functions, which outlive the version that checked them
+
+  // Instructions of the current functions, and of the ones edits replaced
+  // that are still in sem_arena, which is recycled once they outnumber them
+  uint64_t num_live_insts;
+  uint64_t num_dead_insts;
+
+  // Tokens, AST and function arrays of the current text. Each edit builds the
+  // next version in the other arena of the pair and then releases this one.
+  ScratchLibrary* versions;
+  Scratch version;
+
+  SemContext* sem;
+
+  // Edited in place, so the tokens before an edit stay where they are
+  SourceContents source;
+  int capacity;
+
+  // False if the current text has errors, then the next edit starts over
+  bool valid;
+
+  TokenizedBuffer* tokens;
+  AST* ast;
+
+  int num_funcs;
+  SessionFunc* funcs;
+  SemFile* file;
+};
+
+typedef enum {
+  UPDATE_OK,
+  UPDATE_ERROR, // Reported, the same as the whole pipeline would have
+  UPDATE_REBUILD, // The edit could not be confined to whole functions
+} UpdateResult;
+
+static void describe_functions(AST* ast, SessionFunc* out) {
+  ASTNode* file = ast_node(ast, ast->root);
+
+  int first_node = 0;
+  int first_child = 0;
+  int first_literal = 0;
+
+  for_range(int, i, (int)file->num_children) {
+    uint32_t fn_index = ast_child(ast, ast->root, i);
+    ASTNode* fn = ast_node(ast, fn_index);
+
+    int end_token = i+1 < (int)file->num_children
+      ? (int)ast_node(ast, ast_child(ast, ast->root, i+1))->token
+      : ast->tokens->length-1;
+
+    int num_literals = 0;
+
+    for (int t = fn->token; t < end_token; ++t) {
+      num_literals += ast->tokens->tokens[t].kind == TOKEN_INTEGER_LITERAL;
+    }
+
+    out[i] = (SessionFunc) {
+      .first_token = fn->token,
+      .num_tokens = end_token - fn->token,
+      .first_literal = first_literal,
+      .num_literals = num_literals,
+      .first_node = first_node,
+      .num_nodes = fn_index + 1 - first_node,
+      .first_child = first_child,
+      .num_children = fn->first_child + fn->num_children - first_child
+    };
+
+    first_node = fn_index + 1;
+    first_child = fn->first_child + fn->num_children;
+    first_literal += num_literals;
+  }
+}
+
+static uint64_t count_insts(SemFunc* funcs, int num_funcs) {
+  uint64_t count = 0;
+
+  for_range(int, i, num_funcs) {
+    count += dynamic_array_length(funcs[i].insts);
+  }
+
+  return count;
+}
+
+// Copies a function into arrays of the context's arena, leaving nothing of it
+// in the one it was in
+static void copy_func(SemContext* context, SemFunc* func) {
+  Allocator* allocator = context->allocator;
+
+  func->name = copy_cstr(context->arena, func->name.str);
+
+  if (func->regs) {
+    uint32_t* regs = arena_push(context->arena, dynamic_array_length(func->insts) * sizeof(uint32_t));
+    memcpy(regs, func->regs, dynamic_array_length(func->insts) * sizeof(uint32_t));
+    func->regs = regs;
+  }
+
+  func->insts = dynamic_array_copy(allocator, func->insts);
+  func->tokens = dynamic_array_copy(allocator, func->tokens);
+  func->first_use = dynamic_array_copy(allocator, func->first_use);
+  func->replaced_by = dynamic_array_copy(allocator, func->replaced_by);
+  func->uses = dynamic_array_copy(allocator, func->uses);
+  func->constants = dynamic_array_copy(allocator, func->constants);
+  func->blocks = dynamic_array_copy(allocator, func->blocks);
+
+  for_range(int, b, dynamic_array_length(func->blocks)) {
+    SemBlock* block = &func->blocks[b];
+
+    uint32_t* insts = arena_push(context->arena, block->num_insts * sizeof(uint32_t));
+    uint32_t* preds = arena_push(context->arena, block->num_preds * sizeof(uint32_t));
+
+    memcpy(insts, block->insts, block->num_insts * sizeof(uint32_t));
+    memcpy(preds, block->preds, block->num_preds * sizeof(uint32_t));
+
+    block->insts = insts;
+    block->capacity = block->num_insts;
+    block->preds = preds;
+    block->preds_capacity = block->num_preds;
+  }
+
+  sem_invalidate_cfg(func);
+}
+
+// Moves the current functions into a fresh arena, dropping what the functions
+// edits replaced left behind
+static void recycle_sem(Session* s) {
+  Arena* arena = new_arena();
+  SemContext* sem = sem_init(arena);
+
+  for_range(int, i, s->num_funcs) {
+    copy_func(sem, &s->file->funcs[i]);
+  }
+
+  free_arena(s->sem_arena);
+
+  s->sem_arena = arena;
+  s->sem = sem;
+  s->num_dead_insts = 0;
+}
+
+static uint32_t fn_node(SessionFunc* func) {
+  return func->first_node + func->num_nodes - 1;
+}
+
+// Runs the whole pipeline on the current text
+static bool rebuild(Session* s) {
+  free_arena(s->sem_arena);
+  s->sem_arena = new_arena();
+  s->sem = sem_init(s->sem_arena);
+  s->num_live_insts = 0;
+  s->num_dead_insts = 0;
+
+  s->tokens = tokenize(s->version.arena, s->source);
+  if (!s->tokens) { return false; }
+
+  s->ast = parse(s->version.arena, s->source, s->tokens, 0);
+  if (!s->ast) { return false; }
+
+  s->num_funcs = ast_node(s->ast, s->ast->root)->num_children;
+  s->funcs = arena_array(s->version.arena, SessionFunc, s->num_funcs);
+  describe_functions(s->ast, s->funcs);
+
+  s->file = arena_type(s->version.arena, SemFile);
+  s->file->tokens = s->tokens;
+  s->file->num_funcs = s->num_funcs;
+  s->file->funcs = arena_array(s->version.arena, SemFunc, s->num_funcs);
+
+  for_range(int, i, s->num_funcs) {
+    if (!check_fn(s->sem, s->source, s->ast, fn_node(&s->funcs[i]), &s->file->funcs[i])) {
+      return false;
+    }
+  }
+
+  if (!sem_analyze(s->sem, s->source, s->file)) {
+    return false;
+  }
+
+  s->num_live_insts = count_insts(s->file->funcs, s->num_funcs);
+  return true;
+}
+
+static int func_start(Session* s, int i) {
+  return (int)(s->tokens->tokens[s->funcs[i].first_token].start - s->source.contents);
+}
+
+static int func_end(Session* s, int i) {
+  Token last = s->tokens->tokens[s->funcs[i].first_token + s->funcs[i].num_tokens - 1];
+  return (int)(last.start + last.length - s->source.contents);
+}
+
+// Past the last function, where the next one would be
+static SessionFunc func_or_end(Session* s, int i) {
+  if (i < s->num_funcs) {
+    return s->funcs[i];
+  }
+
+  return (SessionFunc) {
+    .first_token = s->tokens->length-1,
+    .first_literal = s->tokens->num_literals,
+    .first_node = s->ast->root,
+    .first_child = ast_node(s->ast, s->ast->root)->first_child
+  };
+}
+
+typedef struct {
+  SourceContents from;
+  SourceContents to;
+  int byte_delta;
+  int line_delta;
+  int literal_delta;
+} TokenShift;
+
+// Moves a token of the old text to the same place in the new text
+static Token shift_token(TokenShift* shift, Token token) {
+  token.start = shift->to.contents + (token.start - shift->from.contents) + shift->byte_delta;
+  token.line += shift->line_delta;
+
+  if (token.kind == TOKEN_INTEGER_LITERAL) {
+    token.literal += shift->literal_delta;
+  }
+
+  return token;
+}
+
+// Re-lexes, re-parses and re-checks the functions that old bytes [start, end)
+// touched, and splices them in between the functions that are unchanged
+static UpdateResult update(Session* s, Session* old, int start, int end, int inserted) {
+  int byte_delta = inserted - (end - start);
+
+  // Functions [a, b) touch the edit. If it is only in between functions,
+  // a == b and the gap is all there is to re-lex.
+  int a = 0;
+  while (a < old->num_funcs && func_end(old, a) < start) {
+    a++;
+  }
+
+  int b = a;
+  while (b < old->num_funcs && func_start(old, b) <= end) {
+    b++;
+  }
+
+  int region_start = a == 0 ? 0 : func_end(old, a-1);
+  int region_end = (b == old->num_funcs ? old->source.length : func_start(old, b)) + byte_delta;
+
+  // The re-lexed range ends at the next function's 'fn', so a comment on its
+  // last line would have swallowed more than the range
+  if (b < old->num_funcs) {
+    char* line = s->source.contents + region_end;
+
+    while (line > s->source.contents + region_start && line[-1] != '\n') {
+      line--;
+    }
+
+    for (; line + 1 < s->source.contents + region_end; ++line) {
+      if (line[0] == '/' && line[1] == '/') {
+        return UPDATE_REBUILD;
+      }
+    }
+  }
+
+  SessionFunc old_first = func_or_end(old, a);
+  SessionFunc old_last = func_or_end(old, b);
+
+  int first_line = a == 0 ? 1 : old->tokens->tokens[old_first.first_token-1].line;
+
+  Scratch scratch = global_scratch(1, &s->version.arena);
+  UpdateResult result = UPDATE_REBUILD;
+
+  TokenizedBuffer* region_tokens = tokenize_region(scratch.arena, s->source, region_start, region_end, first_line);
+
+  if (!region_tokens) {
+    goto end;
+  }
+
+  DynamicArray(int) fn_starts = new_dynamic_array(scratch.allocator);
+
+  if (!find_functions(region_tokens, &fn_starts)) {
+    goto end;
+  }
+
+  // The region is nothing but whole functions, so its first error is the
+  // first error in the file
+  AST* region = parse(scratch.arena, s->source, region_tokens, 0);
+
+  if (!region) {
+    result = UPDATE_ERROR;
+    goto end;
+  }
+
+  int region_funcs = ast_node(region, region->root)->num_children;
+  SessionFunc* region_info = arena_array(scratch.arena, SessionFunc, region_funcs);
+  describe_functions(region, region_info);
+
+  int region_tokens_count = region_tokens->length-1;
+  int region_nodes = region->num_nodes-1;
+  int region_children = ast_node(region, region->root)->first_child;
+
+  int token_delta = region_tokens_count - (old_last.first_token - old_first.first_token);
+  int literal_delta = region_tokens->num_literals - (old_last.first_literal - old_first.first_literal);
+  int node_delta = region_nodes - (old_last.first_node - old_first.first_node);
+  int child_delta = region_children - (old_last.first_child - old_first.first_child);
+  int line_delta = region_tokens->tokens[region_tokens_count].line - old->tokens->tokens[old_last.first_token].line;
+
+  TokenShift before = {
+    .from = old->source,
+    .to = s->source
+  };
+
+  TokenShift after = {
+    .from = old->source,
+    .to = s->source,
+    .byte_delta = byte_delta,
+    .line_delta = line_delta,
+    .literal_delta = literal_delta
+  };
+
+  // Tokens and literals
+
+  TokenizedBuffer* tokens = arena_type(s->version.arena, TokenizedBuffer);
+  tokens->length = old->tokens->length + token_delta;
+  tokens->tokens = arena_push(s->version.arena, tokens->length * sizeof(Token));
+  tokens->num_literals = old->tokens->num_literals + literal_delta;
+  tokens->literals = arena_push(s->version.arena, tokens->num_literals * sizeof(uint64_t));
+
+  if (old->source.contents == s->source.contents) {
+    memcpy(tokens->tokens, old->tokens->tokens, old_first.first_token * sizeof(Token));
+  }
+  else {
+    for_range(int, i, old_first.first_token) {
+      tokens->tokens[i] = shift_token(&before, old->tokens->tokens[i]);
+    }
+  }
+
+  for_range(int, i, region_tokens_count) {
+    Token token = region_tokens->tokens[i];
+
+    if (token.kind == TOKEN_INTEGER_LITERAL) {
+      token.literal += old_first.first_literal;
+    }
+
+    tokens->tokens[old_first.first_token + i] = token;
+  }
+
+  for (int i = old_last.first_token; i < old->tokens->length; ++i) {
+    tokens->tokens[i + token_delta] = shift_token(&after, old->tokens->tokens[i]);
+  }
+
+  memcpy(tokens->literals, old->tokens->literals, old_first.first_literal * sizeof(uint64_t));
+  memcpy(tokens->literals + old_first.first_literal, region_tokens->literals, region_tokens->num_literals * sizeof(uint64_t));
+  memcpy(tokens->literals + old_last.first_literal + literal_delta, old->tokens->literals + old_last.first_literal, (old->tokens->num_literals - old_last.first_literal) * sizeof(uint64_t));
+
+  // Functions
+
+  s->num_funcs = old->num_funcs - (b - a) + region_funcs;
+  s->funcs = arena_push(s->version.arena, s->num_funcs * sizeof(SessionFunc));
+
+  memcpy(s->funcs, old->funcs, a * sizeof(SessionFunc));
+
+  for_range(int, i, region_funcs) {
+    SessionFunc func = region_info[i];
+    func.first_token += old_first.first_token;
+    func.first_literal += old_first.first_literal;
+    func.first_node += old_first.first_node;
+    func.first_child += old_first.first_child;
+    s->funcs[a + i] = func;
+  }
+
+  for (int i = b; i < old->num_funcs; ++i) {
+    SessionFunc func = old->funcs[i];
+    func.first_token += token_delta;
+    func.first_literal += literal_delta;
+    func.first_node += node_delta;
+    func.first_child += child_delta;
+    s->funcs[i - b + a + region_funcs] = func;
+  }
+
+  // Nodes and children, with the file node and its children last
+
+  AST* ast = arena_type(s->version.arena, AST);
+  ast->tokens = tokens;
+  ast->num_nodes = old->ast->num_nodes + node_delta;
+  ast->nodes = arena_push(s->version.arena, ast->num_nodes * sizeof(ASTNode));
+  ast->root = ast->num_nodes-1;
+
+  int num_fn_children = ast_node(old->ast, old->ast->root)->first_child + child_delta;
+  ast->num_children = num_fn_children + s->num_funcs;
+  ast->children = arena_push(s->version.arena, ast->num_children * sizeof(uint32_t));
+
+  memcpy(ast->nodes, old->ast->nodes, old_first.first_node * sizeof(ASTNode));
+  memcpy(ast->children, old->ast->children, old_first.first_child * sizeof(uint32_t));
+
+  for_range(int, i, region_nodes) {
+    ASTNode node = region->nodes[i];
+    node.token += old_first.first_token;
+    node.first_child += old_first.first_child;
+    ast->nodes[old_first.first_node + i] = node;
+  }
+
+  for_range(int, i, region_children) {
+    ast->children[old_first.first_child + i] = region->children[i] + old_first.first_node;
+  }
+
+  for (int i = old_last.first_node; i < (int)old->ast->root; ++i) {
+    ASTNode node = old->ast->nodes[i];
+    node.token += token_delta;
+    node.first_child += child_delta;
+    ast->nodes[i + node_delta] = node;
+  }
+
+  for (int i = old_last.first_child; i < num_fn_children - child_delta; ++i) {
+    ast->children[i + child_delta] = old->ast->children[i] + node_delta;
+  }
+
+  ast->nodes[ast->root] = (ASTNode) {
+    .kind = AST_FILE,
+    .token = tokens->length-1,
+    .first_child = num_fn_children,
+    .num_children = s->num_funcs
+  };
+
+  for_range(int, i, s->num_funcs) {
+    ast->children[num_fn_children + i] = fn_node(&s->funcs[i]);
+  }
+
+  s->tokens = tokens;
+  s->ast = ast;
+
+  // Checked functions, where only the region's are checked again. The rest
+  // only refer to tokens relative to their first.
+
+  s->file = arena_type(s->version.arena, SemFile);
+  s->file->tokens = tokens;
+  s->file->num_funcs = s->num_funcs;
+  s->file->funcs = arena_array(s->version.arena, SemFunc, s->num_funcs);
+
+  memcpy(s->file->funcs, old->file->funcs, a * sizeof(SemFunc));
+
+  for (int i = b; i < old->num_funcs; ++i) {
+    SemFunc func = old->file->funcs[i];
+    func.first_token += token_delta;
+    s->file->funcs[i - b + a + region_funcs] = func;
+  }
+
+  result = UPDATE_OK;
+
+  for_range(int, i, region_funcs) {
+    if (!check_fn(s->sem, s->source, s->ast, fn_node(&s->funcs[a + i]), &s->file->funcs[a + i])) {
+      result = UPDATE_ERROR;
+      goto end;
+    }
+  }
+
+  for_range(int, i, region_funcs) {
+    if (!sem_analyze_func(s->sem, s->source, tokens, &s->file->funcs[a + i])) {
+      result = UPDATE_ERROR;
+    }
+  }
+
+  uint64_t num_replaced = count_insts(old->file->funcs + a, b - a);
+
+  s->num_dead_insts += num_replaced;
+  s->num_live_insts += count_insts(s->file->funcs + a, region_funcs) - num_replaced;
+
+  end:
+  scratch_release(&scratch);
+  return result;
+}
+
+// Only moves the text after the edit, unless the buffer has to grow
+static void replace_text(Session* s, int start, int end, char* text, int text_length) {
+  int length = s->source.length - (end - start) + text_length;
+  char* contents = s->source.contents;
+
+  if (length + 1 > s->capacity) {
+    s->capacity = 2 * (length + 1);
+    s->source.contents = arena_push(s->arena, s->capacity);
+    memcpy(s->source.contents, contents, start);
+  }
+
+  memmove(s->source.contents + start + text_length, contents + end, s->source.length - end);
+  memcpy(s->source.contents + start, text, text_length);
+
+  s->source.length = length;
+  s->source.contents[length] = '\0';
+}
+
+Session* session_open(SourceContents source) {
+  Arena* arena = new_arena();
+
+  Session* s = arena_type(arena, Session);
+  s->arena = arena;
+  s->sem_arena = new_arena();
+  s->versions = new_scratch_library();
+  s->version = scratch_get(s->versions, 0, NULL);
+
+  s->source.path = copy_cstr(arena, source.path).str;
+  replace_text(s, 0, 0, source.contents, source.length);
+
+  s->valid = rebuild(s);
+
+  return s;
+}
+
+void session_close(Session* s) {
+  scratch_release(&s->version);
+  free_scratch_library(s->versions);
+  free_arena(s->sem_arena);
+  free_arena(s->arena);
+}
+
+bool session_edit(Session* s, int start, int end, char* text, int text_length) {
+  assert(start >= 0 && start <= end && end <= s->source.length);
+
+  Session old = *s;
+
+  replace_text(s, start, end, text, text_length);
+  s->version = scratch_get(s->versions, 1, &old.version.arena);
+
+  UpdateResult result = old.valid ? update(s, &old, start, end, text_length) : UPDATE_REBUILD;
+
+  if (result == UPDATE_REBUILD) {
+    scratch_release(&s->version);
+    s->version = scratch_get(s->versions, 1, &old.version.arena);
+    s->valid = rebuild(s);
+  }
+  else {
+    s->valid = result == UPDATE_OK;
+  }
+
+  // An edit that fails starts over from a fresh arena next time anyway
+  if (s->valid && s->num_dead_insts > s->num_live_insts) {
+    recycle_sem(s);
+  }
+
+  scratch_release(&old.version);
+  return s->valid;
+}
+
+// Valid until the next edit
+SourceContents session_source(Session* s) {
+  return s->source;
+}
+
+SemFile* session_file(Session* s) {
+  return s->valid ? s->file : NULL;
+}
@@ -3,6 +3,85 @@
 
 #include "frontend.h"
 
+static THREAD_LOCAL ScratchLibrary* global_scratch_lib;
+
+void init_global_scratch() {
+  global_scratch_lib = new_scratch_library();
+}
+
+void free_global_scratch() {
+  free_scratch_library(global_scratch_lib);
+  global_scratch_lib = NULL;
+}
+
+Scratch global_scratch(int num_conflicts, Arena** conflicts) {
+  return scratch_get(global_scratch_lib, num_conflicts, conflicts);
+}
+
+typedef struct {
+  ParallelProc proc;
+  void* data;
+  int count;
+  volatile int next;
+} ParallelJob;
+
+static void parallel_work(ParallelJob* job) {
+  while (true) {
+    int index = atomic_increment(&job->next) - 1;
+
+    if (index >= job->count) {
+      break;
+    }
+
+    job->proc(job->data, index);
+  }
+}
+
+static void parallel_worker(void* data) {
+  init_global_scratch();
+  parallel_work(data);
+  free_global_scratch();
+}
+
+void parallel_for(int num_threads, int count, ParallelProc proc, void* data) {
+  ParallelJob job = {
+    .proc = proc,
+    .data = data,
+    .count = count
+  };
+
+  if (num_threads > count) {
+    num_threads = count;
+  }
+
+  Thread* threads[64];
+
+  if (num_threads > (int)LENGTH(threads) + 1) {
+    num_threads = (int)LENGTH(threads) + 1;
+  }
+
+  for_range(int, i, num_threads-1) {
+    threads[i] = thread_start(parallel_worker, &job);
+  }
+
+  parallel_work(&job);
+
+  for_range(int, i, num_threads-1) {
+    thread_join(threads[i]);
+  }
+}
+
+int count_batches(int num_items, int num_threads) {
+  int num_batches = num_threads * 4;
+  return num_batches < num_items ? num_batches : num_items;
+}
+
+// Batches differ in size by at most one item
+void batch_range(int num_items, int num_batches, int batch, int* first, int* count) {
+  *first = (int)((int64_t)num_items * batch / num_batches);
+  *count = (int)((int64_t)num_items * (batch+1) / num_batches) - *first;
+}
+
 SourceContents load_source(Arena* arena, char* path) {
   FILE* file = fopen(path, "r");
 
@@ -23,6 +102,40 @@ SourceContents load_source(Arena* arena, char* path) {
 
   return (SourceContents) {
     .contents = source,
+    .length = source_length,
     .path = copy_cstr(arena, path).str,
   };
-}
\ No newline at end of file
+}
+
+void write_text_v(DynamicArray(char)* text, char* fmt, va_list ap) {
+  int start = dynamic_array_length(*text);
+
+  // Most writes are short, so try to fit one in spare room before measuring
+  va_list measure;
+  va_copy(measure, ap);
+
+  dynamic_array_resize(*text, start + 128);
+  int length = vsnprintf(*text + start, 128, fmt, measure);
+  va_end(measure);
+
+  // An encoding error, which leaves nothing written
+  if (length < 0) {
+    dynamic_array_resize(*text, start);
+    return;
+  }
+
+  // vsnprintf always wants room for the terminator, which is then dropped
+  if (length >= 128) {
+    dynamic_array_resize(*text, start + length + 1);
+    vsnprintf(*text + start, length + 1, fmt, ap);
+  }
+
+  dynamic_array_resize(*text, start + length);
+}
+
+void write_text(DynamicArray(char)* text, char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  write_text_v(text, fmt, ap);
+  va_end(ap);
+}
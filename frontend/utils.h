@@ -1,5 +1,29 @@
 #pragma once
 
+#include <stdarg.h>
+
 #include "base.h"
+#include "dynamic_array.h"
+
+// Every thread has its own scratch library, so this must be called on a thread
+// before it uses global_scratch
+void init_global_scratch();
+void free_global_scratch();
 
 Scratch global_scratch(int num_conflicts, Arena** conflicts);
+
+typedef void(*ParallelProc)(void* data, int index);
+
+// Calls proc for every index in [0, count) across num_threads threads, the
+// calling thread included. Returns once every index has been processed.
+void parallel_for(int num_threads, int count, ParallelProc proc, void* data);
+
+// Splitting num_items into batches to go through parallel_for. There are a few
+// batches per thread, so one slow run of items cannot hold up the rest.
+int count_batches(int num_items, int num_threads);
+void batch_range(int num_items, int num_batches, int batch, int* first, int* count);
+
+// Appends formatted text, for output that is built up in memory and written
+// out in one go
+void write_text(DynamicArray(char)* text, char* fmt, ...);
+void write_text_v(DynamicArray(char)* text, char* fmt, va_list ap);
@@ -22,29 +22,60 @@ void* new_dynamic_array(Allocator* allocator) {
   return header + 1;
 }
 
+void free_dynamic_array(void* da) {
+  Header* h = header(da);
+  allocator_free(h->allocator, h);
+}
+
 static size_t allocation_size(int capacity, size_t stride) {
   return sizeof(Header) + capacity * stride;
 }
 
+static Header* grow(Header* h, int new_capacity, size_t stride) {
+  size_t old_size = allocation_size(h->capacity, stride);
+  size_t new_size = allocation_size(new_capacity, stride);
+
+  Header* h2 = allocator_alloc(h->allocator, new_size);
+  memcpy(h2, h, old_size);
+
+  allocator_free(h->allocator, h);
+
+  h2->capacity = new_capacity;
+  return h2;
+}
+
 void* _dynamic_array_put(void* da, size_t stride) {
   Header* h = header(da);
 
   if (h->length == h->capacity) {
-    int new_capacity = h->capacity ? h->capacity * 2 : INITIAL_CAPACITY;
+    h = grow(h, h->capacity ? h->capacity * 2 : INITIAL_CAPACITY, stride);
+  }
 
-    size_t old_size = allocation_size(h->capacity, stride);
-    size_t new_size = allocation_size(new_capacity, stride);
+  h->length++;
+  return h + 1;
+}
 
-    Header* h2 = allocator_alloc(h->allocator, new_size);
-    memcpy(h2, h, old_size);
+// Makes room up front, when the final length is known
+void* _dynamic_array_reserve(void* da, int capacity, size_t stride) {
+  Header* h = header(da);
 
-    allocator_free(h->allocator, h);
-    h = h2;
+  if (capacity > h->capacity) {
+    h = grow(h, capacity, stride);
+  }
+
+  return h + 1;
+}
+
+// New items are left uninitialized, for when they are about to be written
+void* _dynamic_array_resize(void* da, int length, size_t stride) {
+  Header* h = header(da);
 
-    h->capacity = new_capacity;
+  if (length > h->capacity) {
+    int capacity = h->capacity ? h->capacity * 2 : INITIAL_CAPACITY;
+    h = grow(h, capacity > length ? capacity : length, stride);
   }
 
-  h->length++;
+  h->length = length;
   return h + 1;
 }
 
@@ -74,4 +105,17 @@ void* _dynamic_array_bake(Arena* arena, void* da, size_t stride) {
   memcpy(buffer, da, size);
 
   return buffer;
-};
\ No newline at end of file
+};
+
+// A new array with the same items, owned by another allocator
+void* _dynamic_array_copy(Allocator* allocator, void* da, size_t stride) {
+  int length = header(da)->length;
+
+  Header* h = allocator_alloc(allocator, allocation_size(length, stride));
+  h->capacity = length;
+  h->length = length;
+  h->allocator = allocator;
+
+  memcpy(h + 1, da, length * stride);
+  return h + 1;
+}
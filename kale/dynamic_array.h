@@ -5,7 +5,11 @@
 #define DynamicArray(T) T*
 
 void* new_dynamic_array(Allocator* allocator);
+void free_dynamic_array(void* da);
+
 void* _dynamic_array_put(void* da, size_t stride);
+void* _dynamic_array_reserve(void* da, int capacity, size_t stride);
+void* _dynamic_array_resize(void* da, int length, size_t stride);
 
 int dynamic_array_length(void* da);
 int _dynamic_array_pop(void* da);
@@ -14,8 +18,12 @@ int _dynamic_array_back(void* da);
 void dynamic_array_clear(void* da);
 
 void* _dynamic_array_bake(Arena* arena, void* da, size_t stride);
+void* _dynamic_array_copy(Allocator* allocator, void* da, size_t stride);
 
 #define dynamic_array_put(da, item) ( *(void**)&(da) = _dynamic_array_put(da, sizeof(*(da))), (da)[dynamic_array_length(da)-1] = (item), (void)0 )
+#define dynamic_array_reserve(da, capacity) ( *(void**)&(da) = _dynamic_array_reserve(da, capacity, sizeof(*(da))), (void)0 )
+#define dynamic_array_resize(da, length) ( *(void**)&(da) = _dynamic_array_resize(da, length, sizeof(*(da))), (void)0 )
 #define dynamic_array_pop(da) ( (da)[_dynamic_array_pop(da)] )
 #define dynamic_array_back(da) ( (da)[_dynamic_array_back(da)] )
-#define dynamic_array_bake(arena, da) _dynamic_array_bake(arena, da, sizeof(*(da)))
\ No newline at end of file
+#define dynamic_array_bake(arena, da) _dynamic_array_bake(arena, da, sizeof(*(da)))
+#define dynamic_array_copy(allocator, da) _dynamic_array_copy(allocator, da, sizeof(*(da)))
\ No newline at end of file
@@ -28,4 +28,31 @@ Scratch scratch_get(ScratchLibrary* lib, int num_conflicts, Arena** conflicts);
 void scratch_release(Scratch* scratch);
 
 int bitscan_forward(uint64_t number); // Bitscan low to high
-int bitscan_backward(uint64_t number); // Bitscan high to low
\ No newline at end of file
+int bitscan_backward(uint64_t number); // Bitscan high to low
+
+#ifdef _MSC_VER
+  #define THREAD_LOCAL __declspec(thread)
+#else
+  #define THREAD_LOCAL _Thread_local
+#endif
+
+typedef struct Thread Thread;
+typedef void(*ThreadProc)(void* data);
+
+Thread* thread_start(ThreadProc proc, void* data);
+void thread_join(Thread* thread); // Waits for the thread and frees it
+
+int hardware_thread_count();
+int atomic_increment(volatile int* value); // Returns the incremented value
+
+double timer_seconds();
+
+void* map_file(char* path, uint64_t* size); // Read only, NULL if it can't be opened or is empty
+void unmap_file(void* data);
+
+enum {
+  CPU_FEATURE_SSE41 = 1 << 0,
+  CPU_FEATURE_AVX2 = 1 << 1,
+};
+
+int cpu_features(); // Bitset of CPU_FEATURE_*, detected on the first call
\ No newline at end of file
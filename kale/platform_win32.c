@@ -172,4 +172,127 @@ int bitscan_backward(uint64_t number) {
   else {
     return 64;
   }
+}
+
+struct Thread {
+  HANDLE handle;
+  ThreadProc proc;
+  void* data;
+};
+
+static DWORD WINAPI thread_entry(LPVOID param) {
+  Thread* thread = param;
+  thread->proc(thread->data);
+  return 0;
+}
+
+Thread* thread_start(ThreadProc proc, void* data) {
+  Thread* thread = LocalAlloc(LMEM_ZEROINIT, sizeof(Thread));
+  thread->proc = proc;
+  thread->data = data;
+
+  thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+
+  if (!thread->handle) {
+    fprintf(stderr, "Failed to create thread.\n");
+    ExitProcess(1);
+  }
+
+  return thread;
+}
+
+void thread_join(Thread* thread) {
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+  LocalFree(thread);
+}
+
+int hardware_thread_count() {
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  return (int)system_info.dwNumberOfProcessors;
+}
+
+int atomic_increment(volatile int* value) {
+  return (int)InterlockedIncrement((volatile LONG*)value);
+}
+
+double timer_seconds() {
+  static LARGE_INTEGER frequency;
+
+  if (!frequency.QuadPart) {
+    QueryPerformanceFrequency(&frequency);
+  }
+
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+void* map_file(char* path, uint64_t* size) {
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER file_size = {0};
+  void* data = NULL;
+
+  if (GetFileSizeEx(file, &file_size) && file_size.QuadPart) {
+    // The view keeps the mapping alive once both handles are closed
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (mapping) {
+      data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+  }
+
+  CloseHandle(file);
+
+  *size = data ? (uint64_t)file_size.QuadPart : 0;
+  return data;
+}
+
+void unmap_file(void* data) {
+  UnmapViewOfFile(data);
+}
+
+// cpuid is serializing, and traps to the hypervisor under virtualization, so
+// it only runs the first time. Threads racing on the first call store the
+// same value.
+static volatile int detected_features = -1;
+
+int cpu_features() {
+  if (detected_features != -1) {
+    return detected_features;
+  }
+
+  int info[4];
+  __cpuid(info, 0);
+
+  int max_leaf = info[0];
+  int features = 0;
+
+  __cpuid(info, 1);
+
+  if (info[2] & (1 << 19)) {
+    features |= CPU_FEATURE_SSE41;
+  }
+
+  // AVX2 also needs the OS to save the ymm registers
+  bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+
+  if (max_leaf >= 7 && os_saves_ymm) {
+    __cpuidex(info, 7, 0);
+
+    if (info[1] & (1 << 5)) {
+      features |= CPU_FEATURE_AVX2;
+    }
+  }
+
+  detected_features = features;
+  return features;
 }
\ No newline at end of file